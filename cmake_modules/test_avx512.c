@@ -0,0 +1,7 @@
+#include <immintrin.h>
+
+int main(int argc, const char* argv[])
+{
+    __m512d arst = _mm512_fmadd_pd(_mm512_setzero_pd(), _mm512_setzero_pd(), _mm512_setzero_pd());
+    return (int) _mm512_reduce_add_pd(arst);
+}
@@ -84,6 +84,8 @@ typedef struct
     int forceSSE3;
     int forceSSE41;
     int forceAVX;
+    int forceAVX2;
+    int forceAVX512;
     int verbose;
     int enableProfiling;
 } CLRequest;
@@ -243,6 +245,22 @@ real* mwReadRestArgs(const char** rest, unsigned int n);
 
 const char** mwGetForwardedArguments(const char** args, unsigned int* nForwardedArgs);
 
+/* Stream of parameter vectors, one per line, for evaluating many
+ * parameter sets in one process */
+typedef struct
+{
+    FILE* f;
+    char* line;
+    size_t lineSize;
+    const char** args;     /* Values of the last vector read, pointing into line */
+    unsigned int nArgs;
+    unsigned int maxArgs;
+} MWBatchReader;
+
+MWBatchReader* mwOpenBatchReader(const char* filename);
+int mwReadBatchVector(MWBatchReader* br);
+void mwCloseBatchReader(MWBatchReader* br);
+
 #if defined(__SSE__) && DISABLE_DENORMALS
 int mwDisableDenormalsSSE(void);
 #endif /* defined(__SSE__) && DISABLE_DENORMALS */
@@ -26,6 +26,10 @@
   #include <sys/sysctl.h>
 #endif
 
+#if defined(_MSC_VER) && MW_IS_X86
+  #include <immintrin.h>
+#endif
+
 #define bit_CMPXCHG8B (1 << 8)
 #define bit_CMOV (1 << 15)
 #define bit_MMX (1 << 23)
@@ -34,11 +38,17 @@
 #define bit_SSE3 (1 << 0)
 #define bit_SSE41 (1 << 19)
 #define bit_AVX (1 << 28)
+#define bit_FMA (1 << 12)
+#define bit_OSXSAVE (1 << 27)
 #define bit_CMPXCHG16B (1 << 13)
 #define bit_3DNOW (1 << 31)
 #define bit_3DNOWP (1 << 30)
 #define bit_LM (1 << 29)
 
+/* Leaf 7, ebx */
+#define bit_AVX2 (1 << 5)
+#define bit_AVX512F (1 << 16)
+
 
 #if MW_IS_X86
 
@@ -72,9 +82,9 @@ void mw_cpuid(int abcd[4], int a, int c)
 {
     abcd[0] = abcd[1] = abcd[2] = abcd[3] = 0;
     __cpuid(abcd, 0);
-    if (abcd[0] >= 1) /* Is this really necessary? */
+    if (abcd[0] >= a) /* Is this really necessary? */
     {
-        __cpuid(abcd, a);
+        __cpuidex(abcd, a, c);
     }
     else
     {
@@ -99,6 +109,21 @@ int mwHasAVX(const int abcd[4])
     return !!(abcd[2] & bit_AVX);
 }
 
+int mwHasFMA(const int abcd[4])
+{
+    return !!(abcd[2] & bit_FMA);
+}
+
+int mwHasAVX2(const int abcd7[4])
+{
+    return !!(abcd7[1] & bit_AVX2);
+}
+
+int mwHasAVX512F(const int abcd7[4])
+{
+    return !!(abcd7[1] & bit_AVX512F);
+}
+
 int mwHasSSE41(const int abcd[4])
 {
     return !!(abcd[2] & bit_SSE41);
@@ -222,4 +247,43 @@ int mwOSHasAVXSupport()
 #endif /* _WIN32 */
 
 
+#if MW_IS_X86 && (defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1600))
+
+/* Low half of XCR0, which has the register state the OS saves */
+static unsigned int mw_xgetbv0(void)
+{
+  #ifdef _MSC_VER
+    return (unsigned int) _xgetbv(0);
+  #else
+    unsigned int eax, edx;
+
+    /* xgetbv, which old assemblers don't know */
+    __asm__ volatile(".byte 0x0f, 0x01, 0xd0" : "=a" (eax), "=d" (edx) : "c" (0));
+    return eax;
+  #endif
+}
+
+/* AVX-512 needs the OS to save the opmask and upper ZMM registers as
+ * well as the YMM state */
+int mwOSHasAVX512Support(void)
+{
+    int abcd[4];
+
+    mw_cpuid(abcd, 1, 0);
+    if (!(abcd[2] & bit_OSXSAVE))
+    {
+        return FALSE;
+    }
+
+    return (mw_xgetbv0() & 0xe6) == 0xe6;
+}
+
+#else
+
+int mwOSHasAVX512Support(void)
+{
+    return FALSE;
+}
+
+#endif /* MW_IS_X86 */
 
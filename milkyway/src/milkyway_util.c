@@ -279,6 +279,109 @@ const char** mwGetForwardedArguments(const char** args, unsigned int* nForwarded
     return forwardedArgs;
 }
 
+/* Open a file of parameter vectors, or stdin if filename is "-" */
+MWBatchReader* mwOpenBatchReader(const char* filename)
+{
+    MWBatchReader* br;
+    FILE* f;
+
+    if (!strcmp(filename, "-"))
+    {
+        f = stdin;
+    }
+    else
+    {
+        f = mw_fopen(filename, "r");
+        if (!f)
+        {
+            mwPerror("Opening batch file '%s'", filename);
+            return NULL;
+        }
+    }
+
+    br = (MWBatchReader*) mwCalloc(1, sizeof(MWBatchReader));
+    br->f = f;
+    br->lineSize = 1024;
+    br->line = (char*) mwMalloc(br->lineSize);
+
+    return br;
+}
+
+/* Read one line, however long it is. Returns FALSE at end of file. */
+static int mwReadBatchLine(MWBatchReader* br)
+{
+    size_t len = 0;
+
+    while (fgets(&br->line[len], (int) (br->lineSize - len), br->f))
+    {
+        len += strlen(&br->line[len]);
+        if (len > 0 && br->line[len - 1] == '\n')
+        {
+            return TRUE;
+        }
+
+        if (len + 1 == br->lineSize)
+        {
+            br->lineSize *= 2;
+            br->line = (char*) mwRealloc(br->line, br->lineSize);
+        }
+    }
+
+    return len > 0;
+}
+
+/* Read the next vector of whitespace or comma separated values into
+ * br->args. Blank lines and lines starting with '#' are skipped.
+ * Returns TRUE if a vector was read and FALSE at the end of the input.
+ */
+int mwReadBatchVector(MWBatchReader* br)
+{
+    char* tok;
+    static const char sep[] = " \t\r\n,";
+
+    while (mwReadBatchLine(br))
+    {
+        br->nArgs = 0;
+        for (tok = strtok(br->line, sep); tok; tok = strtok(NULL, sep))
+        {
+            if (br->nArgs == 0 && tok[0] == '#')
+            {
+                break;
+            }
+
+            if (br->nArgs == br->maxArgs)
+            {
+                br->maxArgs = br->maxArgs == 0 ? 16 : 2 * br->maxArgs;
+                br->args = (const char**) mwRealloc(br->args, br->maxArgs * sizeof(const char*));
+            }
+
+            br->args[br->nArgs++] = tok;
+        }
+
+        if (br->nArgs > 0)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+void mwCloseBatchReader(MWBatchReader* br)
+{
+    if (!br)
+        return;
+
+    if (br->f != stdin)
+    {
+        fclose(br->f);
+    }
+
+    free(br->line);
+    free(br->args);
+    free(br);
+}
+
 void mwLocalTime(char* buf, size_t bufSize)
 {
     time_t x = time(NULL);
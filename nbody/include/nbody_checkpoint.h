@@ -35,6 +35,10 @@ int nbWriteCheckpointWithTmpFile(const NBodyCtx* ctx, const NBodyState* st, cons
 NBodyStatus nbWriteFinalCheckpoint(const NBodyCtx* ctx, NBodyState* st);
 int nbTimeToCheckpoint(const NBodyCtx* ctx, NBodyState* st);
 
+int nbStartCheckpoint(const NBodyCtx* ctx, NBodyState* st);
+int nbFinishCheckpoint(NBodyState* st, mwbool wait, mwbool* busy);
+void nbDestroyCheckpointWriter(NBodyCheckpointWriter* w);
+
 #ifdef __cplusplus
 }
 #endif
@@ -44,6 +44,34 @@ extern "C" {
 #define DEFAULT_ALLOW_INCEST FALSE
 #define DEFAULT_QUIET_ERRORS FALSE
 
+/* Walk the tree separately for each body by default */
+#define DEFAULT_GROUP_SIZE 0
+#define NBODY_MAX_GROUP_SIZE 256
+
+/* Keep the bodies in their original order by default */
+#define DEFAULT_REORDER_INTERVAL 0
+
+/* Evaluate the external potential directly by default. The table
+ * covers radii from DEFAULT_POTENTIAL_GRID_MIN to DEFAULT_POTENTIAL_GRID_MAX kpc */
+#define DEFAULT_POTENTIAL_GRID 0
+#define DEFAULT_POTENTIAL_GRID_MIN ((real) 1.0)
+#define DEFAULT_POTENTIAL_GRID_MAX ((real) 200.0)
+#define DEFAULT_POTENTIAL_GRID_TOLERANCE ((real) 5.0e-3)
+#define NBODY_MAX_POTENTIAL_GRID 128
+
+/* Step every body with the same timestep by default */
+#define DEFAULT_TIMESTEP_LEVELS 0
+#define NBODY_MAX_TIMESTEP_LEVELS 16
+#define DEFAULT_TIMESTEP_ACCURACY ((real) 0.025)
+
+/* Build a new tree every step by default */
+#define DEFAULT_TREE_REBUILD_INTERVAL 0
+
+/* Local expansions of the FMM criterion carry the field and its first
+ * (order 1) or first and second (order 2) derivatives */
+#define DEFAULT_FMM_ORDER 2
+#define NBODY_MAX_FMM_ORDER 2
+
 #define DEFAULT_USE_BEST_LIKELIHOOD FALSE
 #define DEFAULT_USE_VEL_DISP FALSE
 #define DEFAULT_USE_BETA_DISP TRUE
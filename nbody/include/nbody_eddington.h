@@ -0,0 +1,56 @@
+/* Copyright (c) 2016-2018 Siddhartha Shelton
+
+This file is part of Milkway@Home.
+
+Milkyway@Home is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Milkyway@Home is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _NBODY_EDDINGTON_H_
+#define _NBODY_EDDINGTON_H_
+
+#include "milkyway_math.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Distribution function of a model at a given energy */
+typedef real (*EddingtonDistFun)(real energy, const void* model);
+
+/* Eddington f(E) of a model tabulated on a grid uniform in log(E) */
+typedef struct
+{
+    EddingtonDistFun distFun;
+    const void* model;
+
+    real* f;          /* f(E) at the grid points */
+    real* slope;      /* df / dlog(E) at the grid points */
+    unsigned int n;
+    real logEMin, logEMax, dLogE;
+} EddingtonTable;
+
+#define NBODY_EDDINGTON_TABLE_SIZE 1024
+
+void nbMakeEddingtonTable(EddingtonTable* t, EddingtonDistFun distFun, const void* model, real eMin, real eMax);
+void nbFreeEddingtonTable(EddingtonTable* t);
+
+real nbEddingtonDistFun(const EddingtonTable* t, real energy);
+real nbEddingtonMaxDistFun(const EddingtonTable* t, real psi, real vMax);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _NBODY_EDDINGTON_H_ */
+
@@ -46,6 +46,10 @@ real emdCalc(const real* RESTRICT signature_arr1,
 
 real nbMatchEMD(const NBodyHistogram* data, const NBodyHistogram* histogram);
 
+real nbMatchEMDPrepared(const NBodyDataHistogram* dataHist, const NBodyHistogram* histogram);
+
+real* nbMakeEMDSignature(const NBodyHistogram* data);
+
 real nbWorstCaseEMD(const NBodyHistogram* hist);
 
 #ifdef __cplusplus
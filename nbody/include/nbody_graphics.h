@@ -119,6 +119,10 @@ typedef struct
     int hasInfo;
     int staticScene;
 
+    /* Number of points of the orbit trace written so far. The trace
+       is only appended to, so points below this don't change. */
+    OPA_int_t orbitTraceLength;
+
     NBodyCircularQueue queue;
     FloatPos sceneData[1]; /* Space for orbit trace then space for actual data for the queue */
 } scene_t;
@@ -30,6 +30,9 @@ extern "C" {
 /* compute force on all the bodies */
 NBodyStatus nbGravMap(const NBodyCtx* ctx, NBodyState* st);
 
+/* compute force on the listed bodies only, using the current tree */
+NBodyStatus nbGravMapBodies(const NBodyCtx* ctx, NBodyState* st, const int* active, int nActive, mwvector* selfAcc);
+
 #ifdef __cplusplus
 }
 #endif
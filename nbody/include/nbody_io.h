@@ -29,8 +29,33 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 extern "C" {
 #endif
 
+#define NBODY_BINARY_OUTPUT_MAGIC "mwnbout"
+#define NBODY_BINARY_OUTPUT_VERSION 2
+#define NBODY_BINARY_OUTPUT_BYTE_ORDER 0x01020304
+
+/* Header of the binary body output. See nbody_io.c for the layout of
+ * the rest of the file */
+typedef struct
+{
+    char magic[8];                   /* "mwnbout" */
+    uint32_t version;                /* NBODY_BINARY_OUTPUT_VERSION */
+    uint32_t byteOrder;              /* NBODY_BINARY_OUTPUT_BYTE_ORDER as written */
+    uint32_t realSize;               /* Does the file use float or double */
+    uint32_t nbody;
+    uint32_t step;
+    int32_t hasMilkyway;
+    real sunGCDist;
+    real timestep;
+    real timeEvolve;
+    real centerOfMass[3];
+    real centerOfMomentum[3];
+} NBodyBinaryOutputHeader;
+
 int nbWriteBodies(const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf);
 int nbOutputBodies(FILE* f, const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf);
+int nbOutputBodiesBinary(FILE* f, const NBodyCtx* ctx, const NBodyState* st);
+int nbWriteBodiesBinary(const char* filename, const NBodyCtx* ctx, const NBodyState* st);
+Body* nbReadBodiesBinary(const char* filename, NBodyBinaryOutputHeader* hdr);
 #ifdef __cplusplus
 }
 #endif
@@ -22,6 +22,7 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 #define _NBODY_ISOTROPIC_H_
 
 #include <lua.h>
+#include "nbody_eddington.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,6 +31,8 @@ extern "C" {
 int nbGenerateIsotropic(lua_State* luaSt);
 void registerGenerateIsotropic(lua_State* luaSt);
 
+void nbMakeIsotropicEddingtonTable(EddingtonTable* t, const real* args);
+
 #ifdef __cplusplus
 }
 #endif
@@ -34,6 +34,13 @@ real nbSystemLikelihood(const NBodyState* st,
                      const NBodyHistogram* histogram,
                      NBodyLikelihoodMethod method);
 
+real nbSystemLikelihoodPrepared(const NBodyState* st,
+                                const NBodyDataHistogram* dataHist,
+                                const NBodyHistogram* histogram);
+
+NBodyDataHistogram* nbLoadDataHistogram(const NBodyFlags* nbf);
+void nbFreeDataHistogram(NBodyDataHistogram* dataHist);
+
 int nbGetLikelihoodInfo(const NBodyFlags* nbf, HistogramParams* hp, NBodyLikelihoodMethod* method);
 
 real nbMatchHistogramFiles(const char* datHist, const char* matchHist, mwbool vel_disp, mwbool beta_disp);
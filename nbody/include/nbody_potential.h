@@ -28,6 +28,8 @@ extern "C" {
 #endif
 
 mwvector nbExtAcceleration(const Potential* pot, mwvector pos);
+mwvector nbHaloAcceleration(const Potential* pot, mwvector pos);
+mwvector nbExtAccelerationWithHalo(const Potential* pot, mwvector pos, mwvector haloAcc);
 
 #ifdef __cplusplus
 }
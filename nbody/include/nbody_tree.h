@@ -28,6 +28,10 @@ extern "C" {
 #endif
 
 NBodyStatus nbMakeTree(const NBodyCtx*, NBodyState*);    /* construct tree structure */
+NBodyStatus nbRefitOrMakeTree(const NBodyCtx* ctx, NBodyState* st, mwbool refit);
+mwbool nbKeepTree(const NBodyCtx* ctx, const NBodyState* st);
+void nbReorderBodies(NBodyState* st);
+void nbRestoreBodyOrder(NBodyState* st);
 
 #if 0
 void registerFindRCrit(lua_State* luaSt);
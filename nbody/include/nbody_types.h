@@ -116,6 +116,11 @@ typedef struct MW_ALIGN_TYPE _NBodyNode
 #define Pos(x)  (((NBodyNode*) (x))->pos)
 #define Next(x) (((NBodyNode*) (x))->next)
 
+/* Test particles have no mass and are left out of the tree. Written
+ * without == so it doesn't trip -Wfloat-equal, but NaN is still not
+ * taken as zero. */
+#define isTestParticle(x) (Mass(x) >= 0.0 && Mass(x) <= 0.0)
+
 /* BODY: data structure used to represent particles. */
 
 typedef struct MW_ALIGN_TYPE
@@ -128,6 +133,16 @@ typedef struct MW_ALIGN_TYPE
 
 #define BODY_TYPE "Body"
 
+/* Contiguous array of bodies, which models can be passed around as in
+ * Lua instead of a table of Body userdata */
+typedef struct
+{
+    Body* bodies;
+    unsigned int nbody;
+} BodyBlock;
+
+#define BODY_BLOCK_TYPE "BodyBlock"
+
 #define Vel(x)  (((Body*) (x))->vel)
 
 /* CELL: structure used to represent internal nodes of tree. */
@@ -162,7 +177,8 @@ typedef enum
     TreeCode, 
     SW93,
     BH86,
-    Exact
+    Exact,
+    FMM
 } criterion_t;
 
 
@@ -193,6 +209,25 @@ typedef struct MW_ALIGN_TYPE
 
 #define EMPTY_TREE { NULL, 0.0, 0, 0, FALSE }
 
+/* Contiguous block of cells. Cells are handed out in order, and the
+   whole block is reused at once by resetting used */
+typedef struct
+{
+    NBodyCell* cells;
+    unsigned int size;       /* number of cells allocated */
+    unsigned int used;       /* number of cells handed out */
+} NBodyCellArena;
+
+#define EMPTY_CELL_ARENA { NULL, 0, 0 }
+
+/* Cube of a cell of the finished tree, kept for refitting the tree */
+typedef struct
+{
+    mwvector center;
+    real size;
+    real reach;              /* How far bodies outside of the cube can be from the center of mass */
+} NBodyCellBox;
+
 
 #if NBODY_OPENCL
 
@@ -337,12 +372,63 @@ typedef struct
     HistData data[1];
 } NBodyHistogram;
 
+typedef enum
+{
+    NBODY_INVALID_METHOD = -1,
+    NBODY_EMD,
+    NBODY_ORIG_CHISQ,
+    NBODY_ORIG_ALT,
+    NBODY_CHISQ_ALT,
+    NBODY_POISSON,
+    NBODY_KOLMOGOROV,
+    NBODY_KULLBACK_LEIBLER,
+    NBODY_SAHA
+} NBodyLikelihoodMethod;
+
+/* Input data histogram preprocessed once so it can be compared
+   against many simulated histograms (e.g. every step of the best
+   likelihood search) without reading and parsing the file again. It
+   is not modified after nbLoadDataHistogram() */
+typedef struct
+{
+    NBodyHistogram* histogram;      /* Data histogram as read from the file */
+    real* emdSignature;             /* Data side of the EMD signature as (weight, lambda, beta) triples */
+    int* useBin;                    /* Mask of bins used in the comparison */
+    unsigned int nBin;
+    HistogramParams hp;             /* Histogram parameters from the input script */
+    NBodyLikelihoodMethod method;   /* Likelihood method from the input script */
+} NBodyDataHistogram;
+
+
+
+/* External acceleration tabulated on a spherical grid uniform in
+   log(r), theta and phi, for potentials that are expensive to
+   evaluate. Positions outside of the grid use the potential directly.
+   acc is NULL if the table was not accurate enough to use. */
+typedef struct
+{
+    real* acc;                  /* x, y, z acceleration at each grid point */
+    mwbool haloOnly;            /* Only the halo is tabulated, the disk and bulge are cheap */
+    unsigned int nR, nTheta, nPhi;
+    real rMin, rMax;
+    real logRMin;
+    real dLogR, dTheta, dPhi;   /* Grid spacings */
+    real maxError;              /* Largest relative error found checking the table */
+} NBodyPotentialTable;
+
+
+/* Writes checkpoints in the background. Private to nbody_checkpoint.c */
+typedef struct NBodyCheckpointWriter NBodyCheckpointWriter;
+
+/* Local expansion of the field in a cell. Private to nbody_fmm.c */
+typedef struct NBodyLocalExpansion NBodyLocalExpansion;
 
 /* Mutable state used during an evaluation */
 typedef struct MW_ALIGN_TYPE
 {
     NBodyTree tree;
-    NBodyNode* freeCell;      /* list of free cells */
+    NBodyCellArena buildCells; /* cells the tree is built in */
+    NBodyCellArena treeCells;  /* cells of the finished tree in the order they are walked */
     char* checkpointResolved;
     Body* bodytab;            /* points to array of bodies */
     mwvector* acctab;         /* Corresponding accelerations of bodies */
@@ -352,6 +438,14 @@ typedef struct MW_ALIGN_TYPE
     lua_State** potEvalStates;  /* If using a Lua closure as a potential, the evaluation states.
                                    We need one per thread in the general case. */
     int* potEvalClosures;       /* Lua closure for each state */
+    NBodyDataHistogram* dataHist; /* Input histogram for the best likelihood search, loaded once */
+    NBodyPotentialTable* potTable; /* Tabulated external acceleration. NULL if not used or not built yet */
+    int* bodyOrder;             /* Index in bodytab of each body in its original order. NULL if never reordered */
+    NBodyCheckpointWriter* checkpointWriter; /* NULL until the first background checkpoint */
+    unsigned char* timestepLevel; /* Block timestep level of each body. NULL unless using block timesteps */
+    int* activeBodies;          /* Bodies in order by block timestep level, smallest step first */
+    NBodyCellBox* cellBoxes;    /* Cube of each cell in treeCells. NULL unless the tree is refit */
+    NBodyLocalExpansion* fmmLocals; /* Local expansion of each cell in treeCells. NULL unless using FMM */
 
     size_t nOrbitTrace;         /* Number of items in orbitTrace */
     time_t lastCheckpoint;
@@ -363,6 +457,9 @@ typedef struct MW_ALIGN_TYPE
     int potentialEvalError;  /* Error occured in calling custom Lua potential */
 
     unsigned int maxDepth;   /* Maximum depth before overflow. Used for CL version */
+    unsigned int nCellBoxes;   /* Cells of the current tree in cellBoxes. 0 if it can't be refit */
+    unsigned int cellBoxAlloc; /* Allocated size of cellBoxes */
+    unsigned int fmmLocalAlloc; /* Allocated size of fmmLocals */
     
     real bestLikelihood;            /* new parameter for best likelihood eval*/
     real bestLikelihood_time;      /* to store the evolve time at which the best likelihood occurred */
@@ -393,7 +490,7 @@ typedef struct MW_ALIGN_TYPE
 
 #define NBODYSTATE_TYPE "NBodyState"
 
-#define EMPTY_NBODYSTATE { EMPTY_TREE, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, NULL, NULL, NULL, NULL }
+#define EMPTY_NBODYSTATE { EMPTY_TREE, EMPTY_CELL_ARENA, EMPTY_CELL_ARENA, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, NULL, NULL, NULL, NULL }
 
 
 
@@ -439,6 +536,16 @@ typedef struct MW_ALIGN_TYPE
     real Ntsteps;     /* number of time steps to run when manual control is on */
     time_t checkpointT;       /* Period to checkpoint when not using BOINC */
     unsigned int nStep;
+    unsigned int groupSize;   /* Max bodies sharing one tree walk. 0 walks the tree for each body */
+    unsigned int reorderInterval; /* Steps between sorting the bodies along a space filling curve. 0 never sorts */
+    unsigned int potentialGrid;   /* Points in theta of the external acceleration table, twice as many in r and phi. 0 evaluates the potential directly */
+    real potentialGridMin;        /* Inner radius of the table */
+    real potentialGridMax;        /* Outer radius of the table */
+    real potentialGridTolerance;  /* Largest relative error of the table before it is thrown away */
+    unsigned int timestepLevels;  /* Number of block timestep levels, each half the step of the last. 0 or 1 steps every body with timestep */
+    real timestepAccuracy;        /* eta in the largest timestep of a body, sqrt(2 eta eps / |a|), with a from the other bodies */
+    unsigned int treeRebuildInterval; /* Steps between building new trees, refitting the last one in between. 0 builds every step */
+    unsigned int fmmOrder;        /* Order of the local expansions of the FMM criterion */
 
     Potential pot;
 } NBodyCtx;
@@ -447,7 +554,8 @@ typedef struct MW_ALIGN_TYPE
 #define EMPTY_NBODYCTX { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0,                               \
                          InvalidCriterion, EXTERNAL_POTENTIAL_DEFAULT,               \
                          FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE, FALSE,     \
-                         0, 0, 0, 0, 0, 0, 0, 0, 0, 0,                               \
+                         0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0.0, 0.0, 0.0,       \
+                         0, 0.0, 0, 0,                                               \
                          EMPTY_POTENTIAL }
 
 /* Negative codes can be nonfatal but useful return statuses.
@@ -514,19 +622,6 @@ typedef enum
 
 
 
-typedef enum
-{
-    NBODY_INVALID_METHOD = -1,
-    NBODY_EMD,
-    NBODY_ORIG_CHISQ,
-    NBODY_ORIG_ALT,
-    NBODY_CHISQ_ALT,
-    NBODY_POISSON,
-    NBODY_KOLMOGOROV,
-    NBODY_KULLBACK_LEIBLER,
-    NBODY_SAHA
-} NBodyLikelihoodMethod;
-
 
 
 NBodyStatus nbInitCL(NBodyState* st, const NBodyCtx* ctx, const CLRequest* clr);
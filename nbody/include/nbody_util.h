@@ -23,6 +23,7 @@
 #define _NBODY_UTIL_H_
 
 #include "nbody_types.h"
+#include "dSFMT.h"
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -44,6 +45,13 @@ real nbEstimateTime(const NBodyCtx* ctx, int nbody, real flops);
 
 void nbReportTreeIncest(const NBodyCtx* ctx, NBodyState* st);
 
+/* Number of bodies drawn from each random stream when generating
+ * initial conditions in parallel */
+#define NBODY_IC_BLOCK_SIZE 1024
+
+uint32_t nbBlockSeed(dsfmt_t* prng);
+void nbInitBlockPRNG(dsfmt_t* blockState, uint32_t seed, unsigned int block);
+
 #ifdef _OPENMP
 #define nbGetMaxThreads() omp_get_max_threads()
 #else
@@ -257,13 +257,11 @@ static mwbool nbReadParameters(const int argc, const char* argv[], NBodyFlags* n
             0, "Output file", NULL
         },
 
-      #if 0
         {
             "binary-output", 'B',
             POPT_ARG_NONE, &nbf.outputBinary,
-            0, "Write output dump as a binary", NULL
+            0, "Write output dump in the binary body format", NULL
         },
-      #endif
 
         {
             "output-cartesian", 'x',
@@ -337,6 +335,12 @@ static mwbool nbReadParameters(const int argc, const char* argv[], NBodyFlags* n
             0, "Path to visualize", NULL
         },
 
+        {
+            "batch", '\0',
+            POPT_ARG_STRING, &nbf.batchFile,
+            0, "Run once for each line of parameters in this file (- for stdin), printing a likelihood for each", NULL
+        },
+
         {
             "ignore-checkpoint", 'i',
             POPT_ARG_NONE, &nbf.ignoreCheckpoint,
@@ -537,6 +541,7 @@ static void freeNBodyFlags(NBodyFlags* nbf)
     free(nbf->forwardedArgs);
     free(nbf->graphicsBin);
     free(nbf->visArgs);
+    free(nbf->batchFile);
 }
 
 static int nbSetNumThreads(int numThreads)
@@ -671,6 +676,11 @@ int main(int argc, const char* argv[])
         rc = isnan(emd);
         
     }
+    else if (nbf.batchFile)
+    {
+        rc = nbBatchMain(&nbf);
+        rc = nbStatusToRC(rc);
+    }
     else
     {
         rc = nbMain(&nbf);
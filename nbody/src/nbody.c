@@ -205,10 +205,11 @@ NBodyStatus nbRunSystem(const NBodyCtx* ctx, NBodyState* st, const NBodyFlags* n
 /* Output appropriate things depending on whether raw output, a
  * histogram, or just a likelihood is wanted.
  */
-static NBodyStatus nbReportResults(const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf)
+static NBodyStatus nbReportResults(const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf, real* likelihoodOut)
 {
     NBodyHistogram* data = NULL;
     NBodyHistogram* histogram = NULL;
+    const NBodyDataHistogram* dataHist = st->dataHist;
     real likelihood = NAN;
     NBodyLikelihoodMethod method;
 
@@ -224,7 +225,13 @@ static NBodyStatus nbReportResults(const NBodyCtx* ctx, const NBodyState* st, co
     {
         HistogramParams hp;
 
-        if (nbGetLikelihoodInfo(nbf, &hp, &method) || method == NBODY_INVALID_METHOD)
+        /* A data histogram loaded for the run already has the settings */
+        if (dataHist)
+        {
+            hp = dataHist->hp;
+            method = dataHist->method;
+        }
+        else if (nbGetLikelihoodInfo(nbf, &hp, &method) || method == NBODY_INVALID_METHOD)
         {
             mw_printf("Failed to get likelihood information\n");
             return NBODY_LIKELIHOOD_ERROR;
@@ -255,15 +262,21 @@ static NBodyStatus nbReportResults(const NBodyCtx* ctx, const NBodyState* st, co
 
     if (calculateLikelihood)   /* We want to match or produce a histogram */
     {
-        data = nbReadHistogram(nbf->histogramFileName);
-        if (!data)
+        if (dataHist)
         {
-            free(histogram);
-            return NBODY_LIKELIHOOD_ERROR;
+            likelihood = nbSystemLikelihoodPrepared(st, dataHist, histogram);
+        }
+        else
+        {
+            data = nbReadHistogram(nbf->histogramFileName);
+            if (!data)
+            {
+                free(histogram);
+                return NBODY_LIKELIHOOD_ERROR;
+            }
+
+            likelihood = nbSystemLikelihood(st, data, histogram, method);
         }
-        
-        
-        likelihood = nbSystemLikelihood(st, data, histogram, method);
 
         /*
           Used to fix Windows platform issues.  Windows' infinity is expressed as:
@@ -320,10 +333,8 @@ static NBodyStatus nbReportResults(const NBodyCtx* ctx, const NBodyState* st, co
         {
             likelihood = DEFAULT_WORST_CASE;
             mw_printf("Likelihood was NAN. Returning worst case. \n");
-            mw_printf("<search_likelihood>%.15f</search_likelihood>\n", -likelihood);
-            return NBODY_SUCCESS;
         }
-        mw_printf("<search_likelihood>%.15f</search_likelihood>\n", -likelihood);
+        *likelihoodOut = -likelihood;
     }
 
 
@@ -333,20 +344,79 @@ static NBodyStatus nbReportResults(const NBodyCtx* ctx, const NBodyState* st, co
 static NBodyCtx _ctx = EMPTY_NBODYCTX;
 static NBodyState _st = EMPTY_NBODYSTATE;
 
-int nbMain(const NBodyFlags* nbf)
+/* Things kept between the runs of a batch, so they are only read or
+ * allocated once */
+typedef struct
 {
-    NBodyCtx* ctx = &_ctx;
-    NBodyState* st = &_st;
-    CLRequest clr;
+    NBodyDataHistogram* dataHist;
+    NBodyCellArena buildCells;
+    NBodyCellArena treeCells;
+} NBodyBatchCache;
 
-    NBodyStatus rc = NBODY_SUCCESS;
-    real ts = 0.0, te = 0.0;
+#define EMPTY_BATCH_CACHE { NULL, EMPTY_CELL_ARENA, EMPTY_CELL_ARENA }
 
-    if (!nbOutputIsUseful(nbf))
+/* Hand what the cache holds to a newly set up state. The data
+ * histogram is loaded by the first run which wants it. */
+static void nbUseBatchCache(NBodyState* st, const NBodyFlags* nbf, NBodyBatchCache* cache)
+{
+    static const NBodyCellArena emptyArena = EMPTY_CELL_ARENA;
+
+    if (!cache->dataHist && nbf->histogramFileName)
     {
-        return NBODY_USER_ERROR;
+        cache->dataHist = nbLoadDataHistogram(nbf);
     }
 
+    st->dataHist = cache->dataHist;
+    st->buildCells = cache->buildCells;
+    st->treeCells = cache->treeCells;
+
+    cache->dataHist = NULL;
+    cache->buildCells = emptyArena;
+    cache->treeCells = emptyArena;
+}
+
+/* Take back what the state got from the cache before destroying it */
+static void nbKeepBatchCache(NBodyState* st, NBodyBatchCache* cache)
+{
+    static const NBodyCellArena emptyArena = EMPTY_CELL_ARENA;
+
+    if (!cache->dataHist)
+    {
+        cache->dataHist = st->dataHist;
+        st->dataHist = NULL;
+    }
+
+    if (!cache->buildCells.cells)
+    {
+        cache->buildCells = st->buildCells;
+        st->buildCells = emptyArena;
+    }
+
+    if (!cache->treeCells.cells)
+    {
+        cache->treeCells = st->treeCells;
+        st->treeCells = emptyArena;
+    }
+}
+
+static void nbFreeBatchCache(NBodyBatchCache* cache)
+{
+    nbFreeDataHistogram(cache->dataHist);
+    mwFreeA(cache->buildCells.cells);
+    mwFreeA(cache->treeCells.cells);
+}
+
+/* Set up, run and report one simulation. The caller destroys the
+ * state afterwards, whether or not this succeeds. The likelihood is
+ * only set if there is a histogram to match against. */
+static NBodyStatus nbRunSimulation(NBodyCtx* ctx, NBodyState* st, const NBodyFlags* nbf,
+                                   NBodyBatchCache* cache, real* likelihood)
+{
+    CLRequest clr;
+
+    NBodyStatus rc = NBODY_SUCCESS;
+    real ts = 0.0, te = 0.0;
+
     nbSetCLRequestFromFlags(&clr, nbf);
 
     /* Find out what device we're using so we can tell the workunit
@@ -356,7 +426,6 @@ int nbMain(const NBodyFlags* nbf)
         rc = nbInitCL(st, ctx, &clr);
         if (nbStatusIsFatal(rc))
         {
-            destroyNBodyState(st);
             return rc;
         }
     }
@@ -364,10 +433,14 @@ int nbMain(const NBodyFlags* nbf)
     rc = nbResumeOrNewRun(ctx, st, nbf);
     if (nbStatusIsFatal(rc))
     {
-        destroyNBodyState(st);
         return rc;
     }
 
+    if (cache)
+    {
+        nbUseBatchCache(st, nbf, cache);
+    }
+
     nbSetCtxFromFlags(ctx, nbf); /* Do this after setup to avoid the setup clobbering the flags */
     nbSetStateFromFlags(st, nbf);
 
@@ -376,12 +449,12 @@ int nbMain(const NBodyFlags* nbf)
         rc = nbInitNBodyStateCL(st, ctx);
         if (nbStatusIsFatal(rc))
         {
-            destroyNBodyState(st);
             return rc;
         }
     }
 
-    if (nbCreateSharedScene(st, ctx))
+    /* Nothing can watch the runs of a batch */
+    if (!cache && nbCreateSharedScene(st, ctx))
     {
         mw_printf("Failed to create shared scene\n");
     }
@@ -419,7 +492,6 @@ int nbMain(const NBodyFlags* nbf)
     if (nbStatusIsFatal(rc))
     {
         mw_printf("Error running system: %s (%d)\n", showNBodyStatus(rc), rc);
-        destroyNBodyState(st);
         return rc;
     }
     else
@@ -435,10 +507,105 @@ int nbMain(const NBodyFlags* nbf)
         }
     }
 
-    rc = nbReportResults(ctx, st, nbf);
+    return nbReportResults(ctx, st, nbf, likelihood);
+}
+
+int nbMain(const NBodyFlags* nbf)
+{
+    NBodyCtx* ctx = &_ctx;
+    NBodyState* st = &_st;
+    NBodyStatus rc;
+    real likelihood = NAN;
+
+    if (!nbOutputIsUseful(nbf))
+    {
+        return NBODY_USER_ERROR;
+    }
 
+    rc = nbRunSimulation(ctx, st, nbf, NULL, &likelihood);
     destroyNBodyState(st);
 
+    if (!nbStatusIsFatal(rc) && nbf->histogramFileName)
+    {
+        mw_printf("<search_likelihood>%.15f</search_likelihood>\n", likelihood);
+    }
+
     return rc;
 }
 
+/* Run the simulation once for each line of parameters in
+ * nbf->batchFile, in place of the arguments forwarded to the input
+ * file, and write a line with the likelihood of each to stdout. The
+ * input file and data histogram are only read once, so the histogram
+ * settings must not depend on the parameters. Checkpointing is off.
+ */
+int nbBatchMain(const NBodyFlags* nbf)
+{
+    NBodyCtx* ctx = &_ctx;
+    NBodyState* st = &_st;
+    NBodyFlags runFlags = *nbf;
+    NBodyBatchCache cache = EMPTY_BATCH_CACHE;
+    MWBatchReader* br;
+    NBodyStatus rc = NBODY_SUCCESS;
+    NBodyStatus runRc;
+    real likelihood;
+    unsigned int n = 0;
+
+    static const NBodyCtx emptyCtx = EMPTY_NBODYCTX;
+    static const NBodyState emptyState = EMPTY_NBODYSTATE;
+
+    if (!nbf->inputFile || !nbf->histogramFileName)
+    {
+        mw_printf("Batch mode requires an input file and a histogram to match\n");
+        return NBODY_USER_ERROR;
+    }
+
+    runFlags.inputScript = mwReadFileResolved(nbf->inputFile);
+    if (!runFlags.inputScript)
+    {
+        mwPerror("Opening Lua script '%s'", nbf->inputFile);
+        return NBODY_PARAM_FILE_ERROR;
+    }
+
+    br = mwOpenBatchReader(nbf->batchFile);
+    if (!br)
+    {
+        free(runFlags.inputScript);
+        return NBODY_USER_ERROR;
+    }
+
+    runFlags.ignoreCheckpoint = TRUE;
+    runFlags.checkpointPeriod = -1;
+    runFlags.visualizer = FALSE;
+
+    while (mwReadBatchVector(br))
+    {
+        runFlags.forwardedArgs = br->args;
+        runFlags.numForwardedArgs = br->nArgs;
+
+        *ctx = emptyCtx;
+        *st = emptyState;
+        likelihood = NAN;
+
+        runRc = nbRunSimulation(ctx, st, &runFlags, &cache, &likelihood);
+        nbKeepBatchCache(st, &cache);
+        destroyNBodyState(st);
+
+        if (nbStatusIsFatal(runRc))
+        {
+            mw_printf("Failed to evaluate parameters %u\n", n);
+            rc = runRc;
+            likelihood = NAN;
+        }
+
+        printf("%.15f\n", likelihood);
+        fflush(stdout);
+        ++n;
+    }
+
+    mwCloseBatchReader(br);
+    nbFreeBatchCache(&cache);
+    free(runFlags.inputScript);
+
+    return rc;
+}
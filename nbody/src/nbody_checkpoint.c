@@ -23,6 +23,8 @@
 #include "milkyway_util.h"
 #include "nbody_defaults.h"
 
+#include <stddef.h>
+
 #if HAVE_FCNTL_H
   #include <fcntl.h>
 #endif
@@ -43,6 +45,14 @@
   #include <sys/stat.h>
 #endif
 
+#if HAVE_PTHREAD_H && !defined(_WIN32)
+  #include <pthread.h>
+  #include <errno.h>
+  #define NBODY_ASYNC_CHECKPOINT 1
+#else
+  #define NBODY_ASYNC_CHECKPOINT 0
+#endif
+
 #ifndef _WIN32
 
 typedef struct
@@ -69,7 +79,8 @@ typedef struct
 #endif /* _WIN32 */
 
 
-/* Checkpoint file: Very simple binary "format"
+/* Version 1 checkpoint file: Very simple binary "format". Still read,
+   but no longer written.
    Name        Type         Values     Notes
 -------------------------------------------------------
    NBodyCheckpointHeader
@@ -81,6 +92,46 @@ typedef struct
 static const char hdr[] = "mwnbody";
 static const char tail[] = "end";
 
+/* The NBodyCtx as it was when version 1 files were written. The header
+   holds a raw copy of it, so this must not change with NBodyCtx. */
+typedef struct MW_ALIGN_TYPE
+{
+    real eps2;
+    real theta;
+    real timestep;
+    real timeEvolve;
+    real treeRSize;
+    real sunGCDist;
+
+    criterion_t criterion;
+    ExternalPotentialType potentialType;
+
+    mwbool Nstep_control;
+    mwbool useBestLike;
+    mwbool useVelDisp;
+    mwbool useBetaDisp;
+    mwbool MultiOutput;
+
+    mwbool useQuad;
+    mwbool allowIncest;
+    mwbool quietErrors;
+
+    real BestLikeStart;
+    real OutputFreq;
+
+    real BetaSigma;
+    real VelSigma;
+    real IterMax;
+    real BetaCorrect;
+    real VelCorrect;
+
+    real Ntsteps;
+    time_t checkpointT;
+    unsigned int nStep;
+
+    Potential pot;
+} NBodyCtxV1;
+
 typedef struct
 {
     char header[128];                     /* "mwnbody" */
@@ -92,33 +143,256 @@ typedef struct
     uint32_t nOrbitTrace;
     uint32_t treeIncest;
     real rsize;
-    NBodyCtx ctx;
+    NBodyCtxV1 ctx;
 } NBodyCheckpointHeader;
 
 static const size_t hdrSize = sizeof(NBodyCheckpointHeader) + sizeof(tail);
 
 
+/* Version 2 checkpoint file. Only what is needed to resume is stored, as
+   32 bit integers and doubles, so it doesn't depend on the struct
+   padding, the pointer size or the size of real. Numbers are in the byte
+   order of the writer.
+   Name          Type              Notes
+-------------------------------------------------------
+   header        char[16]          "mwnbody2"
+   byteOrder     uint32            0x01020304
+   majorVersion  uint32
+   minorVersion  uint32
+   nCtxFields    uint32            Number of ctx fields stored
+   nbody         uint32
+   step          uint32
+   nOrbitTrace   uint32
+   treeIncest    uint32
+   rsize         double
+   ctx           double[]          First nCtxFields in ctxFields order
+   x, y, z       double[nbody]     Positions
+   vx, vy, vz    double[nbody]     Velocities
+   mass          double[nbody]
+   id            uint32[nbody]
+   type          int8[nbody]
+   orbitTrace    double[3 * nOrbitTrace]
+   ending        string            "end"
+ */
+
+static const char hdrV2[16] = "mwnbody2";
+static const uint32_t byteOrderV2 = 0x01020304;
+
+typedef enum
+{
+    CTX_REAL,
+    CTX_INT,   /* int and enums */
+    CTX_UINT,
+    CTX_BOOL,
+    CTX_TIME
+} CtxFieldType;
+
+typedef struct
+{
+    size_t offset;
+    CtxFieldType type;
+} CtxField;
+
+#define CTX_FIELD(name, type) { offsetof(NBodyCtx, name), type }
+
+/* Everything in the context but pointers. New fields go at the end, and
+   a file with fewer fields gets the rest from defaultNBodyCtx. */
+static const CtxField ctxFields[] =
+{
+    CTX_FIELD(eps2,                   CTX_REAL),
+    CTX_FIELD(theta,                  CTX_REAL),
+    CTX_FIELD(timestep,               CTX_REAL),
+    CTX_FIELD(timeEvolve,             CTX_REAL),
+    CTX_FIELD(treeRSize,              CTX_REAL),
+    CTX_FIELD(sunGCDist,              CTX_REAL),
+    CTX_FIELD(criterion,              CTX_INT),
+    CTX_FIELD(potentialType,          CTX_INT),
+    CTX_FIELD(Nstep_control,          CTX_BOOL),
+    CTX_FIELD(useBestLike,            CTX_BOOL),
+    CTX_FIELD(useVelDisp,             CTX_BOOL),
+    CTX_FIELD(useBetaDisp,            CTX_BOOL),
+    CTX_FIELD(MultiOutput,            CTX_BOOL),
+    CTX_FIELD(useQuad,                CTX_BOOL),
+    CTX_FIELD(allowIncest,            CTX_BOOL),
+    CTX_FIELD(quietErrors,            CTX_BOOL),
+    CTX_FIELD(BestLikeStart,          CTX_REAL),
+    CTX_FIELD(OutputFreq,             CTX_REAL),
+    CTX_FIELD(BetaSigma,              CTX_REAL),
+    CTX_FIELD(VelSigma,               CTX_REAL),
+    CTX_FIELD(IterMax,                CTX_REAL),
+    CTX_FIELD(BetaCorrect,            CTX_REAL),
+    CTX_FIELD(VelCorrect,             CTX_REAL),
+    CTX_FIELD(Ntsteps,                CTX_REAL),
+    CTX_FIELD(checkpointT,            CTX_TIME),
+    CTX_FIELD(nStep,                  CTX_UINT),
+    CTX_FIELD(groupSize,              CTX_UINT),
+    CTX_FIELD(reorderInterval,        CTX_UINT),
+    CTX_FIELD(potentialGrid,          CTX_UINT),
+    CTX_FIELD(potentialGridMin,       CTX_REAL),
+    CTX_FIELD(potentialGridMax,       CTX_REAL),
+    CTX_FIELD(potentialGridTolerance, CTX_REAL),
+    CTX_FIELD(pot.sphere[0].type,     CTX_INT),
+    CTX_FIELD(pot.sphere[0].mass,     CTX_REAL),
+    CTX_FIELD(pot.sphere[0].scale,    CTX_REAL),
+
+    CTX_FIELD(pot.disk.type,          CTX_INT),
+    CTX_FIELD(pot.disk.mass,          CTX_REAL),
+    CTX_FIELD(pot.disk.scaleLength,   CTX_REAL),
+    CTX_FIELD(pot.disk.scaleHeight,   CTX_REAL),
+
+    CTX_FIELD(pot.halo.type,          CTX_INT),
+    CTX_FIELD(pot.halo.vhalo,         CTX_REAL),
+    CTX_FIELD(pot.halo.scaleLength,   CTX_REAL),
+    CTX_FIELD(pot.halo.flattenZ,      CTX_REAL),
+    CTX_FIELD(pot.halo.flattenY,      CTX_REAL),
+    CTX_FIELD(pot.halo.flattenX,      CTX_REAL),
+    CTX_FIELD(pot.halo.triaxAngle,    CTX_REAL),
+    CTX_FIELD(pot.halo.c1,            CTX_REAL),
+    CTX_FIELD(pot.halo.c2,            CTX_REAL),
+    CTX_FIELD(pot.halo.c3,            CTX_REAL),
+
+    CTX_FIELD(timestepLevels,         CTX_UINT),
+    CTX_FIELD(timestepAccuracy,       CTX_REAL),
+    CTX_FIELD(treeRebuildInterval,    CTX_UINT),
+    CTX_FIELD(fmmOrder,               CTX_UINT)
+};
+
+#define N_CTX_FIELDS (sizeof(ctxFields) / sizeof(ctxFields[0]))
+
+/* header, 8 integers and rsize */
+static const size_t fixedSizeV2 = sizeof(hdrV2) + 8 * sizeof(uint32_t) + sizeof(double);
+static const size_t bodySizeV2 = 7 * sizeof(double) + sizeof(uint32_t) + sizeof(int8_t);
+
+static size_t nbCheckpointSizeV2(size_t nCtxFields, size_t nbody, size_t nOrbitTrace)
+{
+    return fixedSizeV2 + nCtxFields * sizeof(double)
+        + nbody * bodySizeV2 + 3 * nOrbitTrace * sizeof(double) + sizeof(tail);
+}
+
+static size_t nbCheckpointSize(const NBodyState* st)
+{
+    return nbCheckpointSizeV2(N_CTX_FIELDS, st->nbody, st->nOrbitTrace);
+}
 
-static void nbPrepareWriteCheckpointHeader(NBodyCheckpointHeader* cp, const NBodyCtx* ctx, const NBodyState* st)
+static double nbGetCtxField(const NBodyCtx* ctx, const CtxField* f)
 {
-    strcpy(cp->header, hdr);
-    cp->realSize = sizeof(real);
-    cp->ptrSize = sizeof(void*);
-    cp->nOrbitTrace = st->nOrbitTrace;
+    const char* p = (const char*) ctx + f->offset;
 
-    cp->majorVersion = NBODY_VERSION_MAJOR;
-    cp->minorVersion= NBODY_VERSION_MINOR;
+    switch (f->type)
+    {
+        case CTX_REAL:
+            return (double) *(const real*) p;
+        case CTX_INT:
+            return (double) *(const int*) p;
+        case CTX_UINT:
+            return (double) *(const unsigned int*) p;
+        case CTX_BOOL:
+            return (double) *(const mwbool*) p;
+        case CTX_TIME:
+            return (double) *(const time_t*) p;
+        default:
+            mw_panic("Unknown context field type %d\n", (int) f->type);
+    }
 
-    memcpy(&cp->ctx, ctx, sizeof(cp->ctx));
-    cp->nbody = st->nbody;
-    cp->step = st->step;
-    cp->rsize = st->tree.rsize;
-    cp->treeIncest = st->treeIncest;
+    return 0.0;
+}
+
+static void nbSetCtxField(NBodyCtx* ctx, const CtxField* f, double x)
+{
+    char* p = (char*) ctx + f->offset;
+
+    switch (f->type)
+    {
+        case CTX_REAL:
+            *(real*) p = (real) x;
+            break;
+        case CTX_INT:
+            *(int*) p = (int) x;
+            break;
+        case CTX_UINT:
+            *(unsigned int*) p = (unsigned int) x;
+            break;
+        case CTX_BOOL:
+            *(mwbool*) p = (mwbool) x;
+            break;
+        case CTX_TIME:
+            *(time_t*) p = (time_t) x;
+            break;
+        default:
+            mw_panic("Unknown context field type %d\n", (int) f->type);
+    }
+}
+
+static char* nbPutU32(char* p, uint32_t x)
+{
+    memcpy(p, &x, sizeof(x));
+    return p + sizeof(x);
+}
+
+static char* nbPutDouble(char* p, double x)
+{
+    memcpy(p, &x, sizeof(x));
+    return p + sizeof(x);
+}
+
+static const char* nbGetU32(const char* p, uint32_t* x)
+{
+    memcpy(x, p, sizeof(*x));
+    return p + sizeof(*x);
+}
+
+static const char* nbGetDouble(const char* p, double* x)
+{
+    memcpy(x, p, sizeof(*x));
+    return p + sizeof(*x);
+}
+
+
+/* Settings newer than version 1 files get their defaults, which give
+   the behaviour those files were run with */
+static void nbReadCheckpointCtxV1(const NBodyCtxV1* v1, NBodyCtx* ctx)
+{
+    *ctx = defaultNBodyCtx;
+
+    ctx->eps2 = v1->eps2;
+    ctx->theta = v1->theta;
+    ctx->timestep = v1->timestep;
+    ctx->timeEvolve = v1->timeEvolve;
+    ctx->treeRSize = v1->treeRSize;
+    ctx->sunGCDist = v1->sunGCDist;
+
+    ctx->criterion = v1->criterion;
+    ctx->potentialType = v1->potentialType;
+
+    ctx->Nstep_control = v1->Nstep_control;
+    ctx->useBestLike = v1->useBestLike;
+    ctx->useVelDisp = v1->useVelDisp;
+    ctx->useBetaDisp = v1->useBetaDisp;
+    ctx->MultiOutput = v1->MultiOutput;
+
+    ctx->useQuad = v1->useQuad;
+    ctx->allowIncest = v1->allowIncest;
+    ctx->quietErrors = v1->quietErrors;
+
+    ctx->BestLikeStart = v1->BestLikeStart;
+    ctx->OutputFreq = v1->OutputFreq;
+
+    ctx->BetaSigma = v1->BetaSigma;
+    ctx->VelSigma = v1->VelSigma;
+    ctx->IterMax = v1->IterMax;
+    ctx->BetaCorrect = v1->BetaCorrect;
+    ctx->VelCorrect = v1->VelCorrect;
+
+    ctx->Ntsteps = v1->Ntsteps;
+    ctx->checkpointT = v1->checkpointT;
+    ctx->nStep = v1->nStep;
+
+    ctx->pot = v1->pot;
 }
 
 static void nbReadCheckpointHeader(NBodyCheckpointHeader* cp, NBodyCtx* ctx, NBodyState* st)
 {
-    memcpy(ctx, &cp->ctx, sizeof(*ctx));
+    nbReadCheckpointCtxV1(&cp->ctx, ctx);
     st->nbody = cp->nbody;
     st->step = cp->step;
     st->tree.rsize = cp->rsize;
@@ -205,7 +479,7 @@ static int nbOpenCheckpointHandle(const NBodyState* st,
 
     if (writing)
     {
-        cp->cpFileSize = hdrSize + st->nbody * sizeof(Body) + st->nOrbitTrace * sizeof(mwvector);
+        cp->cpFileSize = nbCheckpointSize(st);
         /* Make the file the right size in case it's a new file */
         if (ftruncate(cp->fd, cp->cpFileSize) < 0)
         {
@@ -311,7 +585,7 @@ static int nbOpenCheckpointHandle(const NBodyState* st,
 
     if (writing)
     {
-        cp->cpFileSize = (DWORD) (hdrSize + st->nbody * sizeof(Body) + st->nOrbitTrace * sizeof(mwvector));
+        cp->cpFileSize = (DWORD) nbCheckpointSize(st);
     }
     else
     {
@@ -386,8 +660,7 @@ static int nbCloseCheckpointHandle(CheckpointHandle* cp)
 
 #endif /* _WIN32 */
 
-/* Should be given the same context as the dump. Returns nonzero if the state failed to be thawed */
-static int nbThawState(NBodyCtx* ctx, NBodyState* st, CheckpointHandle* cp)
+static int nbThawStateV1(NBodyCtx* ctx, NBodyState* st, CheckpointHandle* cp)
 {
     size_t bodySize, traceSize, supposedCheckpointSize;
     NBodyCheckpointHeader cpHdr;
@@ -437,30 +710,222 @@ static int nbThawState(NBodyCtx* ctx, NBodyState* st, CheckpointHandle* cp)
     return FALSE;
 }
 
-static void nbFreezeState(const NBodyCtx* ctx, const NBodyState* st, CheckpointHandle* cp)
+static int nbThawStateV2(NBodyCtx* ctx, NBodyState* st, CheckpointHandle* cp)
 {
-    const size_t bodySize = st->nbody * sizeof(Body);
-    const size_t traceSize = st->nOrbitTrace * sizeof(mwvector);
-    char* p = cp->mptr;
-    NBodyCheckpointHeader cpHdr;
+    uint32_t byteOrder, majorVersion, minorVersion, nCtxFields, nbody, step, nOrbitTrace, treeIncest;
+    double x, y, z, rsize;
+    size_t supposedCheckpointSize;
+    unsigned int i;
+    const char* p = cp->mptr + sizeof(hdrV2);
 
-    memset(&cpHdr, 0, sizeof(cpHdr));
-    nbPrepareWriteCheckpointHeader(&cpHdr, ctx, st);
+    if (cp->cpFileSize < fixedSizeV2)
+    {
+        mw_printf("Checkpoint file is too small ("ZU" bytes)\n", (size_t) cp->cpFileSize);
+        return TRUE;
+    }
 
-    memcpy(p, &cpHdr, sizeof(cpHdr));
-    p += sizeof(cpHdr);
+    p = nbGetU32(p, &byteOrder);
+    if (byteOrder != byteOrderV2)
+    {
+        mw_printf("Got checkpoint file with a different byte order\n");
+        return TRUE;
+    }
 
-    /* The main piece of state*/
-    memcpy(p, st->bodytab, bodySize);
-    p += bodySize;
+    p = nbGetU32(p, &majorVersion);
+    p = nbGetU32(p, &minorVersion);
+    if (majorVersion != NBODY_VERSION_MAJOR || minorVersion != NBODY_VERSION_MINOR)
+    {
+        mw_printf("Version mismatch in checkpoint file. File is for %u.%u, But version is %u.%u\n",
+                  majorVersion, minorVersion,
+                  NBODY_VERSION_MAJOR, NBODY_VERSION_MINOR);
+        return TRUE;
+    }
 
-    if (st->orbitTrace)
+    p = nbGetU32(p, &nCtxFields);
+    if (nCtxFields > N_CTX_FIELDS)
     {
-        memcpy(p, st->orbitTrace, traceSize);
-        p += traceSize;
+        mw_printf("Checkpoint file has %u context fields, but only %u are known\n",
+                  nCtxFields, (unsigned int) N_CTX_FIELDS);
+        return TRUE;
+    }
+
+    p = nbGetU32(p, &nbody);
+    p = nbGetU32(p, &step);
+    p = nbGetU32(p, &nOrbitTrace);
+    p = nbGetU32(p, &treeIncest);
+    p = nbGetDouble(p, &rsize);
+
+    /* Make sure the file isn't lying about how many bodies there are */
+    supposedCheckpointSize = nbCheckpointSizeV2(nCtxFields, nbody, nOrbitTrace);
+    if (supposedCheckpointSize != cp->cpFileSize)
+    {
+        mw_printf("Expected checkpoint file size ("ZU") is incorrect for expected number of bodies "
+                  "(%u bodies, file size "ZU")\n",
+                  supposedCheckpointSize, nbody, (size_t) cp->cpFileSize);
+        return TRUE;
+    }
+
+    if (strncmp(cp->mptr + cp->cpFileSize - sizeof(tail), tail, sizeof(tail)))
+    {
+        mw_printf("Failed to find end marker in checkpoint file.\n");
+        return TRUE;
+    }
+
+    /* Fields added after the file was written keep their defaults */
+    *ctx = defaultNBodyCtx;
+    for (i = 0; i < nCtxFields; ++i)
+    {
+        p = nbGetDouble(p, &x);
+        nbSetCtxField(ctx, &ctxFields[i], x);
+    }
+
+    st->nbody = (int) nbody;
+    st->step = step;
+    st->tree.rsize = (real) rsize;
+    st->treeIncest = (int) treeIncest;
+
+    st->bodytab = (Body*) mwCallocA(nbody, sizeof(Body));
+
+    for (i = 0; i < nbody; ++i)
+    {
+        p = nbGetDouble(p, &x);
+        st->bodytab[i].bodynode.pos.x = (real) x;
+    }
+
+    for (i = 0; i < nbody; ++i)
+    {
+        p = nbGetDouble(p, &x);
+        st->bodytab[i].bodynode.pos.y = (real) x;
+    }
+
+    for (i = 0; i < nbody; ++i)
+    {
+        p = nbGetDouble(p, &x);
+        st->bodytab[i].bodynode.pos.z = (real) x;
+    }
+
+    for (i = 0; i < nbody; ++i)
+    {
+        p = nbGetDouble(p, &x);
+        st->bodytab[i].vel.x = (real) x;
+    }
+
+    for (i = 0; i < nbody; ++i)
+    {
+        p = nbGetDouble(p, &x);
+        st->bodytab[i].vel.y = (real) x;
+    }
+
+    for (i = 0; i < nbody; ++i)
+    {
+        p = nbGetDouble(p, &x);
+        st->bodytab[i].vel.z = (real) x;
+    }
+
+    for (i = 0; i < nbody; ++i)
+    {
+        p = nbGetDouble(p, &x);
+        st->bodytab[i].bodynode.mass = (real) x;
+    }
+
+    for (i = 0; i < nbody; ++i)
+    {
+        p = nbGetU32(p, &st->bodytab[i].bodynode.id);
+    }
+
+    for (i = 0; i < nbody; ++i)
+    {
+        st->bodytab[i].bodynode.type = (body_t) (int8_t) *p++;
+    }
+
+    if (nOrbitTrace != 0)
+    {
+        st->nOrbitTrace = nOrbitTrace;
+        st->orbitTrace = (mwvector*) mwCallocA(nOrbitTrace, sizeof(mwvector));
+
+        for (i = 0; i < nOrbitTrace; ++i)
+        {
+            p = nbGetDouble(p, &x);
+            p = nbGetDouble(p, &y);
+            p = nbGetDouble(p, &z);
+            st->orbitTrace[i].x = (real) x;
+            st->orbitTrace[i].y = (real) y;
+            st->orbitTrace[i].z = (real) z;
+        }
+    }
+
+    return FALSE;
+}
+
+/* Should be given the same context as the dump. Returns nonzero if the state failed to be thawed */
+static int nbThawState(NBodyCtx* ctx, NBodyState* st, CheckpointHandle* cp)
+{
+    if (cp->cpFileSize >= sizeof(hdrV2) && !memcmp(cp->mptr, hdrV2, sizeof(hdrV2)))
+    {
+        return nbThawStateV2(ctx, st, cp);
+    }
+
+    return nbThawStateV1(ctx, st, cp);
+}
+
+/* Write the state into p, which must have room for nbCheckpointSize() bytes */
+static void nbFreezeState(const NBodyCtx* ctx, const NBodyState* st, char* p)
+{
+    unsigned int i;
+    const unsigned int nbody = (unsigned int) st->nbody;
+    const Body* bodies = st->bodytab;
+
+    memcpy(p, hdrV2, sizeof(hdrV2));
+    p += sizeof(hdrV2);
+
+    p = nbPutU32(p, byteOrderV2);
+    p = nbPutU32(p, NBODY_VERSION_MAJOR);
+    p = nbPutU32(p, NBODY_VERSION_MINOR);
+    p = nbPutU32(p, (uint32_t) N_CTX_FIELDS);
+    p = nbPutU32(p, nbody);
+    p = nbPutU32(p, st->step);
+    p = nbPutU32(p, (uint32_t) st->nOrbitTrace);
+    p = nbPutU32(p, (uint32_t) st->treeIncest);
+    p = nbPutDouble(p, (double) st->tree.rsize);
+
+    for (i = 0; i < N_CTX_FIELDS; ++i)
+    {
+        p = nbPutDouble(p, nbGetCtxField(ctx, &ctxFields[i]));
     }
 
-    strcpy(p, tail);
+    /* The main piece of state */
+    for (i = 0; i < nbody; ++i)
+        p = nbPutDouble(p, (double) bodies[i].bodynode.pos.x);
+    for (i = 0; i < nbody; ++i)
+        p = nbPutDouble(p, (double) bodies[i].bodynode.pos.y);
+    for (i = 0; i < nbody; ++i)
+        p = nbPutDouble(p, (double) bodies[i].bodynode.pos.z);
+    for (i = 0; i < nbody; ++i)
+        p = nbPutDouble(p, (double) bodies[i].vel.x);
+    for (i = 0; i < nbody; ++i)
+        p = nbPutDouble(p, (double) bodies[i].vel.y);
+    for (i = 0; i < nbody; ++i)
+        p = nbPutDouble(p, (double) bodies[i].vel.z);
+    for (i = 0; i < nbody; ++i)
+        p = nbPutDouble(p, (double) bodies[i].bodynode.mass);
+    for (i = 0; i < nbody; ++i)
+        p = nbPutU32(p, bodies[i].bodynode.id);
+    for (i = 0; i < nbody; ++i)
+        *p++ = (char) (int8_t) bodies[i].bodynode.type;
+
+    for (i = 0; i < st->nOrbitTrace; ++i)
+    {
+        mwvector v = ZERO_VECTOR;
+
+        if (st->orbitTrace)
+            v = st->orbitTrace[i];
+
+        p = nbPutDouble(p, (double) v.x);
+        p = nbPutDouble(p, (double) v.y);
+        p = nbPutDouble(p, (double) v.z);
+    }
+
+    memcpy(p, tail, sizeof(tail));
 }
 
 /* Open the temporary checkpoint file for writing */
@@ -565,7 +1030,7 @@ int nbWriteCheckpointWithTmpFile(const NBodyCtx* ctx, const NBodyState* st, cons
         return TRUE;
     }
 
-    nbFreezeState(ctx, st, &cp);
+    nbFreezeState(ctx, st, cp.mptr);
 
     if (nbCloseCheckpointHandle(&cp))
     {
@@ -600,6 +1065,298 @@ int nbWriteCheckpoint(const NBodyCtx* ctx, const NBodyState* st)
     return nbWriteCheckpointWithTmpFile(ctx, st, path);
 }
 
+#if NBODY_ASYNC_CHECKPOINT
+
+/* Checkpoints during the run are written by a separate thread. The
+   simulation thread only freezes the state into a buffer, and the
+   writer thread writes it to the temporary file, syncs it, and renames
+   it over the checkpoint while the simulation continues.
+
+   There are two buffers, so the next checkpoint can be frozen while the
+   previous one is still being written. At most one checkpoint waits
+   behind the one being written, and each buffer is only used by one
+   thread at a time.
+ */
+struct NBodyCheckpointWriter
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    char* buf[2];               /* Frozen states to write */
+    size_t bufSize[2];
+    size_t size[2];             /* Size of the checkpoint in each buffer */
+    char tmpFile[256];
+    const char* checkpointFile; /* Owned by the state, which outlives the writer */
+
+    int pending;      /* Buffer waiting to be written, or -1 */
+    int writing;      /* Buffer being written, or -1 */
+    mwbool finished;  /* A write finished which hasn't been reported yet */
+    mwbool failed;
+    mwbool quit;
+};
+
+static int nbWriteSyncedFile(const char* filename, const char* buf, size_t size)
+{
+    int fd;
+    ssize_t rc;
+    size_t done = 0;
+
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (fd == -1)
+    {
+        mwPerror("Error opening checkpoint '%s'", filename);
+        return TRUE;
+    }
+
+    while (done < size)
+    {
+        rc = write(fd, buf + done, size - done);
+        if (rc == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            mwPerror("Error writing checkpoint '%s'", filename);
+            close(fd);
+            return TRUE;
+        }
+
+        done += (size_t) rc;
+    }
+
+    /* The new checkpoint must be on disk before it replaces the old one */
+    if (fsync(fd) == -1)
+    {
+        mwPerror("Error on fsync() of checkpoint '%s'", filename);
+        close(fd);
+        return TRUE;
+    }
+
+    if (close(fd) == -1)
+    {
+        mwPerror("closing checkpoint file");
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void* nbCheckpointWriterThread(void* arg)
+{
+    NBodyCheckpointWriter* w = (NBodyCheckpointWriter*) arg;
+    int failed;
+    int i;
+
+    pthread_mutex_lock(&w->lock);
+    while (TRUE)
+    {
+        while (w->pending < 0 && !w->quit)
+        {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+
+        if (w->pending < 0) /* Quitting, and the last checkpoint is done */
+            break;
+
+        i = w->pending;
+        w->pending = -1;
+        w->writing = i;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+
+        /* Same atomic swap as nbWriteCheckpointWithTmpFile() */
+        failed = nbWriteSyncedFile(w->tmpFile, w->buf[i], w->size[i]);
+        if (!failed && mw_rename(w->tmpFile, w->checkpointFile))
+        {
+            mwPerror("Failed to update checkpoint '%s' with temporary", w->checkpointFile);
+            failed = TRUE;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        w->failed |= failed;
+        w->writing = -1;
+        w->finished = TRUE;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+static NBodyCheckpointWriter* nbCreateCheckpointWriter(const NBodyState* st)
+{
+    NBodyCheckpointWriter* w;
+
+    w = (NBodyCheckpointWriter*) mwCalloc(1, sizeof(NBodyCheckpointWriter));
+    snprintf(w->tmpFile, sizeof(w->tmpFile), "nbody_checkpoint_tmp_%d", (int) getpid());
+    w->checkpointFile = st->checkpointResolved;
+    w->pending = -1;
+    w->writing = -1;
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    if (pthread_create(&w->thread, NULL, nbCheckpointWriterThread, w))
+    {
+        mw_printf("Failed to start checkpoint writer thread. Checkpointing in the foreground\n");
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        free(w);
+        return NULL;
+    }
+
+    return w;
+}
+
+void nbDestroyCheckpointWriter(NBodyCheckpointWriter* w)
+{
+    if (!w)
+        return;
+
+    /* Let the checkpoints being written or waiting finish first */
+    pthread_mutex_lock(&w->lock);
+    w->quit = TRUE;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->buf[0]);
+    free(w->buf[1]);
+    free(w);
+}
+
+/* Freeze the state and write it in the background. This only waits if
+   a checkpoint is already waiting behind the one being written (see the
+   busy flag of nbFinishCheckpoint()). If the writer thread can't be
+   started, the checkpoint is written before returning. */
+int nbStartCheckpoint(const NBodyCtx* ctx, NBodyState* st)
+{
+    NBodyCheckpointWriter* w;
+    size_t size;
+    int i;
+
+    assert(st->checkpointResolved);
+
+    if (!st->checkpointWriter)
+    {
+        st->checkpointWriter = nbCreateCheckpointWriter(st);
+    }
+
+    w = st->checkpointWriter;
+    if (!w)
+    {
+        if (nbWriteCheckpoint(ctx, st))
+            return TRUE;
+
+        mw_checkpoint_completed();
+        return FALSE;
+    }
+
+    /* Freeze into the buffer which isn't being written */
+    pthread_mutex_lock(&w->lock);
+    while (w->pending >= 0)
+    {
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+    i = (w->writing == 0) ? 1 : 0;
+    pthread_mutex_unlock(&w->lock);
+
+    size = nbCheckpointSize(st);
+    if (size > w->bufSize[i])
+    {
+        free(w->buf[i]);
+        w->buf[i] = (char*) mwMalloc(size);
+        w->bufSize[i] = size;
+    }
+
+    nbFreezeState(ctx, st, w->buf[i]);
+
+    pthread_mutex_lock(&w->lock);
+    w->size[i] = size;
+    w->pending = i;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    return FALSE;
+}
+
+/* Report background checkpoints once they have been written, waiting
+   for all of them if wait is set. busy is set if one is still waiting
+   behind the one being written, so starting another would block.
+   Returns nonzero if writing one failed. */
+int nbFinishCheckpoint(NBodyState* st, mwbool wait, mwbool* busy)
+{
+    NBodyCheckpointWriter* w = st->checkpointWriter;
+    mwbool finished, failed;
+
+    if (busy)
+        *busy = FALSE;
+
+    if (!w)
+        return FALSE;
+
+    pthread_mutex_lock(&w->lock);
+    while (wait && (w->pending >= 0 || w->writing >= 0))
+    {
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+
+    finished = w->finished;
+    failed = w->failed;
+    w->finished = FALSE;
+    w->failed = FALSE;
+
+    if (busy)
+        *busy = (w->pending >= 0);
+    pthread_mutex_unlock(&w->lock);
+
+    if (failed)
+    {
+        mw_printf("Failed to write checkpoint\n");
+        return TRUE;
+    }
+
+    if (finished)
+    {
+        mw_checkpoint_completed();
+    }
+
+    return FALSE;
+}
+
+#else
+
+/* Without threads checkpoints are written in the foreground */
+void nbDestroyCheckpointWriter(NBodyCheckpointWriter* w)
+{
+    (void) w;
+}
+
+int nbStartCheckpoint(const NBodyCtx* ctx, NBodyState* st)
+{
+    if (nbWriteCheckpoint(ctx, st))
+        return TRUE;
+
+    mw_checkpoint_completed();
+    return FALSE;
+}
+
+int nbFinishCheckpoint(NBodyState* st, mwbool wait, mwbool* busy)
+{
+    (void) st, (void) wait;
+
+    if (busy)
+        *busy = FALSE;
+
+    return FALSE;
+}
+
+#endif /* NBODY_ASYNC_CHECKPOINT */
+
 int nbTimeToCheckpoint(const NBodyCtx* ctx, NBodyState* st)
 {
     time_t now;
@@ -626,6 +1383,12 @@ int nbTimeToCheckpoint(const NBodyCtx* ctx, NBodyState* st)
 
 NBodyStatus nbWriteFinalCheckpoint(const NBodyCtx* ctx, NBodyState* st)
 {
+    /* The final checkpoint must not be replaced by an older one */
+    if (nbFinishCheckpoint(st, TRUE, NULL))
+    {
+        return NBODY_CHECKPOINT_ERROR;
+    }
+
     if (BOINC_APPLICATION || ctx->checkpointT >= 0)
     {
         mw_report("Making final checkpoint\n");
@@ -750,7 +750,11 @@ cl_bool nbCheckDevCapabilities(const DevInfo* di, const NBodyCtx* ctx, cl_uint n
     cl_ulong nNode = (cl_ulong) nbFindNNode(di, nbody) + 1;
     cl_ulong maxNodes = di->maxMemAlloc / (NSUB * sizeof(cl_int));
 
-    (void) ctx;
+    if (ctx->criterion == FMM)
+    {
+        mw_printf("The FMM criterion is not supported with OpenCL\n");
+        return CL_FALSE;
+    }
 
     if (di->devType != CL_DEVICE_TYPE_GPU)
     {
@@ -1468,7 +1472,21 @@ static cl_int nbExecuteForceKernels(NBodyState* st, cl_bool updateState)
 
 static NBodyStatus nbCheckpointCL(const NBodyCtx* ctx, NBodyState* st)
 {
-    if (st->useCLCheckpointing && nbTimeToCheckpoint(ctx, st))
+    mwbool busy;
+
+    if (!st->useCLCheckpointing)
+    {
+        return NBODY_SUCCESS;
+    }
+
+    /* Checkpoints are written in the background. Don't stall on a second
+       one still waiting behind the one being written */
+    if (nbFinishCheckpoint(st, FALSE, &busy))
+    {
+        return NBODY_CHECKPOINT_ERROR;
+    }
+
+    if (!busy && nbTimeToCheckpoint(ctx, st))
     {
         cl_int err;
 
@@ -1478,12 +1496,10 @@ static NBodyStatus nbCheckpointCL(const NBodyCtx* ctx, NBodyState* st)
             return NBODY_CL_ERROR;
         }
 
-        if (nbWriteCheckpoint(ctx, st))
+        if (nbStartCheckpoint(ctx, st))
         {
             return NBODY_CHECKPOINT_ERROR;
         }
-
-        mw_checkpoint_completed();
     }
 
     return NBODY_SUCCESS;
@@ -58,6 +58,16 @@ const NBodyCtx defaultNBodyCtx =
 
     /* .checkpointT     */  NOBOINC_DEFAULT_CHECKPOINT_PERIOD,
     /* .nStep           */  0,
+    /* .groupSize       */  DEFAULT_GROUP_SIZE,
+    /* .reorderInterval */  DEFAULT_REORDER_INTERVAL,
+    /* .potentialGrid   */  DEFAULT_POTENTIAL_GRID,
+    /* .potentialGridMin */ DEFAULT_POTENTIAL_GRID_MIN,
+    /* .potentialGridMax */ DEFAULT_POTENTIAL_GRID_MAX,
+    /* .potentialGridTolerance */ DEFAULT_POTENTIAL_GRID_TOLERANCE,
+    /* .timestepLevels  */  DEFAULT_TIMESTEP_LEVELS,
+    /* .timestepAccuracy */ DEFAULT_TIMESTEP_ACCURACY,
+    /* .treeRebuildInterval */ DEFAULT_TREE_REBUILD_INTERVAL,
+    /* .fmmOrder        */  DEFAULT_FMM_ORDER,
 
     /* .pot             */  EMPTY_POTENTIAL
 };
@@ -0,0 +1,195 @@
+/* Copyright (c) 2016-2018 Siddhartha Shelton
+
+This file is part of Milkway@Home.
+
+Milkyway@Home is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Milkyway@Home is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+
+The minimum bracketing method is based on results from "Numerical Recipes,
+3rd ed." and conforms to the authors' defintion of intellectual
+property under their license, and as such does not conflict with
+their copyright to their programs which execute similar algorithms.
+*/
+
+/* The distribution function of the isotropic dwarf models depends only on
+ * the energy, but each evaluation is a root find followed by a quadrature
+ * over numerical derivatives of the potential and density. The velocity
+ * sampling evaluates it many times for every body, so it is evaluated once
+ * per model on a grid uniform in log(E) and interpolated with monotone
+ * cubic Hermite splines (Fritsch & Carlson 1980). Energies outside of the
+ * table are evaluated directly.
+ */
+
+#include "nbody_priv.h"
+#include "milkyway_util.h"
+#include "nbody_eddington.h"
+
+/* Slopes which keep the interpolant monotone between grid points. With a
+ * uniform grid this is the harmonic mean of the neighbouring secants, or 0
+ * at a local extremum. */
+static void nbEddingtonSlopes(EddingtonTable* t)
+{
+    unsigned int i;
+    real d0, d1;
+    const unsigned int n = t->n;
+
+    for (i = 1; i < n - 1; ++i)
+    {
+        d0 = (t->f[i] - t->f[i - 1]) / t->dLogE;
+        d1 = (t->f[i + 1] - t->f[i]) / t->dLogE;
+
+        if (d0 * d1 <= 0.0)
+        {
+            t->slope[i] = 0.0;
+        }
+        else
+        {
+            t->slope[i] = 2.0 * d0 * d1 / (d0 + d1);
+        }
+    }
+
+    t->slope[0] = (t->f[1] - t->f[0]) / t->dLogE;
+    t->slope[n - 1] = (t->f[n - 1] - t->f[n - 2]) / t->dLogE;
+}
+
+void nbMakeEddingtonTable(EddingtonTable* t, EddingtonDistFun distFun, const void* model, real eMin, real eMax)
+{
+    int i;
+
+    t->distFun = distFun;
+    t->model = model;
+    t->n = NBODY_EDDINGTON_TABLE_SIZE;
+    t->logEMin = mw_log(eMin);
+    t->logEMax = mw_log(eMax);
+    t->dLogE = (t->logEMax - t->logEMin) / (real) (t->n - 1);
+    t->f = (real*) mwCalloc(t->n, sizeof(real));
+    t->slope = (real*) mwCalloc(t->n, sizeof(real));
+
+  #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+  #endif
+    for (i = 0; i < (int) t->n; ++i)
+    {
+        t->f[i] = distFun(mw_exp(t->logEMin + (real) i * t->dLogE), model);
+    }
+
+    nbEddingtonSlopes(t);
+}
+
+void nbFreeEddingtonTable(EddingtonTable* t)
+{
+    free(t->f);
+    free(t->slope);
+    t->f = NULL;
+    t->slope = NULL;
+}
+
+real nbEddingtonDistFun(const EddingtonTable* t, real energy)
+{
+    real x, s, s2, s3;
+    unsigned int i;
+
+    if (!(energy > 0.0))
+    {
+        return t->distFun(energy, t->model);
+    }
+
+    x = (mw_log(energy) - t->logEMin) / t->dLogE;
+    if (x < 0.0 || x > (real) (t->n - 1))
+    {
+        return t->distFun(energy, t->model);
+    }
+
+    i = (unsigned int) x;
+    if (i >= t->n - 1)
+    {
+        i = t->n - 2;
+    }
+
+    s = x - (real) i;
+    s2 = s * s;
+    s3 = s2 * s;
+
+    return (2.0 * s3 - 3.0 * s2 + 1.0) * t->f[i]
+         + (s3 - 2.0 * s2 + s) * t->dLogE * t->slope[i]
+         + (-2.0 * s3 + 3.0 * s2) * t->f[i + 1]
+         + (s3 - s2) * t->dLogE * t->slope[i + 1];
+}
+
+/* v^2 f(E) for a body at a place where the (positive) potential is psi */
+static inline real nbEddingtonSpeedDist(const EddingtonTable* t, real psi, real v)
+{
+    return v * v * nbEddingtonDistFun(t, psi - 0.5 * v * v);
+}
+
+/* Maximum of v^2 f(E) over speeds in [0, vMax], for rejection sampling the
+ * speed. This is the golden section search the generators used before. */
+real nbEddingtonMaxDistFun(const EddingtonTable* t, real psi, real vMax)
+{
+    const real RATIO = 0.61803399;
+    const real RATIO_COMPLEMENT = 1.0 - RATIO;
+    const real tolerance = 1.0e-2;
+    const int limit = 10;
+    int counter = 0;
+
+    real profile_x1, profile_x2, x0, x1, x2, x3;
+    const real a = 0.0;
+    const real b = 0.5 * vMax;
+    const real c = vMax;
+
+    x0 = a;
+    x3 = c;
+
+    if (mw_fabs(b - c) > mw_fabs(b - a))
+    {
+        x1 = b;
+        x2 = b + (RATIO_COMPLEMENT * (c - b));
+    }
+    else
+    {
+        x2 = b;
+        x1 = b - (RATIO_COMPLEMENT * (b - a));
+    }
+
+    profile_x1 = -nbEddingtonSpeedDist(t, psi, x1);
+    profile_x2 = -nbEddingtonSpeedDist(t, psi, x2);
+
+    while (mw_fabs(x3 - x0) > (tolerance * (mw_fabs(x1) + mw_fabs(x2))))
+    {
+        counter++;
+        if (profile_x2 < profile_x1)
+        {
+            x0 = x1;
+            x1 = x2;
+            x2 = RATIO * x2 + RATIO_COMPLEMENT * x3;
+            profile_x1 = profile_x2;
+            profile_x2 = -nbEddingtonSpeedDist(t, psi, x2);
+        }
+        else
+        {
+            x3 = x2;
+            x2 = x1;
+            x1 = RATIO * x1 + RATIO_COMPLEMENT * x0;
+            profile_x2 = profile_x1;
+            profile_x1 = -nbEddingtonSpeedDist(t, psi, x1);
+        }
+
+        if (counter > limit)
+        {
+            break;
+        }
+    }
+
+    return profile_x1 < profile_x2 ? -profile_x1 : -profile_x2;
+}
+
@@ -1271,7 +1271,36 @@ real nbWorstCaseEMD(const NBodyHistogram* hist)
     return DEFAULT_WORST_CASE;
 }
 
-real nbMatchEMD(const NBodyHistogram* data, const NBodyHistogram* histogram)
+/* Build the data side of the EMD signature. Bins not used in the
+ * comparison keep a zero weight. */
+real* nbMakeEMDSignature(const NBodyHistogram* data)
+{
+    unsigned int bins = data->lambdaBins * data->betaBins;
+    unsigned int i;
+    WeightPos* dat;
+
+    dat = mwCalloc(bins, sizeof(WeightPos));
+
+    for (i = 0; i < bins; ++i)
+    {
+        if (data->data[i].useBin)
+        {
+            dat[i].weight = (real) data->data[i].count;
+        }
+
+        dat[i].lambda = (real) data->data[i].lambda;
+        dat[i].beta = (real) data->data[i].beta;
+    }
+
+    return (real*) dat;
+}
+
+/* Match against an already built data signature. useBin is the mask
+ * of bins used from the data histogram. */
+static real nbMatchEMDSignature(const NBodyHistogram* data,
+                                const real* dataSignature,
+                                const int* useBin,
+                                const NBodyHistogram* histogram)
 {
     unsigned int lambdaBins = data->lambdaBins;
     unsigned int betaBins = data->betaBins;
@@ -1282,7 +1311,6 @@ real nbMatchEMD(const NBodyHistogram* data, const NBodyHistogram* histogram)
     real dataMass = data->massPerParticle;
     unsigned int i;
     WeightPos* hist;
-    WeightPos* dat;
     real emd;
     real likelihood;
 
@@ -1308,24 +1336,19 @@ real nbMatchEMD(const NBodyHistogram* data, const NBodyHistogram* histogram)
     
     /* This creates histograms that emdCalc can use */
     hist = mwCalloc(bins, sizeof(WeightPos));
-    dat = mwCalloc(bins, sizeof(WeightPos));
     
     for (i = 0; i < bins; ++i)
     {
-        if (data->data[i].useBin)
+        if (useBin[i])
         {
-            dat[i].weight = (real) data->data[i].count;
             hist[i].weight = (real) histogram->data[i].count;
         }
 
         hist[i].lambda = (real) histogram->data[i].lambda;
-        dat[i].lambda = (real) data->data[i].lambda;
-        
         hist[i].beta = (real) histogram->data[i].beta;
-        dat[i].beta = (real) data->data[i].beta;
     }
 
-    emd = emdCalc((const real*) dat, (const real*) hist, bins, bins, NULL);
+    emd = emdCalc(dataSignature, (const real*) hist, bins, bins, NULL);
 
     emd *= 1.0e9;
     emd = mw_round(emd);
@@ -1334,7 +1357,6 @@ real nbMatchEMD(const NBodyHistogram* data, const NBodyHistogram* histogram)
     if (emd > 50.0)
     {
         free(hist);
-        free(dat);
         /* emd's max value is 50 */
         return NAN;
     }
@@ -1350,10 +1372,35 @@ real nbMatchEMD(const NBodyHistogram* data, const NBodyHistogram* histogram)
     likelihood = 300.0 * mw_log(EMDComponent);
 
     free(hist);
-    free(dat);
 //     mw_printf("l = %.15f\n", likelihood);
     
     /* the emd is a negative. returning a positive value */
     return -likelihood;
 }
 
+real nbMatchEMD(const NBodyHistogram* data, const NBodyHistogram* histogram)
+{
+    unsigned int bins = data->lambdaBins * data->betaBins;
+    unsigned int i;
+    real* dat;
+    int* useBin;
+    real likelihood;
+
+    dat = nbMakeEMDSignature(data);
+    useBin = mwMalloc(bins * sizeof(int));
+    for (i = 0; i < bins; ++i)
+    {
+        useBin[i] = data->data[i].useBin;
+    }
+
+    likelihood = nbMatchEMDSignature(data, dat, useBin, histogram);
+
+    free(useBin);
+    free(dat);
+    return likelihood;
+}
+
+real nbMatchEMDPrepared(const NBodyDataHistogram* dataHist, const NBodyHistogram* histogram)
+{
+    return nbMatchEMDSignature(dataHist->histogram, dataHist->emdSignature, dataHist->useBin, histogram);
+}
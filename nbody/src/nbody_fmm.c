@@ -0,0 +1,420 @@
+/*
+ *  Copyright (c) 2010-2011 Rensselaer Polytechnic Institute
+ *  Copyright (c) 2010-2011 Matthew Arsenault
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Fast multipole style force calculation on the same tree as the other
+ * criteria. Instead of each body walking the tree, pairs of nodes are
+ * walked together. When two cells are far enough apart that their
+ * Salmon & Warren critical radii don't overlap, the field of the source
+ * cell's monopole and quadrupole (from hackQuad) is expanded around the
+ * center of mass of the target cell, and the expansion is later shifted
+ * down the target's subtree to its bodies. One interaction then stands
+ * in for the interactions of every body in the target with the source.
+ *
+ * The walk is one sided: the target tree is split into subtrees of up to
+ * NBODY_FMM_TASK_SIZE bodies, each of which walks against the whole tree
+ * on its own. Every task only writes to its own bodies and cells, so the
+ * tasks run in parallel without any locking.
+ */
+
+#include "nbody_priv.h"
+#include "nbody_fmm.h"
+#include "milkyway_util.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif /* _OPENMP */
+
+/* Largest number of bodies in the subtree walked by one thread */
+#define NBODY_FMM_TASK_SIZE 512
+
+/* Symmetric tensors by their unique components */
+typedef struct
+{
+    real xx, xy, xz;
+    real yy, yz;
+    real zz;
+} NBodyFMMTensor2;
+
+typedef struct
+{
+    real xxx, xxy, xxz, xyy, xyz, xzz;
+    real yyy, yyz, yzz;
+    real zzz;
+} NBodyFMMTensor3;
+
+/* Taylor series of the acceleration around the center of mass of a cell:
+ * a(x + y) = acc + grad y + 1/2 hess y y */
+struct NBodyLocalExpansion
+{
+    mwvector acc;
+    NBodyFMMTensor2 grad;
+    NBodyFMMTensor3 hess;
+};
+
+typedef struct
+{
+    const NBodyCtx* ctx;
+    NBodyState* st;
+    const NBodyCell* cells;
+} NBodyFMMWalk;
+
+typedef struct
+{
+    const NBodyNode** nodes;
+    unsigned int n;
+    unsigned int alloc;
+} NBodyFMMTaskList;
+
+/* Radial derivatives of the softened potential used by the expansions.
+ * With R^2 = r^2 + eps^2, g[0] = 1 / R, g[1] = 1 / R^3 and after that
+ * g[n + 1] = (1 / R) d g[n] / dR */
+static inline void nbFMMRadialDerivs(real r2, real eps2, real g[5])
+{
+    real rInv2 = 1.0 / (r2 + eps2);
+
+    g[0] = mw_sqrt(rInv2);
+    g[1] = g[0] * rInv2;
+    g[2] = -3.0 * g[1] * rInv2;
+    g[3] = -5.0 * g[2] * rInv2;
+    g[4] = -7.0 * g[3] * rInv2;
+}
+
+static inline mwvector nbFMMQuadTimes(const NBodyNode* src, mwvector x)
+{
+    mwvector Qx;
+
+    Qx.x = Quad(src).xx * x.x + Quad(src).xy * x.y + Quad(src).xz * x.z;
+    Qx.y = Quad(src).xy * x.x + Quad(src).yy * x.y + Quad(src).yz * x.z;
+    Qx.z = Quad(src).xz * x.x + Quad(src).yz * x.y + Quad(src).zz * x.z;
+
+    return Qx;
+}
+
+/* Acceleration from src at the offset x from its center of mass. This is
+ * the same as nbGravity(), including the quadrupole of cells. */
+static inline mwvector nbFMMField(const NBodyCtx* ctx, const NBodyNode* src, mwvector x)
+{
+    real g[5];
+    real s, mono;
+    mwvector Qx, a;
+
+    nbFMMRadialDerivs(mw_sqrv(x), ctx->eps2, g);
+
+    if (ctx->useQuad && isCell(src))
+    {
+        Qx = nbFMMQuadTimes(src, x);
+        s = mw_dotv(x, Qx);
+
+        mono = -(Mass(src) * g[1] + g[3] * s / 6.0);
+        a.x = mono * x.x - g[2] * Qx.x / 3.0;
+        a.y = mono * x.y - g[2] * Qx.y / 3.0;
+        a.z = mono * x.z - g[2] * Qx.z / 3.0;
+    }
+    else
+    {
+        a = mw_mulvs(x, -Mass(src) * g[1]);
+    }
+
+    return a;
+}
+
+/* Add the field of src to the expansion of a cell whose center of mass
+ * is at the offset x from the center of mass of src */
+static void nbFMMAddToLocal(const NBodyCtx* ctx, NBodyLocalExpansion* L, const NBodyNode* src, mwvector x)
+{
+    real g[5];
+    real s = 0.0;
+    real m = Mass(src);
+    real cxx, cdiag, cQx, cQ, ch3, ch2;
+    mwvector Qx = ZERO_VECTOR;
+    NBodyQuadMatrix Q;
+    mwbool quad = ctx->useQuad && isCell(src);
+
+    nbFMMRadialDerivs(mw_sqrv(x), ctx->eps2, g);
+
+    if (quad)
+    {
+        Q = Quad(src);
+        Qx = nbFMMQuadTimes(src, x);
+        s = mw_dotv(x, Qx);
+    }
+    else
+    {
+        memset(&Q, 0, sizeof(Q));
+    }
+
+    /* a_i = -(m g1 + g3 s / 6) x_i - g2 (Qx)_i / 3 */
+    cdiag = m * g[1] + g[3] * s / 6.0;
+    cQ = g[2] / 3.0;
+
+    L->acc.x -= cdiag * x.x + cQ * Qx.x;
+    L->acc.y -= cdiag * x.y + cQ * Qx.y;
+    L->acc.z -= cdiag * x.z + cQ * Qx.z;
+
+    /* d a_i / d x_j = -(cxx x_i x_j + cdiag d_ij
+     *                   + cQx (x_i (Qx)_j + x_j (Qx)_i) + cQ Q_ij) */
+    cxx = m * g[2] + g[4] * s / 6.0;
+    cQx = g[3] / 3.0;
+
+    L->grad.xx -= cxx * x.x * x.x + cdiag + 2.0 * cQx * x.x * Qx.x + cQ * Q.xx;
+    L->grad.yy -= cxx * x.y * x.y + cdiag + 2.0 * cQx * x.y * Qx.y + cQ * Q.yy;
+    L->grad.zz -= cxx * x.z * x.z + cdiag + 2.0 * cQx * x.z * Qx.z + cQ * Q.zz;
+    L->grad.xy -= cxx * x.x * x.y + cQx * (x.x * Qx.y + x.y * Qx.x) + cQ * Q.xy;
+    L->grad.xz -= cxx * x.x * x.z + cQx * (x.x * Qx.z + x.z * Qx.x) + cQ * Q.xz;
+    L->grad.yz -= cxx * x.y * x.z + cQx * (x.y * Qx.z + x.z * Qx.y) + cQ * Q.yz;
+
+    if (ctx->fmmOrder < 2)
+    {
+        return;
+    }
+
+    /* Second derivatives of the monopole only. Those of the quadrupole
+     * are of the same order as the terms left out. */
+    ch3 = m * g[3];
+    ch2 = m * g[2];
+
+    L->hess.xxx -= ch3 * x.x * x.x * x.x + 3.0 * ch2 * x.x;
+    L->hess.xxy -= ch3 * x.x * x.x * x.y + ch2 * x.y;
+    L->hess.xxz -= ch3 * x.x * x.x * x.z + ch2 * x.z;
+    L->hess.xyy -= ch3 * x.x * x.y * x.y + ch2 * x.x;
+    L->hess.xyz -= ch3 * x.x * x.y * x.z;
+    L->hess.xzz -= ch3 * x.x * x.z * x.z + ch2 * x.x;
+    L->hess.yyy -= ch3 * x.y * x.y * x.y + 3.0 * ch2 * x.y;
+    L->hess.yyz -= ch3 * x.y * x.y * x.z + ch2 * x.z;
+    L->hess.yzz -= ch3 * x.y * x.z * x.z + ch2 * x.y;
+    L->hess.zzz -= ch3 * x.z * x.z * x.z + 3.0 * ch2 * x.z;
+}
+
+/* Acceleration given by the expansion L at the offset y from its center */
+static inline mwvector nbFMMEvalLocal(const NBodyLocalExpansion* L, mwvector y)
+{
+    mwvector a;
+    const NBodyFMMTensor2* J = &L->grad;
+    const NBodyFMMTensor3* H = &L->hess;
+    real yxx = 0.5 * y.x * y.x, yyy = 0.5 * y.y * y.y, yzz = 0.5 * y.z * y.z;
+    real yxy = y.x * y.y, yxz = y.x * y.z, yyz = y.y * y.z;
+
+    a.x = L->acc.x + J->xx * y.x + J->xy * y.y + J->xz * y.z
+        + H->xxx * yxx + H->xyy * yyy + H->xzz * yzz + H->xxy * yxy + H->xxz * yxz + H->xyz * yyz;
+    a.y = L->acc.y + J->xy * y.x + J->yy * y.y + J->yz * y.z
+        + H->xxy * yxx + H->yyy * yyy + H->yzz * yzz + H->xyy * yxy + H->xyz * yxz + H->yyz * yyz;
+    a.z = L->acc.z + J->xz * y.x + J->yz * y.y + J->zz * y.z
+        + H->xxz * yxx + H->yyz * yyy + H->zzz * yzz + H->xyz * yxy + H->xzz * yxz + H->yzz * yyz;
+
+    return a;
+}
+
+/* Add the expansion L moved to the offset y from its center to sub */
+static inline void nbFMMShiftLocal(NBodyLocalExpansion* sub, const NBodyLocalExpansion* L, mwvector y)
+{
+    const NBodyFMMTensor3* H = &L->hess;
+
+    mw_incaddv(sub->acc, nbFMMEvalLocal(L, y));
+
+    sub->grad.xx += L->grad.xx + H->xxx * y.x + H->xxy * y.y + H->xxz * y.z;
+    sub->grad.xy += L->grad.xy + H->xxy * y.x + H->xyy * y.y + H->xyz * y.z;
+    sub->grad.xz += L->grad.xz + H->xxz * y.x + H->xyz * y.y + H->xzz * y.z;
+    sub->grad.yy += L->grad.yy + H->xyy * y.x + H->yyy * y.y + H->yyz * y.z;
+    sub->grad.yz += L->grad.yz + H->xyz * y.x + H->yyz * y.y + H->yzz * y.z;
+    sub->grad.zz += L->grad.zz + H->xzz * y.x + H->yzz * y.y + H->zzz * y.z;
+
+    sub->hess.xxx += H->xxx;
+    sub->hess.xxy += H->xxy;
+    sub->hess.xxz += H->xxz;
+    sub->hess.xyy += H->xyy;
+    sub->hess.xyz += H->xyz;
+    sub->hess.xzz += H->xzz;
+    sub->hess.yyy += H->yyy;
+    sub->hess.yyz += H->yyz;
+    sub->hess.yzz += H->yzz;
+    sub->hess.zzz += H->zzz;
+}
+
+static inline NBodyLocalExpansion* nbFMMLocal(const NBodyFMMWalk* w, const NBodyNode* c)
+{
+    return &w->st->fmmLocals[(const NBodyCell*) c - w->cells];
+}
+
+static inline mwvector* nbFMMAcc(const NBodyFMMWalk* w, const NBodyNode* b)
+{
+    return &w->st->acctab[(const Body*) b - w->st->bodytab];
+}
+
+/* Size of a node for the separation test. Bodies are points. */
+static inline real nbFMMRadius(const NBodyNode* p)
+{
+    return isCell(p) ? mw_sqrt(Rcrit2(p)) : 0.0;
+}
+
+/* Add the force of everything in src on everything in dest */
+static void nbFMMInteract(const NBodyFMMWalk* w, const NBodyNode* dest, const NBodyNode* src)
+{
+    const NBodyNode* p;
+    const NBodyNode* q;
+    mwvector x;
+    mwbool separated;
+
+    if (dest == src)
+    {
+        if (isCell(dest))
+        {
+            for (p = More(dest); p != Next(dest); p = Next(p))
+            {
+                for (q = More(dest); q != Next(dest); q = Next(q))
+                {
+                    nbFMMInteract(w, p, q);
+                }
+            }
+        }
+
+        return;
+    }
+
+    x = mw_subv(Pos(dest), Pos(src));
+    separated = nbFMMRadius(dest) + nbFMMRadius(src) < mw_absv(x);
+
+    if (isBody(dest) && (isBody(src) || separated))
+    {
+        mw_incaddv(*nbFMMAcc(w, dest), nbFMMField(w->ctx, src, x));
+        return;
+    }
+    else if (separated)
+    {
+        nbFMMAddToLocal(w->ctx, nbFMMLocal(w, dest), src, x);
+        return;
+    }
+
+    /* Too close. Open the bigger of the two. */
+    if (isCell(dest) && (isBody(src) || Rcrit2(dest) >= Rcrit2(src)))
+    {
+        for (p = More(dest); p != Next(dest); p = Next(p))
+        {
+            nbFMMInteract(w, p, src);
+        }
+    }
+    else
+    {
+        for (q = More(src); q != Next(src); q = Next(q))
+        {
+            nbFMMInteract(w, dest, q);
+        }
+    }
+}
+
+/* Move the expansion of c down to its subcells and bodies */
+static void nbFMMPushDown(const NBodyFMMWalk* w, const NBodyNode* c)
+{
+    const NBodyNode* q;
+    const NBodyLocalExpansion* L = nbFMMLocal(w, c);
+
+    for (q = More(c); q != Next(c); q = Next(q))
+    {
+        if (isCell(q))
+        {
+            nbFMMShiftLocal(nbFMMLocal(w, q), L, mw_subv(Pos(q), Pos(c)));
+            nbFMMPushDown(w, q);
+        }
+        else
+        {
+            mw_incaddv(*nbFMMAcc(w, q), nbFMMEvalLocal(L, mw_subv(Pos(q), Pos(c))));
+        }
+    }
+}
+
+/* Number of bodies under p, counting no further than max */
+static unsigned int nbFMMCountBodies(const NBodyNode* p, unsigned int max)
+{
+    const NBodyNode* q;
+    unsigned int n = 0;
+
+    if (isBody(p))
+        return 1;
+
+    for (q = More(p); q != Next(p) && n <= max; q = Next(q))
+    {
+        n += nbFMMCountBodies(q, max - n);
+    }
+
+    return n;
+}
+
+static void nbFMMFindTasks(NBodyFMMTaskList* tl, const NBodyNode* p)
+{
+    const NBodyNode* q;
+
+    if (isBody(p) || nbFMMCountBodies(p, NBODY_FMM_TASK_SIZE) <= NBODY_FMM_TASK_SIZE)
+    {
+        if (tl->n == tl->alloc)
+        {
+            tl->alloc = tl->alloc ? 2 * tl->alloc : 64;
+            tl->nodes = (const NBodyNode**) mwRealloc((void*) tl->nodes, tl->alloc * sizeof(NBodyNode*));
+        }
+
+        tl->nodes[tl->n++] = p;
+        return;
+    }
+
+    for (q = More(p); q != Next(p); q = Next(q))
+    {
+        nbFMMFindTasks(tl, q);
+    }
+}
+
+void nbGravityFMM(const NBodyCtx* ctx, NBodyState* st)
+{
+    int i;
+    NBodyFMMWalk w;
+    NBodyFMMTaskList tl = { NULL, 0, 0 };
+    const NBodyNode* root = (const NBodyNode*) st->tree.root;
+
+    if (st->fmmLocalAlloc < st->treeCells.used)
+    {
+        free(st->fmmLocals);
+        st->fmmLocalAlloc = st->treeCells.size;
+        st->fmmLocals = (NBodyLocalExpansion*) mwMalloc(st->fmmLocalAlloc * sizeof(NBodyLocalExpansion));
+    }
+
+    memset(st->acctab, 0, st->nbody * sizeof(mwvector));
+    memset(st->fmmLocals, 0, st->treeCells.used * sizeof(NBodyLocalExpansion));
+
+    if (!root)
+        return;
+
+    w.ctx = ctx;
+    w.st = st;
+    w.cells = st->treeCells.cells;
+
+    nbFMMFindTasks(&tl, root);
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) schedule(dynamic)
+  #endif
+    for (i = 0; i < (int) tl.n; ++i)
+    {
+        nbFMMInteract(&w, tl.nodes[i], root);
+        if (isCell(tl.nodes[i]))
+        {
+            nbFMMPushDown(&w, tl.nodes[i]);
+        }
+    }
+
+    free((void*) tl.nodes);
+}
+
@@ -943,6 +943,7 @@ static int nbPopCircularQueue(scene_t* scene,
     NBodyCircularQueue* queue = &scene->queue;
     int head = OPA_load_int(&queue->head);
     int tail = OPA_load_int(&queue->tail);
+    int traceLength;
 
     if (head == tail)
     {
@@ -962,7 +963,10 @@ static int nbPopCircularQueue(scene_t* scene,
                                         info->rootCenterOfMass[1],
                                         info->rootCenterOfMass[2]);
 
-    trace->updatePoints(nbSceneGetOrbitTrace(scene), sceneData->currentStep);
+    /* Points of the trace below the published length are complete */
+    traceLength = OPA_load_int(&scene->orbitTraceLength);
+    OPA_read_barrier();
+    trace->updatePoints(nbSceneGetOrbitTrace(scene), (GLuint) traceLength);
 
     head = (head + 1) % NBODY_CIRC_QUEUE_SIZE;
     OPA_store_int(&queue->head, head);
@@ -86,7 +86,7 @@ void OrbitTrace::prepareVAO()
 
 void OrbitTrace::updatePoints(const FloatPos* cmList, GLuint step)
 {
-    if (step >= this->maxPoints)
+    if (step >= this->maxPoints || step <= this->nPoints)
         return;
 
     glBindBuffer(GL_ARRAY_BUFFER, this->cmPosBuffer);
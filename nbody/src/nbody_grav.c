@@ -23,6 +23,9 @@
 #include "nbody_util.h"
 #include "nbody_grav.h"
 #include "milkyway_util.h"
+#include "nbody_defaults.h"
+#include "nbody_potential_table.h"
+#include "nbody_fmm.h"
 
 #ifdef _OPENMP
   #include <omp.h>
@@ -123,50 +126,477 @@ static inline mwvector nbGravity(const NBodyCtx* ctx, NBodyState* st, const Body
     return acc0;
 }
 
+/* Add the acceleration from the external potential at pos to a. The
+ * check of the potential type for each body is nothing next to the
+ * tree walk for it. */
+static inline void nbAddExternalAcceleration(const NBodyCtx* ctx, NBodyState* st, mwvector pos, mwvector* a)
+{
+    mwvector externAcc;
+
+    switch (ctx->potentialType)
+    {
+        case EXTERNAL_POTENTIAL_DEFAULT:
+            if (!nbPotentialTableAccel(st->potTable, &ctx->pot, pos, &externAcc))
+                externAcc = nbExtAcceleration(&ctx->pot, pos);
+            mw_incaddv(*a, externAcc);
+            break;
+
+        case EXTERNAL_POTENTIAL_NONE:
+            break;
+
+        case EXTERNAL_POTENTIAL_CUSTOM_LUA:
+            if (!nbPotentialTableAccel(st->potTable, &ctx->pot, pos, &externAcc))
+                nbEvalPotentialClosure(st, pos, &externAcc);
+            mw_incaddv(*a, externAcc);
+            break;
+
+        default:
+            mw_fail("Bad external potential type: %d\n", ctx->potentialType);
+    }
+}
+
 static inline void nbMapForceBody(const NBodyCtx* ctx, NBodyState* st)
 {
     int i;
     const int nbody = st->nbody;  /* Prevent reload on each loop */
-    mwvector a, externAcc;
-    const Body* b;
+    mwvector a;
 
     const Body* bodies = mw_assume_aligned(st->bodytab, 16);
     mwvector* accels = mw_assume_aligned(st->acctab, 16);
 
   #ifdef _OPENMP
-    #pragma omp parallel for private(i, b, a, externAcc) shared(bodies, accels) schedule(dynamic, 4096 / sizeof(accels[0]))
+    #pragma omp parallel for private(i, a) shared(bodies, accels) schedule(dynamic, 4096 / sizeof(accels[0]))
   #endif
     for (i = 0; i < nbody; ++i)      /* get force on each body */
     {
-        /* Repeat the base hackGrav part in each case or else GCC's
-         * -funswitch-loops doesn't happen. Without that this constant
-         * gets checked on every body on every step which is dumb.  */
-        switch (ctx->potentialType)
+        a = nbGravity(ctx, st, &bodies[i]);
+        nbAddExternalAcceleration(ctx, st, Pos(&bodies[i]), &a);
+        accels[i] = a;
+    }
+}
+
+/*
+ * Grouped tree walk: Spatially close bodies share one walk of the
+ * tree, as in Barnes (1990). The bodies of a small cell (or a run of
+ * sibling bodies) form a group, and a cell is only accepted for the
+ * whole group if it would be accepted for every body in it, using the
+ * distance from the group's bounding sphere. The resulting interaction
+ * list is then evaluated for all bodies of the group at once, with the
+ * group held as arrays so the inner loops vectorize across bodies.
+ *
+ * The list is built in the same order as the walk in nbGravity(), so
+ * the only difference from it is that some cells are opened which a
+ * single body would have accepted.
+ */
+
+typedef struct
+{
+    const NBodyNode* first;  /* First node of the group in the threaded tree */
+    const NBodyNode* end;    /* Node after the last body of the group */
+} NBodyGroup;
+
+typedef struct
+{
+    NBodyGroup* groups;
+    unsigned int nGroups;
+    unsigned int nAlloc;
+} NBodyGroupList;
+
+typedef struct
+{
+    const NBodyNode** nodes;
+    unsigned int n;
+    unsigned int nAlloc;
+} NBodyInteractionList;
+
+static void nbAddGroup(NBodyGroupList* gl, const NBodyNode* first, const NBodyNode* end)
+{
+    if (gl->nGroups == gl->nAlloc)
+    {
+        gl->nAlloc = 2 * gl->nAlloc + 64;
+        gl->groups = (NBodyGroup*) mwRealloc(gl->groups, gl->nAlloc * sizeof(NBodyGroup));
+    }
+
+    gl->groups[gl->nGroups].first = first;
+    gl->groups[gl->nGroups].end = end;
+    gl->nGroups++;
+}
+
+static inline void nbAddInteraction(NBodyInteractionList* il, const NBodyNode* q)
+{
+    if (il->n == il->nAlloc)
+    {
+        il->nAlloc = 2 * il->nAlloc + 256;
+        il->nodes = (const NBodyNode**) mwRealloc((void*) il->nodes, il->nAlloc * sizeof(NBodyNode*));
+    }
+
+    il->nodes[il->n++] = q;
+}
+
+/* Count the bodies below cell c, giving up once there are more than maxCount */
+static unsigned int nbCountBodies(const NBodyNode* c, unsigned int maxCount)
+{
+    unsigned int n = 0;
+    const NBodyNode* q = More(c);
+    const NBodyNode* end = Next(c);
+
+    while (q != end && n <= maxCount)
+    {
+        if (isBody(q))
+        {
+            ++n;
+            q = Next(q);
+        }
+        else
+        {
+            q = More(q);
+        }
+    }
+
+    return n;
+}
+
+/* Split the tree below cell c into groups of at most groupSize bodies */
+static void nbFindGroups(NBodyGroupList* gl, const NBodyNode* c, unsigned int groupSize)
+{
+    const NBodyNode* q;
+    const NBodyNode* runStart = NULL;
+    unsigned int runLength = 0;
+    unsigned int count = nbCountBodies(c, groupSize);
+
+    if (count <= groupSize)
+    {
+        if (count > 0)
+        {
+            nbAddGroup(gl, More(c), Next(c));
+        }
+        return;
+    }
+
+    /* Sibling bodies next to each other in the thread are grouped
+     * together, other children are split up further */
+    for (q = More(c); q != Next(c); q = Next(q))
+    {
+        if (isBody(q) && runLength < groupSize)
+        {
+            if (runLength++ == 0)
+            {
+                runStart = q;
+            }
+            continue;
+        }
+
+        if (runLength > 0)
+        {
+            nbAddGroup(gl, runStart, q);
+            runLength = 0;
+        }
+
+        if (isCell(q))
+        {
+            nbFindGroups(gl, q, groupSize);
+        }
+        else
+        {
+            runStart = q;
+            runLength = 1;
+        }
+    }
+
+    if (runLength > 0)
+    {
+        nbAddGroup(gl, runStart, Next(c));
+    }
+}
+
+/* Walk the tree once for the group with the given bounding sphere */
+static void nbGroupInteractionList(const NBodyState* st,
+                                   NBodyInteractionList* il,
+                                   mwvector center,
+                                   real radius)
+{
+    const NBodyNode* q = (const NBodyNode*) st->tree.root;
+
+    il->n = 0;
+    while (q != NULL)
+    {
+        if (isBody(q))
+        {
+            nbAddInteraction(il, q);
+            q = Next(q);
+        }
+        else
+        {
+            /* Closest any body of the group can be to the cell */
+            real d = mw_distv(Pos(q), center) - radius;
+
+            if (d > 0.0 && sqr(d) >= Rcrit2(q))
+            {
+                nbAddInteraction(il, q);
+                q = Next(q);
+            }
+            else
+            {
+                q = More(q);
+            }
+        }
+    }
+}
+
+static inline void nbMonopoleGroup(const NBodyNode* q,
+                                   real eps2,
+                                   unsigned int from,
+                                   unsigned int to,
+                                   const real* RESTRICT x,
+                                   const real* RESTRICT y,
+                                   const real* RESTRICT z,
+                                   real* RESTRICT ax,
+                                   real* RESTRICT ay,
+                                   real* RESTRICT az)
+{
+    unsigned int j;
+    const real qx = X(Pos(q));
+    const real qy = Y(Pos(q));
+    const real qz = Z(Pos(q));
+    const real m = Mass(q);
+
+    for (j = from; j < to; ++j)
+    {
+        real dx = qx - x[j];
+        real dy = qy - y[j];
+        real dz = qz - z[j];
+        real drSq = dx * dx + dy * dy + dz * dz + eps2;
+        real drab = mw_sqrt(drSq);
+        real phii = m / drab;
+        real mor3 = phii / drSq;
+
+        ax[j] += mor3 * dx;
+        ay[j] += mor3 * dy;
+        az[j] += mor3 * dz;
+    }
+}
+
+static inline void nbQuadrupoleGroup(const NBodyNode* q,
+                                     real eps2,
+                                     unsigned int n,
+                                     const real* RESTRICT x,
+                                     const real* RESTRICT y,
+                                     const real* RESTRICT z,
+                                     real* RESTRICT ax,
+                                     real* RESTRICT ay,
+                                     real* RESTRICT az)
+{
+    unsigned int j;
+    const real qx = X(Pos(q));
+    const real qy = Y(Pos(q));
+    const real qz = Z(Pos(q));
+    const real m = Mass(q);
+    const NBodyQuadMatrix quad = Quad(q);
+
+    for (j = 0; j < n; ++j)
+    {
+        real dx = qx - x[j];
+        real dy = qy - y[j];
+        real dz = qz - z[j];
+        real drSq = dx * dx + dy * dy + dz * dz + eps2;
+        real drab = mw_sqrt(drSq);
+        real phii = m / drab;
+        real mor3 = phii / drSq;
+        real Qdrx, Qdry, Qdrz, drQdr, dr5inv, phiQ;
+
+        ax[j] += mor3 * dx;
+        ay[j] += mor3 * dy;
+        az[j] += mor3 * dz;
+
+        Qdrx = quad.xx * dx + quad.xy * dy + quad.xz * dz;
+        Qdry = quad.xy * dx + quad.yy * dy + quad.yz * dz;
+        Qdrz = quad.xz * dx + quad.yz * dy + quad.zz * dz;
+
+        drQdr = Qdrx * dx + Qdry * dy + Qdrz * dz;
+        dr5inv = 1.0 / (sqr(drSq) * drab);
+        phiQ = 2.5 * (dr5inv * drQdr) / drSq;
+
+        ax[j] += phiQ * dx;
+        ay[j] += phiQ * dy;
+        az[j] += phiQ * dz;
+
+        ax[j] -= dr5inv * Qdrx;
+        ay[j] -= dr5inv * Qdry;
+        az[j] -= dr5inv * Qdrz;
+    }
+}
+
+static void nbGravityGroup(const NBodyCtx* ctx,
+                           NBodyState* st,
+                           const NBodyGroup* g,
+                           NBodyInteractionList* il)
+{
+    const Body* bodies[NBODY_MAX_GROUP_SIZE];
+    real x[NBODY_MAX_GROUP_SIZE], y[NBODY_MAX_GROUP_SIZE], z[NBODY_MAX_GROUP_SIZE];
+    real ax[NBODY_MAX_GROUP_SIZE], ay[NBODY_MAX_GROUP_SIZE], az[NBODY_MAX_GROUP_SIZE];
+
+    const NBodyNode* q;
+    mwvector center, lo, hi, a;
+    real radius = 0.0;
+    unsigned int i, j, n = 0;
+    unsigned int self = 0;
+
+    for (q = g->first; q != g->end; )
+    {
+        if (isBody(q))
+        {
+            bodies[n] = (const Body*) q;
+            x[n] = X(Pos(q));
+            y[n] = Y(Pos(q));
+            z[n] = Z(Pos(q));
+            ax[n] = ay[n] = az[n] = 0.0;
+            ++n;
+            q = Next(q);
+        }
+        else
+        {
+            q = More(q);
+        }
+    }
+
+    if (n == 0)
+    {
+        /* nbFindGroups() never makes an empty group */
+        return;
+    }
+
+    lo = hi = Pos(bodies[0]);
+    for (j = 1; j < n; ++j)
+    {
+        X(lo) = mw_fmin(X(lo), x[j]);
+        Y(lo) = mw_fmin(Y(lo), y[j]);
+        Z(lo) = mw_fmin(Z(lo), z[j]);
+        X(hi) = mw_fmax(X(hi), x[j]);
+        Y(hi) = mw_fmax(Y(hi), y[j]);
+        Z(hi) = mw_fmax(Z(hi), z[j]);
+    }
+
+    center = mw_mulvs(mw_addv(lo, hi), 0.5);
+    for (j = 0; j < n; ++j)
+    {
+        radius = mw_fmax(radius, mw_distv(Pos(bodies[j]), center));
+    }
+
+    nbGroupInteractionList(st, il, center, radius);
+
+    for (i = 0; i < il->n; ++i)
+    {
+        q = il->nodes[i];
+
+        if (isCell(q))
+        {
+            if (ctx->useQuad)
+            {
+                nbQuadrupoleGroup(q, ctx->eps2, n, x, y, z, ax, ay, az);
+            }
+            else
+            {
+                nbMonopoleGroup(q, ctx->eps2, 0, n, x, y, z, ax, ay, az);
+            }
+        }
+        else if (self < n && (const Body*) q == bodies[self])
         {
-            case EXTERNAL_POTENTIAL_DEFAULT:
-                /* Include the external potential */
-                b = &bodies[i];
+            /* The group's own bodies come up in the same order as
+             * they were gathered. Skip the self-interaction */
+            nbMonopoleGroup(q, ctx->eps2, 0, self, x, y, z, ax, ay, az);
+            nbMonopoleGroup(q, ctx->eps2, self + 1, n, x, y, z, ax, ay, az);
+            ++self;
+        }
+        else
+        {
+            nbMonopoleGroup(q, ctx->eps2, 0, n, x, y, z, ax, ay, az);
+        }
+    }
+
+    if (self != n)
+    {
+        /* Some body of the group was not found in its own walk */
+        nbReportTreeIncest(ctx, st);
+    }
+
+    for (j = 0; j < n; ++j)
+    {
+        SET_VECTOR(a, ax[j], ay[j], az[j]);
+        nbAddExternalAcceleration(ctx, st, Pos(bodies[j]), &a);
+        st->acctab[bodies[j] - st->bodytab] = a;
+    }
+}
+
+static void nbMapForceGroups(const NBodyCtx* ctx, NBodyState* st)
+{
+    int i;
+    const int nbody = st->nbody;
+    NBodyGroupList gl = { NULL, 0, 0 };
+    const unsigned int groupSize = (ctx->groupSize < NBODY_MAX_GROUP_SIZE) ? ctx->groupSize : NBODY_MAX_GROUP_SIZE;
+
+    nbFindGroups(&gl, (const NBodyNode*) st->tree.root, groupSize);
+
+  #ifdef _OPENMP
+    #pragma omp parallel private(i)
+  #endif
+    {
+        NBodyInteractionList il = { NULL, 0, 0 };
+
+      #ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+      #endif
+        for (i = 0; i < (int) gl.nGroups; ++i)
+        {
+            nbGravityGroup(ctx, st, &gl.groups[i], &il);
+        }
+
+        /* Test particles are not in the tree so walk it for each of them */
+      #ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 4096 / sizeof(mwvector))
+      #endif
+        for (i = 0; i < nbody; ++i)
+        {
+            const Body* b = &st->bodytab[i];
+            mwvector a;
+
+            if (isTestParticle(b))
+            {
                 a = nbGravity(ctx, st, b);
+                nbAddExternalAcceleration(ctx, st, Pos(b), &a);
+                st->acctab[i] = a;
+            }
+        }
 
-                externAcc = nbExtAcceleration(&ctx->pot, Pos(b));
-                mw_incaddv(a, externAcc);
-                accels[i] = a;
-                break;
+        free((void*) il.nodes);
+    }
 
-            case EXTERNAL_POTENTIAL_NONE:
-                accels[i] = nbGravity(ctx, st, &bodies[i]);
-                break;
+    free(gl.groups);
+}
 
-            case EXTERNAL_POTENTIAL_CUSTOM_LUA:
-                a = nbGravity(ctx, st, &bodies[i]);
-                nbEvalPotentialClosure(st, Pos(&bodies[i]), &externAcc);
-                mw_incaddv(a, externAcc)
-                accels[i] = a;
-                break;
+/* Self gravity from the dual tree walk, then the test particles, which
+ * are not in the tree, and the external potential for everything */
+static void nbMapForceFMM(const NBodyCtx* ctx, NBodyState* st)
+{
+    int i;
+    const int nbody = st->nbody;
+
+    nbGravityFMM(ctx, st);
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) schedule(dynamic, 4096 / sizeof(mwvector))
+  #endif
+    for (i = 0; i < nbody; ++i)
+    {
+        const Body* b = &st->bodytab[i];
+        mwvector a = st->acctab[i];
 
-            default:
-                mw_fail("Bad external potential type: %d\n", ctx->potentialType);
+        if (isTestParticle(b))
+        {
+            a = nbGravity(ctx, st, b);
         }
+
+        nbAddExternalAcceleration(ctx, st, Pos(b), &a);
+        st->acctab[i] = a;
     }
 }
 
@@ -198,40 +628,19 @@ static inline void nbMapForceBody_Exact(const NBodyCtx* ctx, NBodyState* st)
 {
     int i;
     const int nbody = st->nbody;  /* Prevent reload on each loop */
-    mwvector a, externAcc;
-    const Body* b;
+    mwvector a;
 
     Body* bodies = mw_assume_aligned(st->bodytab, 16);
     mwvector* accels = mw_assume_aligned(st->acctab, 16);
 
   #ifdef _OPENMP
-    #pragma omp parallel for private(i, b, a, externAcc) shared(bodies, accels) schedule(dynamic, 4096 / sizeof(accels[0]))
+    #pragma omp parallel for private(i, a) shared(bodies, accels) schedule(dynamic, 4096 / sizeof(accels[0]))
   #endif
     for (i = 0; i < nbody; ++i)      /* get force on each body */
     {
-        switch (ctx->potentialType)
-        {
-            case EXTERNAL_POTENTIAL_DEFAULT:
-                b = &bodies[i];
-                a = nbGravity_Exact(ctx, st, b);
-                mw_incaddv(a, nbExtAcceleration(&ctx->pot, Pos(b)));
-                accels[i] = a;
-                break;
-
-            case EXTERNAL_POTENTIAL_NONE:
-                accels[i] = nbGravity_Exact(ctx, st, &bodies[i]);
-                break;
-
-            case EXTERNAL_POTENTIAL_CUSTOM_LUA:
-                a = nbGravity_Exact(ctx, st, &bodies[i]);
-                nbEvalPotentialClosure(st, Pos(&bodies[i]), &externAcc);
-                mw_incaddv(a, externAcc);
-                accels[i] = a;
-                break;
-
-            default:
-                mw_fail("Bad external potential type: %d\n", ctx->potentialType);
-        }
+        a = nbGravity_Exact(ctx, st, &bodies[i]);
+        nbAddExternalAcceleration(ctx, st, Pos(&bodies[i]), &a);
+        accels[i] = a;
     }
 }
 
@@ -249,13 +658,37 @@ NBodyStatus nbGravMap(const NBodyCtx* ctx, NBodyState* st)
 {
     NBodyStatus rc;
 
+    if (ctx->potentialGrid > 0 && !st->potTable)
+    {
+        st->potTable = nbMakePotentialTable(ctx, st); /* Built once per run */
+    }
+
     if (mw_likely(ctx->criterion != Exact))
     {
-        rc = nbMakeTree(ctx, st);
+        if (ctx->treeRebuildInterval > 1)
+        {
+            rc = nbRefitOrMakeTree(ctx, st, nbKeepTree(ctx, st));
+        }
+        else
+        {
+            rc = nbMakeTree(ctx, st);
+        }
+
         if (nbStatusIsFatal(rc))
             return rc;
 
-        nbMapForceBody(ctx, st);
+        if (ctx->criterion == FMM)
+        {
+            nbMapForceFMM(ctx, st);
+        }
+        else if (ctx->groupSize > 1)
+        {
+            nbMapForceGroups(ctx, st);
+        }
+        else
+        {
+            nbMapForceBody(ctx, st);
+        }
     }
     else
     {
@@ -270,3 +703,46 @@ NBodyStatus nbGravMap(const NBodyCtx* ctx, NBodyState* st)
     return nbIncestStatusCheck(ctx, st); /* Check if incest occured during step */
 }
 
+/* Compute the force on only the nActive bodies listed in active, with
+ * the tree as it is. Each body walks the tree on its own. selfAcc[i]
+ * gets the part of the acceleration of active[i] from the other bodies,
+ * without the external potential. */
+NBodyStatus nbGravMapBodies(const NBodyCtx* ctx, NBodyState* st, const int* active, int nActive, mwvector* selfAcc)
+{
+    int i;
+
+    if (ctx->potentialGrid > 0 && !st->potTable)
+    {
+        st->potTable = nbMakePotentialTable(ctx, st);
+    }
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) schedule(dynamic, 4096 / sizeof(mwvector))
+  #endif
+    for (i = 0; i < nActive; ++i)
+    {
+        const Body* b = &st->bodytab[active[i]];
+        mwvector a;
+
+        if (mw_likely(ctx->criterion != Exact))
+        {
+            a = nbGravity(ctx, st, b);
+        }
+        else
+        {
+            a = nbGravity_Exact(ctx, st, b);
+        }
+
+        selfAcc[i] = a;
+        nbAddExternalAcceleration(ctx, st, Pos(b), &a);
+        st->acctab[active[i]] = a;
+    }
+
+    if (st->potentialEvalError)
+    {
+        return NBODY_LUA_POTENTIAL_ERROR;
+    }
+
+    return nbIncestStatusCheck(ctx, st);
+}
+
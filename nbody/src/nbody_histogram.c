@@ -391,7 +391,6 @@ NBodyHistogram* nbCreateHistogram(const NBodyCtx* ctx,        /* Simulation cont
     NBodyHistogram* histogram;
     HistData* histData;
     NBHistTrig histTrig;
-    const Body* endp = st->bodytab + st->nbody;
     real lambdaSize = nbHistogramLambdaBinSize(hp);
     real betaSize = nbHistogramBetaBinSize(hp);
     /* Calculate the bounds of the bin range, making sure to use a
@@ -459,8 +458,12 @@ NBodyHistogram* nbCreateHistogram(const NBodyCtx* ctx,        /* Simulation cont
     }
 
 
-    for (p = st->bodytab; p < endp; ++p)
+    for (int i = 0; i < st->nbody; ++i)
     {
+        /* Use the original order of the bodies if they have been sorted,
+         * so the sums don't depend on it */
+        p = &st->bodytab[st->bodyOrder ? st->bodyOrder[i] : i];
+
         /* Only include bodies in models we aren't ignoring (like dark matter) */
         if (!ignoreBody(p))
         {
@@ -27,19 +27,24 @@
 #include "nbody_coordinates.h"
 #include "nbody_mass.h"
 
-static void nbPrintSimInfoHeader(FILE* f, const NBodyFlags* nbf, const NBodyCtx* ctx, const NBodyState* st)
+static void nbGetCenters(const NBodyState* st, mwvector* cmPos, mwvector* cmVel)
 {
-    mwvector cmPos;
-    mwvector cmVel;
-    cmVel = nbCenterOfMom(st);
+    *cmVel = nbCenterOfMom(st);
     if (st->tree.root)
     {
-        cmPos = Pos(st->tree.root);
+        *cmPos = Pos(st->tree.root);
     }
     else
     {
-        cmPos = nbCenterOfMass(st);
+        *cmPos = nbCenterOfMass(st);
     }
+}
+
+static void nbPrintSimInfoHeader(FILE* f, const NBodyFlags* nbf, const NBodyCtx* ctx, const NBodyState* st)
+{
+    mwvector cmPos;
+    mwvector cmVel;
+    nbGetCenters(st, &cmPos, &cmVel);
 
     fprintf(f,
             "cartesian    = %d\n"
@@ -138,35 +143,313 @@ int nbOutputBodies(FILE* f, const NBodyCtx* ctx, const NBodyState* st, const NBo
     return FALSE;
 }
 
-int nbWriteBodies(const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf)
+/* Binary body output: Versioned structure of arrays snapshot. Every
+   block is nbody entries long and stored in the byte order of the
+   writer, which is recorded in the header.
+   Name        Type             Notes
+-------------------------------------------------------
+   NBodyBinaryOutputHeader
+   x, y, z     real[]           Cartesian positions, one block each
+   vx, vy, vz  real[]           Cartesian velocities, one block each
+   mass        real[]
+   type        int32_t[]        Negative if the body is ignored
+   id          uint32_t[]
+ */
+
+static int nbWriteBlock(FILE* f, const void* block, size_t size, unsigned int n)
+{
+    if (fwrite(block, size, n, f) != n)
+    {
+        mwPerror("Error writing binary body output block");
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static int nbReadBlock(FILE* f, void* block, size_t size, unsigned int n)
+{
+    if (fread(block, size, n, f) != n)
+    {
+        mw_printf("Binary body output ended early\n");
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void nbPrepareBinaryOutputHeader(NBodyBinaryOutputHeader* hdr, const NBodyCtx* ctx, const NBodyState* st)
+{
+    mwvector cmPos;
+    mwvector cmVel;
+
+    nbGetCenters(st, &cmPos, &cmVel);
+
+    memset(hdr, 0, sizeof(*hdr));
+    strncpy(hdr->magic, NBODY_BINARY_OUTPUT_MAGIC, sizeof(hdr->magic));
+    hdr->version = NBODY_BINARY_OUTPUT_VERSION;
+    hdr->byteOrder = NBODY_BINARY_OUTPUT_BYTE_ORDER;
+    hdr->realSize = sizeof(real);
+    hdr->nbody = st->nbody;
+    hdr->step = st->step;
+    hdr->hasMilkyway = (ctx->potentialType == EXTERNAL_POTENTIAL_DEFAULT);
+    hdr->sunGCDist = ctx->sunGCDist;
+    hdr->timestep = ctx->timestep;
+    hdr->timeEvolve = ctx->timeEvolve;
+
+    hdr->centerOfMass[0] = X(cmPos);
+    hdr->centerOfMass[1] = Y(cmPos);
+    hdr->centerOfMass[2] = Z(cmPos);
+    hdr->centerOfMomentum[0] = X(cmVel);
+    hdr->centerOfMomentum[1] = Y(cmVel);
+    hdr->centerOfMomentum[2] = Z(cmVel);
+}
+
+/* Size of a file with n bodies */
+static size_t nbBinaryOutputSize(uint32_t n)
+{
+    return sizeof(NBodyBinaryOutputHeader) + (size_t) n * (7 * sizeof(real) + sizeof(int32_t) + sizeof(uint32_t));
+}
+
+static int nbVerifyBinaryOutputHeader(const NBodyBinaryOutputHeader* hdr, size_t fileSize)
+{
+    if (strncmp(hdr->magic, NBODY_BINARY_OUTPUT_MAGIC, sizeof(hdr->magic)))
+    {
+        mw_printf("Didn't find header for binary body output\n");
+        return 1;
+    }
+
+    if (hdr->byteOrder != NBODY_BINARY_OUTPUT_BYTE_ORDER)
+    {
+        mw_printf("Got binary body output with a different byte order\n");
+        return 1;
+    }
+
+    if (hdr->version != NBODY_BINARY_OUTPUT_VERSION)
+    {
+        mw_printf("Unsupported binary body output version %u, expected %u\n",
+                  hdr->version, NBODY_BINARY_OUTPUT_VERSION);
+        return 1;
+    }
+
+    if (hdr->realSize != sizeof(real))
+    {
+        mw_printf("Got binary body output for wrong type. "
+                  "Expected sizeof(real) = "ZU", got "ZU"\n",
+                  sizeof(real), (size_t) hdr->realSize);
+        return 1;
+    }
+
+    if (fileSize != nbBinaryOutputSize(hdr->nbody))
+    {
+        mw_printf("Binary body output is the wrong size for %u bodies\n", hdr->nbody);
+        return 1;
+    }
+
+    return 0;
+}
+
+int nbOutputBodiesBinary(FILE* f, const NBodyCtx* ctx, const NBodyState* st)
+{
+    NBodyBinaryOutputHeader hdr;
+    const unsigned int n = (unsigned int) st->nbody;
+    const Body* b = st->bodytab;
+    real* block;
+    int32_t* types;
+    uint32_t* ids;
+    unsigned int i;
+    int rc = FALSE;
+
+    nbPrepareBinaryOutputHeader(&hdr, ctx, st);
+    if (nbWriteBlock(f, &hdr, sizeof(hdr), 1))
+    {
+        return TRUE;
+    }
+
+    block = (real*) mwMallocA((n + 1) * sizeof(real));
+
+  #define WRITE_REAL_BLOCK(expr)                          \
+    if (!rc)                                              \
+    {                                                     \
+        for (i = 0; i < n; ++i)                           \
+        {                                                 \
+            block[i] = (expr);                            \
+        }                                                 \
+        rc = nbWriteBlock(f, block, sizeof(real), n);     \
+    }
+
+    WRITE_REAL_BLOCK(X(Pos(&b[i])))
+    WRITE_REAL_BLOCK(Y(Pos(&b[i])))
+    WRITE_REAL_BLOCK(Z(Pos(&b[i])))
+    WRITE_REAL_BLOCK(X(Vel(&b[i])))
+    WRITE_REAL_BLOCK(Y(Vel(&b[i])))
+    WRITE_REAL_BLOCK(Z(Vel(&b[i])))
+    WRITE_REAL_BLOCK(Mass(&b[i]))
+
+  #undef WRITE_REAL_BLOCK
+
+    /* The integer blocks are no larger than the real block */
+    types = (int32_t*) block;
+    for (i = 0; i < n && !rc; ++i)
+    {
+        types[i] = (int32_t) Type(&b[i]);
+    }
+    rc = rc || nbWriteBlock(f, types, sizeof(int32_t), n);
+
+    ids = (uint32_t*) block;
+    for (i = 0; i < n && !rc; ++i)
+    {
+        ids[i] = (uint32_t) idBody(&b[i]);
+    }
+    rc = rc || nbWriteBlock(f, ids, sizeof(uint32_t), n);
+
+    mwFreeA(block);
+
+    if (!rc && fflush(f))
+    {
+        mwPerror("Binary body output flush");
+        return TRUE;
+    }
+
+    return rc;
+}
+
+int nbWriteBodiesBinary(const char* filename, const NBodyCtx* ctx, const NBodyState* st)
 {
     FILE* f;
-    int rc = 0;
+    int rc;
 
-    if (!nbf->outFileName)
+    f = mwOpenResolved(filename, "wb");
+    if (!f)
     {
+        mw_printf("Failed to open output file '%s'\n", filename);
         return 1;
     }
 
-    f = mwOpenResolved(nbf->outFileName, nbf->outputBinary ? "wb" : "w");
+    rc = nbOutputBodiesBinary(f, ctx, st);
+
+    if (fclose(f) < 0)
+    {
+        mwPerror("Error closing output file '%s'", filename);
+        return 1;
+    }
+
+    return rc;
+}
+
+/* Read bodies written by nbOutputBodiesBinary(). Returns NULL on
+ * failure, otherwise an array of hdr->nbody bodies to be freed with
+ * mwFreeA() */
+Body* nbReadBodiesBinary(const char* filename, NBodyBinaryOutputHeader* hdr)
+{
+    FILE* f;
+    Body* bodies = NULL;
+    real* block = NULL;
+    int32_t* types;
+    uint32_t* ids;
+    unsigned int i, n;
+    long fileSize;
+    int rc = FALSE;
+
+    f = mwOpenResolved(filename, "rb");
     if (!f)
     {
-        mw_printf("Failed to open output file '%s'\n", nbf->outFileName);
+        mw_printf("Failed to open binary body output '%s'\n", filename);
+        return NULL;
+    }
+
+    if (fseek(f, 0, SEEK_END) || (fileSize = ftell(f)) < 0 || fseek(f, 0, SEEK_SET))
+    {
+        mwPerror("Failed to get size of binary body output '%s'", filename);
+        fclose(f);
+        return NULL;
+    }
+
+    /* Check the body count against the file before allocating for it */
+    if (nbReadBlock(f, hdr, sizeof(*hdr), 1) || nbVerifyBinaryOutputHeader(hdr, (size_t) fileSize))
+    {
+        mw_printf("Error reading binary body output '%s'\n", filename);
+        fclose(f);
+        return NULL;
+    }
+
+    n = hdr->nbody;
+    bodies = (Body*) mwCallocA(n + 1, sizeof(Body));
+    block = (real*) mwMallocA((n + 1) * sizeof(real));
+
+  #define READ_REAL_BLOCK(lhs)                            \
+    if (!rc)                                              \
+    {                                                     \
+        rc = nbReadBlock(f, block, sizeof(real), n);      \
+        for (i = 0; i < n && !rc; ++i)                    \
+        {                                                 \
+            (lhs) = block[i];                             \
+        }                                                 \
+    }
+
+    READ_REAL_BLOCK(X(Pos(&bodies[i])))
+    READ_REAL_BLOCK(Y(Pos(&bodies[i])))
+    READ_REAL_BLOCK(Z(Pos(&bodies[i])))
+    READ_REAL_BLOCK(X(Vel(&bodies[i])))
+    READ_REAL_BLOCK(Y(Vel(&bodies[i])))
+    READ_REAL_BLOCK(Z(Vel(&bodies[i])))
+    READ_REAL_BLOCK(Mass(&bodies[i]))
+
+  #undef READ_REAL_BLOCK
+
+    types = (int32_t*) block;
+    rc = rc || nbReadBlock(f, types, sizeof(int32_t), n);
+    for (i = 0; i < n && !rc; ++i)
+    {
+        Type(&bodies[i]) = (body_t) types[i];
+    }
+
+    ids = (uint32_t*) block;
+    rc = rc || nbReadBlock(f, ids, sizeof(uint32_t), n);
+    for (i = 0; i < n && !rc; ++i)
+    {
+        idBody(&bodies[i]) = ids[i];
+    }
+
+    mwFreeA(block);
+    fclose(f);
+
+    if (rc)
+    {
+        mw_printf("Error reading binary body output '%s'\n", filename);
+        mwFreeA(bodies);
+        return NULL;
+    }
+
+    return bodies;
+}
+
+int nbWriteBodies(const NBodyCtx* ctx, const NBodyState* st, const NBodyFlags* nbf)
+{
+    FILE* f;
+    int rc = 0;
+
+    if (!nbf->outFileName)
+    {
         return 1;
     }
 
     if (nbf->outputBinary)
     {
-        mw_printf("Binary output unimplemented\n");
-        return 1;
+        return nbWriteBodiesBinary(nbf->outFileName, ctx, st);
     }
-    else
+
+    f = mwOpenResolved(nbf->outFileName, "w");
+    if (!f)
     {
-        mw_boinc_print(f, "<bodies>\n");
-        rc = nbOutputBodies(f, ctx, st, nbf);
-        mw_boinc_print(f, "</bodies>\n");
+        mw_printf("Failed to open output file '%s'\n", nbf->outFileName);
+        return 1;
     }
 
+    mw_boinc_print(f, "<bodies>\n");
+    rc = nbOutputBodies(f, ctx, st, nbf);
+    mw_boinc_print(f, "</bodies>\n");
+
     if (fclose(f) < 0)
     {
         mwPerror("Error closing output file '%s'", nbf->outFileName);
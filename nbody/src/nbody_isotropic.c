@@ -34,6 +34,7 @@ their copyright to their programs which execute similar algorithms.
 #include "milkyway_lua.h"
 #include "nbody_lua_types.h"
 #include "nbody_isotropic.h"
+#include "nbody_eddington.h"
 
 /*Note: minusfivehalves(x) raises to x^-5/2 power and minushalf(x) is x^-1/2*/
 
@@ -466,54 +467,35 @@ real fun(real ri, real * args, dsfmt_t* dsfmtState)
         
 }
 
-static inline real find_upperlimit_r(dsfmt_t* dsfmtState, real * args, real energy, real search_range, real r)
+static inline real find_upperlimit_r(real * args, real energy, real search_range)
 {
-    int counter = 0;
-    real upperlimit_r = 0.0;
-    
-    do
-    {
-        upperlimit_r = root_finder(potential, args, energy, 0.0, search_range, dsfmtState); 
+    /* root_finder returns 0 if it can't find psi(r) = energy in the search range */
+    real upperlimit_r = root_finder(potential, args, energy, 0.0, search_range, NULL);
 
-        if(isinf(upperlimit_r) == FALSE && upperlimit_r != 0.0 && isnan(upperlimit_r) == FALSE){break;}
-        
-        counter++;
-        
-        if(counter > 100)
-        {
-            upperlimit_r = r;
-            break;
-        }
-        
-    }while(1);
-        
     return mw_fabs(upperlimit_r);
 }
  
-static inline real dist_fun(real v, real * args, dsfmt_t* dsfmtState)
+static real dist_fun(real energy, const void* model)
 {
-    /*This returns the value of the distribution function*/
+    /*This returns the value of the distribution function at a given energy*/
     
     //-------------------------------
+    const real * args = (const real *) model;
     real mass_l   = args[0];
     real mass_d   = args[1];
     real rscale_l = args[2];
     real rscale_d = args[3];
-    real r        = args[4];
     //-------------------------------
     
     
     real distribution_function = 0.0;
 //     real c = inv( (mw_sqrt(8.0) * sqr(M_PI)) );
     real c = 0.03582244801567226;
-    real energy = 0.0;
     real upperlimit_r = 0.0;
     real lowerlimit_r = 0.0; 
     int counter = 0;
     real search_range = 0.0;   
-    
-    /*energy as defined in binney*/
-    energy = potential(r, args, dsfmtState) - 0.5 * v * v; 
+    real potargs[4] = {mass_l, mass_d, rscale_l, rscale_d};
     
     /*this starting point is 20 times where the dark matter component is equal to the energy, since the dark matter dominates*/
     search_range = 20.0 * mw_sqrt( mw_fabs( sqr(mass_d / energy) - sqr(rscale_d) ));
@@ -529,7 +511,7 @@ static inline real dist_fun(real v, real * args, dsfmt_t* dsfmtState)
      * By this, we mean that we want to find a root within a range (r1, r2), where 
      * psi(r1) > energy and psi(r2) < energy
      */
-    while(potential(search_range, args, dsfmtState) > energy)
+    while(potential(search_range, potargs, NULL) > energy)
     {
         search_range = 100.0 * search_range;
         if(counter > 100)
@@ -540,8 +522,11 @@ static inline real dist_fun(real v, real * args, dsfmt_t* dsfmtState)
         counter++;
     }
     
-    upperlimit_r = find_upperlimit_r(dsfmtState, args, energy, search_range, r);
-    
+    upperlimit_r = find_upperlimit_r(potargs, energy, search_range);
+    if (!(upperlimit_r > 0.0))
+    {
+        return 0.0;
+    }
     
     real funcargs[5] = {mass_l, mass_d, rscale_l, rscale_d, energy};
     
@@ -551,12 +536,27 @@ static inline real dist_fun(real v, real * args, dsfmt_t* dsfmtState)
     lowerlimit_r = 5.0 * (upperlimit_r);
     
     /*This calls guassian quad to integrate the function for a given energy*/
-    distribution_function = v * v * c * gauss_quad(fun, lowerlimit_r, upperlimit_r, funcargs, dsfmtState);
+    distribution_function = c * gauss_quad(fun, lowerlimit_r, upperlimit_r, funcargs, NULL);
     
     return distribution_function;
 }
 
 
+/* Tabulate f(E) for the model args = {mass_l, mass_d, rscale_l, rscale_d}, which
+ * must outlive the table. Energies of bodies very close to the center, or very close
+ * to escaping, are outside of the table.
+ */
+void nbMakeIsotropicEddingtonTable(EddingtonTable* t, const real* args)
+{
+    real bound = 50.0 * (args[2] + args[3]);
+    real r_table_min = 0.2 * (args[2] < args[3] ? args[2] : args[3]);
+
+    nbMakeEddingtonTable(t, dist_fun, args,
+                         1.0e-3 * potential(bound, (real*) args, NULL),
+                         potential(r_table_min, (real*) args, NULL));
+}
+
+
 /*      SAMPLING FUNCTIONS      */
 static inline real r_mag(dsfmt_t* dsfmtState, real * args, real rho_max, real bound)
 {
@@ -588,7 +588,7 @@ static inline real r_mag(dsfmt_t* dsfmtState, real * args, real rho_max, real bo
     return r;
 }
 
-static inline real vel_mag(dsfmt_t* dsfmtState, real r, real * args)
+static inline real vel_mag(dsfmt_t* dsfmtState, real r, real * args, const EddingtonTable* table)
 {
     
     /*
@@ -597,19 +597,13 @@ static inline real vel_mag(dsfmt_t* dsfmtState, real r, real * args)
      * THIS IS EQUAL TO 0.977813107 KM/S
      */
     
-    //-------------------------------
-    real mass_l   = args[0];
-    real mass_d   = args[1];
-    real rscale_l = args[2];
-    real rscale_d = args[3];
-    //-------------------------------
-    
     int counter = 0;
     real v, u, d;
-    real v_esc = mw_sqrt( mw_fabs(2.0 * potential( r, args, dsfmtState) ) );
+    real psi = potential( r, args, dsfmtState);
+    real v_esc = mw_sqrt( mw_fabs(2.0 * psi) );
     
-    real parameters[5] = {mass_l, mass_d, rscale_l, rscale_d, r};
-    real dist_max = max_finder(dist_fun, parameters, 0.0, 0.5 * v_esc, v_esc, 10, 1.0e-2, dsfmtState);
+    /* the distribution function of the speed is v^2 f(E), with E = psi(r) - v^2 / 2 */
+    real dist_max = nbEddingtonMaxDistFun(table, psi, v_esc);
    
     while(1)
     {
@@ -617,7 +611,7 @@ static inline real vel_mag(dsfmt_t* dsfmtState, real r, real * args)
         v = (real)mwXrandom(dsfmtState, 0.0, 1.0) * v_esc;
         u = (real)mwXrandom(dsfmtState, 0.0, 1.0);
         
-        d = dist_fun(v, parameters, dsfmtState);
+        d = v * v * nbEddingtonDistFun(table, psi - 0.5 * v * v);
         if(mw_fabs(d / dist_max) > u)
         {
             break;
@@ -707,7 +701,7 @@ static int cm_correction(real * x, real * y, real * z, real * vx, real * vy, rea
 }
 
 /*      DWARF GENERATION        */
-static int nbGenerateIsotropicCore(lua_State* luaSt, dsfmt_t* prng, unsigned int nbody, real mass1, real mass2, mwbool ignore, mwvector rShift, mwvector vShift, real radiusScale1, real radiusScale2)
+static int nbGenerateIsotropicCore(lua_State* luaSt, dsfmt_t* prng, unsigned int nbody, real mass1, real mass2, mwbool ignore, mwbool parallel, mwvector rShift, mwvector vShift, real radiusScale1, real radiusScale2)
 {
     /* generatePlummer: generate Plummer model initial conditions for test
     * runs, scaled to units such that M = -4E = G = 1 (Henon, Heggie,
@@ -715,8 +709,10 @@ static int nbGenerateIsotropicCore(lua_State* luaSt, dsfmt_t* prng, unsigned int
     * 183.
     */
         unsigned int i;
-        int table;
+        int block, n_blocks;
+        uint32_t seed = 0;
         Body b;
+        Body* bodies;
         real r, v;
  
         real * x  = mwCalloc(nbody, sizeof(real));
@@ -760,73 +756,108 @@ static int nbGenerateIsotropicCore(lua_State* luaSt, dsfmt_t* prng, unsigned int
         real rho_max_light = max_finder(profile_rho, parameters_light, 0, rscale_l, 2.0 * (rscale_l), 20, 1e-4, prng );
         real rho_max_dark  = max_finder(profile_rho, parameters_dark, 0, rscale_d, 2.0 * (rscale_d), 20, 1e-4, prng );
         
+        /*the distribution function only depends on energy, so it is tabulated once for the whole model.*/
+        EddingtonTable df_table;
+        nbMakeIsotropicEddingtonTable(&df_table, args);
+        
      
      /*initializing particles:*/
         memset(&b, 0, sizeof(b));
-        lua_createtable(luaSt, nbody, 0);
-        table = lua_gettop(luaSt);      
+        bodies = (Body*) mwMallocA(nbody * sizeof(Body));
         int counter = 0;
         
+        /*with parallel set, each block of bodies is drawn from its own stream seeded from prng.
+         * the model is then the same for any number of threads.
+         */
+        if(parallel)
+        {
+            seed = nbBlockSeed(prng);
+            n_blocks = (int) ((nbody + NBODY_IC_BLOCK_SIZE - 1) / NBODY_IC_BLOCK_SIZE);
+        }
+        else
+        {
+            n_blocks = 1;
+        }
+
         /*getting the radii and velocities for the bodies*/
-        for (i = 0; i < nbody; i++)
+      #ifdef _OPENMP
+        #pragma omp parallel for private(i, r, v, vec, counter) schedule(dynamic) if(parallel)
+      #endif
+        for (block = 0; block < n_blocks; block++)
         {
-            counter = 0;
-            do
+            dsfmt_t block_state;
+            dsfmt_t* rng = prng;
+            unsigned int first = 0;
+            unsigned int last = nbody;
+
+            if(parallel)
             {
-                
-                if(i < half_bodies)
-                {
-                    r = r_mag(prng, parameters_light, rho_max_light, bound);
-                    masses[i] = mass_light_particle;
-                }
-                else if(i >= half_bodies)
+                nbInitBlockPRNG(&block_state, seed, (unsigned int) block);
+                rng = &block_state;
+                first = (unsigned int) block * NBODY_IC_BLOCK_SIZE;
+                last = first + NBODY_IC_BLOCK_SIZE < nbody ? first + NBODY_IC_BLOCK_SIZE : nbody;
+            }
+
+            for (i = first; i < last; i++)
+            {
+                counter = 0;
+                do
                 {
-                    r = r_mag(prng, parameters_dark, rho_max_dark, bound);
-                    masses[i] = mass_dark_particle;
-                }
-                /*to ensure that r is finite and nonzero*/
-                if(isinf(r) == FALSE && r != 0.0 && isnan(r) == FALSE){break;}
                 
-                if(counter > 1000)
-                {
-                    exit(-1);
-                }
-                else
-                {
-                    counter++;
-                }
+                    if(i < half_bodies)
+                    {
+                        r = r_mag(rng, parameters_light, rho_max_light, bound);
+                        masses[i] = mass_light_particle;
+                    }
+                    else if(i >= half_bodies)
+                    {
+                        r = r_mag(rng, parameters_dark, rho_max_dark, bound);
+                        masses[i] = mass_dark_particle;
+                    }
+                    /*to ensure that r is finite and nonzero*/
+                    if(isinf(r) == FALSE && r != 0.0 && isnan(r) == FALSE){break;}
+                
+                    if(counter > 1000)
+                    {
+                        exit(-1);
+                    }
+                    else
+                    {
+                        counter++;
+                    }
                 
-            }while (1);
+                }while (1);
             
             
             
 //             mw_printf("\r velocity of particle %i", i+1);
-            counter = 0;
-            do
-            {
-                v = vel_mag(prng, r, args);
-                if(isinf(v) == FALSE && v != 0.0 && isnan(v) == FALSE){break;}
-                
-                if(counter > 1000)
-                {
-                    exit(-1);
-                }
-                else
+                counter = 0;
+                do
                 {
-                    counter++;
-                }
+                    v = vel_mag(rng, r, args, &df_table);
+                    if(isinf(v) == FALSE && v != 0.0 && isnan(v) == FALSE){break;}
+                
+                    if(counter > 1000)
+                    {
+                        exit(-1);
+                    }
+                    else
+                    {
+                        counter++;
+                    }
                 
-            }while (1);
+                }while (1);
 
-            vec = get_components(prng, v);   
-            vx[i] = vec.x;
-            vy[i] = vec.y;
-            vz[i] = vec.z;
+                vec = get_components(rng, v);   
+                vx[i] = vec.x;
+                vy[i] = vec.y;
+                vz[i] = vec.z;
             
-            vec = get_components(prng, r);  
-            x[i] = vec.x;
-            y[i] = vec.y;
-            z[i] = vec.z;
+                vec = get_components(rng, r);  
+                x[i] = vec.x;
+                y[i] = vec.y;
+                z[i] = vec.z;
+            }
         }
         
         /* getting the center of mass and momentum correction */
@@ -847,7 +878,7 @@ static int nbGenerateIsotropicCore(lua_State* luaSt, dsfmt_t* prng, unsigned int
             }
             
             b.bodynode.mass = masses[i];
-            /*this actually gets the position and velocity vectors and pushes table of bodies*/
+            /*this actually gets the position and velocity vectors and fills the block of bodies*/
             /*They are meant to give the dwarf an initial position and vel*/
             /* you have to work for your bodynode */
             b.bodynode.pos.x = x[i];
@@ -859,11 +890,11 @@ static int nbGenerateIsotropicCore(lua_State* luaSt, dsfmt_t* prng, unsigned int
             b.vel.z = vz[i];
             
             assert(nbPositionValid(b.bodynode.pos));
-            pushBody(luaSt, &b);
-            lua_rawseti(luaSt, table, i + 1);
+            bodies[i] = b;
         }
         
         /* go now and be free!*/
+        nbFreeEddingtonTable(&df_table);
         free(x);
         free(y);
         free(z);
@@ -872,7 +903,7 @@ static int nbGenerateIsotropicCore(lua_State* luaSt, dsfmt_t* prng, unsigned int
         free(vz);
         free(masses);
         
-        return 1;             
+        return pushBodyBlock(luaSt, bodies, nbody);
         
 }
 
@@ -882,6 +913,7 @@ int nbGenerateIsotropic(lua_State* luaSt)
         static const mwvector* position = NULL;
         static const mwvector* velocity = NULL;
         static mwbool ignore;
+        static mwbool parallel;
         static real mass1 = 0.0, nbodyf = 0.0, radiusScale1 = 0.0;
         static real mass2 = 0.0, radiusScale2 = 0.0;
 
@@ -895,6 +927,7 @@ int nbGenerateIsotropic(lua_State* luaSt)
             { "position",             LUA_TUSERDATA,   MWVECTOR_TYPE,           TRUE,    &position          },
             { "velocity",             LUA_TUSERDATA,   MWVECTOR_TYPE,           TRUE,    &velocity          },
             { "ignore",               LUA_TBOOLEAN,    NULL,                    FALSE,   &ignore            },
+            { "parallel",             LUA_TBOOLEAN,    NULL,                    FALSE,   &parallel          },
             { "prng",                 LUA_TUSERDATA,   DSFMT_TYPE,              TRUE,    &prng              },
             END_MW_NAMED_ARG
             
@@ -903,10 +936,11 @@ int nbGenerateIsotropic(lua_State* luaSt)
         if (lua_gettop(luaSt) != 1)
             return luaL_argerror(luaSt, 1, "Expected 1 arguments");
         
+        parallel = FALSE;
         handleNamedArgumentTable(luaSt, argTable, 1);
         
         
-        return nbGenerateIsotropicCore(luaSt, prng, (unsigned int) nbodyf, mass1, mass2, ignore,
+        return nbGenerateIsotropicCore(luaSt, prng, (unsigned int) nbodyf, mass1, mass2, ignore, parallel,
                                                                  *position, *velocity, radiusScale1, radiusScale2);
 }
 
@@ -98,11 +98,64 @@ real nbMatchHistogramFiles(const char* datHist, const char* matchHist, mwbool us
 }
 
 
-/* Calculate the likelihood from the final state of the simulation */
-real nbSystemLikelihood(const NBodyState* st,
-                     const NBodyHistogram* data,
-                     const NBodyHistogram* histogram,
-                     NBodyLikelihoodMethod method)
+/* Read the input histogram and likelihood settings once and build
+ * what is needed to compare simulated histograms against it.
+ *
+ * Return NULL on failure.
+ */
+NBodyDataHistogram* nbLoadDataHistogram(const NBodyFlags* nbf)
+{
+    NBodyDataHistogram* dataHist;
+    HistogramParams hp;
+    NBodyLikelihoodMethod method;
+    NBodyHistogram* data;
+    unsigned int i;
+
+    if (nbGetLikelihoodInfo(nbf, &hp, &method) || method == NBODY_INVALID_METHOD)
+    {
+        return NULL;
+    }
+
+    data = nbReadHistogram(nbf->histogramFileName);
+    if (!data)
+    {
+        return NULL;
+    }
+
+    dataHist = mwCalloc(1, sizeof(NBodyDataHistogram));
+    dataHist->histogram = data;
+    dataHist->hp = hp;
+    dataHist->method = method;
+    dataHist->nBin = data->lambdaBins * data->betaBins;
+    dataHist->emdSignature = nbMakeEMDSignature(data);
+    dataHist->useBin = mwMalloc(dataHist->nBin * sizeof(int));
+
+    for (i = 0; i < dataHist->nBin; ++i)
+    {
+        dataHist->useBin[i] = data->data[i].useBin;
+    }
+
+    return dataHist;
+}
+
+void nbFreeDataHistogram(NBodyDataHistogram* dataHist)
+{
+    if (!dataHist)
+        return;
+
+    free(dataHist->histogram);
+    free(dataHist->emdSignature);
+    free(dataHist->useBin);
+    free(dataHist);
+}
+
+/* dataHist is optional. If given, the prepared EMD signature is used
+   instead of rebuilding it from data */
+static real nbSystemLikelihoodInternal(const NBodyState* st,
+                                       const NBodyHistogram* data,
+                                       const NBodyDataHistogram* dataHist,
+                                       const NBodyHistogram* histogram,
+                                       NBodyLikelihoodMethod method)
 {
     
     real geometry_component;
@@ -151,7 +204,7 @@ real nbSystemLikelihood(const NBodyState* st,
             return worstEMD; //Changed.  See above comment.
         }
 
-        geometry_component = nbMatchEMD(data, histogram);
+        geometry_component = dataHist ? nbMatchEMDPrepared(dataHist, histogram) : nbMatchEMD(data, histogram);
     }
     else
     {
@@ -177,4 +230,20 @@ real nbSystemLikelihood(const NBodyState* st,
     }
     return likelihood;
     
-} 
\ No newline at end of file
+}
+
+/* Calculate the likelihood from the final state of the simulation */
+real nbSystemLikelihood(const NBodyState* st,
+                     const NBodyHistogram* data,
+                     const NBodyHistogram* histogram,
+                     NBodyLikelihoodMethod method)
+{
+    return nbSystemLikelihoodInternal(st, data, NULL, histogram, method);
+}
+
+real nbSystemLikelihoodPrepared(const NBodyState* st,
+                                const NBodyDataHistogram* dataHist,
+                                const NBodyHistogram* histogram)
+{
+    return nbSystemLikelihoodInternal(st, dataHist->histogram, dataHist, histogram, dataHist->method);
+}
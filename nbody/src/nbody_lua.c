@@ -257,16 +257,24 @@ lua_State* nbOpenLuaStateWithScript(const NBodyFlags* nbf, NBodyState* st)
     bindDeviceInformation(luaSt, st);
     mwBindBOINCStatus(luaSt);
 
-    script = mwReadFileResolved(nbf->inputFile);
-    if (!script)
+    if (nbf->inputScript)
     {
-        mwPerror("Opening Lua script '%s'", nbf->inputFile);
-        lua_close(luaSt);
-        return NULL;
+        execFailed = dostringWithArgs(luaSt, nbf->inputScript, nbf->forwardedArgs, nbf->numForwardedArgs);
+    }
+    else
+    {
+        script = mwReadFileResolved(nbf->inputFile);
+        if (!script)
+        {
+            mwPerror("Opening Lua script '%s'", nbf->inputFile);
+            lua_close(luaSt);
+            return NULL;
+        }
+
+        execFailed = dostringWithArgs(luaSt, script, nbf->forwardedArgs, nbf->numForwardedArgs);
+        free(script);
     }
 
-    execFailed = dostringWithArgs(luaSt, script, nbf->forwardedArgs, nbf->numForwardedArgs);
-    free(script);
     if (execFailed)
     {
         mw_lua_perror(luaSt, "Error loading Lua script '%s'", nbf->inputFile);
@@ -0,0 +1,291 @@
+/*
+Copyright (C) 2011  Matthew Arsenault
+
+This file is part of Milkway@Home.
+
+Milkyway@Home is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Milkyway@Home is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* A model as one array of bodies. The generators return these instead
+ * of a table with a Body userdata per body, and the simulation takes
+ * over the array of a single returned block without copying it. */
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <string.h>
+
+#include "nbody_types.h"
+#include "nbody_lua_body.h"
+#include "nbody_lua_body_block.h"
+#include "milkyway_lua.h"
+#include "milkyway_util.h"
+
+BodyBlock* checkBodyBlock(lua_State* luaSt, int idx)
+{
+    return (BodyBlock*) mw_checknamedudata(luaSt, idx, BODY_BLOCK_TYPE);
+}
+
+BodyBlock* toBodyBlock(lua_State* luaSt, int idx)
+{
+    return (BodyBlock*) mw_tonamedudata(luaSt, idx, BODY_BLOCK_TYPE);
+}
+
+/* The block takes ownership of bodies, which must come from mwMallocA() */
+int pushBodyBlock(lua_State* luaSt, Body* bodies, unsigned int nbody)
+{
+    BodyBlock block;
+
+    block.bodies = bodies;
+    block.nbody = nbody;
+
+    return pushType(luaSt, BODY_BLOCK_TYPE, sizeof(BodyBlock), (void*) &block);
+}
+
+/* Number of bodies in a block or table of bodies */
+static unsigned int modelSize(lua_State* luaSt, int idx)
+{
+    BodyBlock* block;
+
+    block = toBodyBlock(luaSt, idx);
+    if (block)
+        return block->nbody;
+
+    luaL_checktype(luaSt, idx, LUA_TTABLE);
+    return (unsigned int) luaL_getn(luaSt, idx);
+}
+
+static Body* copyModel(lua_State* luaSt, int idx, Body* bodies)
+{
+    BodyBlock* block;
+    unsigned int i, n;
+
+    block = toBodyBlock(luaSt, idx);
+    if (block)
+    {
+        memcpy(bodies, block->bodies, block->nbody * sizeof(Body));
+        return &bodies[block->nbody];
+    }
+
+    n = (unsigned int) luaL_getn(luaSt, idx);
+    for (i = 0; i < n; ++i)
+    {
+        lua_rawgeti(luaSt, idx, (int) i + 1);
+        bodies[i] = *checkBody(luaSt, lua_gettop(luaSt));
+        lua_pop(luaSt, 1);
+    }
+
+    return &bodies[n];
+}
+
+/* New block with the bodies of the blocks or tables of bodies in
+ * arguments first to last */
+static int concatModels(lua_State* luaSt, int first, int last)
+{
+    int i;
+    unsigned int n = 0;
+    Body* bodies;
+    Body* p;
+
+    for (i = first; i <= last; ++i)
+    {
+        n += modelSize(luaSt, i);
+    }
+
+    p = bodies = (Body*) mwMallocA((n > 0 ? n : 1) * sizeof(Body));
+    for (i = first; i <= last; ++i)
+    {
+        p = copyModel(luaSt, i, p);
+    }
+
+    return pushBodyBlock(luaSt, bodies, n);
+}
+
+/* BodyBlock.create(...) */
+static int createBodyBlock(lua_State* luaSt)
+{
+    return concatModels(luaSt, 1, lua_gettop(luaSt));
+}
+
+static int concatBodyBlock(lua_State* luaSt)
+{
+    return concatModels(luaSt, 1, 2);
+}
+
+static int lenBodyBlock(lua_State* luaSt)
+{
+    lua_pushinteger(luaSt, (lua_Integer) checkBodyBlock(luaSt, 1)->nbody);
+    return 1;
+}
+
+static Body* checkBodyBlockIndex(lua_State* luaSt, BodyBlock* block, int idx)
+{
+    lua_Integer i = luaL_checkinteger(luaSt, idx);
+
+    if (i < 1 || i > (lua_Integer) block->nbody)
+    {
+        luaL_error(luaSt, "Body index %d out of range [1, %d]", (int) i, (int) block->nbody);
+    }
+
+    return &block->bodies[i - 1];
+}
+
+/* block[i] is a copy of body i. Anything else is a method. */
+static int indexBodyBlock(lua_State* luaSt)
+{
+    BodyBlock* block = checkBodyBlock(luaSt, 1);
+
+    if (lua_type(luaSt, 2) == LUA_TNUMBER)
+    {
+        return pushBody(luaSt, checkBodyBlockIndex(luaSt, block, 2));
+    }
+
+    lua_pushvalue(luaSt, 2);
+    lua_gettable(luaSt, lua_upvalueindex(1));
+    if (lua_isnil(luaSt, -1))
+        luaL_error(luaSt, "cannot get member '%s'", lua_tostring(luaSt, 2));
+
+    return 1;
+}
+
+static int newIndexBodyBlock(lua_State* luaSt)
+{
+    BodyBlock* block = checkBodyBlock(luaSt, 1);
+
+    *checkBodyBlockIndex(luaSt, block, 2) = *checkBody(luaSt, 3);
+    return 0;
+}
+
+/* block:shift(position [, velocity]) moves every body in place */
+static int shiftBodyBlock(lua_State* luaSt)
+{
+    unsigned int i;
+    BodyBlock* block;
+    mwvector dx, dv = ZERO_VECTOR;
+
+    block = checkBodyBlock(luaSt, 1);
+    dx = *checkVector(luaSt, 2);
+    if (!lua_isnoneornil(luaSt, 3))
+        dv = *checkVector(luaSt, 3);
+
+    for (i = 0; i < block->nbody; ++i)
+    {
+        mw_incaddv(Pos(&block->bodies[i]), dx);
+        mw_incaddv(Vel(&block->bodies[i]), dv);
+    }
+
+    lua_settop(luaSt, 1);
+    return 1;
+}
+
+/* block:setIgnore(ignore) tags every body in place */
+static int setIgnoreBodyBlock(lua_State* luaSt)
+{
+    unsigned int i;
+    BodyBlock* block;
+    body_t type;
+
+    block = checkBodyBlock(luaSt, 1);
+    type = BODY(mw_lua_checkboolean(luaSt, 2));
+
+    for (i = 0; i < block->nbody; ++i)
+    {
+        Type(&block->bodies[i]) = type;
+    }
+
+    lua_settop(luaSt, 1);
+    return 1;
+}
+
+/* Table of Body, for scripts which want to work on single bodies */
+static int toTableBodyBlock(lua_State* luaSt)
+{
+    unsigned int i;
+    int table;
+    BodyBlock* block;
+
+    block = checkBodyBlock(luaSt, 1);
+
+    lua_createtable(luaSt, (int) block->nbody, 0);
+    table = lua_gettop(luaSt);
+
+    for (i = 0; i < block->nbody; ++i)
+    {
+        pushBody(luaSt, &block->bodies[i]);
+        lua_rawseti(luaSt, table, (int) i + 1);
+    }
+
+    return 1;
+}
+
+static int toStringBodyBlock(lua_State* luaSt)
+{
+    lua_pushfstring(luaSt, "BodyBlock(%d bodies)", (int) checkBodyBlock(luaSt, 1)->nbody);
+    return 1;
+}
+
+static int gcBodyBlock(lua_State* luaSt)
+{
+    BodyBlock* block = checkBodyBlock(luaSt, 1);
+
+    mwFreeA(block->bodies);
+    block->bodies = NULL;
+    block->nbody = 0;
+
+    return 0;
+}
+
+static const luaL_reg metaMethodsBodyBlock[] =
+{
+    { "__tostring", toStringBodyBlock },
+    { "__len",      lenBodyBlock      },
+    { "__concat",   concatBodyBlock   },
+    { "__newindex", newIndexBodyBlock },
+    { "__gc",       gcBodyBlock       },
+    { NULL, NULL }
+};
+
+static const luaL_reg methodsBodyBlock[] =
+{
+    { "create",    createBodyBlock    },
+    { "shift",     shiftBodyBlock     },
+    { "setIgnore", setIgnoreBodyBlock },
+    { "toTable",   toTableBodyBlock   },
+    { NULL, NULL }
+};
+
+/* Like registerStruct(), except indexing with a number gets a body */
+int registerBodyBlock(lua_State* luaSt)
+{
+    int metatable, methods;
+
+    luaL_register(luaSt, BODY_BLOCK_TYPE, methodsBodyBlock);
+    methods = lua_gettop(luaSt);
+
+    luaL_newmetatable(luaSt, BODY_BLOCK_TYPE);
+    luaL_register(luaSt, NULL, metaMethodsBodyBlock);
+    metatable = lua_gettop(luaSt);
+
+    lua_pushliteral(luaSt, "__metatable");
+    lua_pushvalue(luaSt, methods);
+    lua_rawset(luaSt, metatable);
+
+    lua_pushliteral(luaSt, "__index");
+    lua_pushvalue(luaSt, methods);
+    lua_pushcclosure(luaSt, indexBodyBlock, 1);
+    lua_rawset(luaSt, metatable);
+
+    lua_pop(luaSt, 2);
+    return 0;
+}
+
@@ -39,6 +39,7 @@ static const MWEnumAssociation criterionOptions[] =
     { "Exact",        Exact        },
     { "BH86",         BH86         },
     { "SW93",         SW93         },
+    { "FMM",          FMM          },
     END_MW_ENUM_ASSOCIATION
 };
 
@@ -82,6 +83,12 @@ static int createNBodyCtx(lua_State* luaSt)
 {
     static NBodyCtx ctx;
     static const char* criterionName = NULL;
+    static real groupSizef = 0.0;
+    static real reorderIntervalf = 0.0;
+    static real potentialGridf = 0.0;
+    static real timestepLevelsf = 0.0;
+    static real treeRebuildIntervalf = 0.0;
+    static real fmmOrderf = 0.0;
     real nStepf = 0.0;
 
     static const MWNamedArg argTable[] =
@@ -109,11 +116,27 @@ static int createNBodyCtx(lua_State* luaSt)
             { "IterMax",       LUA_TNUMBER,  NULL, TRUE,  &ctx.IterMax       },
             { "BetaCorrect",   LUA_TNUMBER,  NULL, TRUE,  &ctx.BetaCorrect   },
             { "VelCorrect",    LUA_TNUMBER,  NULL, TRUE,  &ctx.VelCorrect    },
+            { "groupSize",     LUA_TNUMBER,  NULL, FALSE, &groupSizef        },
+            { "reorderInterval", LUA_TNUMBER, NULL, FALSE, &reorderIntervalf },
+            { "potentialGrid", LUA_TNUMBER,  NULL, FALSE, &potentialGridf    },
+            { "potentialGridMin", LUA_TNUMBER, NULL, FALSE, &ctx.potentialGridMin },
+            { "potentialGridMax", LUA_TNUMBER, NULL, FALSE, &ctx.potentialGridMax },
+            { "potentialGridTolerance", LUA_TNUMBER, NULL, FALSE, &ctx.potentialGridTolerance },
+            { "timestepLevels", LUA_TNUMBER, NULL, FALSE, &timestepLevelsf   },
+            { "timestepAccuracy", LUA_TNUMBER, NULL, FALSE, &ctx.timestepAccuracy },
+            { "treeRebuildInterval", LUA_TNUMBER, NULL, FALSE, &treeRebuildIntervalf },
+            { "fmmOrder",      LUA_TNUMBER,  NULL, FALSE, &fmmOrderf         },
             END_MW_NAMED_ARG
         };
 
     criterionName = NULL;
     ctx = defaultNBodyCtx;
+    groupSizef = (real) DEFAULT_GROUP_SIZE;
+    reorderIntervalf = (real) DEFAULT_REORDER_INTERVAL;
+    potentialGridf = (real) DEFAULT_POTENTIAL_GRID;
+    timestepLevelsf = (real) DEFAULT_TIMESTEP_LEVELS;
+    treeRebuildIntervalf = (real) DEFAULT_TREE_REBUILD_INTERVAL;
+    fmmOrderf = (real) DEFAULT_FMM_ORDER;
 
     if (lua_gettop(luaSt) != 1)
         return luaL_argerror(luaSt, 1, "Expected named argument table");
@@ -138,6 +161,59 @@ static int createNBodyCtx(lua_State* luaSt)
         ctx.useQuad = FALSE;
     }
 
+    if (groupSizef < 0.0 || groupSizef > (real) NBODY_MAX_GROUP_SIZE)
+    {
+        return luaL_error(luaSt, "groupSize must be between 0 and %d", NBODY_MAX_GROUP_SIZE);
+    }
+    ctx.groupSize = (unsigned int) groupSizef;
+
+    if (reorderIntervalf < 0.0 || reorderIntervalf >= (real) UINT_MAX)
+    {
+        return luaL_error(luaSt, "reorderInterval must be a non-negative number of steps");
+    }
+    ctx.reorderInterval = (unsigned int) reorderIntervalf;
+
+    if (   potentialGridf < 0.0
+        || (potentialGridf > 0.0 && potentialGridf < 4.0)
+        || potentialGridf > (real) NBODY_MAX_POTENTIAL_GRID)
+    {
+        return luaL_error(luaSt, "potentialGrid must be 0 or between 4 and %d", NBODY_MAX_POTENTIAL_GRID);
+    }
+    ctx.potentialGrid = (unsigned int) potentialGridf;
+
+    if (ctx.potentialGridMin <= 0.0 || ctx.potentialGridMax <= ctx.potentialGridMin)
+    {
+        return luaL_error(luaSt, "potentialGridMin must be positive and less than potentialGridMax");
+    }
+
+    if (ctx.potentialGridTolerance <= 0.0)
+    {
+        return luaL_error(luaSt, "potentialGridTolerance must be positive");
+    }
+
+    if (timestepLevelsf < 0.0 || timestepLevelsf > (real) NBODY_MAX_TIMESTEP_LEVELS)
+    {
+        return luaL_error(luaSt, "timestepLevels must be between 0 and %d", NBODY_MAX_TIMESTEP_LEVELS);
+    }
+    ctx.timestepLevels = (unsigned int) timestepLevelsf;
+
+    if (ctx.timestepAccuracy <= 0.0)
+    {
+        return luaL_error(luaSt, "timestepAccuracy must be positive");
+    }
+
+    if (treeRebuildIntervalf < 0.0 || treeRebuildIntervalf >= (real) UINT_MAX)
+    {
+        return luaL_error(luaSt, "treeRebuildInterval must be a non-negative number of steps");
+    }
+    ctx.treeRebuildInterval = (unsigned int) treeRebuildIntervalf;
+
+    if (fmmOrderf < 1.0 || fmmOrderf > (real) NBODY_MAX_FMM_ORDER)
+    {
+        return luaL_error(luaSt, "fmmOrder must be between 1 and %d", NBODY_MAX_FMM_ORDER);
+    }
+    ctx.fmmOrder = (unsigned int) fmmOrderf;
+
     nStepf = mw_ceil(ctx.timeEvolve / ctx.timestep);
     if (nStepf >= (real) UINT_MAX)
     {
@@ -246,6 +322,16 @@ static const Xet_reg_pre gettersNBodyCtx[] =
     { "IterMax",         getNumber,     offsetof(NBodyCtx, IterMax)     },
     { "BetaCorrect",     getNumber,     offsetof(NBodyCtx, BetaCorrect) },
     { "VelCorrect",      getNumber,     offsetof(NBodyCtx, VelCorrect)  },
+    { "groupSize",       getUInt,       offsetof(NBodyCtx, groupSize)   },
+    { "reorderInterval", getUInt,       offsetof(NBodyCtx, reorderInterval) },
+    { "potentialGrid",   getUInt,       offsetof(NBodyCtx, potentialGrid) },
+    { "potentialGridMin", getNumber,    offsetof(NBodyCtx, potentialGridMin) },
+    { "potentialGridMax", getNumber,    offsetof(NBodyCtx, potentialGridMax) },
+    { "potentialGridTolerance", getNumber, offsetof(NBodyCtx, potentialGridTolerance) },
+    { "timestepLevels",  getUInt,       offsetof(NBodyCtx, timestepLevels) },
+    { "timestepAccuracy", getNumber,    offsetof(NBodyCtx, timestepAccuracy) },
+    { "treeRebuildInterval", getUInt,   offsetof(NBodyCtx, treeRebuildInterval) },
+    { "fmmOrder",        getUInt,       offsetof(NBodyCtx, fmmOrder)    },
     { NULL, NULL, 0 }
 };
 
@@ -274,6 +360,16 @@ static const Xet_reg_pre settersNBodyCtx[] =
     { "IterMax",         setNumber,     offsetof(NBodyCtx, IterMax)    },
     { "BetaCorrect",     setNumber,     offsetof(NBodyCtx, BetaCorrect) },
     { "VelCorrect",      setNumber,     offsetof(NBodyCtx, VelCorrect)  },
+    { "groupSize",       setUInt,       offsetof(NBodyCtx, groupSize)   },
+    { "reorderInterval", setUInt,       offsetof(NBodyCtx, reorderInterval) },
+    { "potentialGrid",   setUInt,       offsetof(NBodyCtx, potentialGrid) },
+    { "potentialGridMin", setNumber,    offsetof(NBodyCtx, potentialGridMin) },
+    { "potentialGridMax", setNumber,    offsetof(NBodyCtx, potentialGridMax) },
+    { "potentialGridTolerance", setNumber, offsetof(NBodyCtx, potentialGridTolerance) },
+    { "timestepLevels",  setUInt,       offsetof(NBodyCtx, timestepLevels) },
+    { "timestepAccuracy", setNumber,    offsetof(NBodyCtx, timestepAccuracy) },
+    { "treeRebuildInterval", setUInt,   offsetof(NBodyCtx, treeRebuildInterval) },
+    { "fmmOrder",        setUInt,       offsetof(NBodyCtx, fmmOrder)    },
     { NULL, NULL, 0 }
 };
 
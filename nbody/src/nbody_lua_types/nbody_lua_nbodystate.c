@@ -30,8 +30,11 @@
 #include "nbody_lua_type_marshal.h"
 #include "nbody_defaults.h"
 #include "nbody_checkpoint.h"
+#include "nbody_io.h"
+#include "nbody_lua_body.h"
 #include "nbody_lua_misc.h"
 #include "nbody_grav.h"
+#include "nbody_tree.h"
 #include "nbody.h"
 
 
@@ -50,6 +53,17 @@ NBodyState* expectNBodyState(lua_State* luaSt, int idx)
     return (NBodyState*) expectType(luaSt, idx, NBODYSTATE_TYPE);
 }
 
+/* Anything which shows the bodies to a script puts them back in the
+ * order they were created in first, since reorderInterval may have
+ * sorted them for the tree walk */
+static NBodyState* checkNBodyStateInOrder(lua_State* luaSt, int idx)
+{
+    NBodyState* st = checkNBodyState(luaSt, idx);
+
+    nbRestoreBodyOrder(st);
+    return st;
+}
+
 int pushNBodyState(lua_State* luaSt, const NBodyState* p)
 {
     return pushType(luaSt, NBODYSTATE_TYPE, sizeof(NBodyState), (void*) p);
@@ -148,31 +162,104 @@ static int sortBodiesNBodyState(lua_State* luaSt)
     return 0;
 }
 
+/* Table of the acceleration of each body from the last force calculation
+ * st:accelerations() */
+static int luaAccelerationsNBodyState(lua_State* luaSt)
+{
+    const NBodyState* st;
+    int i, table;
+
+    st = checkNBodyStateInOrder(luaSt, 1);
+
+    lua_createtable(luaSt, st->nbody, 0);
+    table = lua_gettop(luaSt);
+
+    for (i = 0; i < st->nbody; ++i)
+    {
+        pushVector(luaSt, st->acctab[i]);
+        lua_rawseti(luaSt, table, i + 1);
+    }
+
+    return 1;
+}
+
 static int luaWriteCheckpoint(lua_State* luaSt)
 {
     NBodyState* st;
     const NBodyCtx* ctx;
     char tmpPath[256];
+    char* resolved;
     int pid;
     int failed;
 
-    st = checkNBodyState(luaSt, 1);
+    st = checkNBodyStateInOrder(luaSt, 1);
     ctx = checkNBodyCtx(luaSt, 2);
 
-    assert(st->checkpointResolved == NULL);
-
     pid = (int) getpid();
     snprintf(tmpPath, sizeof(tmpPath), "nbody_checkpoint_tmp_%d", pid);
 
+    /* Keep the file of background checkpoints, which may still be in use */
+    resolved = st->checkpointResolved;
     st->checkpointResolved = strdup(luaL_optstring(luaSt, 3, DEFAULT_CHECKPOINT_FILE));
 
     failed = nbWriteCheckpointWithTmpFile(ctx, st, luaL_optstring(luaSt, 4, tmpPath));
     free(st->checkpointResolved);
-    st->checkpointResolved = NULL;
+    st->checkpointResolved = resolved;
 
     return failed ? luaL_error(luaSt, "Error writing checkpoint") : 0;
 }
 
+/* Write a checkpoint in the background the same way as during a run
+ * st:startCheckpoint(ctx, [filename]) */
+static int luaStartCheckpoint(lua_State* luaSt)
+{
+    NBodyState* st;
+    const NBodyCtx* ctx;
+    const char* filename;
+
+    st = checkNBodyStateInOrder(luaSt, 1);
+    ctx = checkNBodyCtx(luaSt, 2);
+    filename = luaL_optstring(luaSt, 3, DEFAULT_CHECKPOINT_FILE);
+
+    /* The writer keeps using the file it was started with */
+    if (!st->checkpointResolved)
+    {
+        st->checkpointResolved = strdup(filename);
+    }
+    else if (strcmp(st->checkpointResolved, filename))
+    {
+        return luaL_error(luaSt, "Background checkpoints already go to '%s'", st->checkpointResolved);
+    }
+
+    if (nbStartCheckpoint(ctx, st))
+    {
+        return luaL_error(luaSt, "Error writing checkpoint");
+    }
+
+    return 0;
+}
+
+/* Returns true if a checkpoint is still waiting to be written. Waits
+ * for the background checkpoints unless wait is false.
+ * st:finishCheckpoint([wait]) */
+static int luaFinishCheckpoint(lua_State* luaSt)
+{
+    NBodyState* st;
+    mwbool wait;
+    mwbool busy;
+
+    st = checkNBodyState(luaSt, 1);
+    wait = lua_isnoneornil(luaSt, 2) ? TRUE : mw_lua_checkboolean(luaSt, 2);
+
+    if (nbFinishCheckpoint(st, wait, &busy))
+    {
+        return luaL_error(luaSt, "Error writing checkpoint");
+    }
+
+    lua_pushboolean(luaSt, busy);
+    return 1;
+}
+
 static int luaCloneNBodyState(lua_State* luaSt)
 {
     const NBodyState* oldSt;
@@ -213,9 +300,93 @@ static int luaReadCheckpoint(lua_State* luaSt)
     return 2;
 }
 
+/* state:writeBinaryOutput(ctx, filename) */
+static int luaWriteBinaryOutput(lua_State* luaSt)
+{
+    const NBodyState* st;
+    const NBodyCtx* ctx;
+    const char* filename;
+
+    st = checkNBodyStateInOrder(luaSt, 1);
+    ctx = checkNBodyCtx(luaSt, 2);
+    filename = luaL_checkstring(luaSt, 3);
+
+    if (nbWriteBodiesBinary(filename, ctx, st))
+    {
+        return luaL_error(luaSt, "Error writing binary output '%s'", filename);
+    }
+
+    return 0;
+}
+
+static void pushBinaryOutputInfo(lua_State* luaSt, const NBodyBinaryOutputHeader* hdr)
+{
+    mwvector cmPos = ZERO_VECTOR;
+    mwvector cmVel = ZERO_VECTOR;
+
+    SET_VECTOR(cmPos, hdr->centerOfMass[0], hdr->centerOfMass[1], hdr->centerOfMass[2]);
+    SET_VECTOR(cmVel, hdr->centerOfMomentum[0], hdr->centerOfMomentum[1], hdr->centerOfMomentum[2]);
+
+    lua_newtable(luaSt);
+
+    lua_pushnumber(luaSt, (lua_Number) hdr->nbody);
+    lua_setfield(luaSt, -2, "nbody");
+
+    lua_pushnumber(luaSt, (lua_Number) hdr->step);
+    lua_setfield(luaSt, -2, "step");
+
+    lua_pushboolean(luaSt, hdr->hasMilkyway);
+    lua_setfield(luaSt, -2, "hasMilkyway");
+
+    lua_pushnumber(luaSt, hdr->sunGCDist);
+    lua_setfield(luaSt, -2, "sunGCDist");
+
+    lua_pushnumber(luaSt, hdr->timestep);
+    lua_setfield(luaSt, -2, "timestep");
+
+    lua_pushnumber(luaSt, hdr->timeEvolve);
+    lua_setfield(luaSt, -2, "timeEvolve");
+
+    pushVector(luaSt, cmPos);
+    lua_setfield(luaSt, -2, "centerOfMass");
+
+    pushVector(luaSt, cmVel);
+    lua_setfield(luaSt, -2, "centerOfMomentum");
+}
+
+/* Returns a table of the bodies and a table of the simulation info
+ * NBodyState.readBinaryOutput(filename) */
+static int luaReadBinaryOutput(lua_State* luaSt)
+{
+    NBodyBinaryOutputHeader hdr;
+    Body* bodies;
+    const char* filename;
+    unsigned int i;
+
+    filename = luaL_checkstring(luaSt, 1);
+    bodies = nbReadBodiesBinary(filename, &hdr);
+    if (!bodies)
+    {
+        return luaL_error(luaSt, "Error reading binary output '%s'", filename);
+    }
+
+    lua_createtable(luaSt, hdr.nbody, 0);
+    for (i = 0; i < hdr.nbody; ++i)
+    {
+        pushBody(luaSt, &bodies[i]);
+        lua_rawseti(luaSt, -2, i + 1);
+    }
+
+    mwFreeA(bodies);
+
+    pushBinaryOutputInfo(luaSt, &hdr);
+
+    return 2;
+}
+
 static int eqNBodyState(lua_State* luaSt)
 {
-    lua_pushboolean(luaSt, equalNBodyState(checkNBodyState(luaSt, 1), checkNBodyState(luaSt, 2)));
+    lua_pushboolean(luaSt, equalNBodyState(checkNBodyStateInOrder(luaSt, 1), checkNBodyStateInOrder(luaSt, 2)));
     return 1;
 }
 
@@ -224,7 +395,7 @@ static int toStringNBodyState(lua_State* luaSt)
     const NBodyState* st;
     char* buf;
 
-    st = checkNBodyState(luaSt, 1);
+    st = checkNBodyStateInOrder(luaSt, 1);
     buf = showNBodyState(st);
     lua_pushstring(luaSt, buf);
     free(buf);
@@ -309,15 +480,20 @@ static const luaL_reg metaMethodsNBodyState[] =
 
 static const luaL_reg methodsNBodyState[] =
 {
-    { "create",          createNBodyState     },
-    { "step",            stepNBodyState       },
-    { "runSystem",       luaRunSystem         },
-    { "sortBodies",      sortBodiesNBodyState },
-    { "clone",           luaCloneNBodyState   },
-    { "writeCheckpoint", luaWriteCheckpoint   },
-    { "readCheckpoint",  luaReadCheckpoint    },
-    { "initCL",          luaInitCL            },
-    { "initCLState",     luaInitNBodyStateCL  },
+    { "create",            createNBodyState     },
+    { "step",              stepNBodyState       },
+    { "runSystem",         luaRunSystem         },
+    { "sortBodies",        sortBodiesNBodyState },
+    { "accelerations",     luaAccelerationsNBodyState },
+    { "clone",             luaCloneNBodyState   },
+    { "writeCheckpoint",   luaWriteCheckpoint   },
+    { "startCheckpoint",   luaStartCheckpoint   },
+    { "finishCheckpoint",  luaFinishCheckpoint  },
+    { "readCheckpoint",    luaReadCheckpoint    },
+    { "writeBinaryOutput", luaWriteBinaryOutput },
+    { "readBinaryOutput",  luaReadBinaryOutput  },
+    { "initCL",            luaInitCL            },
+    { "initCLState",       luaInitNBodyStateCL  },
     { NULL, NULL }
 };
 
@@ -19,6 +19,7 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <lua.h>
 #include <lauxlib.h>
+#include <string.h>
 
 #include "nbody_types.h"
 #include "nbody_lua_types.h"
@@ -29,10 +30,18 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 static int totalBodies(lua_State* luaSt, int nModels)
 {
     int top, i, n = 0;
+    BodyBlock* block;
 
     top = lua_gettop(luaSt);
     for (i = top; i > top - nModels; --i)
     {
+        block = toBodyBlock(luaSt, i);
+        if (block)
+        {
+            n += (int) block->nbody;
+            continue;
+        }
+
         if (expectTable(luaSt, i))
         {
             mw_lua_perror(luaSt, "Error reading body table");
@@ -49,6 +58,14 @@ static int readBodyArray(lua_State* luaSt, int table, Body* bodies, int n)
 {
     int i;
     Body* b;
+    BodyBlock* block;
+
+    block = toBodyBlock(luaSt, table);
+    if (block)
+    {
+        memcpy(bodies, block->bodies, block->nbody * sizeof(Body));
+        return 0;
+    }
 
     for (i = 0; i < n; ++i)
     {
@@ -67,12 +84,14 @@ static int readBodyArray(lua_State* luaSt, int table, Body* bodies, int n)
     return i != n; /* Didn't read all bodies successfully */
 }
 
-/* Read returned table of model components. Pops the n arguments */
+/* Read returned body blocks or tables of model components. Pops the
+ * n arguments */
 Body* readModels(lua_State* luaSt, int nModels, int* nOut)
 {
     int i, n, totalN, top;
     Body* allBodies;
     Body* bodies;
+    BodyBlock* block;
 
     totalN = totalBodies(luaSt, nModels);
     if (totalN == 0)
@@ -81,17 +100,34 @@ Body* readModels(lua_State* luaSt, int nModels, int* nOut)
         return NULL;
     }
 
+    /* A single block is already the array we want, so take it over
+     * instead of copying it */
+    block = nModels == 1 ? toBodyBlock(luaSt, lua_gettop(luaSt)) : NULL;
+    if (block)
+    {
+        allBodies = block->bodies;
+        block->bodies = NULL;
+        block->nbody = 0;
+        lua_pop(luaSt, 1);
+
+        if (nOut)
+            *nOut = totalN;
+
+        return allBodies;
+    }
+
     bodies = allBodies = (Body*) mwCallocA(totalN, sizeof(Body));
 
     for (i = 0; i < nModels; ++i)
     {
         top = lua_gettop(luaSt);
-        n = luaL_getn(luaSt, top);
+        block = toBodyBlock(luaSt, top);
+        n = block ? (int) block->nbody : (int) luaL_getn(luaSt, top);
 
         if (readBodyArray(luaSt, top, bodies, n))
         {
             mw_printf("Error reading body array %d\n", i);
-            free(allBodies);
+            mwFreeA(allBodies);
             allBodies = NULL;
             totalN = 0;
             break;
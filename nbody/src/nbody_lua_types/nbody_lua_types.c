@@ -28,6 +28,7 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 void registerNBodyTypes(lua_State* luaSt)
 {
     registerBody(luaSt);
+    registerBodyBlock(luaSt);
 
     registerHalo(luaSt);
     registerDisk(luaSt);
@@ -39,8 +39,8 @@ static int nbGenerateManualBodiescore(lua_State* luaSt, const char* body_file)
 {   
     
     /*initializing particles:*/
-    int table;
     Body b;
+    Body* bodies;
     FILE* body_inputs;
 
     unsigned int lineNum = 0;
@@ -88,8 +88,7 @@ static int nbGenerateManualBodiescore(lua_State* luaSt, const char* body_file)
     
     unsigned int nbody = fsize;
     memset(&b, 0, sizeof(b));
-    lua_createtable(luaSt, nbody, 0);
-    table = lua_gettop(luaSt);      
+    bodies = (Body*) mwMallocA(nbody * sizeof(Body));
     
 
     int counter = 0;
@@ -126,14 +125,14 @@ static int nbGenerateManualBodiescore(lua_State* luaSt, const char* body_file)
     
     fclose(body_inputs);
 
-    /* pushing the bodies */
+    /* filling the bodies */
     for (int i = 0; i < nbody; i++)
     {
         b.bodynode.type = ty[i];
         b.bodynode.id = id[i];
         b.bodynode.mass = masses[i];
 
-        /*this actually gets the position and velocity vectors and pushes table of bodies*/
+        /*this actually gets the position and velocity vectors and fills the block of bodies*/
         /*They are meant to give the dwarf an initial position and vel*/
         /* you have to work for your bodynode */
         b.bodynode.pos.x = x[i];
@@ -146,8 +145,7 @@ static int nbGenerateManualBodiescore(lua_State* luaSt, const char* body_file)
         
 //         mw_printf("%f %f %f %f %f %f %f\n", b.bodynode.pos.x, b.bodynode.pos.y, b.bodynode.pos.z, b.vel.x, b.vel.y, b.vel.z, b.bodynode.mass);
         assert(nbPositionValid(b.bodynode.pos));
-        pushBody(luaSt, &b);
-        lua_rawseti(luaSt, table, i + 1);
+        bodies[i] = b;
     }
     
     
@@ -161,7 +159,7 @@ static int nbGenerateManualBodiescore(lua_State* luaSt, const char* body_file)
     free(vz);
     free(masses);
     free(id);
-    return 1;             
+    return pushBodyBlock(luaSt, bodies, nbody);
         
 }
 
@@ -31,6 +31,7 @@ their copyright to their programs which execute similar algorithms.
 #include "nbody_lua_types.h"
 #include "nbody_dwarf_potential.h"
 #include "nbody_mixeddwarf.h"
+#include "nbody_eddington.h"
 #include "nbody_types.h"
 #include "nbody_potential_types.h"
 
@@ -197,70 +198,6 @@ static real gauss_quad(real (*func)(real, const Dwarf*, const Dwarf*, real), rea
     return intv;
 }
 
-static inline real max_finder(real (*profile)(real , real , const Dwarf*, const Dwarf*), real r, const Dwarf* comp1, const Dwarf* comp2, real a, real b, real c, int limit, real tolerance)
-{
-    /*this is a maxfinding routine to find the maximum of the density.
-     * It uses Golden Section Search as outlined in Numerical Recipes 3rd edition
-     */
-    real RATIO = 0.61803399;
-    real RATIO_COMPLEMENT = 1.0 - RATIO;
-    int counter = 0;
-    
-    real profile_x1, profile_x2, x0, x1, x2, x3;
-    x0 = a;
-    x3 = c;
-    
-    if (mw_fabs(b - c) > mw_fabs(b - a))
-    {
-        x1 = b;
-        x2 = b + (RATIO_COMPLEMENT * (c - b)); 
-    }
-    else
-    {
-        x2 = b;
-        x1 = b - (RATIO_COMPLEMENT * (b - a));
-    }
-
-    profile_x1 = -(*profile)(x1, r, comp1, comp2);
-    profile_x2 = -(*profile)(x2, r, comp1, comp2);
-    
-    while (mw_fabs(x3 - x0) > (tolerance * (mw_fabs(x1) + mw_fabs(x2)) ) )
-    {
-        counter++;
-        if (profile_x2 < profile_x1)
-        {
-            x0 = x1;
-            x1 = x2;
-            x2 = RATIO * x2 + RATIO_COMPLEMENT * x3;
-            profile_x1 = (real)profile_x2;
-            profile_x2 = -(*profile)(x2, r, comp1, comp2);
-        }
-        else
-        {
-            x3 = x2;
-            x2 = x1;
-            x1 = RATIO * x1 + RATIO_COMPLEMENT * x0;
-            profile_x2 = (real)profile_x1;
-            profile_x1 = -(*profile)(x1, r, comp1, comp2);
-        }
-        
-        if(counter > limit)
-        {
-            break;
-        }
-    }
-
-    if (profile_x1 < profile_x2)
-    {
-        return (-profile_x1);
-    }
-    else
-    {
-        return (-profile_x2);
-    }
-}
-
-
 static inline real root_finder(real (*func)(real, const Dwarf*, const Dwarf*), const Dwarf* comp1, const Dwarf* comp2, real function_value, real lower_bound, real upper_bound)
 {
     //requires lower_bound and upper_bound to evaluate to opposite sign when func-function_value
@@ -427,36 +364,24 @@ static real fun(real ri, const Dwarf* comp1, const Dwarf* comp2, real energy)
         
 }
 
-static inline real find_upperlimit_r(const Dwarf* comp1, const Dwarf* comp2, real energy, real search_range, real r)
+static inline real find_upperlimit_r(const Dwarf* comp1, const Dwarf* comp2, real energy, real search_range)
 {
-    int counter = 0;
-    real upperlimit_r = 0.0;
-
-    do
-    {
-        upperlimit_r = root_finder(potential, comp1, comp2, energy, 0.0, search_range); 
+    /* The search starts just off of r = 0, where the nfw potential is 0 / 0. 
+     * root_finder returns 0 if it can't find psi(r) = energy in the search range.
+     */
+    real upperlimit_r = root_finder(potential, comp1, comp2, energy, 1.0e-6 * search_range, search_range);
 
-        if(isinf(upperlimit_r) == FALSE && upperlimit_r != 0.0 && isnan(upperlimit_r) == FALSE){break;}
-        
-        counter++;
-        
-        if(counter > 100)
-        {
-            upperlimit_r = r;
-            break;
-        }
-        
-    }while(1);
-        
     return mw_fabs(upperlimit_r);
 }
  
-static inline real dist_fun(real v, real r, const Dwarf* comp1, const Dwarf* comp2)
+static real dist_fun(real energy, const void* model)
 {
-    /*This returns the value of the distribution function*/
+    /*This returns the value of the distribution function at a given energy*/
     
     //-------------------------------
-    real mass_l   = comp1->mass; //comp1[0]; /*mass of the light component*/
+    const Dwarf* const * comps = (const Dwarf* const *) model;
+    const Dwarf* comp1 = comps[0];
+    const Dwarf* comp2 = comps[1];
     real mass_d   = comp2->mass; //comp2[0]; /*mass of the dark component*/
     real rscale_l = comp1->scaleLength; //comp1[1]; /*scale radius of the light component*/
     real rscale_d = comp2->scaleLength; //comp2[1]; /*scale radius of the dark component*/
@@ -466,15 +391,11 @@ static inline real dist_fun(real v, real r, const Dwarf* comp1, const Dwarf* com
     real distribution_function = 0.0;
 //     real cons = inv( (mw_sqrt(8.0) * sqr(M_PI)) );
     real cons = 0.03582244801567226;
-    real energy = 0.0;
     real upperlimit_r = 0.0;
     real lowerlimit_r = 0.0; 
     int counter = 0;
     real search_range = 0.0;   
     
-    /*energy as defined in binney*/
-    energy = potential(r, comp1, comp2) - 0.5 * v * v; 
-    
     /*this starting point is 20 times where the dark matter component is equal to the energy, since the dark matter dominates*/
     search_range = 20.0 * mw_sqrt( mw_fabs( sqr(mass_d / energy) - sqr(rscale_d) ));
     
@@ -502,14 +423,19 @@ static inline real dist_fun(real v, real r, const Dwarf* comp1, const Dwarf* com
         }
         counter++;
     }
-    upperlimit_r = find_upperlimit_r(comp1, comp2, energy, search_range, r);
+    upperlimit_r = find_upperlimit_r(comp1, comp2, energy, search_range);
+    if (!(upperlimit_r > 0.0))
+    {
+        return 0.0;
+    }
+    
     /* This lowerlimit should be good enough. In the important case where the upperlimit is small (close to the singularity in the integrand)
      * then 5 times it is already where the integrand is close to 0 since it goes to 0 quickly. 
      */
     lowerlimit_r = 10.0 * (upperlimit_r);
 
     /*This calls guassian quad to integrate the function for a given energy*/
-    distribution_function = v * v * cons * gauss_quad(fun, lowerlimit_r, upperlimit_r, comp1, comp2, energy);
+    distribution_function = cons * gauss_quad(fun, lowerlimit_r, upperlimit_r, comp1, comp2, energy);
     return distribution_function;
 }
 
@@ -552,7 +478,7 @@ static inline real r_mag(dsfmt_t* dsfmtState, const Dwarf* comp, real rho_max, r
     return r;
 }
 
-static inline real vel_mag(real r, const Dwarf* comp1, const Dwarf* comp2, dsfmt_t* dsfmtState)
+static inline real vel_mag(real r, const Dwarf* comp1, const Dwarf* comp2, const EddingtonTable* table, dsfmt_t* dsfmtState)
 {
     
     /*
@@ -564,18 +490,20 @@ static inline real vel_mag(real r, const Dwarf* comp1, const Dwarf* comp2, dsfmt
     
     int counter = 0;
     real v, u, d;
+    real psi = potential( r, comp1, comp2);
     
     /* having the upper limit as exactly v_esc is bad since the dist fun seems to blow up there for small r. */
-    real v_esc = 0.99 * mw_sqrt( mw_fabs(2.0 * potential( r, comp1, comp2) ) );
+    real v_esc = 0.99 * mw_sqrt( mw_fabs(2.0 * psi) );
     
-    real dist_max = max_finder(dist_fun, r, comp1, comp2, 0.0, 0.5 * v_esc, v_esc, 10, 1.0e-2);
+    /* the distribution function of the speed is v^2 f(E), with E = psi(r) - v^2 / 2 */
+    real dist_max = nbEddingtonMaxDistFun(table, psi, v_esc);
     while(1)
     {
 
         v = (real)mwXrandom(dsfmtState, 0.0, 1.0) * v_esc;
         u = (real)mwXrandom(dsfmtState, 0.0, 1.0);
 
-        d = dist_fun(v, r, comp1, comp2);
+        d = v * v * nbEddingtonDistFun(table, psi - 0.5 * v * v);
         
         if(mw_fabs(d / dist_max) > u)
         {
@@ -705,7 +633,7 @@ static inline void get_extra_nfw_mass(Dwarf* comp, real bound)
 /*      DWARF GENERATION        */
 static int nbGenerateMixedDwarfCore(lua_State* luaSt, dsfmt_t* prng, unsigned int nbody, 
                                      Dwarf* comp1,  Dwarf* comp2, 
-                                    mwbool ignore, mwvector rShift, mwvector vShift)
+                                    mwbool ignore, mwbool parallel, mwvector rShift, mwvector vShift)
 {
     /* generatePlummer: generate Plummer model initial conditions for test
     * runs, scaled to units such that M = -4E = G = 1 (Henon, Heggie,
@@ -713,8 +641,10 @@ static int nbGenerateMixedDwarfCore(lua_State* luaSt, dsfmt_t* prng, unsigned in
     * 183.
     */
         unsigned int i;
-        int table;
+        int block, n_blocks;
+        uint32_t seed = 0;
         Body b;
+        Body* bodies;
         real r, v;
  
         real * x  = mwCalloc(nbody, sizeof(real));
@@ -790,69 +720,109 @@ static int nbGenerateMixedDwarfCore(lua_State* luaSt, dsfmt_t* prng, unsigned in
         rho_max_light = sqr(rho_max_light) * get_density(comp1, rho_max_light);
         rho_max_dark  = sqr(rho_max_dark)  * get_density(comp2, rho_max_dark);
         
+        /*the distribution function only depends on energy, so it is tabulated once for the whole model.
+         * energies of bodies very close to the center, or very close to escaping, are outside of the table.
+         */
+        EddingtonTable df_table;
+        const Dwarf* comps[2] = {comp1, comp2};
+        real bound = bound1 > bound2 ? bound1 : bound2;
+        real r_table_min = 0.2 * (rscale_l < rscale_d ? rscale_l : rscale_d);
+        nbMakeEddingtonTable(&df_table, dist_fun, comps, 1.0e-3 * potential(bound, comp1, comp2), potential(r_table_min, comp1, comp2));
+        
      /*initializing particles:*/
         memset(&b, 0, sizeof(b));
-        lua_createtable(luaSt, nbody, 0);
-        table = lua_gettop(luaSt);      
+        bodies = (Body*) mwMallocA(nbody * sizeof(Body));
         int counter = 0;
         
 
+        /*with parallel set, each block of bodies is drawn from its own stream seeded from prng.
+         * the model is then the same for any number of threads.
+         */
+        if(parallel)
+        {
+            seed = nbBlockSeed(prng);
+            n_blocks = (int) ((nbody + NBODY_IC_BLOCK_SIZE - 1) / NBODY_IC_BLOCK_SIZE);
+        }
+        else
+        {
+            n_blocks = 1;
+        }
+
         /*getting the radii and velocities for the bodies*/
-        for (i = 0; i < nbody; i++)
+      #ifdef _OPENMP
+        #pragma omp parallel for private(i, r, v, vec, counter) schedule(dynamic) if(parallel)
+      #endif
+        for (block = 0; block < n_blocks; block++)
         {
-            counter = 0;
-            do
+            dsfmt_t block_state;
+            dsfmt_t* rng = prng;
+            unsigned int first = 0;
+            unsigned int last = nbody;
+
+            if(parallel)
             {
-                
-                if(i < half_bodies)
-                {
-                    r = r_mag(prng, comp1, rho_max_light, bound1);
-                    masses[i] = mass_light_particle;
-                }
-                else if(i >= half_bodies)
+                nbInitBlockPRNG(&block_state, seed, (unsigned int) block);
+                rng = &block_state;
+                first = (unsigned int) block * NBODY_IC_BLOCK_SIZE;
+                last = first + NBODY_IC_BLOCK_SIZE < nbody ? first + NBODY_IC_BLOCK_SIZE : nbody;
+            }
+
+            for (i = first; i < last; i++)
+            {
+                counter = 0;
+                do
                 {
-                    r = r_mag(prng, comp2, rho_max_dark, bound2);
-                    masses[i] = mass_dark_particle;
-                }
-                /*to ensure that r is finite and nonzero*/
-                if(isinf(r) == FALSE && r != 0.0 && isnan(r) == FALSE){break;}
                 
-                if(counter > 1000)
-                {
-                    exit(-1);
-                }
-                else
-                {
-                    counter++;
-                }
+                    if(i < half_bodies)
+                    {
+                        r = r_mag(rng, comp1, rho_max_light, bound1);
+                        masses[i] = mass_light_particle;
+                    }
+                    else if(i >= half_bodies)
+                    {
+                        r = r_mag(rng, comp2, rho_max_dark, bound2);
+                        masses[i] = mass_dark_particle;
+                    }
+                    /*to ensure that r is finite and nonzero*/
+                    if(isinf(r) == FALSE && r != 0.0 && isnan(r) == FALSE){break;}
                 
-            }while (1);
+                    if(counter > 1000)
+                    {
+                        exit(-1);
+                    }
+                    else
+                    {
+                        counter++;
+                    }
+                
+                }while (1);
             
 //             mw_printf("\rvelocity of particle %i", i + 1);
-            counter = 0;
-            do
-            {
-                v = vel_mag(r, comp1, comp2, prng);
-                if(isinf(v) == FALSE && v != 0.0 && isnan(v) == FALSE){break;}
-                
-                if(counter > 1000)
-                {
-                    exit(-1);
-                }
-                else
+                counter = 0;
+                do
                 {
-                    counter++;
-                }
+                    v = vel_mag(r, comp1, comp2, &df_table, rng);
+                    if(isinf(v) == FALSE && v != 0.0 && isnan(v) == FALSE){break;}
                 
-            }while (1);
-            vec = get_components(prng, v);   
-            vx[i] = vec.x;
-            vy[i] = vec.y;
-            vz[i] = vec.z;
-            vec = get_components(prng, r);  
-            x[i] = vec.x;
-            y[i] = vec.y;
-            z[i] = vec.z;
+                    if(counter > 1000)
+                    {
+                        exit(-1);
+                    }
+                    else
+                    {
+                        counter++;
+                    }
+                
+                }while (1);
+                vec = get_components(rng, v);   
+                vx[i] = vec.x;
+                vy[i] = vec.y;
+                vz[i] = vec.z;
+                vec = get_components(rng, r);  
+                x[i] = vec.x;
+                y[i] = vec.y;
+                z[i] = vec.z;
+            }
         }
         
         /* getting the center of mass and momentum correction */
@@ -873,7 +843,7 @@ static int nbGenerateMixedDwarfCore(lua_State* luaSt, dsfmt_t* prng, unsigned in
             }
             
             b.bodynode.mass = masses[i];
-            /*this actually gets the position and velocity vectors and pushes table of bodies*/
+            /*this actually gets the position and velocity vectors and fills the block of bodies*/
             /*They are meant to give the dwarf an initial position and vel*/
             /* you have to work for your bodynode */
             b.bodynode.pos.x = x[i];
@@ -885,11 +855,11 @@ static int nbGenerateMixedDwarfCore(lua_State* luaSt, dsfmt_t* prng, unsigned in
             b.vel.z = vz[i];
             
             assert(nbPositionValid(b.bodynode.pos));
-            pushBody(luaSt, &b);
-            lua_rawseti(luaSt, table, i + 1);
+            bodies[i] = b;
         }
         
         /* go now and be free!*/
+        nbFreeEddingtonTable(&df_table);
         free(x);
         free(y);
         free(z);
@@ -898,7 +868,7 @@ static int nbGenerateMixedDwarfCore(lua_State* luaSt, dsfmt_t* prng, unsigned in
         free(vz);
         free(masses);
         
-        return 1;             
+        return pushBodyBlock(luaSt, bodies, nbody);
         
 }
 
@@ -908,6 +878,7 @@ int nbGenerateMixedDwarf(lua_State* luaSt)
         static const mwvector* position = NULL;
         static const mwvector* velocity = NULL;
         static mwbool ignore;
+        static mwbool parallel;
         static real nbodyf = 0.0;
         static Dwarf* comp1 = NULL;
         static Dwarf* comp2 = NULL;
@@ -919,6 +890,7 @@ int nbGenerateMixedDwarf(lua_State* luaSt)
             { "position",             LUA_TUSERDATA,   MWVECTOR_TYPE,           TRUE,    &position          },
             { "velocity",             LUA_TUSERDATA,   MWVECTOR_TYPE,           TRUE,    &velocity          },
             { "ignore",               LUA_TBOOLEAN,    NULL,                    FALSE,   &ignore            },
+            { "parallel",             LUA_TBOOLEAN,    NULL,                    FALSE,   &parallel          },
             { "prng",                 LUA_TUSERDATA,   DSFMT_TYPE,              TRUE,    &prng              },
             END_MW_NAMED_ARG
             
@@ -927,9 +899,10 @@ int nbGenerateMixedDwarf(lua_State* luaSt)
         if (lua_gettop(luaSt) != 1)
             return luaL_argerror(luaSt, 1, "Expected 1 arguments");
         
+        parallel = FALSE;
         handleNamedArgumentTable(luaSt, argTable, 1);
         
-        return nbGenerateMixedDwarfCore(luaSt, prng, (unsigned int) nbodyf, comp1, comp2, ignore,
+        return nbGenerateMixedDwarfCore(luaSt, prng, (unsigned int) nbodyf, comp1, comp2, ignore, parallel,
                                                                  *position, *velocity);
 }
 
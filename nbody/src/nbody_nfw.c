@@ -146,8 +146,8 @@ static int nbGenerateNFWCore(lua_State* luaSt,
                              real R_S)
 {
     unsigned int i;
-    int table;
     Body b;
+    Body* bodies;
     real r;
     real totalMass = 0.0;
     real radius = 0.0;
@@ -160,9 +160,7 @@ static int nbGenerateNFWCore(lua_State* luaSt,
     b.bodynode.mass = mass / nbody;    /* Mass per particle */
 
 
-    lua_createtable(luaSt, nbody, 0);
-    table = lua_gettop(luaSt);
-
+    bodies = (Body*) mwMallocA(nbody * sizeof(Body));
 
     /* Start with half an epsilon */
     totalMass = 0.5 * massEpsilon;
@@ -184,11 +182,10 @@ static int nbGenerateNFWCore(lua_State* luaSt,
         b.vel = nfwBodyVelocity(prng, vShift, r, rho_0, R_S);
         assert(nbPositionValid(b.bodynode.pos));
 
-        pushBody(luaSt, &b);
-        lua_rawseti(luaSt, table, i + 1);
+        bodies[i] = b;
     }
 
-    return 1;
+    return pushBodyBlock(luaSt, bodies, nbody);
 }
 
 int nbGenerateNFW(lua_State* luaSt)
@@ -29,6 +29,7 @@
 #include "nbody_histogram.h"
 #include "nbody_likelihood.h"
 #include "nbody_devoptions.h"
+#include "nbody_tree.h"
 
 #ifdef NBODY_BLENDER_OUTPUT
   #include "blender_visualizer.h"
@@ -55,14 +56,24 @@ static void nbReportProgress(const NBodyCtx* ctx, NBodyState* st)
 
 static NBodyStatus nbCheckpoint(const NBodyCtx* ctx, NBodyState* st)
 {
-    if (nbTimeToCheckpoint(ctx, st))
+    mwbool busy;
+
+    /* Checkpoints are written in the background. Don't stall on a second
+       one still waiting behind the one being written */
+    if (nbFinishCheckpoint(st, FALSE, &busy))
     {
-        if (nbWriteCheckpoint(ctx, st))
+        return NBODY_CHECKPOINT_ERROR;
+    }
+
+    if (!busy && nbTimeToCheckpoint(ctx, st))
+    {
+        /* Checkpoints always hold the bodies in their original order */
+        nbRestoreBodyOrder(st);
+
+        if (nbStartCheckpoint(ctx, st))
         {
             return NBODY_CHECKPOINT_ERROR;
         }
-
-        mw_checkpoint_completed();
     }
 
     return NBODY_SUCCESS;
@@ -120,97 +131,309 @@ static inline void advanceVelocities(NBodyState* st, const int nbody, const real
     }
 }
 
+/* Block timesteps: Each body steps with timestep / 2^k, for the
+ * smallest level k whose step is within sqrt(2 eta eps / |a|), so the
+ * bodies in the dense core take small steps while the rest of the
+ * stream takes the full timestep. a is the acceleration from the other
+ * bodies only. The external potential hardly changes over a softening
+ * length, and the full timestep must already be short enough for it.
+ *
+ * One call advances every body by ctx->timestep in 2^(levels - 1)
+ * substeps of the smallest step. All bodies drift on every substep,
+ * but only the ones whose step ends get forces and kicks. The closing
+ * half kick of a step and the opening half kick of the next use the
+ * same forces, so they are done together. A body can move to a smaller
+ * step whenever its step ends, and to a larger one if that step would
+ * start at the same time. Every step ends on the last substep, so the
+ * levels for the next call are chosen there.
+ *
+ * The bodies are kept sorted by level, smallest step first. The bodies
+ * active on a substep are those at some level and above, which are the
+ * start of the list, so finding them and sorting them again after
+ * their levels change only touches the active bodies.
+ */
 
-static inline int get_likelihood(const NBodyCtx* ctx, NBodyState* st, const NBodyFlags* nbf)
+static unsigned int nbTimestepLevel(const NBodyCtx* ctx, mwvector selfAcc, unsigned int minLevel, unsigned int nLevel)
 {
-    NBodyHistogram* data = NULL;
-    NBodyHistogram* histogram = NULL;
-    real likelihood = NAN;
-    NBodyLikelihoodMethod method;
-    HistogramParams hp;
-    
-    mwbool calculateLikelihood = (nbf->histogramFileName != NULL);
-    
-    
-    if (calculateLikelihood || nbf->histoutFileName || nbf->printHistogram)
+    unsigned int k = minLevel;
+    real dt = ctx->timestep / (real) (1u << k);
+    const real aMag = mw_absv(selfAcc);
+    const real limit = 2.0 * ctx->timestepAccuracy * mw_sqrt(ctx->eps2);
+
+    /* dt <= sqrt(2 eta eps / |a|) */
+    while (k + 1 < nLevel && sqr(dt) * aMag > limit)
     {
-        if (nbGetLikelihoodInfo(nbf, &hp, &method) || method == NBODY_INVALID_METHOD)
-        {
-            /* this would normally return a print statement 
-             * but I do not want to overload the output since 
-             * this would run every time step.
-             */
-            return 0;
-        }
+        ++k;
+        dt *= 0.5;
     }
-    
-    if (calculateLikelihood)
+
+    return k;
+}
+
+/* Smallest level with a step starting at substep s */
+static inline unsigned int nbMinTimestepLevel(unsigned int s, unsigned int nSub)
+{
+    unsigned int k = 0;
+
+    while (s % (nSub >> k) != 0)
     {
-        
-        histogram = nbCreateHistogram(ctx, st, &hp);
- 
-        if (!histogram)
-        {
-            /* this would normally return a print statement 
-             * but I do not want to overload the output since 
-             * this would run every time step.
-             */
-            return 0;
-        }
-        
-        data = nbReadHistogram(nbf->histogramFileName);
-        
-        if (!data)
+        ++k;
+    }
+
+    return k;
+}
+
+/* Sort the n listed bodies, which are all at minLevel or above, by
+ * level into order, smallest step first. count[k] gets the number of
+ * them at level k for k >= minLevel. */
+static void nbSortByTimestepLevel(const unsigned char* level,
+                                  const int* bodies,
+                                  int n,
+                                  int* order,
+                                  int* count,
+                                  unsigned int minLevel,
+                                  unsigned int nLevel)
+{
+    int i;
+    unsigned int k;
+    int start[NBODY_MAX_TIMESTEP_LEVELS];
+
+    for (k = minLevel; k < nLevel; ++k)
+    {
+        count[k] = 0;
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        ++count[level[bodies[i]]];
+    }
+
+    start[nLevel - 1] = 0;
+    for (k = nLevel - 1; k > minLevel; --k)
+    {
+        start[k - 1] = start[k] + count[k];
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        order[start[level[bodies[i]]]++] = bodies[i];
+    }
+}
+
+static void nbDriftAll(NBodyState* st, real dt)
+{
+    int i;
+    const int nbody = st->nbody;
+    Body* bodies = st->bodytab;
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) schedule(static)
+  #endif
+    for (i = 0; i < nbody; ++i)
+    {
+        bodyAdvancePos(&bodies[i], dt);
+    }
+}
+
+/* Tree for the forces of a substep. The first one of the step follows
+ * treeRebuildInterval like nbGravMap(). If the tree is being refit,
+ * the later substeps refit it as well. */
+static NBodyStatus nbBlockTree(const NBodyCtx* ctx, NBodyState* st, mwbool haveTree)
+{
+    if (ctx->criterion == Exact)
+    {
+        return NBODY_SUCCESS;
+    }
+
+    if (ctx->treeRebuildInterval > 1)
+    {
+        return nbRefitOrMakeTree(ctx, st, (haveTree && !st->treeIncest) || nbKeepTree(ctx, st));
+    }
+
+    return nbMakeTree(ctx, st);
+}
+
+static NBodyStatus nbStepSystemBlock(const NBodyCtx* ctx, NBodyState* st)
+{
+    NBodyStatus rc = NBODY_SUCCESS;
+    const int nbody = st->nbody;
+    const unsigned int nLevel = (ctx->timestepLevels < NBODY_MAX_TIMESTEP_LEVELS) ? ctx->timestepLevels : NBODY_MAX_TIMESTEP_LEVELS;
+    const unsigned int nSub = 1u << (nLevel - 1);
+    const real dtMin = ctx->timestep / (real) nSub;
+    int count[NBODY_MAX_TIMESTEP_LEVELS];
+    int* order;
+    int* active;
+    mwvector* selfAcc;
+    mwbool haveTree = FALSE;
+    unsigned int s, k, minLevel;
+    int i, nActive;
+
+    order = st->activeBodies;
+    active = (int*) mwMalloc(nbody * sizeof(int));
+    selfAcc = (mwvector*) mwMallocA(nbody * sizeof(mwvector));
+
+    for (i = 0; i < nbody; ++i)
+    {
+        active[i] = i;
+    }
+
+    if (!st->timestepLevel)
+    {
+        /* The first step needs the forces from the other bodies alone
+         * to choose the levels */
+        st->timestepLevel = (unsigned char*) mwMalloc(nbody * sizeof(unsigned char));
+        order = st->activeBodies = (int*) mwMalloc(nbody * sizeof(int));
+
+        rc |= nbBlockTree(ctx, st, FALSE);
+        if (!nbStatusIsFatal(rc))
+            rc |= nbGravMapBodies(ctx, st, active, nbody, selfAcc);
+        if (nbStatusIsFatal(rc))
+            goto done;
+        haveTree = TRUE;
+
+        for (i = 0; i < nbody; ++i)
         {
-            free(histogram);
-            /* if the input histogram does not exist, I do not want the 
-             * simulation to terminate as you can still get the output file
-             * from it. Therefore, this function will end here but with 0
-             */
-            return 0;
+            st->timestepLevel[i] = (unsigned char) nbTimestepLevel(ctx, selfAcc[i], 0, nLevel);
         }
-        likelihood = nbSystemLikelihood(st, data, histogram, method);
-
-        /*
-          Used to fix Windows platform issues.  Windows' infinity is expressed as:
-          1.#INF00000, -1.#INF00000, or 0.#INF000000.  The server reads these as -1, 1, and 0
-          respectively, accounting for the sign change.  Thus, I have changed overflow
-          infinities (not errors) to be the worst case.  The worst case is now the actual
-          worst thing that can happen.
-
-        * It previous returned the worse case when the likelihood == 0. 
-        * Changed it to be best case, 1e-9 which has been added in nbody_defaults.h
-        */
-        if (likelihood > DEFAULT_WORST_CASE || likelihood < (-1 * DEFAULT_WORST_CASE) || isnan(likelihood))
+    }
+
+    /* Every body starts a step. The bodies may have been reordered
+     * since the levels were chosen, which moves their levels with them */
+    nbSortByTimestepLevel(st->timestepLevel, active, nbody, order, count, 0, nLevel);
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) schedule(static)
+  #endif
+    for (i = 0; i < nbody; ++i)
+    {
+        unsigned int period = nSub >> st->timestepLevel[i];
+        bodyAdvanceVel(&st->bodytab[i], st->acctab[i], 0.5 * dtMin * (real) period);
+    }
+
+    for (s = 0; s < nSub; ++s)
+    {
+        nbDriftAll(st, dtMin);
+
+        /* Steps of level minLevel and smaller end here */
+        minLevel = nbMinTimestepLevel(s + 1, nSub);
+        nActive = 0;
+        for (k = minLevel; k < nLevel; ++k)
         {
-            likelihood = DEFAULT_WORST_CASE;
+            nActive += count[k];
         }
-        else if(likelihood == 0.0)
+
+        if (nActive == 0)
         {
-            likelihood = DEFAULT_BEST_CASE;
+            continue;
         }
 
-        /* this checks to see if the likelihood is an improvement */
-        if(mw_fabs(likelihood) < mw_fabs(st->bestLikelihood))
+        rc |= nbBlockTree(ctx, st, haveTree);
+        if (nbStatusIsFatal(rc))
+            goto done;
+        haveTree = TRUE;
+
+        rc |= nbGravMapBodies(ctx, st, order, nActive, selfAcc);
+        if (nbStatusIsFatal(rc))
+            goto done;
+
+      #ifdef _OPENMP
+        #pragma omp parallel for private(i) schedule(static)
+      #endif
+        for (i = 0; i < nActive; ++i)
         {
-            st->bestLikelihood = likelihood;
-            
-            /* Calculating the time that the best likelihood occurred */
-            st->bestLikelihood_time = ((real) st->step / (real) ctx->nStep) * ctx->timeEvolve;
-            
-            /* checking how many times the likelihood was improved */
-            st->bestLikelihood_count++;
-            
-            /* if it is an improvement then write out this histogram */
-            if (nbf->histoutFileName)
+            const int b = order[i];
+            real dtKick = 0.5 * dtMin * (real) (nSub >> st->timestepLevel[b]);
+
+            st->timestepLevel[b] = (unsigned char) nbTimestepLevel(ctx, selfAcc[i], minLevel, nLevel);
+
+            /* Close this step and open the next one, which ends after
+             * the last substep if it starts there */
+            if (s + 1 < nSub)
             {
-                nbWriteHistogram(nbf->histoutFileName, ctx, st, histogram);
+                dtKick += 0.5 * dtMin * (real) (nSub >> st->timestepLevel[b]);
             }
+
+            bodyAdvanceVel(&st->bodytab[b], st->acctab[b], dtKick);
+        }
+
+        memcpy(active, order, nActive * sizeof(int));
+        nbSortByTimestepLevel(st->timestepLevel, active, nActive, order, count, minLevel, nLevel);
+    }
+
+done:
+    free(active);
+    mwFreeA(selfAcc);
+
+    return rc;
+}
+
+static inline int get_likelihood(const NBodyCtx* ctx, NBodyState* st, const NBodyFlags* nbf)
+{
+    NBodyHistogram* histogram = NULL;
+    real likelihood = NAN;
+    const NBodyDataHistogram* dataHist = st->dataHist;
+
+    /* The data histogram is loaded once at the start of the run. If
+     * there is no input histogram, or it could not be read, there is
+     * nothing to compare against. I do not want the simulation to
+     * terminate as you can still get the output file from it.
+     */
+    if (!nbf->histogramFileName || !dataHist)
+    {
+        return 0;
+    }
+
+    histogram = nbCreateHistogram(ctx, st, &dataHist->hp);
+
+    if (!histogram)
+    {
+        /* this would normally return a print statement 
+         * but I do not want to overload the output since 
+         * this would run every time step.
+         */
+        return 0;
+    }
+
+    likelihood = nbSystemLikelihoodPrepared(st, dataHist, histogram);
+
+    /*
+      Used to fix Windows platform issues.  Windows' infinity is expressed as:
+      1.#INF00000, -1.#INF00000, or 0.#INF000000.  The server reads these as -1, 1, and 0
+      respectively, accounting for the sign change.  Thus, I have changed overflow
+      infinities (not errors) to be the worst case.  The worst case is now the actual
+      worst thing that can happen.
+
+    * It previous returned the worse case when the likelihood == 0. 
+    * Changed it to be best case, 1e-9 which has been added in nbody_defaults.h
+    */
+    if (likelihood > DEFAULT_WORST_CASE || likelihood < (-1 * DEFAULT_WORST_CASE) || isnan(likelihood))
+    {
+        likelihood = DEFAULT_WORST_CASE;
+    }
+    else if(likelihood == 0.0)
+    {
+        likelihood = DEFAULT_BEST_CASE;
+    }
+
+    /* this checks to see if the likelihood is an improvement */
+    if(mw_fabs(likelihood) < mw_fabs(st->bestLikelihood))
+    {
+        st->bestLikelihood = likelihood;
+        
+        /* Calculating the time that the best likelihood occurred */
+        st->bestLikelihood_time = ((real) st->step / (real) ctx->nStep) * ctx->timeEvolve;
+        
+        /* checking how many times the likelihood was improved */
+        st->bestLikelihood_count++;
+        
+        /* if it is an improvement then write out this histogram */
+        if (nbf->histoutFileName)
+        {
+            nbWriteHistogram(nbf->histoutFileName, ctx, st, histogram);
         }
     }
     
     free(histogram);
-    free(data);
     return NBODY_SUCCESS;
     
 }
@@ -223,10 +446,22 @@ NBodyStatus nbStepSystemPlain(const NBodyCtx* ctx, NBodyState* st)
     
     const real dt = ctx->timestep;
 
-    advancePosVel(st, st->nbody, dt);
+    if (ctx->reorderInterval > 0 && st->step % ctx->reorderInterval == 0)
+    {
+        nbReorderBodies(st);
+    }
+
+    if (ctx->timestepLevels > 1)
+    {
+        rc = nbStepSystemBlock(ctx, st);
+    }
+    else
+    {
+        advancePosVel(st, st->nbody, dt);
 
-    rc = nbGravMap(ctx, st);
-    advanceVelocities(st, st->nbody, dt);
+        rc = nbGravMap(ctx, st);
+        advanceVelocities(st, st->nbody, dt);
+    }
 
     st->step++;
     #ifdef NBODY_BLENDER_OUTPUT
@@ -261,6 +496,13 @@ NBodyStatus nbRunSystemPlain(const NBodyCtx* ctx, NBodyState* st, const NBodyFla
     real Nstep = ctx->nStep;
     
     st->bestLikelihood = DEFAULT_WORST_CASE; //initializing it.
+
+    /* Read and preprocess the data histogram once instead of every
+     * step of the best likelihood search */
+    if (ctx->useBestLike && nbf->histogramFileName && !st->dataHist)
+    {
+        st->dataHist = nbLoadDataHistogram(nbf);
+    }
     
     while (st->step < ctx->nStep)
     {
@@ -289,17 +531,24 @@ NBodyStatus nbRunSystemPlain(const NBodyCtx* ctx, NBodyState* st, const NBodyFla
         }
     
         if (nbStatusIsFatal(rc))   /* advance N-body system */
-            return rc;
+            break;
 
         rc |= nbCheckpoint(ctx, st);
         if (nbStatusIsFatal(rc))
-            return rc;
+            break;
         /* We report the progress at step + 1. 0 is the original
            center of mass. */
         nbReportProgress(ctx, st);
         nbUpdateDisplayedBodies(ctx, st);
     }
     
+    /* Outputs list the bodies in the order they were created in, even
+     * when the run stopped with an error */
+    nbRestoreBodyOrder(st);
+
+    if (nbStatusIsFatal(rc))
+        return rc;
+
     #ifdef NBODY_BLENDER_OUTPUT
         blenderPrintMisc(st, ctx, startCmPos, perpendicularCmPos);
     #endif
@@ -105,6 +105,11 @@ static inline mwvector plummerBodyVelocity(dsfmt_t* dsfmtState, mwvector vshift,
  * runs, scaled to units such that M = -4E = G = 1 (Henon, Hegge,
  * etc).  See Aarseth, SJ, Henon, M, & Wielen, R (1974) Astr & Ap, 37,
  * 183.
+ *
+ * With parallel set, each block of NBODY_IC_BLOCK_SIZE bodies is drawn
+ * from its own stream seeded from prng. The model is then the same for
+ * any number of threads, but is a different realization than the
+ * serial one.
  */
 static int nbGeneratePlummerCore(lua_State* luaSt,
 
@@ -113,15 +118,18 @@ static int nbGeneratePlummerCore(lua_State* luaSt,
                                  real mass,
 
                                  mwbool ignore,
+                                 mwbool parallel,
 
                                  mwvector rShift,
                                  mwvector vShift,
                                  real radiusScale)
 {
     unsigned int i;
-    int table;
+    int block, nBlock;
+    uint32_t seed = 0;
     Body b;
-    real r, velScale;
+    Body* bodies;
+    real velScale;
 
     memset(&b, 0, sizeof(b));
 
@@ -130,31 +138,58 @@ static int nbGeneratePlummerCore(lua_State* luaSt,
     b.bodynode.type = BODY(ignore);    /* Same for all in the model */
     b.bodynode.mass = mass / nbody;    /* Mass per particle */
 
-    lua_createtable(luaSt, nbody, 0);
-    table = lua_gettop(luaSt);
+    bodies = (Body*) mwMallocA(nbody * sizeof(Body));
 
-    for (i = 0; i < nbody; ++i)
+    if (parallel)
     {
-        do
+        seed = nbBlockSeed(prng);
+        nBlock = (int) ((nbody + NBODY_IC_BLOCK_SIZE - 1) / NBODY_IC_BLOCK_SIZE);
+    }
+    else
+    {
+        nBlock = 1;
+    }
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(i) schedule(dynamic) if(parallel)
+  #endif
+    for (block = 0; block < nBlock; ++block)
+    {
+        dsfmt_t blockState;
+        dsfmt_t* rng = prng;
+        unsigned int first = 0;
+        unsigned int last = nbody;
+        real r;
+
+        if (parallel)
         {
-            r = plummerRandomR(prng);
-            /* FIXME: We should avoid the divide by 0.0 by multiplying
-             * the original random number by 0.9999.. but I'm too lazy
-             * to change the tests. Same with other models */
+            nbInitBlockPRNG(&blockState, seed, (unsigned int) block);
+            rng = &blockState;
+            first = (unsigned int) block * NBODY_IC_BLOCK_SIZE;
+            last = first + NBODY_IC_BLOCK_SIZE < nbody ? first + NBODY_IC_BLOCK_SIZE : nbody;
         }
-        while (isinf(r));
-        
-        b.bodynode.id = i + 1;
-        b.bodynode.pos = plummerBodyPosition(prng, rShift, radiusScale, r);
-        b.vel = plummerBodyVelocity(prng, vShift, velScale, r);
-
-        assert(nbPositionValid(b.bodynode.pos));
 
-        pushBody(luaSt, &b);
-        lua_rawseti(luaSt, table, i + 1);
+        for (i = first; i < last; ++i)
+        {
+            do
+            {
+                r = plummerRandomR(rng);
+                /* FIXME: We should avoid the divide by 0.0 by multiplying
+                 * the original random number by 0.9999.. but I'm too lazy
+                 * to change the tests. Same with other models */
+            }
+            while (isinf(r));
+
+            bodies[i] = b;
+            bodies[i].bodynode.id = i + 1;
+            bodies[i].bodynode.pos = plummerBodyPosition(rng, rShift, radiusScale, r);
+            bodies[i].vel = plummerBodyVelocity(rng, vShift, velScale, r);
+
+            assert(nbPositionValid(bodies[i].bodynode.pos));
+        }
     }
 
-    return 1;
+    return pushBodyBlock(luaSt, bodies, nbody);
 }
 
 int nbGeneratePlummer(lua_State* luaSt)
@@ -163,6 +198,7 @@ int nbGeneratePlummer(lua_State* luaSt)
     static const mwvector* position = NULL;
     static const mwvector* velocity = NULL;
     static mwbool ignore;
+    static mwbool parallel;
     static real mass = 0.0, nbodyf = 0.0, radiusScale = 0.0;
 
     static const MWNamedArg argTable[] =
@@ -173,6 +209,7 @@ int nbGeneratePlummer(lua_State* luaSt)
             { "position",     LUA_TUSERDATA, MWVECTOR_TYPE, TRUE,  &position    },
             { "velocity",     LUA_TUSERDATA, MWVECTOR_TYPE, TRUE,  &velocity    },
             { "ignore",       LUA_TBOOLEAN,  NULL,          FALSE, &ignore      },
+            { "parallel",     LUA_TBOOLEAN,  NULL,          FALSE, &parallel    },
             { "prng",         LUA_TUSERDATA, DSFMT_TYPE,    TRUE,  &prng        },
             END_MW_NAMED_ARG
         };
@@ -180,9 +217,10 @@ int nbGeneratePlummer(lua_State* luaSt)
     if (lua_gettop(luaSt) != 1)
         return luaL_argerror(luaSt, 1, "Expected 1 arguments");
 
+    parallel = FALSE;
     handleNamedArgumentTable(luaSt, argTable, 1);
 
-    return nbGeneratePlummerCore(luaSt, prng, (unsigned int) nbodyf, mass, ignore,
+    return nbGeneratePlummerCore(luaSt, prng, (unsigned int) nbodyf, mass, ignore, parallel,
                                  *position, *velocity, radiusScale);
 }
 
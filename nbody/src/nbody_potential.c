@@ -119,44 +119,62 @@ static inline mwvector triaxialHaloAccel(const Halo* h, mwvector pos, real r)
     return acc;
 }
 
-mwvector nbExtAcceleration(const Potential* pot, mwvector pos)
+static inline mwvector diskAccel(const Disk* disk, mwvector pos, real r)
 {
-    mwvector acc, acctmp;
-    const real r = mw_absv(pos);
-    /*Calculate the Disk Accelerations*/
-    switch (pot->disk.type)
+    mwvector acc;
+
+    switch (disk->type)
     {
         case ExponentialDisk:
-            acc = exponentialDiskAccel(&pot->disk, pos, r);
+            acc = exponentialDiskAccel(disk, pos, r);
             break;
         case MiyamotoNagaiDisk:
-            acc = miyamotoNagaiDiskAccel(&pot->disk, pos, r);
+            acc = miyamotoNagaiDiskAccel(disk, pos, r);
             break;
         case InvalidDisk:
         default:
             mw_fail("Invalid disk type in external acceleration\n");
     }
-    /*Calculate the Halo Accelerations*/
-    switch (pot->halo.type)
+
+    return acc;
+}
+
+static inline mwvector haloAccel(const Halo* halo, mwvector pos, real r)
+{
+    mwvector acc;
+
+    switch (halo->type)
     {
         case LogarithmicHalo:
-            acctmp = logHaloAccel(&pot->halo, pos, r);
+            acc = logHaloAccel(halo, pos, r);
             break;
         case NFWHalo:
-            acctmp = nfwHaloAccel(&pot->halo, pos, r);
+            acc = nfwHaloAccel(halo, pos, r);
             break;
         case TriaxialHalo:
-            acctmp = triaxialHaloAccel(&pot->halo, pos, r);
+            acc = triaxialHaloAccel(halo, pos, r);
             break;
         case CausticHalo:
-            acctmp = causticHaloAccel(&pot->halo, pos, r);
+            acc = causticHaloAccel(halo, pos, r);
             break;
         case InvalidHalo:
         default:
             mw_fail("Invalid halo type in external acceleration\n");
     }
 
-    mw_incaddv(acc, acctmp);
+    return acc;
+}
+
+static inline mwvector extAccelWithHalo(const Potential* pot, mwvector pos, real r, mwvector haloAcc)
+{
+    mwvector acc, acctmp;
+
+    /*Calculate the Disk Accelerations*/
+    acc = diskAccel(&pot->disk, pos, r);
+
+    /*Add the Halo Accelerations*/
+    mw_incaddv(acc, haloAcc);
+
     /*Calculate the Bulge Accelerations*/
     acctmp = sphericalAccel(&pot->sphere[0], pos, r);
     mw_incaddv(acc, acctmp);
@@ -164,6 +182,25 @@ mwvector nbExtAcceleration(const Potential* pot, mwvector pos)
     return acc;
 }
 
+mwvector nbExtAcceleration(const Potential* pot, mwvector pos)
+{
+    const real r = mw_absv(pos);
+
+    return extAccelWithHalo(pot, pos, r, haloAccel(&pot->halo, pos, r));
+}
+
+/* Acceleration of the halo alone */
+mwvector nbHaloAcceleration(const Potential* pot, mwvector pos)
+{
+    return haloAccel(&pot->halo, pos, mw_absv(pos));
+}
+
+/* Full acceleration, with the halo's part already known */
+mwvector nbExtAccelerationWithHalo(const Potential* pot, mwvector pos, mwvector haloAcc)
+{
+    return extAccelWithHalo(pot, pos, mw_absv(pos), haloAcc);
+}
+
 
 
 
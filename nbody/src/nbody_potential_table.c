@@ -0,0 +1,292 @@
+/*
+ *  Copyright (c) 2010-2011 Rensselaer Polytechnic Institute
+ *  Copyright (c) 2010-2011 Matthew Arsenault
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Tabulated external acceleration. Halos like the caustic and
+ * triaxial halos, or a potential given as a Lua function, cost more
+ * to evaluate for every body on every step than the tree walk. The
+ * potential doesn't change during a run, so the acceleration is
+ * evaluated once on a grid uniform in log(r), theta and phi and
+ * interpolated from there. The table is checked against the potential
+ * at the center of every grid cell, and is not used if the worst
+ * relative error is above ctx->potentialGridTolerance.
+ *
+ * For the built in potentials only the halo is tabulated. The disk
+ * is cheap, and too thin to interpolate well on a spherical grid.
+ */
+
+#include "nbody_priv.h"
+#include "nbody_potential.h"
+#include "nbody_potential_table.h"
+#include "milkyway_util.h"
+
+static inline size_t nbTableIndex(const NBodyPotentialTable* t, unsigned int i, unsigned int j, unsigned int k)
+{
+    return 3 * (((size_t) i * t->nTheta + j) * t->nPhi + k);
+}
+
+/* Grid cell containing coordinate x, clamped to [0, n] */
+static inline unsigned int nbTableCell(real x, unsigned int n)
+{
+    unsigned int i = x > 0.0 ? (unsigned int) x : 0;
+    return i < n ? i : n;
+}
+
+/* Position of the point log(r), theta, phi */
+static mwvector nbTablePosition(real logR, real theta, real phi)
+{
+    mwvector pos = ZERO_VECTOR;
+    const real r = mw_exp(logR);
+    const real s = mw_sin(theta);
+
+    X(pos) = r * s * mw_cos(phi);
+    Y(pos) = r * s * mw_sin(phi);
+    Z(pos) = r * mw_cos(theta);
+
+    return pos;
+}
+
+/* The part of the acceleration that goes in the table */
+static mwvector nbTableExtAcceleration(const NBodyCtx* ctx, NBodyState* st, mwvector pos)
+{
+    mwvector acc;
+
+    if (ctx->potentialType == EXTERNAL_POTENTIAL_CUSTOM_LUA)
+    {
+        nbEvalPotentialClosure(st, pos, &acc);
+    }
+    else
+    {
+        acc = nbHaloAcceleration(&ctx->pot, pos);
+    }
+
+    return acc;
+}
+
+/* Trilinear interpolation in log(r), theta and phi. Returns FALSE if pos
+ * is outside of the table. */
+static int nbInterpolatePotentialTable(const NBodyPotentialTable* t, mwvector pos, mwvector* acc)
+{
+    real r, u, v, w, phi;
+    real fu, fv, fw;
+    unsigned int i, j, k, k1;
+    unsigned int di, dj;
+    real a[3] = { 0.0, 0.0, 0.0 };
+    const real* p;
+    real wt;
+    unsigned int c;
+
+    r = mw_absv(pos);
+    if (r < t->rMin || r >= t->rMax)
+        return FALSE;
+
+    u = (mw_log(r) - t->logRMin) / t->dLogR;
+    i = nbTableCell(u, t->nR - 2);
+    fu = u - (real) i;
+
+    v = mw_atan2(mw_sqrt(sqr(X(pos)) + sqr(Y(pos))), Z(pos)) / t->dTheta;
+    j = nbTableCell(v, t->nTheta - 2);
+    fv = v - (real) j;
+
+    phi = mw_atan2(Y(pos), X(pos));
+    if (phi < 0.0)
+        phi += M_2PI;
+    w = phi / t->dPhi;
+    k = nbTableCell(w, t->nPhi - 1);
+    fw = w - (real) k;
+    k1 = (k + 1) % t->nPhi;          /* phi wraps around */
+
+    for (di = 0; di < 2; ++di)
+    {
+        for (dj = 0; dj < 2; ++dj)
+        {
+            wt = (di ? fu : 1.0 - fu) * (dj ? fv : 1.0 - fv);
+
+            p = &t->acc[nbTableIndex(t, i + di, j + dj, k)];
+            for (c = 0; c < 3; ++c)
+                a[c] += wt * (1.0 - fw) * p[c];
+
+            p = &t->acc[nbTableIndex(t, i + di, j + dj, k1)];
+            for (c = 0; c < 3; ++c)
+                a[c] += wt * fw * p[c];
+        }
+    }
+
+    X(*acc) = a[0];
+    Y(*acc) = a[1];
+    Z(*acc) = a[2];
+
+    return TRUE;
+}
+
+/* External acceleration at pos from the table. Returns FALSE if the
+ * table doesn't cover pos, and the potential must be used instead. */
+int nbPotentialTableAccel(const NBodyPotentialTable* t, const Potential* pot, mwvector pos, mwvector* acc)
+{
+    mwvector tabAcc;
+
+    if (!t || !t->acc || !nbInterpolatePotentialTable(t, pos, &tabAcc))
+        return FALSE;
+
+    *acc = t->haloOnly ? nbExtAccelerationWithHalo(pot, pos, tabAcc) : tabAcc;
+    return TRUE;
+}
+
+/* Largest relative error of the table at the centers of its cells */
+static real nbCheckPotentialTable(const NBodyCtx* ctx, NBodyState* st, const NBodyPotentialTable* t)
+{
+    int i;
+    unsigned int j, k;
+    real maxError = 0.0;
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(j, k) schedule(dynamic)
+  #endif
+    for (i = 0; i < (int) t->nR - 1; ++i)
+    {
+        real threadMax = 0.0;
+        mwvector pos, exact, interp;
+
+        for (j = 0; j < t->nTheta - 1; ++j)
+        {
+            for (k = 0; k < t->nPhi; ++k)
+            {
+                pos = nbTablePosition(t->logRMin + ((real) i + 0.5) * t->dLogR,
+                                      ((real) j + 0.5) * t->dTheta,
+                                      ((real) k + 0.5) * t->dPhi);
+
+                exact = nbTableExtAcceleration(ctx, st, pos);
+                if (!nbInterpolatePotentialTable(t, pos, &interp))
+                    continue;
+
+                threadMax = mw_fmax(threadMax, mw_distv(interp, exact) / mw_absv(exact));
+            }
+        }
+
+      #ifdef _OPENMP
+        #pragma omp critical(nbPotentialTableError)
+      #endif
+        {
+            maxError = mw_fmax(maxError, threadMax);
+        }
+    }
+
+    return maxError;
+}
+
+NBodyPotentialTable* nbMakePotentialTable(const NBodyCtx* ctx, NBodyState* st)
+{
+    int i;
+    unsigned int j, k;
+    NBodyPotentialTable* t;
+    double ts, te;
+
+    t = (NBodyPotentialTable*) mwCalloc(1, sizeof(NBodyPotentialTable));
+    if (ctx->potentialGrid == 0 || ctx->potentialType == EXTERNAL_POTENTIAL_NONE)
+        return t;
+
+    ts = mwGetTime();
+
+    t->haloOnly = (ctx->potentialType == EXTERNAL_POTENTIAL_DEFAULT);
+    t->nR = 2 * ctx->potentialGrid;     /* The radial range is the widest */
+    t->nTheta = ctx->potentialGrid;
+    t->nPhi = 2 * ctx->potentialGrid;
+    t->rMin = ctx->potentialGridMin;
+    t->rMax = ctx->potentialGridMax;
+    t->logRMin = mw_log(t->rMin);
+    t->dLogR = (mw_log(t->rMax) - t->logRMin) / (real) (t->nR - 1);
+    t->dTheta = M_PI / (real) (t->nTheta - 1);
+    t->dPhi = M_2PI / (real) t->nPhi;
+    t->acc = (real*) mwMallocA(3 * (size_t) t->nR * t->nTheta * t->nPhi * sizeof(real));
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(j, k) schedule(dynamic)
+  #endif
+    for (i = 0; i < (int) t->nR; ++i)
+    {
+        mwvector pos, acc;
+        real* p;
+
+        for (j = 0; j < t->nTheta; ++j)
+        {
+            for (k = 0; k < t->nPhi; ++k)
+            {
+                pos = nbTablePosition(t->logRMin + (real) i * t->dLogR,
+                                      (real) j * t->dTheta,
+                                      (real) k * t->dPhi);
+                acc = nbTableExtAcceleration(ctx, st, pos);
+
+                p = &t->acc[nbTableIndex(t, (unsigned int) i, j, k)];
+                p[0] = X(acc);
+                p[1] = Y(acc);
+                p[2] = Z(acc);
+            }
+        }
+    }
+
+    t->maxError = nbCheckPotentialTable(ctx, st, t);
+
+    te = mwGetTime();
+
+    if (!(t->maxError <= ctx->potentialGridTolerance))
+    {
+        mw_printf("Potential table %u x %u x %u has relative error %g > %g, evaluating the potential directly\n",
+                  t->nR, t->nTheta, t->nPhi, t->maxError, ctx->potentialGridTolerance);
+        mwFreeA(t->acc);
+        t->acc = NULL;
+    }
+    else if (!ctx->quietErrors)
+    {
+        mw_printf("Potential table %u x %u x %u built in %f s, relative error %g\n",
+                  t->nR, t->nTheta, t->nPhi, te - ts, t->maxError);
+    }
+
+    return t;
+}
+
+NBodyPotentialTable* nbClonePotentialTable(const NBodyPotentialTable* t)
+{
+    NBodyPotentialTable* newT;
+    size_t size;
+
+    if (!t)
+        return NULL;
+
+    newT = (NBodyPotentialTable*) mwMalloc(sizeof(NBodyPotentialTable));
+    *newT = *t;
+
+    if (t->acc)
+    {
+        size = 3 * (size_t) t->nR * t->nTheta * t->nPhi * sizeof(real);
+        newT->acc = (real*) mwMallocA(size);
+        memcpy(newT->acc, t->acc, size);
+    }
+
+    return newT;
+}
+
+void nbFreePotentialTable(NBodyPotentialTable* t)
+{
+    if (!t)
+        return;
+
+    mwFreeA(t->acc);
+    free(t);
+}
+
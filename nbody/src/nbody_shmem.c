@@ -64,6 +64,7 @@ static void nbPrepareSceneFromState(const NBodyCtx* ctx, const NBodyState* st)
     st->scene->nSteps = ctx->nStep;
     st->scene->hasInfo = TRUE;
     st->scene->hasGalaxy = (ctx->potentialType == EXTERNAL_POTENTIAL_DEFAULT);
+    OPA_store_int(&st->scene->orbitTraceLength, 0);
 }
 
 #if USE_POSIX_SHMEM
@@ -530,17 +531,22 @@ static void nbWriteSnapshot(NBodyCircularQueue* queue, int buffer, const NBodyCt
     }
 }
 
-/* FIXME: Copies all the steps every step */
-static inline void nbUpdateDisplayedOrbitTrace(FloatPos* sceneTrace, const mwvector* trace, int n)
+/* Append the points of the trace up to n the scene doesn't have yet,
+ * which is usually just the newest one, then publish the new length */
+static inline void nbUpdateDisplayedOrbitTrace(scene_t* scene, const mwvector* trace, int n)
 {
     int i;
+    FloatPos* sceneTrace = nbSceneGetOrbitTrace(scene);
 
-    for (i = 0; i < n; ++i)
+    for (i = OPA_load_int(&scene->orbitTraceLength); i < n; ++i)
     {
         sceneTrace[i].x = (float) trace[i].x;
         sceneTrace[i].y = (float) trace[i].y;
         sceneTrace[i].z = (float) trace[i].z;
     }
+
+    OPA_write_barrier();
+    OPA_store_int(&scene->orbitTraceLength, n);
 }
 
 static int nbPushCircularQueue(NBodyCircularQueue* queue, const NBodyCtx* ctx, NBodyState* st, const mwvector* cmPos)
@@ -553,7 +559,7 @@ static int nbPushCircularQueue(NBodyCircularQueue* queue, const NBodyCtx* ctx, N
     if (nextTail != head)
     {
         nbWriteSnapshot(queue, tail, ctx, st, cmPos);
-        nbUpdateDisplayedOrbitTrace(nbSceneGetOrbitTrace(st->scene), st->orbitTrace, st->step);
+        nbUpdateDisplayedOrbitTrace(st->scene, st->orbitTrace, st->step);
 
         OPA_store_int(&queue->tail, nextTail);
         return TRUE;
@@ -50,6 +50,8 @@ const char* showCriterionT(criterion_t x)
             return "BH86";
         case SW93:
             return "SW93";
+        case FMM:
+            return "FMM";
         case InvalidCriterion:
             return "InvalidCriterion";
         default:
@@ -466,6 +468,16 @@ char* showNBodyCtx(const NBodyCtx* ctx)
                      "  allowIncest     = %s\n"
                      "  checkpointT     = %d\n"
                      "  nStep           = %u\n"
+                     "  groupSize       = %u\n"
+                     "  reorderInterval = %u\n"
+                     "  potentialGrid   = %u\n"
+                     "  potentialGridMin = %f\n"
+                     "  potentialGridMax = %f\n"
+                     "  potentialGridTolerance = %g\n"
+                     "  timestepLevels  = %u\n"
+                     "  timestepAccuracy = %f\n"
+                     "  treeRebuildInterval = %u\n"
+                     "  fmmOrder        = %u\n"
                      "  potentialType   = %s\n"
                      "  pot = %s\n"
                      "};\n",
@@ -480,6 +492,16 @@ char* showNBodyCtx(const NBodyCtx* ctx)
                      showBool(ctx->allowIncest),
                      (int) ctx->checkpointT,
                      ctx->nStep,
+                     ctx->groupSize,
+                     ctx->reorderInterval,
+                     ctx->potentialGrid,
+                     ctx->potentialGridMin,
+                     ctx->potentialGridMax,
+                     ctx->potentialGridTolerance,
+                     ctx->timestepLevels,
+                     ctx->timestepAccuracy,
+                     ctx->treeRebuildInterval,
+                     ctx->fmmOrder,
                      showExternalPotentialType(ctx->potentialType),
                      potBuf
             ))
@@ -614,7 +636,7 @@ char* showNBodyState(const NBodyState* st)
     if (0 > asprintf(&buf,
                      "NBodyState %p = {\n"
                      "  tree           = %s\n"
-                     "  freeCell       = %p\n"
+                     "  treeCells      = %p (%u of %u used)\n"
                      "  lastCheckpoint = %d\n"
                      "  step           = %u\n"
                      "  nbody          = %u\n"
@@ -624,7 +646,9 @@ char* showNBodyState(const NBodyState* st)
                      "};\n",
                      st,
                      treeBuf,
-                     st->freeCell,
+                     st->treeCells.cells,
+                     st->treeCells.used,
+                     st->treeCells.size,
                      (int) st->lastCheckpoint,
                      st->step,
                      st->nbody,
@@ -63,11 +63,12 @@ static inline void nbIncAddNBodyQuadMatrix(NBodyQuadMatrix* RESTRICT a, NBodyQua
     a->zz += b->zz;
 }
 
-/* hackQuad: descend tree, evaluating quadrupole moments.  Note that this
- * routine is coded so that the Subp() and Quad() components of a cell can
- * share the same memory locations.
+/* hackQuadCell: evaluate the quadrupole moment of cell p from its
+ * subnodes, which must already have their own moments. Note that this
+ * routine is coded so that the Subp() and Quad() components of a cell
+ * can share the same memory locations.
  */
-static void hackQuad(NBodyCell* p)
+static void hackQuadCell(NBodyCell* p)
 {
     unsigned int ndesc, i;
     NBodyNode* desc[NSUB];
@@ -88,10 +89,6 @@ static void hackQuad(NBodyCell* p)
     for (i = 0; i < ndesc; ++i)                 /* loop over real subnodes  */
     {
         q = desc[i];                            /* access each one in turn  */
-        if (isCell(q))                          /* if it's also a cell      */
-        {
-            hackQuad((NBodyCell*) q);           /* then process it first    */
-        }
 
         dr = mw_subv(Pos(q), Pos(p));           /* find displacement vect.  */
         drsq = mw_sqrv(dr);                     /* and dot prod. (dr . dr)  */
@@ -120,6 +117,24 @@ static void hackQuad(NBodyCell* p)
     }
 }
 
+/* hackQuad: descend tree, evaluating quadrupole moments. */
+static void hackQuad(NBodyCell* p)
+{
+    unsigned int i;
+    NBodyNode* q;
+
+    for (i = 0; i < NSUB; ++i)
+    {
+        q = Subp(p)[i];
+        if (q != NULL && isCell(q))             /* process subcells first */
+        {
+            hackQuad((NBodyCell*) q);
+        }
+    }
+
+    hackQuadCell(p);
+}
+
 
 /* threadTree: do a recursive treewalk starting from node p,
  * with next stop n, installing Next and More links.
@@ -175,53 +190,242 @@ static void expandBox(NBodyTree* t, const Body* btab, int nbody)
     }
 }
 
-/* makecell: return pointer to free cell. */
-static NBodyCell* nbMakeCell(NBodyState* st, NBodyTree* t)
+/* Cells are handed out from st->buildCells while building the tree.
+ * When parts of the tree are built in parallel, each piece gets its
+ * own builder which takes a block of the arena at a time, so cells and
+ * counters can be handed out without locking.
+ */
+typedef struct
 {
-    NBodyCell* c;
+    NBodyCell* next;           /* next free cell of this builder's block */
+    NBodyCell* end;            /* end of the block */
+    NBodyCell** overflow;      /* blocks allocated after the arena ran out */
+    unsigned int nOverflow, maxOverflow;
+    unsigned int cellUsed;     /* count of cells made */
+    unsigned int maxDepth;     /* deepest level a body was stored at */
+    int structureError;
+} NBodyTreeBuilder;
+
+#define EMPTY_TREE_BUILDER { NULL, NULL, NULL, 0, 0, 0, 0, FALSE }
+
+/* Number of cells a builder takes from the arena at once */
+#define NBODY_TREE_CELL_BATCH 64
+
+/* takeCells: get a new block of cells for b, from the arena if there
+ * are any left or else a newly allocated one. */
+static void nbTakeCells(NBodyState* st, NBodyTreeBuilder* b, unsigned int n)
+{
+    NBodyCellArena* a = &st->buildCells;
+    unsigned int avail;
 
-    if (st->freeCell == NULL)                   /* no free cells left? */
+  #ifdef _OPENMP
+    #pragma omp critical(nbBuildCells)
+  #endif
     {
-        c = (NBodyCell*) mwMallocA(sizeof(*c)); /* allocate a new one */
+        avail = a->size - a->used;
+        avail = n < avail ? n : avail;
+        b->next = a->cells + a->used;
+        b->end = b->next + avail;
+        a->used += avail;
     }
-    else                                        /* use existing free cell */
+
+    if (avail == 0)
     {
-        c = (NBodyCell*) st->freeCell;          /* take one on front */
-        st->freeCell = Next(c);                 /* go on to next one */
+        if (b->nOverflow == b->maxOverflow)
+        {
+            b->maxOverflow = b->maxOverflow == 0 ? 16 : 2 * b->maxOverflow;
+            b->overflow = (NBodyCell**) mwRealloc(b->overflow, b->maxOverflow * sizeof(NBodyCell*));
+        }
+
+        b->next = (NBodyCell*) mwMallocA(NBODY_TREE_CELL_BATCH * sizeof(NBodyCell));
+        b->end = b->next + NBODY_TREE_CELL_BATCH;
+        b->overflow[b->nOverflow++] = b->next;
     }
+}
+
+/* returnCells: give back the unused part of b's block if it is the
+ * last block taken from the arena. */
+static void nbReturnCells(NBodyState* st, NBodyTreeBuilder* b)
+{
+    NBodyCellArena* a = &st->buildCells;
+
+    if (b->end != NULL && b->end == a->cells + a->used)
+    {
+        a->used -= (unsigned int) (b->end - b->next);
+    }
+    b->next = b->end = NULL;
+}
+
+/* finishBuilder: fold the counts of b into the tree. */
+static void nbFinishBuilder(NBodyTree* t, NBodyTreeBuilder* b)
+{
+    t->cellUsed += b->cellUsed;
+    t->maxDepth = MAX(t->maxDepth, b->maxDepth);
+    t->structureError = t->structureError || b->structureError;
+}
+
+/* freeBuilder: release blocks allocated outside of the arena. Returns
+ * the number of cells they held. */
+static unsigned int nbFreeBuilder(NBodyTreeBuilder* b)
+{
+    unsigned int i, n = b->nOverflow;
+
+    for (i = 0; i < b->nOverflow; ++i)
+    {
+        mwFreeA(b->overflow[i]);
+    }
+    free(b->overflow);
+
+    b->overflow = NULL;
+    b->nOverflow = b->maxOverflow = 0;
+
+    return n * NBODY_TREE_CELL_BATCH;
+}
+
+/* makecell: return pointer to free cell. */
+static NBodyCell* nbMakeCell(NBodyState* st, NBodyTreeBuilder* b)
+{
+    NBodyCell* c;
+
+    if (b->next == b->end)                      /* no free cells left? */
+    {
+        nbTakeCells(st, b, NBODY_TREE_CELL_BATCH);
+    }
+
+    c = b->next++;                              /* take next free cell */
     Type(c) = CELL(0);                          /* initialize cell type */
     More(c) = NULL;
     memset(&c->stuff, 0, sizeof(c->stuff));     /* empty sub cells */
-    t->cellUsed++;                              /* count one more cell */
+    b->cellUsed++;                              /* count one more cell */
     return c;
 }
 
-/* reclaim cells in tree, prepare to build new one. */
-static void nbNewTree(NBodyState* st, NBodyTree* t)
+/* reserveCells: make sure arena a has room for n cells and empty it */
+static void nbReserveCells(NBodyCellArena* a, unsigned int n)
 {
-    NBodyNode* p = (NBodyNode*) t->root;              /* start with the root */
+    if (a->size < n)
+    {
+        mwFreeA(a->cells);
+        a->size = n + n / 8;
+        a->cells = (NBodyCell*) mwMallocA(a->size * sizeof(NBodyCell));
+    }
+    a->used = 0;
+}
 
-    while (p != NULL)                       /* loop scanning tree */
+/* prepare to build new tree. The old tree's cells are all released at
+ * once by emptying the arena, and the builder b takes all of it.
+ */
+static void nbNewTree(NBodyState* st, NBodyTree* t, NBodyTreeBuilder* b)
+{
+    NBodyCellArena* a = &st->buildCells;
+
+    if (a->size == 0)                 /* first guess, grown as needed */
+    {
+        nbReserveCells(a, (unsigned int) st->nbody / 2 + NBODY_TREE_CELL_BATCH);
+    }
+
+    a->used = 0;                      /* reclaim all cells */
+    t->cellUsed = 0;                  /* init count of cells, levels */
+    t->maxDepth = 0;
+
+    nbTakeCells(st, b, a->size);
+    t->root = nbMakeCell(st, b);      /* allocate the root cell */
+    mw_zerov(Pos(t->root));           /* initialize the midpoint */
+}
+
+/* Where a cell was moved to by nbLayoutTree */
+#define Moved(x) (((NBodyCell*) (x))->stuff.subp[0])
+
+static inline NBodyNode* nbMovedNode(NBodyNode* p)
+{
+    return (p != NULL && isCell(p)) ? Moved(p) : p;
+}
+
+/* layoutTree: copy the finished tree into st->treeCells in the order
+ * the threaded walk visits the cells, so walking the tree goes
+ * through memory in order. The subcell pointers are only fixed if
+ * they weren't replaced by the quadrupole moments.
+ */
+static void nbLayoutTree(NBodyState* st, NBodyTree* t, mwbool useQuad)
+{
+    NBodyCellArena* a = &st->treeCells;
+    NBodyNode* p;
+    NBodyCell* c;
+    Body* b;
+    unsigned int i, j, n = 0;
+    const Body* endp = st->bodytab + st->nbody;
+
+    nbReserveCells(a, t->cellUsed);
+
+    p = (NBodyNode*) t->root;
+    while (p != NULL)                           /* copy cells in walk order */
     {
-        if (isCell(p))                      /* found cell to free? */
+        if (isCell(p))
         {
-            Next(p) = st->freeCell;         /* link to front of */
-            st->freeCell = p;               /* ...existing list */
-            p = More(p);                    /* scan down tree */
+            c = &a->cells[n++];
+            *c = *(NBodyCell*) p;
+            Moved(p) = (NBodyNode*) c;          /* leave new address behind */
+            p = More(c);
         }
-        else                                /* skip over bodies */
+        else
         {
-            p = Next(p);                    /* go on to next */
+            p = Next(p);
         }
     }
 
-    t->cellUsed = 0;   /* init count of cells, levels */
-    t->maxDepth = 0;
+    assert(n == t->cellUsed);
+    a->used = n;
 
-    t->root = nbMakeCell(st, t);      /* allocate the root cell */
-    mw_zerov(Pos(t->root));           /* initialize the midpoint */
+    for (i = 0; i < n; ++i)                     /* fix links between cells */
+    {
+        c = &a->cells[i];
+        More(c) = nbMovedNode(More(c));
+        Next(c) = nbMovedNode(Next(c));
+
+        if (!useQuad)
+        {
+            for (j = 0; j < NSUB; ++j)
+            {
+                Subp(c)[j] = nbMovedNode(Subp(c)[j]);
+            }
+        }
+    }
+
+    for (b = st->bodytab; b < endp; ++b)        /* and from bodies to cells */
+    {
+        if (!isTestParticle(b))
+        {
+            Next(b) = nbMovedNode(Next(b));
+        }
+    }
+
+    t->root = &a->cells[0];
+}
+
+/* finishTree: move the tree to its final place in st->treeCells. */
+static NBodyStatus nbFinishTree(NBodyState* st, NBodyTree* t, mwbool useQuad)
+{
+    if (t->structureError)
+    {
+        t->root = NULL;      /* The cells it was in are about to go away */
+        return NBODY_TREE_STRUCTURE_ERROR;
+    }
+
+    nbLayoutTree(st, t, useQuad);
+    return NBODY_SUCCESS;
 }
 
+/* growBuildCells: make the arena big enough for the extra cells the
+ * builders had to allocate this time. */
+static void nbGrowBuildCells(NBodyState* st, unsigned int extra)
+{
+    NBodyCellArena* a = &st->buildCells;
+
+    if (extra > 0)
+    {
+        nbReserveCells(a, a->used + extra);
+    }
+}
 
 ALWAYS_INLINE
 static inline real calcOffset(real pPos, real qPos, real qsize)
@@ -238,34 +442,35 @@ static inline void nbInitMidpoint(NBodyCell* c, const Body* p, const NBodyCell*
     Z(Pos(c)) = calcOffset(Z(Pos(p)), Z(Pos(q)), qsize);
 }
 
-/* loadBody: descend tree and insert body p in appropriate place. */
-static void nbLoadBody(NBodyState* st, NBodyTree* t, Body* p)
+/* loadBody: descend tree from cell q of size qsize at level lev and
+ * insert body p in appropriate place. */
+static void nbLoadBody(NBodyState* st,
+                       NBodyTreeBuilder* b,
+                       real rsize,
+                       NBodyCell* q,
+                       real qsize,
+                       unsigned int lev,
+                       Body* p)
 {
-    NBodyCell* q;
     NBodyCell* c;
     size_t qind;
-    unsigned int lev;
-    real qsize;
 
-    q = t->root;                                /* start with tree t.root */
     qind = nbSubIndex(p, q);                    /* get index of subcell */
-    qsize = t->rsize;                           /* keep track of cell size */
-    lev = 0;                                    /* count levels descended */
     while (Subp(q)[qind] != NULL)               /* loop descending tree */
     {
         if (qsize <= REAL_EPSILON)
         {
-            if (!t->structureError)
+            if (!b->structureError)
             {
-                mw_printf("qsize (= %.15f) <= epsilon at level %u (initial root = %.15f)\n", qsize, lev, t->rsize);
-                t->structureError = TRUE; /* FIXME: Not quite the same as the other structure error */
+                mw_printf("qsize (= %.15f) <= epsilon at level %u (initial root = %.15f)\n", qsize, lev, rsize);
+                b->structureError = TRUE; /* FIXME: Not quite the same as the other structure error */
             }
             return;
         }
 
         if (isBody(Subp(q)[qind]))              /* reached a "leaf"? */
         {
-            c = nbMakeCell(st, t);             /* allocate new cell */
+            c = nbMakeCell(st, b);             /* allocate new cell */
             nbInitMidpoint(c, p, q, qsize);    /* initialize midpoint */
 
             Subp(c)[nbSubIndex((Body*) Subp(q)[qind], c)] = Subp(q)[qind];
@@ -278,7 +483,7 @@ static void nbLoadBody(NBodyState* st, NBodyTree* t, Body* p)
         ++lev;                            /* count another level */
     }
     Subp(q)[qind] = (NBodyNode*) p;            /* found place, store p */
-    t->maxDepth = MAX(t->maxDepth, lev);  /* remember maximum level */
+    b->maxDepth = MAX(b->maxDepth, lev);  /* remember maximum level */
 }
 
 ALWAYS_INLINE
@@ -290,22 +495,22 @@ static inline real bmax2Inc(real cmPos, real pPos, real psize)
 }
 
 ALWAYS_INLINE
-static inline real calcSW93MaxDist2(const NBodyCell* p, const mwvector cmpos, real psize)
+static inline real calcSW93MaxDist2(const mwvector center, const mwvector cmpos, real psize)
 {
     real bmax2;
 
     /* compute max distance^2 */
     /* loop over dimensions */
-    bmax2 = bmax2Inc(X(cmpos), X(Pos(p)), psize);
-    bmax2 += bmax2Inc(Y(cmpos), Y(Pos(p)), psize);
-    bmax2 += bmax2Inc(Z(cmpos), Z(Pos(p)), psize);
+    bmax2 = bmax2Inc(X(cmpos), X(center), psize);
+    bmax2 += bmax2Inc(Y(cmpos), Y(center), psize);
+    bmax2 += bmax2Inc(Z(cmpos), Z(center), psize);
 
     return bmax2;
 }
 
-/* assign critical radius for cell p, using center-of-mass position
- * cmpos and cell size psize. */
-static inline real findRCrit(const NBodyCtx* ctx, const NBodyCell* p, real treeRSize, mwvector cmpos, real psize)
+/* assign critical radius for a cell with its middle at center, using
+ * center-of-mass position cmpos and cell size psize. */
+static inline real findRCrit(const NBodyCtx* ctx, mwvector center, real treeRSize, mwvector cmpos, real psize)
 {
     real rc, bmax2;
 
@@ -321,12 +526,13 @@ static inline real findRCrit(const NBodyCtx* ctx, const NBodyCell* p, real treeR
     {
         case TreeCode:
             /* use size plus offset */
-            rc = psize / ctx->theta + mw_distv(cmpos, Pos(p));
+            rc = psize / ctx->theta + mw_distv(cmpos, center);
             return sqr(rc);
 
         case SW93:                           /* use S&W's criterion? */
+        case FMM:                            /* cells are well separated when their S&W radii don't overlap */
             /* compute max distance^2 */
-            bmax2 = calcSW93MaxDist2(p, cmpos, psize);
+            bmax2 = calcSW93MaxDist2(center, cmpos, psize);
             return bmax2 / sqr(ctx->theta);      /* using max dist from cm */
 
         case BH86:                          /* use old BH criterion? */
@@ -380,10 +586,10 @@ static inline void nbCheckTreeStructure(NBodyTree* tree, const mwvector pPos, co
 }
 
 
-/* hackCofM: descend tree finding center-of-mass coordinates and
- * setting critical cell radii.
+/* hackCofMCell: find the center-of-mass coordinates and critical
+ * radius of cell p from its subnodes, which must already be done.
  */
-static void hackCofM(const NBodyCtx* ctx, NBodyTree* tree, NBodyCell* p, real psize)
+static void hackCofMCell(const NBodyCtx* ctx, NBodyTree* tree, NBodyCell* p, real psize)
 {
     int i;
     NBodyNode* q;
@@ -396,11 +602,6 @@ static void hackCofM(const NBodyCtx* ctx, NBodyTree* tree, NBodyCell* p, real ps
     {
         if ((q = Subp(p)[i]) != NULL)           /* does subnode exist? */
         {
-            if (isCell(q))                     /* and is it a cell? */
-            {
-                hackCofM(ctx, tree, (NBodyCell*) q, 0.5 * psize); /* find subcell cm */
-            }
-
             Mass(p) += Mass(q);                       /* sum total mass */
                                                       /* weight pos by mass */
             mw_incaddv_s(cmpos, Pos(q), Mass(q));     /* sum c-of-m position */
@@ -419,10 +620,367 @@ static void hackCofM(const NBodyCtx* ctx, NBodyTree* tree, NBodyCell* p, real ps
 
     nbCheckTreeStructure(tree, Pos(p), cmpos, psize);
 
-    Rcrit2(p) = findRCrit(ctx, p, tree->rsize, cmpos, psize);            /* set critical radius */
+    Rcrit2(p) = findRCrit(ctx, Pos(p), tree->rsize, cmpos, psize);            /* set critical radius */
     Pos(p) = cmpos;             /* and center-of-mass pos */
 }
 
+/* hackCofM: descend tree finding center-of-mass coordinates and
+ * setting critical cell radii.
+ */
+static void hackCofM(const NBodyCtx* ctx, NBodyTree* tree, NBodyCell* p, real psize)
+{
+    int i;
+    NBodyNode* q;
+
+    for (i = 0; i < NSUB; ++i)                  /* loop over subnodes */
+    {
+        q = Subp(p)[i];
+        if (q != NULL && isCell(q))             /* find subcell cm first */
+        {
+            hackCofM(ctx, tree, (NBodyCell*) q, 0.5 * psize);
+        }
+    }
+
+    hackCofMCell(ctx, tree, p, psize);
+}
+
+/* Parallel tree construction: The top of the tree is split serially
+ * by sorting the bodies into octants until each octant holds few
+ * enough bodies. Each of these octants becomes a task which loads its
+ * bodies into its own subtree, and the subtrees are then summarized
+ * in parallel. The top cells are finished last, deepest first. The
+ * tree is the same no matter what order bodies are loaded, so this
+ * gives exactly the same tree and moments as the serial build.
+ */
+
+/* Don't bother making subtree tasks smaller than this */
+#define NBODY_TREE_TASK_MIN 128
+
+typedef struct
+{
+    NBodyCell* cell;
+    real psize;
+    int child[NSUB];           /* index of each subcell that is also a top cell, or -1 */
+    int task[NSUB];            /* index of the task filling each subcell, or -1 */
+} NBodyTreeTop;
+
+typedef struct
+{
+    NBodyCell* parent;         /* top cell the subtree hangs from */
+    real psize;                /* size of parent */
+    unsigned int lev;          /* level of parent */
+    unsigned int slot;         /* subcell of parent the subtree fills */
+    Body** bodies;
+    unsigned int nbody;
+    NBodyNode* next;           /* Next link for the subtree root */
+    NBodyTreeBuilder builder;
+} NBodyTreeTask;
+
+typedef struct
+{
+    NBodyTreeTop* top;
+    unsigned int nTop, maxTop;
+
+    NBodyTreeTask* tasks;
+    unsigned int nTask, maxTask;
+
+    unsigned int taskSize;     /* split octants with more bodies than this */
+    Body** bodies;             /* bodies of all tasks, grouped by octant */
+    Body** scratch;
+} NBodyTreeSplit;
+
+static unsigned int nbAddTopCell(NBodyTreeSplit* s, NBodyCell* c, real psize)
+{
+    unsigned int i;
+    NBodyTreeTop* top;
+
+    if (s->nTop == s->maxTop)
+    {
+        s->maxTop = s->maxTop == 0 ? 64 : 2 * s->maxTop;
+        s->top = (NBodyTreeTop*) mwRealloc(s->top, s->maxTop * sizeof(NBodyTreeTop));
+    }
+
+    top = &s->top[s->nTop];
+    top->cell = c;
+    top->psize = psize;
+    for (i = 0; i < NSUB; ++i)
+    {
+        top->child[i] = -1;
+        top->task[i] = -1;
+    }
+
+    return s->nTop++;
+}
+
+static void nbAddTreeTask(NBodyTreeSplit* s,
+                          NBodyCell* parent,
+                          real psize,
+                          unsigned int lev,
+                          unsigned int slot,
+                          Body** bodies,
+                          unsigned int nbody)
+{
+    NBodyTreeTask* task;
+    NBodyTreeBuilder emptyBuilder = EMPTY_TREE_BUILDER;
+
+    if (s->nTask == s->maxTask)
+    {
+        s->maxTask = s->maxTask == 0 ? 64 : 2 * s->maxTask;
+        s->tasks = (NBodyTreeTask*) mwRealloc(s->tasks, s->maxTask * sizeof(NBodyTreeTask));
+    }
+
+    task = &s->tasks[s->nTask++];
+    task->parent = parent;
+    task->psize = psize;
+    task->lev = lev;
+    task->slot = slot;
+    task->bodies = bodies;
+    task->nbody = nbody;
+    task->next = NULL;
+    task->builder = emptyBuilder;
+}
+
+/* splitCell: sort the bodies in top cell number top into its octants,
+ * making new top cells or tasks for the octants as needed. */
+static void nbSplitCell(NBodyState* st,
+                        NBodyTreeBuilder* b,
+                        NBodyTreeSplit* s,
+                        unsigned int top,
+                        Body** bodies,
+                        unsigned int n,
+                        unsigned int lev)
+{
+    unsigned int i, ind;
+    unsigned int count[NSUB] = { 0 };
+    unsigned int start[NSUB];
+    unsigned int fill[NSUB];
+    Body** scratch = s->scratch + (bodies - s->bodies);
+    NBodyCell* q = s->top[top].cell;
+    real qsize = s->top[top].psize;
+    NBodyCell* c;
+    unsigned int sub;
+
+    for (i = 0; i < n; ++i)
+    {
+        ++count[nbSubIndex(bodies[i], q)];
+    }
+
+    for (i = 0, ind = 0; i < NSUB; ++i)
+    {
+        start[i] = fill[i] = ind;
+        ind += count[i];
+    }
+
+    for (i = 0; i < n; ++i)          /* keep the loading order within an octant */
+    {
+        scratch[fill[nbSubIndex(bodies[i], q)]++] = bodies[i];
+    }
+    memcpy(bodies, scratch, n * sizeof(Body*));
+
+    for (i = 0; i < NSUB; ++i)
+    {
+        if (count[i] == 0)
+        {
+            continue;
+        }
+        else if (count[i] == 1)
+        {
+            Subp(q)[i] = (NBodyNode*) bodies[start[i]];
+            b->maxDepth = MAX(b->maxDepth, lev);
+        }
+        else if (qsize <= REAL_EPSILON)
+        {
+            if (!b->structureError)
+            {
+                mw_printf("qsize (= %.15f) <= epsilon at level %u (initial root = %.15f)\n", qsize, lev, st->tree.rsize);
+                b->structureError = TRUE;
+            }
+            return;
+        }
+        else if (count[i] <= s->taskSize)
+        {
+            s->top[top].task[i] = (int) s->nTask;
+            nbAddTreeTask(s, q, qsize, lev, i, &bodies[start[i]], count[i]);
+        }
+        else
+        {
+            c = nbMakeCell(st, b);
+            nbInitMidpoint(c, bodies[start[i]], q, qsize);
+            Subp(q)[i] = (NBodyNode*) c;
+
+            sub = nbAddTopCell(s, c, 0.5 * qsize);
+            s->top[top].child[i] = (int) sub;
+            nbSplitCell(st, b, s, sub, &bodies[start[i]], count[i], lev + 1);
+        }
+    }
+}
+
+/* threadTop: threadTree for the top cells. The subtrees of the tasks
+ * are left to be threaded later, starting from task->next. */
+static void nbThreadTop(NBodyTreeSplit* s, unsigned int top, NBodyNode* n)
+{
+    unsigned int ndesc, i;
+    NBodyNode* desc[NSUB+1];
+    int sub[NSUB];
+    int task[NSUB];
+    NBodyCell* p = s->top[top].cell;
+
+    Next(p) = n;
+    ndesc = 0;
+    for (i = 0; i < NSUB; ++i)
+    {
+        if (Subp(p)[i] != NULL)
+        {
+            sub[ndesc] = s->top[top].child[i];
+            task[ndesc] = s->top[top].task[i];
+            desc[ndesc++] = Subp(p)[i];
+        }
+    }
+    More(p) = desc[0];
+    desc[ndesc] = n;
+
+    for (i = 0; i < ndesc; ++i)
+    {
+        if (sub[i] >= 0)
+        {
+            nbThreadTop(s, (unsigned int) sub[i], desc[i + 1]);
+        }
+        else if (task[i] >= 0 && isCell(desc[i]))
+        {
+            s->tasks[task[i]].next = desc[i + 1];
+        }
+        else
+        {
+            Next(desc[i]) = desc[i + 1];
+        }
+    }
+}
+
+static NBodyStatus nbMakeTreeParallel(const NBodyCtx* ctx, NBodyState* st, int nThread)
+{
+    int i;
+    unsigned int j, nbody = 0, extra;
+    NBodyTree* t = &st->tree;
+    NBodyTreeBuilder topBuilder = EMPTY_TREE_BUILDER;
+    NBodyTreeSplit s;
+    NBodyStatus rc;
+
+    memset(&s, 0, sizeof(s));
+
+    nbNewTree(st, t, &topBuilder);                   /* flush existing tree, etc */
+    expandBox(t, st->bodytab, st->nbody);            /* and expand cell to fit */
+
+    s.bodies = (Body**) mwMalloc(st->nbody * sizeof(Body*));
+    s.scratch = (Body**) mwMalloc(st->nbody * sizeof(Body*));
+    for (j = 0; j < (unsigned int) st->nbody; ++j)
+    {
+        if (!isTestParticle(&st->bodytab[j]))           /* exclude test particles */
+            s.bodies[nbody++] = &st->bodytab[j];
+    }
+
+    s.taskSize = MAX(NBODY_TREE_TASK_MIN, nbody / (8 * nThread));
+    nbAddTopCell(&s, t->root, t->rsize);
+    nbSplitCell(st, &topBuilder, &s, 0, s.bodies, nbody, 0);
+    nbReturnCells(st, &topBuilder);
+    nbFinishBuilder(t, &topBuilder);
+
+    if (t->structureError)
+        goto finish;
+
+  #ifdef _OPENMP
+    #pragma omp parallel for private(j) schedule(dynamic)
+  #endif
+    for (i = 0; i < (int) s.nTask; ++i)
+    {
+        NBodyTreeTask* task = &s.tasks[i];
+
+        for (j = 0; j < task->nbody; ++j)
+        {
+            nbLoadBody(st, &task->builder, t->rsize, task->parent, task->psize, task->lev, task->bodies[j]);
+        }
+    }
+
+    for (j = 0; j < s.nTask; ++j)
+    {
+        nbFinishBuilder(t, &s.tasks[j].builder);
+    }
+
+    if (t->structureError)
+        goto finish;
+
+  #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+  #endif
+    for (i = 0; i < (int) s.nTask; ++i)
+    {
+        NBodyTreeTask* task = &s.tasks[i];
+        NBodyNode* q = Subp(task->parent)[task->slot];
+        NBodyTree local = *t;
+
+        if (isCell(q))
+        {
+            hackCofM(ctx, &local, (NBodyCell*) q, 0.5 * task->psize);
+            task->builder.structureError = local.structureError;
+        }
+    }
+
+    for (j = 0; j < s.nTask; ++j)
+    {
+        t->structureError = t->structureError || s.tasks[j].builder.structureError;
+    }
+
+    for (j = s.nTop; j-- > 0; )                      /* deepest top cells first */
+    {
+        hackCofMCell(ctx, t, s.top[j].cell, s.top[j].psize);
+    }
+
+    if (t->structureError)
+        goto finish;
+
+    nbThreadTop(&s, 0, NULL);
+
+  #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic)
+  #endif
+    for (i = 0; i < (int) s.nTask; ++i)
+    {
+        NBodyTreeTask* task = &s.tasks[i];
+        NBodyNode* q = Subp(task->parent)[task->slot];
+
+        if (isCell(q))
+        {
+            threadTree(q, task->next);
+            if (ctx->useQuad)
+                hackQuad((NBodyCell*) q);
+        }
+    }
+
+    if (ctx->useQuad)
+    {
+        for (j = s.nTop; j-- > 0; )
+        {
+            hackQuadCell(s.top[j].cell);
+        }
+    }
+
+finish:
+    rc = nbFinishTree(st, t, ctx->useQuad);
+
+    extra = nbFreeBuilder(&topBuilder);
+    for (j = 0; j < s.nTask; ++j)
+    {
+        extra += nbFreeBuilder(&s.tasks[j].builder);
+    }
+
+    free(s.top);
+    free(s.tasks);
+    free(s.bodies);
+    free(s.scratch);
+
+    nbGrowBuildCells(st, extra);
+    return rc;
+}
+
 /* nbMakeTree: initialize tree structure for hierarchical force calculation
  * from body array btab, which contains ctx.nbody bodies.
  */
@@ -431,50 +989,460 @@ NBodyStatus nbMakeTree(const NBodyCtx* ctx, NBodyState* st)
     Body* p;
     const Body* endp = st->bodytab + st->nbody;
     NBodyTree* t = &st->tree;
+    NBodyTreeBuilder b = EMPTY_TREE_BUILDER;
+    int nThread = nbGetMaxThreads();
+    NBodyStatus rc;
 
-    nbNewTree(st, t);                                /* flush existing tree, etc */
+    st->nCellBoxes = 0;         /* The cubes of the last tree are gone */
+
+    if (nThread > 1 && st->nbody > 8 * NBODY_TREE_TASK_MIN)
+    {
+        return nbMakeTreeParallel(ctx, st, nThread);
+    }
+
+    nbNewTree(st, t, &b);                            /* flush existing tree, etc */
 
     expandBox(t, st->bodytab, st->nbody);            /* and expand cell to fit */
     for (p = st->bodytab; p < endp; p++)             /* loop over bodies... */
     {
         if (Mass(p) != 0.0)                  /* exclude test particles */
-            nbLoadBody(st, t, p);              /* and insert into tree */
+            nbLoadBody(st, &b, t->rsize, t->root, t->rsize, 0, p); /* and insert into tree */
     }
+    nbFinishBuilder(t, &b);
 
     /* Check if tree structure error occured */
-    if (st->tree.structureError)
-        return NBODY_TREE_STRUCTURE_ERROR;
+    if (!st->tree.structureError)
+        hackCofM(ctx, &st->tree, t->root, t->rsize);   /* find c-of-m coordinates */
 
+    /* Check if tree structure error occured */
+    if (!st->tree.structureError)
+    {
+        threadTree((NBodyNode*) t->root, NULL);        /* add Next and More links */
+        if (ctx->useQuad)                           /* including quad moments? */
+            hackQuad(t->root);                      /* assign Quad moments */
+    }
 
-    hackCofM(ctx, &st->tree, t->root, t->rsize);   /* find c-of-m coordinates */
+    rc = nbFinishTree(st, t, ctx->useQuad);
+    nbGrowBuildCells(st, nbFreeBuilder(&b));
 
-    /* Check if tree structure error occured */
-    if (st->tree.structureError)
-        return NBODY_TREE_STRUCTURE_ERROR;
+    return rc;
+}
 
-    threadTree((NBodyNode*) t->root, NULL);        /* add Next and More links */
-    if (ctx->useQuad)                           /* including quad moments? */
-        hackQuad(t->root);                      /* assign Quad moments */
+/* Tree refitting: The tree from before keeps its structure, and only
+ * its moments are updated for where the bodies are now. The cube of
+ * each cell is found once after the tree is built, so the critical
+ * radii can be found as for a new tree. A body which left the cube of
+ * its cell stays where it is in the tree, and the critical radius of
+ * every cell it is below grows to keep it inside. Once too many bodies
+ * have left their cells a new tree is built.
+ */
 
-    return NBODY_SUCCESS;
+/* Build a new tree once more than 1 / NBODY_TREE_REFIT_ESCAPE_FRACTION
+ * of the bodies have left their cells */
+#define NBODY_TREE_REFIT_ESCAPE_FRACTION 16
+
+/* findCellBoxes: find the cube of every cell of a new tree. The root
+ * is centered on the origin, and the center of mass of each subcell is
+ * inside of its cube, which tells which octant of its parent it is.
+ * Cells come after their parents in st->treeCells.
+ */
+static void nbFindCellBoxes(NBodyState* st)
+{
+    unsigned int i;
+    real quarter;
+    NBodyCell* c;
+    NBodyNode* q;
+    NBodyCellBox* box;
+    NBodyCellBox* sub;
+    NBodyCellArena* a = &st->treeCells;
+
+    if (st->cellBoxAlloc < a->used)
+    {
+        free(st->cellBoxes);
+        st->cellBoxAlloc = a->size;
+        st->cellBoxes = (NBodyCellBox*) mwMalloc(st->cellBoxAlloc * sizeof(NBodyCellBox));
+    }
+
+    box = &st->cellBoxes[0];
+    SET_VECTOR(box->center, 0.0, 0.0, 0.0);
+    box->size = st->tree.rsize;
+    box->reach = 0.0;
+
+    for (i = 0; i < a->used; ++i)
+    {
+        c = &a->cells[i];
+        box = &st->cellBoxes[i];
+        quarter = 0.25 * box->size;
+
+        for (q = More(c); q != Next(c); q = Next(q))
+        {
+            if (isCell(q))
+            {
+                sub = &st->cellBoxes[(NBodyCell*) q - a->cells];
+                SET_VECTOR(sub->center,
+                           X(box->center) + (X(box->center) <= X(Pos(q)) ? quarter : -quarter),
+                           Y(box->center) + (Y(box->center) <= Y(Pos(q)) ? quarter : -quarter),
+                           Z(box->center) + (Z(box->center) <= Z(Pos(q)) ? quarter : -quarter));
+                sub->size = 0.5 * box->size;
+                sub->reach = 0.0;
+            }
+        }
+    }
+
+    st->nCellBoxes = a->used;
+}
+
+static inline mwbool nbOutsideBox(const NBodyCellBox* box, mwvector pos, real halfSize)
+{
+    return mw_fabs(X(pos) - X(box->center)) > halfSize
+        || mw_fabs(Y(pos) - Y(box->center)) > halfSize
+        || mw_fabs(Z(pos) - Z(box->center)) > halfSize;
+}
+
+/* refitTree: update the centers of mass, critical radii and quadrupole
+ * moments of the tree from the bottom up, going backwards through
+ * st->treeCells. Returns the number of bodies outside of their cells.
+ */
+static unsigned int nbRefitTree(const NBodyCtx* ctx, NBodyState* st)
+{
+    int i;
+    unsigned int nEscaped = 0;
+    NBodyCell* c;
+    NBodyNode* q;
+    NBodyCellBox* box;
+    const NBodyCellBox* sub;
+    mwvector cmpos, dr;
+    real drsq, reach, rc2;
+    NBodyCellArena* a = &st->treeCells;
+
+    for (i = (int) a->used - 1; i >= 0; --i)
+    {
+        c = &a->cells[i];
+        box = &st->cellBoxes[i];
+
+        mw_zerov(cmpos);
+        for (q = More(c); q != Next(c); q = Next(q))
+        {
+            mw_incaddv_s(cmpos, Pos(q), Mass(q));
+        }
+
+        if (Mass(c) > 0.0)
+        {
+            mw_incdivs(cmpos, Mass(c));
+        }
+        else
+        {
+            cmpos = box->center;
+        }
+
+        /* Furthest any body outside of the cube can be from the center of mass */
+        reach = 0.0;
+        for (q = More(c); q != Next(c); q = Next(q))
+        {
+            if (isCell(q))
+            {
+                sub = &st->cellBoxes[(NBodyCell*) q - a->cells];
+                if (sub->reach > 0.0)
+                {
+                    reach = mw_fmax(reach, mw_distv(Pos(q), cmpos) + sub->reach);
+                }
+            }
+            else if (nbOutsideBox(box, Pos(q), 0.5 * box->size))
+            {
+                reach = mw_fmax(reach, mw_distv(Pos(q), cmpos));
+
+                /* Bodies which only went a little way out of their
+                 * cell don't make the tree much worse */
+                if (nbOutsideBox(box, Pos(q), box->size))
+                {
+                    ++nEscaped;
+                }
+            }
+        }
+
+        /* A little past the furthest body so it still opens the cell */
+        rc2 = findRCrit(ctx, box->center, st->tree.rsize, cmpos, box->size);
+        Rcrit2(c) = mw_fmax(rc2, sqr(1.01 * reach));
+        box->reach = reach;
+        Pos(c) = cmpos;
+
+        if (ctx->useQuad)
+        {
+            NBodyQuadMatrix quad = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+
+            /* Same moments as hackQuadCell() */
+            for (q = More(c); q != Next(c); q = Next(q))
+            {
+                real m = Mass(q);
+
+                dr = mw_subv(Pos(q), cmpos);
+                drsq = mw_sqrv(dr);
+
+                quad.xx += m * (3.0 * (X(dr) * X(dr)) - drsq);
+                quad.xy += m * (3.0 * (X(dr) * Y(dr)));
+                quad.xz += m * (3.0 * (X(dr) * Z(dr)));
+
+                quad.yy += m * (3.0 * (Y(dr) * Y(dr)) - drsq);
+                quad.yz += m * (3.0 * (Y(dr) * Z(dr)));
+
+                quad.zz += m * (3.0 * (Z(dr) * Z(dr)) - drsq);
+
+                if (isCell(q))
+                {
+                    nbIncAddNBodyQuadMatrix(&quad, &Quad(q));
+                }
+            }
+
+            Quad(c) = quad;
+        }
+    }
+
+    return nEscaped;
+}
+
+/* Whether this step should keep the tree from the last one. Tree
+ * incest means the tree can't be trusted, so build it every time. */
+mwbool nbKeepTree(const NBodyCtx* ctx, const NBodyState* st)
+{
+    return ctx->treeRebuildInterval > 1
+        && st->step % ctx->treeRebuildInterval != 0
+        && !st->treeIncest;
+}
+
+/* nbRefitOrMakeTree: refit the tree from before if asked to and it is
+ * still good enough, or else build a new one which can be refit later.
+ */
+NBodyStatus nbRefitOrMakeTree(const NBodyCtx* ctx, NBodyState* st, mwbool refit)
+{
+    NBodyStatus rc;
+
+    if (refit && st->tree.root && st->nCellBoxes > 0 && st->nCellBoxes == st->treeCells.used)
+    {
+        if (NBODY_TREE_REFIT_ESCAPE_FRACTION * nbRefitTree(ctx, st) <= (unsigned int) st->nbody)
+        {
+            return NBODY_SUCCESS;
+        }
+    }
+
+    rc = nbMakeTree(ctx, st);
+    if (!nbStatusIsFatal(rc))
+    {
+        nbFindCellBoxes(st);
+    }
+
+    return rc;
+}
+
+/* Space filling curve order of the bodies: Sorting bodytab by Morton
+ * key puts bodies that are close in space close in memory, so the tree
+ * build and the force walks of neighbouring bodies touch the same
+ * cache lines. The tree itself does not depend on the order the bodies
+ * are loaded, so the forces don't change. st->bodyOrder keeps track of
+ * where each body went so the original order can be restored.
+ */
+
+#define MORTON_BITS 21
+
+typedef struct
+{
+    uint64_t key;
+    int index;
+} NBodyMortonKey;
+
+/* Spread the low 21 bits of x out to every third bit */
+static inline uint64_t nbSpreadBits(uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | (x << 32)) & 0x1f00000000ffffULL;
+    x = (x | (x << 16)) & 0x1f0000ff0000ffULL;
+    x = (x | (x << 8))  & 0x100f00f00f00f00fULL;
+    x = (x | (x << 4))  & 0x10c30c30c30c30c3ULL;
+    x = (x | (x << 2))  & 0x1249249249249249ULL;
+    return x;
+}
+
+static inline uint64_t nbMortonCoord(real x, real lo, real scale)
+{
+    real c = (x - lo) * scale;
+    const real maxCoord = (real) ((1 << MORTON_BITS) - 1);
+
+    return (uint64_t) mw_fmin(mw_fmax(c, 0.0), maxCoord);
+}
+
+static int nbCompareMortonKeys(const void* _a, const void* _b)
+{
+    const NBodyMortonKey* a = (const NBodyMortonKey*) _a;
+    const NBodyMortonKey* b = (const NBodyMortonKey*) _b;
+
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+
+    return a->index - b->index;  /* Keep the sort stable */
+}
+
+static NBodyNode* nbRemapNode(NBodyNode* p, const Body* bodytab, const int* newIndex)
+{
+    if (p == NULL || isCell(p))
+        return p;
+
+    return (NBodyNode*) &bodytab[newIndex[(const Body*) p - bodytab]];
+}
+
+/* Fix the links of the threaded tree after the bodies have moved.
+ * Bodies carry their own next link with them, and every node is
+ * visited once before its links are followed. */
+static void nbRemapTree(NBodyTree* t, const Body* bodytab, const int* newIndex)
+{
+    NBodyNode* p = (NBodyNode*) t->root;
+
+    while (p != NULL)
+    {
+        Next(p) = nbRemapNode(Next(p), bodytab, newIndex);
+        if (isCell(p))
+        {
+            More(p) = nbRemapNode(More(p), bodytab, newIndex);
+            p = More(p);
+        }
+        else
+        {
+            p = Next(p);
+        }
+    }
+}
+
+/* Move the body in slot perm[i] to slot i, along with its acceleration */
+static void nbPermuteBodies(NBodyState* st, const int* perm)
+{
+    int i;
+    const int nbody = st->nbody;
+    Body* oldBodies = (Body*) mwMallocA(nbody * sizeof(Body));
+    mwvector* oldAccs = (mwvector*) mwMallocA(nbody * sizeof(mwvector));
+    int* newIndex = (int*) mwMalloc(nbody * sizeof(int));
+
+    memcpy(oldBodies, st->bodytab, nbody * sizeof(Body));
+    memcpy(oldAccs, st->acctab, nbody * sizeof(mwvector));
+
+    for (i = 0; i < nbody; ++i)
+    {
+        st->bodytab[i] = oldBodies[perm[i]];
+        st->acctab[i] = oldAccs[perm[i]];
+        newIndex[perm[i]] = i;
+    }
+
+    if (st->timestepLevel)
+    {
+        unsigned char* oldLevels = (unsigned char*) mwMalloc(nbody * sizeof(unsigned char));
+
+        memcpy(oldLevels, st->timestepLevel, nbody * sizeof(unsigned char));
+        for (i = 0; i < nbody; ++i)
+        {
+            st->timestepLevel[i] = oldLevels[perm[i]];
+        }
+
+        free(oldLevels);
+    }
+
+    if (!st->bodyOrder)
+    {
+        st->bodyOrder = (int*) mwMalloc(nbody * sizeof(int));
+        for (i = 0; i < nbody; ++i)
+        {
+            st->bodyOrder[i] = i;
+        }
+    }
+
+    for (i = 0; i < nbody; ++i)
+    {
+        st->bodyOrder[i] = newIndex[st->bodyOrder[i]];
+    }
+
+    nbRemapTree(&st->tree, st->bodytab, newIndex);
+
+    free(newIndex);
+    mwFreeA(oldBodies);
+    mwFreeA(oldAccs);
+}
+
+/* Sort the bodies along a Morton curve through their bounding box */
+void nbReorderBodies(NBodyState* st)
+{
+    int i;
+    const int nbody = st->nbody;
+    const Body* b;
+    NBodyMortonKey* keys;
+    int* perm;
+    mwvector lo, hi;
+    real extent, scale;
+
+    if (nbody < 2)
+        return;
+
+    lo = hi = Pos(&st->bodytab[0]);
+    for (i = 1; i < nbody; ++i)
+    {
+        b = &st->bodytab[i];
+        X(lo) = mw_fmin(X(lo), X(Pos(b)));
+        Y(lo) = mw_fmin(Y(lo), Y(Pos(b)));
+        Z(lo) = mw_fmin(Z(lo), Z(Pos(b)));
+        X(hi) = mw_fmax(X(hi), X(Pos(b)));
+        Y(hi) = mw_fmax(Y(hi), Y(Pos(b)));
+        Z(hi) = mw_fmax(Z(hi), Z(Pos(b)));
+    }
+
+    extent = mw_fmax(X(hi) - X(lo), mw_fmax(Y(hi) - Y(lo), Z(hi) - Z(lo)));
+    scale = extent > 0.0 ? (real) (1 << MORTON_BITS) / extent : 0.0;
+
+    keys = (NBodyMortonKey*) mwMalloc(nbody * sizeof(NBodyMortonKey));
+    for (i = 0; i < nbody; ++i)
+    {
+        b = &st->bodytab[i];
+        keys[i].key = (nbSpreadBits(nbMortonCoord(X(Pos(b)), X(lo), scale)) << 2)
+                    | (nbSpreadBits(nbMortonCoord(Y(Pos(b)), Y(lo), scale)) << 1)
+                    |  nbSpreadBits(nbMortonCoord(Z(Pos(b)), Z(lo), scale));
+        keys[i].index = i;
+    }
+
+    qsort(keys, (size_t) nbody, sizeof(NBodyMortonKey), nbCompareMortonKeys);
+
+    perm = (int*) mwMalloc(nbody * sizeof(int));
+    for (i = 0; i < nbody; ++i)
+    {
+        perm[i] = keys[i].index;
+    }
+    free(keys);
+
+    nbPermuteBodies(st, perm);
+    free(perm);
+}
+
+/* Put the bodies back in the order they were created in */
+void nbRestoreBodyOrder(NBodyState* st)
+{
+    if (!st->bodyOrder)
+        return;
+
+    nbPermuteBodies(st, st->bodyOrder);
+    free(st->bodyOrder);
+    st->bodyOrder = NULL;
 }
 
+
 #if 0
 /* For testing */
 static int luaFindRCrit(lua_State* luaSt)
 {
     const NBodyCtx* ctx;
-    NBodyCell p;  /* Test cell, just need a set position */
+    mwvector center;
     real rSize, pSize;
     mwvector cmPos;
 
     ctx = checkNBodyCtx(luaSt, 1);
-    Pos(&p) = *checkVector(luaSt, 2);
+    center = *checkVector(luaSt, 2);
     rSize = luaL_checknumber(luaSt, 3);
     cmPos = *checkVector(luaSt, 4);
     pSize = luaL_checknumber(luaSt, 5);
 
-    lua_pushnumber(luaSt, findRCrit(ctx, &p, rSize, cmPos, pSize));
+    lua_pushnumber(luaSt, findRCrit(ctx, center, rSize, cmPos, pSize));
 
     return 1;
 }
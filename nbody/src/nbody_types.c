@@ -25,6 +25,9 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 #include "nbody_types.h"
 #include "nbody_show.h"
 #include "nbody_defaults.h"
+#include "nbody_likelihood.h"
+#include "nbody_potential_table.h"
+#include "nbody_checkpoint.h"
 
 #if NBODY_OPENCL
   #include "nbody_cl.h"
@@ -36,41 +39,17 @@ along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
 
 static void freeNBodyTree(NBodyTree* t)
 {
-    NBodyNode* p;
-    NBodyNode* tmp;
-
-    p = (NBodyNode*) t->root;
-    while (p != NULL)
-    {
-        if (isCell(p))
-        {
-            tmp = More(p);
-            mwFreeA(p);
-            p = tmp;
-        }
-        else                        /* skip over bodies */
-        {
-            p = Next(p);
-        }
-    }
-
     t->root = NULL;
     t->cellUsed = 0;
     t->maxDepth = 0;
 }
 
-static void freeFreeCells(NBodyNode* freeCell)
+static void freeCellArena(NBodyCellArena* a)
 {
-    NBodyNode* p;
-    NBodyNode* tmp;
-
-    p = freeCell;
-    while (p)
-    {
-        tmp = Next(p);
-        mwFreeA(p);
-        p = tmp;
-    }
+    mwFreeA(a->cells);
+    a->cells = NULL;
+    a->size = 0;
+    a->used = 0;
 }
 
 int nbDetachSharedScene(NBodyState* st)
@@ -107,11 +86,23 @@ int destroyNBodyState(NBodyState* st)
     int i;
 
     freeNBodyTree(&st->tree);
-    freeFreeCells(st->freeCell);
+    freeCellArena(&st->buildCells);
+    freeCellArena(&st->treeCells);
     mwFreeA(st->bodytab);
     mwFreeA(st->acctab);
     mwFreeA(st->orbitTrace);
-
+    free(st->bodyOrder);
+    free(st->timestepLevel);
+    free(st->activeBodies);
+    free(st->cellBoxes);
+    free(st->fmmLocals);
+    nbFreePotentialTable(st->potTable);
+    st->potTable = NULL;
+    nbFreeDataHistogram(st->dataHist);
+    st->dataHist = NULL;
+
+    nbDestroyCheckpointWriter(st->checkpointWriter);
+    st->checkpointWriter = NULL;
     free(st->checkpointResolved);
 
     if (st->potEvalStates)
@@ -168,9 +159,11 @@ int destroyNBodyState(NBodyState* st)
 void setInitialNBodyState(NBodyState* st, const NBodyCtx* ctx, Body* bodies, int nbody)
 {
     static const NBodyTree emptyTree = EMPTY_TREE;
+    static const NBodyCellArena emptyArena = EMPTY_CELL_ARENA;
 
     st->tree = emptyTree;
-    st->freeCell = NULL;
+    st->buildCells = emptyArena;
+    st->treeCells = emptyArena;
     st->usesQuad = ctx->useQuad;
     st->usesExact = (ctx->criterion == Exact);
 
@@ -401,12 +394,14 @@ int equalNBodyState(const NBodyState* st1, const NBodyState* st2)
 void cloneNBodyState(NBodyState* st, const NBodyState* oldSt)
 {
     static const NBodyTree emptyTree = EMPTY_TREE;
+    static const NBodyCellArena emptyArena = EMPTY_CELL_ARENA;
     unsigned int nbody = oldSt->nbody;
 
     st->tree = emptyTree;
     st->tree.rsize = oldSt->tree.rsize;
 
-    st->freeCell = NULL;
+    st->buildCells = emptyArena;
+    st->treeCells = emptyArena;
 
     st->lastCheckpoint = oldSt->lastCheckpoint;
     st->step           = oldSt->step;
@@ -434,6 +429,14 @@ void cloneNBodyState(NBodyState* st, const NBodyState* oldSt)
     st->acctab = (mwvector*) mwMallocA(nbody * sizeof(mwvector));
     memcpy(st->acctab, oldSt->acctab, nbody * sizeof(mwvector));
 
+    st->potTable = nbClonePotentialTable(oldSt->potTable);
+
+    if (oldSt->bodyOrder)
+    {
+        st->bodyOrder = (int*) mwMalloc(nbody * sizeof(int));
+        memcpy(st->bodyOrder, oldSt->bodyOrder, nbody * sizeof(int));
+    }
+
     if (oldSt->orbitTrace)
     {
         st->orbitTrace = (mwvector*) mwMallocA(oldSt->nOrbitTrace * sizeof(mwvector));
@@ -620,6 +623,16 @@ int equalNBodyCtx(const NBodyCtx* ctx1, const NBodyCtx* ctx2)
         && feqWithNan(ctx1->quietErrors, ctx2->quietErrors)
         && ctx1->checkpointT == ctx2->checkpointT
         && feqWithNan(ctx1->nStep, ctx2->nStep)
+        && ctx1->groupSize == ctx2->groupSize
+        && ctx1->reorderInterval == ctx2->reorderInterval
+        && ctx1->potentialGrid == ctx2->potentialGrid
+        && feqWithNan(ctx1->potentialGridMin, ctx2->potentialGridMin)
+        && feqWithNan(ctx1->potentialGridMax, ctx2->potentialGridMax)
+        && feqWithNan(ctx1->potentialGridTolerance, ctx2->potentialGridTolerance)
+        && ctx1->timestepLevels == ctx2->timestepLevels
+        && feqWithNan(ctx1->timestepAccuracy, ctx2->timestepAccuracy)
+        && ctx1->treeRebuildInterval == ctx2->treeRebuildInterval
+        && ctx1->fmmOrder == ctx2->fmmOrder
         && equalPotential(&ctx1->pot, &ctx2->pot);
 }
 
@@ -198,3 +198,21 @@ void nbReportTreeIncest(const NBodyCtx* ctx, NBodyState* st)
     }
 }
 
+/* Seed for the streams of a parallel model. Taking it from the model's
+ * prng keeps models generated one after another independent. */
+uint32_t nbBlockSeed(dsfmt_t* prng)
+{
+    return dsfmt_genrand_uint32(prng);
+}
+
+/* Each block of bodies gets its own stream, so the bodies don't depend
+ * on how the blocks are divided between threads */
+void nbInitBlockPRNG(dsfmt_t* blockState, uint32_t seed, unsigned int block)
+{
+    uint32_t key[2];
+
+    key[0] = seed;
+    key[1] = (uint32_t) block;
+    dsfmt_init_by_array(blockState, key, 2);
+}
+
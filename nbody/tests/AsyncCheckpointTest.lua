@@ -0,0 +1,112 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- Checkpoints written in the background must be identical to ones
+-- written in the foreground, including when the next checkpoint is
+-- frozen while the previous one is still being written, and resuming
+-- from them must give the same run.
+
+require "NBodyTesting"
+SM = require "SampleModels"
+SP = require "SamplePotentials"
+
+local function readFile(name)
+   local f = assert(io.open(name, "rb"))
+   local s = assert(f:read("*a"))
+   f:close()
+   return s
+end
+
+local function runNSteps(st, ctx, n)
+   for i = 1, n do
+      st:step(ctx)
+   end
+end
+
+local function assertSameFile(async, sync, what)
+   assert(readFile(async) == readFile(sync),
+          string.format("Background checkpoint %s does not match the foreground one", what))
+end
+
+local function assertSameState(st1, st2, what)
+   assert(st1 == st2,
+          string.format("%s does not match:\nstate 1 = %s\nstate 2 = %s\n",
+                        what, tostring(st1), tostring(st2)))
+end
+
+-- The writer renames its temporary in the working directory over the
+-- checkpoint, so keep the checkpoint next to it
+local asyncCheckpoint = string.format("nbody_async_checkpoint_test_%d", os.time())
+local syncCheckpoint = os.tmpname()
+local syncTmp = os.tmpname()
+
+local prng = DSFMT.create(4291)
+
+for _, criterion in ipairs({ "TreeCode", "Exact" }) do
+   local ctx = createTestCtx{
+      timestep   = 1.0e-4,
+      timeEvolve = 1.0,
+      theta      = 0.5,
+      eps2       = 1.0e-4,
+      criterion  = criterion
+   }
+   ctx:addPotential(SP.randomPotential(prng))
+
+   local st = NBodyState.create(ctx, SM.randomPlummer(prng, 1000))
+   runNSteps(st, ctx, 5)
+
+   -- One checkpoint, compared with the same state written in the foreground
+   st:startCheckpoint(ctx, asyncCheckpoint)
+   st:writeCheckpoint(ctx, syncCheckpoint, syncTmp)
+   st:finishCheckpoint()
+   assertSameFile(asyncCheckpoint, syncCheckpoint, criterion .. " after 5 steps")
+
+   -- Several checkpoints in a row without waiting, so later ones are
+   -- frozen into the other buffer while earlier ones are written. The
+   -- last one started must be the one left on disk, whichever buffer
+   -- it ended up in.
+   for n = 2, 5 do
+      for i = 1, n do
+         st:step(ctx)
+         st:startCheckpoint(ctx, asyncCheckpoint)
+      end
+      st:writeCheckpoint(ctx, syncCheckpoint, syncTmp)
+      assert(st:finishCheckpoint() == false, "Background checkpoint still waiting after finishing")
+      assertSameFile(asyncCheckpoint, syncCheckpoint,
+                     string.format("%s after %d checkpoints in a row", criterion, n))
+   end
+
+   -- Resuming from the background and foreground checkpoints, and
+   -- carrying on, must give the same run
+   local ctxAsync, stAsync = NBodyState.readCheckpoint(asyncCheckpoint)
+   local ctxSync, stSync = NBodyState.readCheckpoint(syncCheckpoint)
+   assert(ctxAsync == ctxSync, "Context resumed from the background checkpoint does not match")
+   assertSameState(stAsync, stSync, criterion .. " state resumed from the background checkpoint")
+
+   runNSteps(st, ctx, 5)
+   runNSteps(stAsync, ctxAsync, 5)
+   runNSteps(stSync, ctxSync, 5)
+   assertSameState(stAsync, stSync, criterion .. " run resumed from the background checkpoint")
+   assertSameState(stAsync, st, criterion .. " resumed run compared with the uninterrupted run")
+end
+
+os.remove(asyncCheckpoint)
+os.remove(syncCheckpoint)
+os.remove(syncTmp)
+
@@ -0,0 +1,53 @@
+
+args = {...}
+
+assert(#args == 2, "2 arguments required")
+
+evolveTime = tonumber(args[1])
+dwarfMass = tonumber(args[2])
+assert(evolveTime and dwarfMass, "Arguments must be numbers")
+
+nbody = 100
+dwarfRadius = 0.2
+prng = DSFMT.create(42)
+
+function makeHistogram()
+   return HistogramParams.create()
+end
+
+function makePotential()
+   return Potential.create{
+      spherical = Spherical.spherical{ mass = 1.52954402e5, scale = 0.7 },
+      disk      = Disk.miyamotoNagai{ mass = 4.45865888e5, scaleLength = 6.5, scaleHeight = 0.26 },
+      halo      = Halo.logarithmic{ vhalo = 73, scaleLength = 12.0, flattenZ = 1.0 }
+   }
+end
+
+function makeContext()
+   return NBodyCtx.create{
+      timestep      = calculateTimestep(dwarfMass, dwarfRadius),
+      timeEvolve    = evolveTime,
+      eps2          = calculateEps2(nbody, dwarfRadius),
+      criterion     = "sw93",
+      useQuad       = true,
+      theta         = 1.0,
+      BestLikeStart = 0.95,
+      BetaSigma     = 2.5,
+      VelSigma      = 2.5,
+      IterMax       = 6,
+      BetaCorrect   = 1.111,
+      VelCorrect    = 1.111
+   }
+end
+
+function makeBodies(ctx, potential)
+   return predefinedModels.plummer{
+      nbody       = nbody,
+      prng        = prng,
+      position    = lbrToCartesian(ctx, Vector.create(218, 53.5, 28.6)),
+      velocity    = Vector.create(-156, 79, 107),
+      mass        = dwarfMass,
+      scaleRadius = dwarfRadius
+   }
+end
+
@@ -0,0 +1,115 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+require "NBodyTesting"
+SM = require "SampleModels"
+SP = require "SamplePotentials"
+
+local nTests = 5
+
+for i = 1, nTests do
+   local prng = DSFMT.create()
+   local tmpDir = os.getenv("TMP") or ""
+   local output = tmpDir .. os.tmpname()
+
+   local m = SM.randomPlummer(prng, 500)
+   local ctx = createTestCtx{
+      timestep   = prng:random(1.0e-5, 1.0e-4),
+      timeEvolve = prng:random(0, 10),
+      theta      = prng:random(0, 1),
+      eps2       = prng:random(1.0e-9, 1.0e-3),
+      criterion  = "TreeCode"
+   }
+   ctx:addPotential(SP.randomPotential(prng))
+
+   local st = NBodyState.create(ctx, m)
+   for j = 1, floor(prng:random(0, 11)) do
+      st:step(ctx)
+   end
+
+   st:writeBinaryOutput(ctx, output)
+
+   assert(st:binaryOutputMatches(output), "Binary output does not match state")
+
+   local bodies, info = NBodyState.readBinaryOutput(output)
+   os.remove(output)
+
+   assert(#bodies == info.nbody,
+          string.format("Expected %d bodies in binary output, got %d", info.nbody, #bodies))
+   assert(info.timestep == ctx.timestep, "Binary output timestep does not match")
+end
+
+
+-- Damaged files should be rejected before any bodies are read
+local function readFile(name)
+   local f = assert(io.open(name, "rb"))
+   local s = assert(f:read("*a"))
+   f:close()
+   return s
+end
+
+local function writeFile(name, s)
+   local f = assert(io.open(name, "wb"))
+   f:write(s)
+   f:close()
+end
+
+-- Replace the 4 bytes at offset in s
+local function replaceU32(s, offset, bytes)
+   return s:sub(1, offset) .. bytes .. s:sub(offset + 5)
+end
+
+local function readFails(s)
+   local file = os.tmpname()
+   writeFile(file, s)
+   local ok = pcall(NBodyState.readBinaryOutput, file)
+   os.remove(file)
+   return not ok
+end
+
+do
+   local prng = DSFMT.create(42)
+   local output = os.tmpname()
+   local ctx = createTestCtx{
+      timestep   = 1.0e-4,
+      timeEvolve = 1.0,
+      theta      = 0.5,
+      eps2       = 1.0e-4,
+      criterion  = "TreeCode"
+   }
+   ctx:addPotential(SP.randomPotential(prng))
+
+   local st = NBodyState.create(ctx, SM.randomPlummer(prng, 100))
+   st:writeBinaryOutput(ctx, output)
+   local good = readFile(output)
+   os.remove(output)
+
+   -- Offsets in the header after the 8 byte magic and version
+   local byteOrderOffset, nbodyOffset = 12, 20
+
+   assert(not readFails(good), "Undamaged binary output was rejected")
+   assert(readFails(good:sub(1, #good - 1)), "Truncated binary output was accepted")
+   assert(readFails(good .. "\0"), "Binary output with trailing bytes was accepted")
+   assert(readFails(good:sub(1, 20)), "Binary output with a partial header was accepted")
+   assert(readFails(replaceU32(good, byteOrderOffset, good:sub(byteOrderOffset + 1, byteOrderOffset + 4):reverse())),
+          "Binary output with the other byte order was accepted")
+   assert(readFails(replaceU32(good, nbodyOffset, "\255\255\255\127")),
+          "Binary output with a huge body count was accepted")
+end
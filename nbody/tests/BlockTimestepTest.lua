@@ -0,0 +1,136 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+-- Compare block timesteps against global steps for a dense core in a
+-- wide halo of bodies, like a dwarf which has started to come apart.
+-- The global step dt is short enough for the core. Errors are the RMS
+-- distance from a run with global steps of dt / 8.
+
+require "NBodyTesting"
+
+local nbody = 1000
+local evolveTime = 0.05
+local coreMass, coreRadius = 12, 0.2
+
+local eps2 = calculateEps2(nbody, coreRadius)
+local dt = evolveTime / 96
+
+local potential = Potential.create{
+   spherical = Spherical.spherical{ mass = 1.52954402e5, scale = 0.7 },
+   disk      = Disk.miyamotoNagai{ mass = 4.45865888e5, scaleLength = 6.5, scaleHeight = 0.26 },
+   halo      = Halo.logarithmic{ vhalo = 73, scaleLength = 12.0, flattenZ = 1.0 }
+}
+
+local function makeModel()
+   local prng = DSFMT.create(1234)
+   local pos = Vector.create(-22.0415, -3.35444, 19.9539)
+   local vel = Vector.create(118.444, 168.874, -67.6378)
+
+   local core = predefinedModels.plummer{
+      nbody       = nbody / 5,
+      prng        = prng,
+      position    = pos,
+      velocity    = vel,
+      mass        = coreMass,
+      scaleRadius = coreRadius
+   }
+
+   local halo = predefinedModels.plummer{
+      nbody       = 4 * nbody / 5,
+      prng        = prng,
+      position    = pos,
+      velocity    = vel,
+      mass        = 4,
+      scaleRadius = 3.0
+   }
+
+   return core .. halo
+end
+
+local model = makeModel()
+
+local function runModel(timestep, levels, accuracy)
+   local ctx = createTestCtx{
+      timestep         = timestep,
+      timeEvolve       = evolveTime,
+      theta            = 0.5,
+      eps2             = eps2,
+      criterion        = "TreeCode",
+      timestepLevels   = levels,
+      timestepAccuracy = accuracy
+   }
+   ctx:addPotential(potential)
+
+   local st = NBodyState.create(ctx, BodyBlock.create(model))
+   -- The context shortens the step to fit in evolveTime
+   for i = 1, floor(evolveTime / ctx.timestep + 0.5) do
+      st:step(ctx)
+   end
+
+   return st, ctx
+end
+
+local function finalBodies(st, ctx)
+   local file = os.tmpname()
+   st:writeBinaryOutput(ctx, file)
+   local bodies = NBodyState.readBinaryOutput(file)
+   os.remove(file)
+   return bodies
+end
+
+local reference = finalBodies(runModel(dt / 8, 0, 0.025))
+
+local function runError(timestep, levels, accuracy)
+   local st, ctx = runModel(timestep, levels, accuracy)
+   local bodies = finalBodies(st, ctx)
+   local err = 0.0
+
+   for i = 1, #bodies do
+      err = err + Vector.length(bodies[i].position - reference[i].position)^2
+   end
+
+   return sqrt(err / #bodies), st
+end
+
+local globalErr, globalSt = runError(dt, 0, 0.025)
+local coarseErr = runError(8 * dt, 0, 0.025)
+local oneLevelErr, oneLevelSt = runError(dt, 1, 0.025)
+local blockErr = runError(8 * dt, 4, 0.025)
+local looseErr, looseSt = runError(8 * dt, 4, 0.2)
+local tightErr, tightSt = runError(8 * dt, 4, 0.005)
+
+eprintf("Global step error %g, 8 times longer %g\n", globalErr, coarseErr)
+eprintf("Block step error %g, accuracy 0.2: %g, accuracy 0.005: %g\n", blockErr, looseErr, tightErr)
+
+assert(globalSt == oneLevelSt, "One timestep level should be the same as global steps")
+
+assert(looseSt ~= tightSt, "Timestep accuracy does not change the block steps")
+
+-- The halo bodies take the long step, which alone is much worse
+assert(blockErr < 0.5 * coarseErr,
+       string.format("Block step error %g is not much better than the longest step %g", blockErr, coarseErr))
+
+assert(blockErr < 1.5 * globalErr,
+       string.format("Block step error %g is much worse than the global step %g", blockErr, globalErr))
+
+assert(tightErr < looseErr,
+       string.format("Block step error %g with accuracy 0.005 is not better than %g with accuracy 0.2",
+                     tightErr, looseErr))
+
@@ -0,0 +1,198 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+
+-- Check the BodyBlock methods against the same operations on tables
+-- of Body, and that a state made from a block matches one made from
+-- its bodies.
+
+require "NBodyTesting"
+
+local function testCtx()
+   local ctx = createTestCtx{
+      timestep   = 1.0e-3,
+      timeEvolve = 1.0,
+      theta      = 0.5,
+      eps2       = 1.0e-4,
+      criterion  = "SW93"
+   }
+
+   ctx:addPotential(
+      Potential.create{
+         spherical = Spherical.spherical{ mass = 1.52954402e5, scale = 0.7 },
+         disk      = Disk.miyamotoNagai{ mass = 4.45865888e5, scaleLength = 6.5, scaleHeight = 0.26 },
+         halo      = Halo.logarithmic{ vhalo = 73, scaleLength = 12.0, flattenZ = 1.0 }
+      }
+   )
+
+   return ctx
+end
+
+-- Bodies on a fixed pattern, starting from offset so different
+-- calls give different bodies
+local function testBodies(n, offset)
+   local bodies = { }
+
+   for i = offset + 1, offset + n do
+      bodies[#bodies + 1] = Body.create{
+         mass     = 10.0 + i % 7,
+         position = Vector.create(8.0 + math.sin(1.3 * i), math.cos(0.7 * i), 0.5 * math.sin(2.1 * i)),
+         velocity = Vector.create(10.0 * math.cos(1.1 * i), 200.0 + 10.0 * math.sin(0.3 * i), math.cos(0.9 * i)),
+         ignore   = (i % 10 == 0)
+      }
+   end
+
+   return bodies
+end
+
+local function vectorsEqual(a, b)
+   return a.x == b.x and a.y == b.y and a.z == b.z
+end
+
+local function bodiesEqual(a, b)
+   return a.mass == b.mass
+      and a.ignore == b.ignore
+      and vectorsEqual(a.position, b.position)
+      and vectorsEqual(a.velocity, b.velocity)
+end
+
+-- model is a block or a table of Body
+local function assertBodiesEqual(model, expected, what)
+   assert(#model == #expected,
+          string.format("%s: got %d bodies, expected %d", what, #model, #expected))
+
+   for i = 1, #expected do
+      assert(bodiesEqual(model[i], expected[i]),
+             string.format("%s: body %d differs:\n  got      %s\n  expected %s\n",
+                           what, i, tostring(model[i]), tostring(expected[i])))
+   end
+end
+
+local function assertFails(f, what)
+   assert(not pcall(f), what .. " did not raise an error")
+end
+
+
+local tableA = testBodies(30, 0)
+local tableB = testBodies(20, 30)
+local tableAB = testBodies(50, 0)
+
+-- create
+local blockA = BodyBlock.create(tableA)
+local blockB = BodyBlock.create(tableB)
+assertBodiesEqual(blockA, tableA, "Block from table")
+assertBodiesEqual(BodyBlock.create(blockA), tableA, "Block from block")
+assertBodiesEqual(BodyBlock.create(blockA, tableB), tableAB, "Block from block and table")
+assertBodiesEqual(BodyBlock.create(tableA, blockB), tableAB, "Block from table and block")
+assert(#BodyBlock.create() == 0, "Block with no arguments is not empty")
+assert(tostring(blockA) == "BodyBlock(30 bodies)", "Unexpected tostring: " .. tostring(blockA))
+
+-- Concatenation makes a new block and leaves the operands alone
+assertBodiesEqual(blockA .. blockB, tableAB, "Concatenated blocks")
+assertBodiesEqual(blockA .. tableB, tableAB, "Concatenated block and table")
+assertBodiesEqual(blockA, tableA, "First operand of concatenation")
+assertBodiesEqual(blockB, tableB, "Second operand of concatenation")
+
+-- toTable
+local t = blockA:toTable()
+assert(type(t) == "table", "toTable() did not return a table")
+assertBodiesEqual(t, tableA, "toTable()")
+
+-- __index returns a copy of the body
+local b = blockA[1]
+b.mass = 1234.0
+b.position = Vector.create(1, 2, 3)
+assertBodiesEqual(blockA, tableA, "Block after changing a body from __index")
+
+assertFails(function() return blockA[0] end, "Index 0")
+assertFails(function() return blockA[#blockA + 1] end, "Index past the end")
+assertFails(function() return blockA.notAMethod end, "Unknown member")
+
+-- __newindex replaces the body
+local blockC = BodyBlock.create(tableA)
+local tableC = testBodies(30, 0)
+tableC[5] = tableB[1]
+blockC[5] = tableB[1]
+assertBodiesEqual(blockC, tableC, "Block after __newindex")
+assertFails(function() blockC[0] = tableB[1] end, "Setting index 0")
+assertFails(function() blockC[#blockC + 1] = tableB[1] end, "Setting index past the end")
+
+-- shift and setIgnore work in place and return the block
+local dx, dv = Vector.create(1.5, -2.0, 0.25), Vector.create(-10.0, 3.0, 7.5)
+local shifted = testBodies(30, 0)
+for i = 1, #shifted do
+   shifted[i].position = shifted[i].position + dx
+   shifted[i].velocity = shifted[i].velocity + dv
+end
+
+local blockD = BodyBlock.create(tableA)
+assert(rawequal(blockD:shift(dx, dv), blockD), "shift() did not return the block")
+assertBodiesEqual(blockD, shifted, "Shifted position and velocity")
+
+for i = 1, #shifted do
+   shifted[i].position = shifted[i].position + dx
+end
+blockD:shift(dx)
+assertBodiesEqual(blockD, shifted, "Shifted position only")
+
+assert(rawequal(blockD:setIgnore(true), blockD), "setIgnore() did not return the block")
+for i = 1, #blockD do
+   assert(blockD[i].ignore, string.format("Body %d not ignored after setIgnore(true)", i))
+end
+blockD:setIgnore(false)
+for i = 1, #blockD do
+   assert(not blockD[i].ignore, string.format("Body %d ignored after setIgnore(false)", i))
+end
+
+-- A state made from a single block takes over its bodies, and is the
+-- same as one made from a table of them
+local ctx = testCtx()
+local blockE = BodyBlock.create(tableA, tableB)
+local stBlock = NBodyState.create(ctx, blockE)
+local stTable = NBodyState.create(ctx, tableAB)
+
+assert(#blockE == 0, string.format("State did not take over the block, which has %d bodies", #blockE))
+assert(stBlock == stTable,
+       string.format("State from a block does not match the state from a table:\nstate 1 = %s\n state 2 = %s\n",
+                     tostring(stBlock),
+                     tostring(stTable))
+    )
+
+-- With more than one model the bodies are copied. Models are read
+-- from the last one.
+local stMixed = NBodyState.create(ctx, tableB, blockA)
+assertBodiesEqual(blockA, tableA, "Block after making a state with another model")
+assert(stMixed == stTable,
+       string.format("State from a block and table does not match the state from a table:\nstate 1 = %s\n state 2 = %s\n",
+                     tostring(stMixed),
+                     tostring(stTable))
+    )
+
+for i = 1, 10 do
+   stBlock:step(ctx)
+   stTable:step(ctx)
+end
+
+assert(stBlock == stTable,
+       string.format("State from a block diverged from the state from a table:\nstate 1 = %s\n state 2 = %s\n",
+                     tostring(stBlock),
+                     tostring(stTable))
+    )
+
@@ -0,0 +1,152 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+require "NBodyTesting"
+SM = require "SampleModels"
+SP = require "SamplePotentials"
+
+-- A version 2 checkpoint stores how many context fields it has. Cut
+-- the fields added last out of a checkpoint, as if it was written
+-- before they existed, and check those come back as the defaults
+-- while everything else is resumed. A file with more fields than are
+-- known must be rejected.
+
+-- Offsets of the field count and the first context field
+local nCtxFieldsOffset = 16 + 3 * 4
+local ctxOffset = 16 + 8 * 4 + 8
+
+-- Fields added last, with values other than the defaults
+local newFields = {
+   timestepLevels      = 2,
+   timestepAccuracy    = 0.05,
+   treeRebuildInterval = 4,
+   fmmOrder            = 1
+}
+local nNewFields = 4
+
+local function readFile(name)
+   local f = assert(io.open(name, "rb"))
+   local s = assert(f:read("*a"))
+   f:close()
+   return s
+end
+
+local function writeFile(name, s)
+   local f = assert(io.open(name, "wb"))
+   f:write(s)
+   f:close()
+end
+
+-- Integers are in the byte order of the writer, given by the 0x01020304
+-- after the header
+local function littleEndian(s)
+   return s:byte(17) == 4
+end
+
+local function getU32(s, offset)
+   local b1, b2, b3, b4 = s:byte(offset + 1, offset + 4)
+   if not littleEndian(s) then
+      b1, b2, b3, b4 = b4, b3, b2, b1
+   end
+   return b1 + 256 * (b2 + 256 * (b3 + 256 * b4))
+end
+
+local function putU32(s, offset, x)
+   local b = { }
+   for i = 1, 4 do
+      b[i] = x % 256
+      x = floor(x / 256)
+   end
+   if not littleEndian(s) then
+      b = { b[4], b[3], b[2], b[1] }
+   end
+   return s:sub(1, offset) .. string.char(unpack(b)) .. s:sub(offset + 5)
+end
+
+-- Set the field count to nCtxFields, keeping the first nKeep fields
+-- and adding extra ones after them
+local function changeFields(s, nKeep, extra)
+   local nCtxFields = getU32(s, nCtxFieldsOffset)
+   local keepEnd = ctxOffset + 8 * nKeep
+   local ctxEnd = ctxOffset + 8 * nCtxFields
+   s = s:sub(1, keepEnd) .. extra .. s:sub(ctxEnd + 1)
+   return putU32(s, nCtxFieldsOffset, nKeep + #extra / 8)
+end
+
+local function readCheckpoint(s)
+   local file = os.tmpname()
+   writeFile(file, s)
+   local ok, ctx, st = pcall(NBodyState.readCheckpoint, file)
+   os.remove(file)
+   return ok, ctx, st
+end
+
+local function makeCtx(fields)
+   local t = {
+      timestep   = 1.0e-3,
+      timeEvolve = 1.0,
+      theta      = 0.5,
+      eps2       = 1.0e-4,
+      criterion  = "SW93"
+   }
+   for k, v in pairs(fields) do
+      t[k] = v
+   end
+
+   local ctx = createTestCtx(t)
+   ctx:addPotential(SP.samplePotentials.potentialA)
+   return ctx
+end
+
+
+local prng = DSFMT.create(5)
+local m = SM.randomPlummer(prng, 100)
+
+local ctx = makeCtx(newFields)
+local oldCtx = makeCtx({ })
+local st = NBodyState.create(ctx, m)
+for i = 1, 5 do
+   st:step(ctx)
+end
+
+local file = os.tmpname()
+st:writeCheckpoint(ctx, file)
+local full = readFile(file)
+os.remove(file)
+
+local nCtxFields = getU32(full, nCtxFieldsOffset)
+assert(nCtxFields > nNewFields, "Checkpoint has too few context fields")
+
+local ok, ctxFull, stFull = readCheckpoint(full)
+assert(ok, "Failed to read checkpoint: " .. tostring(ctxFull))
+assert(ctxFull == ctx,
+       string.format("Checkpoint context does not match:\nctx 1 = %s\n ctx 2 = %s\n",
+                     tostring(ctx), tostring(ctxFull)))
+assert(stFull == st, "Checkpoint state does not match")
+
+local ok, ctxOld, stOld = readCheckpoint(changeFields(full, nCtxFields - nNewFields, ""))
+assert(ok, "Failed to read checkpoint with fewer context fields: " .. tostring(ctxOld))
+assert(ctxOld == oldCtx,
+       string.format("Missing context fields should be the defaults:\nctx 1 = %s\n ctx 2 = %s\n",
+                     tostring(oldCtx), tostring(ctxOld)))
+assert(stOld == st, "Checkpoint state with fewer context fields does not match")
+
+assert(not readCheckpoint(changeFields(full, nCtxFields, string.rep("\0", 8))),
+       "Checkpoint with an unknown context field should be rejected")
@@ -33,10 +33,16 @@ function randomNBodyCtx(prng)
       theta       = prng:random(0, 1),
       eps2        = prng:random(1.0e-9, 1.0e-3),
       treeRSize   = prng:randomListItem({ 4, 8, 2, 16 }),
-      criterion   = prng:randomListItem({"TreeCode", "SW93", "BH86", "Exact"}),
+      criterion   = prng:randomListItem({"TreeCode", "SW93", "BH86", "Exact", "FMM"}),
       useQuad     = prng:randomBool(),
       allowIncest = true,
-      quietErrors = true
+      quietErrors = true,
+      BestLikeStart = 0.95,
+      BetaSigma     = 2.5,
+      VelSigma      = 2.5,
+      IterMax       = 6,
+      BetaCorrect   = 1.111,
+      VelCorrect    = 1.111
    }
 end
 
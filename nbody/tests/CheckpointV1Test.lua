@@ -0,0 +1,104 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+-- Resume a checkpoint in the version 1 format, which is a raw copy of
+-- the old context and bodies. The file was written by a build from
+-- before the version 2 format, at step 0 of the state made by
+-- v1TestState() below, with
+--
+--   st:writeCheckpoint(ctx, "CheckpointV1Test.checkpoint")
+--
+-- The format depends on the struct layout, so it can only be read on
+-- 64 bit little endian builds with double precision.
+
+require "NBodyTesting"
+
+local checkpointFile = "CheckpointV1Test.checkpoint"
+local nbody = 100
+local nSteps = 20
+
+function v1TestCtx()
+   local ctx = createTestCtx{
+      timestep   = 1.0e-3,
+      timeEvolve = 1.0,
+      theta      = 0.5,
+      eps2       = 1.0e-4,
+      criterion  = "SW93"
+   }
+
+   ctx:addPotential(
+      Potential.create{
+         spherical = Spherical.spherical{ mass = 1.52954402e5, scale = 0.7 },
+         disk      = Disk.miyamotoNagai{ mass = 4.45865888e5, scaleLength = 6.5, scaleHeight = 0.26 },
+         halo      = Halo.logarithmic{ vhalo = 73, scaleLength = 12.0, flattenZ = 1.0 }
+      }
+   )
+
+   return ctx
+end
+
+-- Bodies on a fixed pattern so the state doesn't depend on the PRNG
+function v1TestBodies()
+   local bodies = { }
+
+   for i = 1, nbody do
+      bodies[i] = Body.create{
+         mass     = 10.0 + i % 7,
+         position = Vector.create(8.0 + math.sin(1.3 * i), math.cos(0.7 * i), 0.5 * math.sin(2.1 * i)),
+         velocity = Vector.create(10.0 * math.cos(1.1 * i), 200.0 + 10.0 * math.sin(0.3 * i), math.cos(0.9 * i)),
+         ignore   = (i % 10 == 0)
+      }
+   end
+
+   return bodies
+end
+
+function v1TestState(ctx)
+   return NBodyState.create(ctx, v1TestBodies())
+end
+
+
+local ctx = v1TestCtx()
+local st = v1TestState(ctx)
+local ctxV1, stV1 = NBodyState.readCheckpoint(checkpointFile)
+
+assert(ctx == ctxV1,
+       string.format("Version 1 checkpoint context does not match:\nctx 1 = %s\n ctx 2 = %s\n",
+                     tostring(ctx),
+                     tostring(ctxV1))
+    )
+
+assert(st == stV1,
+       string.format("Version 1 checkpoint state does not match:\nstate 1 = %s\n state 2 = %s\n",
+                     tostring(st),
+                     tostring(stV1))
+    )
+
+for i = 1, nSteps do
+   st:step(ctx)
+   stV1:step(ctxV1)
+end
+
+assert(st == stV1,
+       string.format("State resumed from version 1 checkpoint diverged:\nstate 1 = %s\n state 2 = %s\n",
+                     tostring(st),
+                     tostring(stV1))
+    )
+
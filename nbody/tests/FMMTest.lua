@@ -0,0 +1,80 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+require "NBodyTesting"
+SM = require "SampleModels"
+SP = require "SamplePotentials"
+
+-- Largest RMS error of the FMM self gravity relative to the exact self
+-- gravity for each setting
+local settings = {
+   { theta = 0.0, useQuad = true,  fmmOrder = 2, tolerance = 1.0e-10 },
+   { theta = 0.3, useQuad = true,  fmmOrder = 2, tolerance = 1.0e-3  },
+   { theta = 0.5, useQuad = true,  fmmOrder = 2, tolerance = 5.0e-3  },
+   { theta = 0.5, useQuad = true,  fmmOrder = 1, tolerance = 1.0e-2  },
+   { theta = 0.5, useQuad = false, fmmOrder = 2, tolerance = 2.0e-2  },
+   { theta = 0.8, useQuad = true,  fmmOrder = 2, tolerance = 5.0e-2  }
+}
+
+local function makeCtx(criterion, eps2, s)
+   return createTestCtx{
+      timestep   = 1.0e-4,
+      timeEvolve = 1.0,
+      theta      = s.theta,
+      eps2       = eps2,
+      criterion  = criterion,
+      useQuad    = s.useQuad,
+      fmmOrder   = s.fmmOrder
+   }
+end
+
+local nTests = 3
+
+for i = 1, nTests do
+   local prng = DSFMT.create()
+   local m = SM.randomPlummer(prng, 2000)
+   local pot = SP.randomPotential(prng)
+   local eps2 = prng:random(1.0e-9, 1.0e-3)
+
+   for _, s in ipairs(settings) do
+      local exactCtx = makeCtx("Exact", eps2, s)
+      local fmmCtx = makeCtx("FMM", eps2, s)
+      exactCtx:addPotential(pot)
+      fmmCtx:addPotential(pot)
+
+      local exact = NBodyState.create(exactCtx, BodyBlock.create(m)):accelerations()
+      local fmm = NBodyState.create(fmmCtx, BodyBlock.create(m)):accelerations()
+
+      -- The external potential is the same for both, so leave it out of
+      -- the size of the accelerations
+      local err, size = 0.0, 0.0
+      for j = 1, #exact do
+         local self = exact[j] - pot:acceleration(m[j].position)
+         err = err + Vector.length(fmm[j] - exact[j])^2
+         size = size + Vector.length(self)^2
+      end
+      err = sqrt(err / size)
+
+      assert(err <= s.tolerance,
+             string.format("FMM error %g with %d bodies, theta = %g, useQuad = %s, fmmOrder = %d exceeds %g",
+                           err, #exact, s.theta, tostring(s.useQuad), s.fmmOrder, s.tolerance))
+   end
+end
+
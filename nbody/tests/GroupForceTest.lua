@@ -0,0 +1,116 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+require "NBodyTesting"
+SM = require "SampleModels"
+SP = require "SamplePotentials"
+
+-- Compare the accelerations from the grouped tree walk to those from
+-- the walk for each body and to the exact ones. A group only accepts
+-- a cell which every body in it would accept, so it should be at
+-- least as close to the exact forces as the walk for each body.
+-- Test particles aren't in the tree and take the walk for each body
+-- either way, so those have to match exactly.
+
+local groupSizes = { 2, 8, 32, 64 }
+local criteria = { "TreeCode", "BH86", "SW93" }
+local nTestParticles = 50
+local tolerance = 5.0e-3
+
+local function makeCtx(criterion, eps2, groupSize)
+   return createTestCtx{
+      timestep   = 1.0e-4,
+      timeEvolve = 1.0,
+      theta      = 0.5,
+      eps2       = eps2,
+      criterion  = criterion,
+      groupSize  = groupSize
+   }
+end
+
+local function accelerations(criterion, eps2, groupSize, pot, m)
+   local ctx = makeCtx(criterion, eps2, groupSize)
+   ctx:addPotential(pot)
+   return NBodyState.create(ctx, BodyBlock.create(m)):accelerations()
+end
+
+-- RMS difference of the accelerations of the first n bodies relative
+-- to the RMS self gravity
+local function rmsError(a, b, exact, n, pot, m)
+   local err, size = 0.0, 0.0
+   for j = 1, n do
+      err = err + Vector.length(a[j] - b[j])^2
+      size = size + Vector.length(exact[j] - pot:acceleration(m[j].position))^2
+   end
+   return sqrt(err / size)
+end
+
+local nTests = 3
+
+for i = 1, nTests do
+   local prng = DSFMT.create(i)
+   local m = SM.randomPlummer(prng, 2000)
+   local nMassive = #m
+   local pot = SP.randomPotential(prng)
+   local eps2 = prng:random(1.0e-9, 1.0e-3)
+
+   -- Test particles spread over the same region as the model
+   local testParticles = { }
+   for j = 1, nTestParticles do
+      local b = m[1 + (j * 37) % nMassive]
+      testParticles[j] = Body.create{
+         mass     = 0.0,
+         position = b.position + prng:randomVector(0.1),
+         velocity = b.velocity
+      }
+   end
+   m = mergeTables(m, testParticles)
+
+   local exact = accelerations("Exact", eps2, 0, pot, m)
+
+   for _, criterion in ipairs(criteria) do
+      local body = accelerations(criterion, eps2, 0, pot, m)
+      local bodyError = rmsError(body, exact, exact, nMassive, pot, m)
+
+      for _, groupSize in ipairs(groupSizes) do
+         local group = accelerations(criterion, eps2, groupSize, pot, m)
+         local name = string.format("%s with %d bodies, groupSize = %d", criterion, nMassive, groupSize)
+
+         assert(#group == #m, name .. ": wrong number of accelerations")
+
+         local groupError = rmsError(group, exact, exact, nMassive, pot, m)
+         assert(groupError <= tolerance,
+                string.format("%s: error %g against Exact exceeds %g", name, groupError, tolerance))
+         assert(groupError <= 1.01 * bodyError + 1.0e-12,
+                string.format("%s: error %g against Exact exceeds %g for the walk for each body",
+                              name, groupError, bodyError))
+
+         local diff = rmsError(group, body, exact, nMassive, pot, m)
+         assert(diff <= 2.0 * bodyError + 1.0e-12,
+                string.format("%s: differs from the walk for each body by %g, more than twice its error %g",
+                              name, diff, bodyError))
+
+         for j = nMassive + 1, #m do
+            assert(Vector.length(group[j] - body[j]) == 0.0,
+                   string.format("%s: test particle %d has a different acceleration", name, j - nMassive))
+         end
+      end
+   end
+end
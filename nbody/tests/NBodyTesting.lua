@@ -117,6 +117,10 @@ function deepcopy(object)
 end
 
 function mergeTables(m1, ...)
+   if type(m1) == "userdata" then
+      return BodyBlock.create(m1, ...)
+   end
+
    local i = #m1
    for _, m in ipairs({...}) do
       for _, v in ipairs(m) do
@@ -461,5 +465,25 @@ function findLikelihood(str, emd)
    return -findNumber(str, name)
 end
 
-
-
+-- Create a context for a test from the fields it sets. The tree
+-- fields default to the usual ones, and the likelihood fields, which
+-- every context needs but no force or integration test looks at, are
+-- always filled in.
+function createTestCtx(fields)
+   local t = {
+      treeRSize     = 4,
+      useQuad       = true,
+      allowIncest   = true,
+      quietErrors   = true,
+      BestLikeStart = 0.95,
+      BetaSigma     = 2.5,
+      VelSigma      = 2.5,
+      IterMax       = 6,
+      BetaCorrect   = 1.111,
+      VelCorrect    = 1.111
+   }
+   for k, v in pairs(fields) do
+      t[k] = v
+   end
+   return NBodyCtx.create(t)
+end
@@ -0,0 +1,62 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+-- Models generated with parallel set must not depend on the number of
+-- threads. Generate them in a new process for each thread count and
+-- compare every body.
+
+require "NBodyTesting"
+
+args = {...}
+
+driverBin = assert(args[1], "Missing test driver name")
+modelScript = "ParallelModelsTestModels.lua"
+
+local threadCounts = { 1, 2, 3, 8 }
+
+local function generate(nThreads)
+   local cmd = string.format("OMP_NUM_THREADS=%d %s %s", nThreads, driverBin, modelScript)
+   local f = assert(io.popen(cmd, "r"))
+   local lines = { }
+   for line in f:lines() do
+      lines[#lines + 1] = line
+   end
+   f:close()
+   return lines
+end
+
+local expected = generate(threadCounts[1])
+assert(#expected > 3, "Failed to generate models:\n" .. table.concat(expected, "\n"))
+
+for i = 2, #threadCounts do
+   local nThreads = threadCounts[i]
+   local lines = generate(nThreads)
+   local model = ""
+
+   assert(#lines == #expected,
+          string.format("Got %d lines with %d threads, expected %d", #lines, nThreads, #expected))
+
+   for j = 1, #expected do
+      model = expected[j]:match("^(%a+)") or model
+      assert(lines[j] == expected[j],
+             string.format("%s differs with %d threads on line %d:\n  %s\nexpected\n  %s",
+                           model, nThreads, j, lines[j], expected[j]))
+   end
+end
@@ -0,0 +1,81 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+-- Used by ParallelModelsTest.lua. Generates each model with parallel
+-- set and prints every body in full precision.
+
+require "NBodyTesting"
+
+local nbody = 2500
+
+local position = Vector.create(-22.0415, -3.35444, 19.9539)
+local velocity = Vector.create(118.444, 168.874, -67.6378)
+
+local models = {
+   plummer = function(prng)
+      return predefinedModels.plummer{
+         nbody       = nbody,
+         prng        = prng,
+         position    = position,
+         velocity    = velocity,
+         mass        = 12.0,
+         scaleRadius = 0.2,
+         parallel    = true
+      }
+   end,
+
+   isotropic = function(prng)
+      return predefinedModels.isotropic{
+         nbody        = nbody,
+         prng         = prng,
+         position     = position,
+         velocity     = velocity,
+         mass1        = 12.0,
+         mass2        = 60.0,
+         scaleRadius1 = 0.2,
+         scaleRadius2 = 0.8,
+         parallel     = true
+      }
+   end,
+
+   mixeddwarf = function(prng)
+      return predefinedModels.mixeddwarf{
+         nbody    = nbody,
+         prng     = prng,
+         position = position,
+         velocity = velocity,
+         comp1    = Dwarf.plummer{ mass = 12.0, scaleLength = 0.2 },
+         comp2    = Dwarf.plummer{ mass = 60.0, scaleLength = 0.8 },
+         parallel = true
+      }
+   end
+}
+
+for _, name in ipairs({ "plummer", "isotropic", "mixeddwarf" }) do
+   local m = models[name](DSFMT.create(1234))
+   printf("%s %d\n", name, #m)
+   for i = 1, #m do
+      local b = m[i]
+      printf("%.17g %.17g %.17g %.17g %.17g %.17g %.17g\n",
+             b.position.x, b.position.y, b.position.z,
+             b.velocity.x, b.velocity.y, b.velocity.z,
+             b.mass)
+   end
+end
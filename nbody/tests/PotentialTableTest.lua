@@ -0,0 +1,126 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+require "NBodyTesting"
+SP = require "SamplePotentials"
+
+-- Check the interpolated external acceleration against the potential,
+-- and the checks on the size of the table
+
+local function makeCtx(grid, tolerance)
+   return createTestCtx{
+      timestep               = 1.0e-3,
+      timeEvolve             = 1.0,
+      theta                  = 0.5,
+      eps2                   = 1.0e-4,
+      criterion              = "SW93",
+      potentialGrid          = grid,
+      potentialGridTolerance = tolerance
+   }
+end
+
+
+-- Sizes of the table
+local function gridIsValid(grid)
+   return pcall(makeCtx, grid, 5.0e-3)
+end
+
+for _, grid in ipairs({ 0, 4, 5, 64, 128 }) do
+   assert(gridIsValid(grid), string.format("potentialGrid = %d should be allowed", grid))
+end
+
+for _, grid in ipairs({ -1, 1, 2, 3, 129, 1024 }) do
+   assert(not gridIsValid(grid), string.format("potentialGrid = %d should not be allowed", grid))
+end
+
+assert(not pcall(makeCtx, 32, 0.0), "potentialGridTolerance = 0 should not be allowed")
+
+
+-- Bodies from well inside to well outside of the default table range
+-- of 1 to 200 kpc, uniform in log(r) and over the sphere
+local function makeBodies(prng, n)
+   local bodies = { }
+
+   for i = 1, n do
+      local r = math.exp(prng:random(math.log(0.3), math.log(400.0)))
+      local z = prng:random(-1.0, 1.0)
+      local phi = prng:random(0.0, 2.0 * math.pi)
+      local s = sqrt(1.0 - z * z)
+
+      bodies[i] = Body.create{
+         mass     = 1.0e-3,
+         position = Vector.create(r * s * math.cos(phi), r * s * math.sin(phi), r * z),
+         velocity = Vector.create(0, 0, 0)
+      }
+   end
+
+   return bodies
+end
+
+-- The self gravity is the same with and without the table, so the
+-- difference of the accelerations is the error of the table
+local function checkTable(name, pot, bodies, grid, tolerance)
+   local directCtx, tableCtx = makeCtx(0, tolerance), makeCtx(grid, tolerance)
+   directCtx:addPotential(pot)
+   tableCtx:addPotential(pot)
+
+   local direct = NBodyState.create(directCtx, bodies):accelerations()
+   local tabulated = NBodyState.create(tableCtx, bodies):accelerations()
+
+   local maxErr, nInside = 0.0, 0
+   for i = 1, #bodies do
+      local r = Vector.length(bodies[i].position)
+      local exact = pot:acceleration(bodies[i].position)
+      local err = Vector.length(tabulated[i] - direct[i]) / Vector.length(exact)
+
+      if r >= tableCtx.potentialGridMin and r < tableCtx.potentialGridMax then
+         nInside = nInside + 1
+         maxErr = math.max(maxErr, err)
+      else
+         assert(err == 0.0, string.format("%s: body %d at r = %g outside of the table is not evaluated directly",
+                                          name, i, r))
+      end
+   end
+
+   eprintf("%s: potentialGrid = %d, largest relative error %g of %d bodies in the table\n",
+           name, grid, maxErr, nInside)
+
+   assert(nInside > 0, name .. ": no bodies in the table")
+   assert(maxErr <= tolerance,
+          string.format("%s: potentialGrid = %d has relative error %g > potentialGridTolerance = %g",
+                        name, grid, maxErr, tolerance))
+
+   return maxErr
+end
+
+local prng = DSFMT.create(1234)
+local bodies = makeBodies(prng, 1000)
+
+for name, pot in pairs(SP.samplePotentials) do
+   assert(checkTable(name, pot, bodies, 32, 5.0e-3) > 0.0,
+          name .. ": table with the default tolerance was not used")
+   assert(checkTable(name, pot, bodies, 64, 2.0e-3) > 0.0,
+          name .. ": table with a tighter tolerance was not used")
+
+   -- A table which misses the tolerance is thrown away
+   assert(checkTable(name, pot, bodies, 4, 1.0e-6) == 0.0,
+          name .. ": table worse than the tolerance was used")
+end
+
@@ -0,0 +1,134 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+require "NBodyTesting"
+
+-- Compare the accelerations from a tree refit for a few steps to the
+-- accelerations from a new tree for the same bodies, and check that
+-- bodies moving out of their cells make a new tree be built.
+
+local nbody = 2000
+local mass, radius = 10.0, 0.5
+local nSteps = 5
+local rebuildInterval = 8
+
+local function makeCtx(criterion, interval)
+   return createTestCtx{
+      timestep            = calculateTimestep(mass, radius),
+      timeEvolve          = 1.0,
+      theta               = 0.5,
+      eps2                = calculateEps2(nbody, radius),
+      criterion           = criterion,
+      treeRebuildInterval = interval
+   }
+end
+
+local potential = Potential.create{
+   spherical = Spherical.spherical{ mass = 1.52954402e5, scale = 0.7 },
+   disk      = Disk.miyamotoNagai{ mass = 4.45865888e5, scaleLength = 6.5, scaleHeight = 0.26 },
+   halo      = Halo.logarithmic{ vhalo = 73, scaleLength = 12.0, flattenZ = 1.0 }
+}
+
+local refitCtx = makeCtx("SW93", rebuildInterval)
+local rebuildCtx = makeCtx("SW93", 0)
+local exactCtx = makeCtx("Exact", 0)
+refitCtx:addPotential(potential)
+rebuildCtx:addPotential(potential)
+exactCtx:addPotential(potential)
+
+local function makeModel()
+   return predefinedModels.plummer{
+      nbody       = nbody,
+      prng        = DSFMT.create(42),
+      position    = Vector.create(-22.0415, -3.35444, 19.9539),
+      velocity    = Vector.create(0, 0, 0),
+      mass        = mass,
+      scaleRadius = radius
+   }
+end
+
+-- Bodies and accelerations after some steps which keep the first tree
+local function stepRefit(model)
+   local st = NBodyState.create(refitCtx, model)
+   for i = 1, nSteps do
+      st:step(refitCtx)
+   end
+
+   local file = os.tmpname()
+   st:writeBinaryOutput(refitCtx, file)
+   local bodies = NBodyState.readBinaryOutput(file)
+   os.remove(file)
+
+   return bodies, st:accelerations()
+end
+
+-- RMS of the differences relative to the RMS of the exact self
+-- gravity. The external potential is the same for all of them, so it is
+-- left out of the size.
+local function rmsDifference(a, b, exact, bodies)
+   local err, size = 0.0, 0.0
+   for i = 1, #exact do
+      err = err + Vector.length(a[i] - b[i])^2
+      size = size + Vector.length(exact[i] - potential:acceleration(bodies[i].position))^2
+   end
+   return sqrt(err / size)
+end
+
+local function identical(a, b)
+   for i = 1, #a do
+      local d = a[i] - b[i]
+      if d.x ~= 0.0 or d.y ~= 0.0 or d.z ~= 0.0 then
+         return false
+      end
+   end
+   return true
+end
+
+
+-- The bodies barely move, so the refit tree is almost as good as a new one
+local bodies, refit = stepRefit(makeModel())
+local rebuilt = NBodyState.create(rebuildCtx, bodies):accelerations()
+local exact = NBodyState.create(exactCtx, bodies):accelerations()
+
+local refitErr = rmsDifference(refit, exact, exact, bodies)
+local rebuildErr = rmsDifference(rebuilt, exact, exact, bodies)
+local diff = rmsDifference(refit, rebuilt, exact, bodies)
+
+eprintf("After %d steps: refit error %g, new tree error %g, difference %g\n",
+        nSteps, refitErr, rebuildErr, diff)
+
+assert(not identical(refit, rebuilt), "The tree was not refit")
+-- Both are off from the exact forces by about 1e-3 with theta = 0.5
+assert(diff < 2.0e-3,
+       string.format("Refit accelerations differ from a new tree by %g", diff))
+assert(refitErr < 1.5 * rebuildErr,
+       string.format("Refit error %g is much worse than the new tree error %g", refitErr, rebuildErr))
+
+
+-- Moving everything by a few cells each step takes all of the bodies
+-- out of their cells, so each step builds a new tree
+local fast = makeModel():shift(Vector.create(0, 0, 0), Vector.create(1.0, -0.5, 0.5) / refitCtx.timestep)
+local fastBodies, fastRefit = stepRefit(fast)
+local fastRebuilt = NBodyState.create(rebuildCtx, fastBodies):accelerations()
+
+assert(identical(fastRefit, fastRebuilt),
+       string.format("Accelerations with all bodies out of their cells differ from a new tree by %g",
+                     rmsDifference(fastRefit, fastRebuilt, fastRebuilt, fastBodies)))
+
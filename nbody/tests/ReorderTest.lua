@@ -0,0 +1,140 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+-- Sorting the bodies along a space filling curve every few steps
+-- should not change the result. Scripts and outputs always see the
+-- bodies in the order they were created in, so the state, the
+-- accelerations, binary output and checkpoints written partway through
+-- a run must all match a run which never sorts them. Then run the
+-- whole simulation with and without sorting and compare the outputs.
+
+require "NBodyTesting"
+SM = require "SampleModels"
+SP = require "SamplePotentials"
+
+args = {...}
+
+nbodyBin = assert(args[1], "Missing binary name")
+inputTest = "ReorderTestInput.lua"
+
+local nSteps = 12
+local checkpointStep = 5
+
+local function readFile(name)
+   local f = assert(io.open(name, "rb"))
+   local s = assert(f:read("*a"))
+   f:close()
+   return s
+end
+
+local function binaryOutput(st, ctx)
+   local file = os.tmpname()
+   st:writeBinaryOutput(ctx, file)
+   local s = readFile(file)
+   os.remove(file)
+   return s
+end
+
+local function checkpoint(st, ctx)
+   local file = os.tmpname()
+   st:writeCheckpoint(ctx, file)
+   local _, stCp = NBodyState.readCheckpoint(file)
+   os.remove(file)
+   return stCp
+end
+
+local function makeCtx(reorderInterval, timestepLevels)
+   local ctx = createTestCtx{
+      timestep        = 1.0e-3,
+      timeEvolve      = 1.0,
+      theta           = 0.5,
+      eps2            = 1.0e-4,
+      criterion       = "SW93",
+      reorderInterval = reorderInterval,
+      timestepLevels  = timestepLevels
+   }
+   ctx:addPotential(SP.samplePotentials.potentialA)
+   return ctx
+end
+
+local m = SM.randomPlummer(DSFMT.create(3), 2000)
+
+for _, timestepLevels in ipairs({ 0, 3 }) do
+   local ctx = makeCtx(0, timestepLevels)
+   local st = NBodyState.create(ctx, BodyBlock.create(m))
+
+   for _, reorderInterval in ipairs({ 1, 4 }) do
+      local name = string.format("reorderInterval = %d, timestepLevels = %d", reorderInterval, timestepLevels)
+      local ctxR = makeCtx(reorderInterval, timestepLevels)
+      local stR = NBodyState.create(ctxR, BodyBlock.create(m))
+      local stPlain = st:clone()
+
+      for i = 1, nSteps do
+         stPlain:step(ctx)
+         stR:step(ctxR)
+
+         if i == checkpointStep then
+            assert(checkpoint(stR, ctxR) == checkpoint(stPlain, ctx),
+                   name .. ": checkpoint written partway through doesn't match")
+         end
+      end
+
+      local acc, accR = stPlain:accelerations(), stR:accelerations()
+      for j = 1, #acc do
+         assert(Vector.length(accR[j] - acc[j]) == 0.0,
+                string.format("%s: acceleration of body %d doesn't match", name, j))
+      end
+
+      assert(binaryOutput(stR, ctxR) == binaryOutput(stPlain, ctx),
+             name .. ": binary output doesn't match")
+      assert(stR == stPlain, name .. ": final state doesn't match")
+   end
+end
+
+
+-- The same through a whole run, which writes its output at the end
+local function runOutput(reorderInterval)
+   local output = os.tmpname()
+   local run = os.readProcess(nbodyBin,
+                              "--checkpoint-interval=-1",
+                              "--ignore-checkpoint",
+                              "--input-file", inputTest,
+                              "--output-file", output,
+                              "--output-cartesian",
+                              tostring(reorderInterval))
+   local f = io.open(output, "r")
+   local s = f and f:read("*a")
+   if f then
+      f:close()
+   end
+   os.remove(output)
+
+   if not s or s == "" then
+      eprintf("Failed to run with reorderInterval = %d:\n", reorderInterval)
+      error(run)
+   end
+   return s
+end
+
+local plainOutput = runOutput(0)
+for _, reorderInterval in ipairs({ 1, 3 }) do
+   assert(runOutput(reorderInterval) == plainOutput,
+          string.format("Output with reorderInterval = %d doesn't match", reorderInterval))
+end
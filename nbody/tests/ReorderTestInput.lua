@@ -0,0 +1,75 @@
+--
+-- Copyright (C) 2011  Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+--
+
+-- Input for ReorderTest.lua. Takes the reorderInterval to use.
+
+args = {...}
+
+assert(#args == 1, "1 argument required")
+
+reorderInterval = tonumber(args[1])
+assert(reorderInterval, "Argument must be a number")
+
+nbody = 500
+dwarfMass = 16
+dwarfRadius = 0.2
+evolveTime = 0.05
+prng = DSFMT.create(42)
+
+function makeHistogram()
+   return HistogramParams.create()
+end
+
+function makePotential()
+   return Potential.create{
+      spherical = Spherical.spherical{ mass = 1.52954402e5, scale = 0.7 },
+      disk      = Disk.miyamotoNagai{ mass = 4.45865888e5, scaleLength = 6.5, scaleHeight = 0.26 },
+      halo      = Halo.logarithmic{ vhalo = 73, scaleLength = 12.0, flattenZ = 1.0 }
+   }
+end
+
+function makeContext()
+   return NBodyCtx.create{
+      timestep        = calculateTimestep(dwarfMass, dwarfRadius),
+      timeEvolve      = evolveTime,
+      eps2            = calculateEps2(nbody, dwarfRadius),
+      criterion       = "sw93",
+      useQuad         = true,
+      theta           = 1.0,
+      reorderInterval = reorderInterval,
+      BestLikeStart   = 0.95,
+      BetaSigma       = 2.5,
+      VelSigma        = 2.5,
+      IterMax         = 6,
+      BetaCorrect     = 1.111,
+      VelCorrect      = 1.111
+   }
+end
+
+function makeBodies(ctx, potential)
+   return predefinedModels.plummer{
+      nbody       = nbody,
+      prng        = prng,
+      position    = lbrToCartesian(ctx, Vector.create(218, 53.5, 28.6)),
+      velocity    = Vector.create(-156, 79, 107),
+      mass        = dwarfMass,
+      scaleRadius = dwarfRadius
+   }
+end
@@ -0,0 +1,80 @@
+
+require "NBodyTesting"
+
+args = {...}
+
+nbodyBin = assert(args[1], "Missing binary name")
+inputTest = "BatchTestInput.lua"
+
+-- Only read stdout, where the likelihoods go
+local function readBatchOutput(bin, ...)
+   local cmd = table.concat({ bin, table.concat({...}, " ") }, " ")
+   local f = assert(io.popen(cmd, "r"))
+   local lines = { }
+   for line in f:lines() do
+      lines[#lines + 1] = line
+   end
+   f:close()
+   return lines
+end
+
+-- Make the histogram to match from a normal run with the parameters
+-- of the first line of the batch
+local histogram = os.tmpname()
+local run = os.readProcess(nbodyBin,
+                           "--checkpoint-interval=-1",
+                           "--ignore-checkpoint",
+                           "--input-file", inputTest,
+                           "--histoout-file", histogram,
+                           "0.1 16")
+
+local f = io.open(histogram, "r")
+local hasHistogram = f and f:read("*a"):find("lambdaBins")
+if f then
+   f:close()
+end
+
+if not hasHistogram then
+   os.remove(histogram)
+   eprintf("Failed to make histogram:\n")
+   error(run)
+end
+
+local batchFile = os.tmpname()
+f = assert(io.open(batchFile, "w"))
+f:write("# evolveTime dwarfMass\n",
+        "0.1 16\n",
+        "\n",
+        "0.1 sixteen\n",
+        "0.1, 12\n",
+        "0.1 16\n")
+f:close()
+
+local output = readBatchOutput(nbodyBin,
+                               "--input-file", inputTest,
+                               "--histogram-file", histogram,
+                               "--batch=" .. batchFile,
+                               "2>/dev/null")
+
+os.remove(histogram)
+os.remove(batchFile)
+
+assert(#output == 4, string.format("Expected 4 lines of output, got %d:\n%s\n", #output, table.concat(output, "\n")))
+
+local results = { }
+for i = 1, #output do
+   results[i] = tonumber(output[i])
+   assert(results[i], string.format("Line %d of output is not a number: '%s'", i, output[i]))
+end
+
+-- The likelihood is the negative of the emd, which is 0 for a match
+assert(math.abs(results[1]) < 1.0e-6,
+       string.format("Parameters of the histogram gave likelihood %.15f", results[1]))
+assert(results[2] ~= results[2], string.format("Bad parameters gave %.15f instead of nan", results[2]))
+assert(results[3] < results[1],
+       string.format("Changed parameters gave likelihood %.15f, not worse than %.15f", results[3], results[1]))
+assert(results[4] == results[1],
+       string.format("Repeated parameters gave likelihood %.15f instead of %.15f", results[4], results[1]))
+
+printf("batch passed\n")
+
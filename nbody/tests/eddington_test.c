@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2011 Matthew Arsenault
+ * Copyright (c) 2011 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compare the tabulated distribution function of the isotropic model
+ * to direct evaluation between the grid points, where the interpolation
+ * is worst, over the whole range of the table. */
+
+#include "milkyway_util.h"
+#include "nbody_isotropic.h"
+#include "nbody_eddington.h"
+
+/* Largest difference allowed, relative to the peak of f(E). Near the
+ * top of the table, bodies close to the center, the direct evaluation
+ * itself scatters by up to about 0.5% of the peak from one energy to the
+ * next, since the root found for the upper limit of the integral moves
+ * in steps. The table smooths over that, so the top 1% of the table in
+ * log(E) only has to be as close as the scatter. */
+#define EDDINGTON_TOLERANCE 1.0e-3
+#define EDDINGTON_CENTER_TOLERANCE 2.0e-2
+
+/* Points compared in each interval of the table */
+#define POINTS_PER_INTERVAL 3
+
+static int testEddingtonTable(const real* args)
+{
+    EddingtonTable t;
+    unsigned int i, j;
+    real peak = 0.0;
+    real maxDiff = 0.0;
+    real logE, energy, f, fExpected, diff, tolerance;
+    int center;
+    int fails = 0;
+
+    nbMakeIsotropicEddingtonTable(&t, args);
+
+    for (i = 0; i < t.n; ++i)
+    {
+        peak = mw_fmax(peak, t.f[i]);
+    }
+
+    if (!(peak > 0.0))
+    {
+        mw_printf("ERROR: f(E) is not positive anywhere in the table\n");
+        nbFreeEddingtonTable(&t);
+        return 1;
+    }
+
+    for (i = 0; i < t.n - 1; ++i)
+    {
+        center = (i >= t.n - t.n / 100);
+        tolerance = center ? EDDINGTON_CENTER_TOLERANCE : EDDINGTON_TOLERANCE;
+
+        for (j = 1; j <= POINTS_PER_INTERVAL; ++j)
+        {
+            logE = t.logEMin + ((real) i + (real) j / (POINTS_PER_INTERVAL + 1)) * t.dLogE;
+            energy = mw_exp(logE);
+
+            f = nbEddingtonDistFun(&t, energy);
+            fExpected = t.distFun(energy, t.model);
+            diff = mw_fabs(f - fExpected);
+            if (!center)
+            {
+                maxDiff = mw_fmax(maxDiff, diff);
+            }
+
+            if (diff > tolerance * peak)
+            {
+                mw_printf("ERROR: Tabulated f(E) differs at E = %.15g:\n"
+                          "  Got      %.15g\n"
+                          "  Expected %.15g\n",
+                          energy, f, fExpected);
+                ++fails;
+            }
+        }
+    }
+
+    mw_printf("Eddington table test (%g, %g, %g, %g), E in [%g, %g]: "
+              "largest difference %g of the peak below the top 1%%, %s\n",
+              args[0], args[1], args[2], args[3],
+              mw_exp(t.logEMin), mw_exp(t.logEMax),
+              maxDiff / peak,
+              fails ? "failed" : "passed");
+
+    nbFreeEddingtonTable(&t);
+
+    return fails;
+}
+
+int main(int argc, const char* argv[])
+{
+    /* { light mass, dark mass, light scale radius, dark scale radius } */
+    static const real models[][4] =
+        {
+            { 12.0, 48.0, 0.2, 0.8 },
+            {  2.0, 60.0, 0.5, 1.5 },
+            { 30.0, 30.0, 0.3, 0.3 }
+        };
+
+    unsigned int i;
+    int fails = 0;
+
+    (void) argc, (void) argv;
+
+    for (i = 0; i < sizeof(models) / sizeof(models[0]); ++i)
+    {
+        fails += testEddingtonTable(models[i]);
+    }
+
+    if (fails != 0)
+    {
+        mw_printf("%d Eddington table comparisons failed\n", fails);
+    }
+
+    return fails;
+}
+
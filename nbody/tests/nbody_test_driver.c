@@ -38,6 +38,7 @@
 #include "nbody_plummer.h"
 #include "nbody_defaults.h"
 #include "nbody_tree.h"
+#include "nbody_io.h"
 
 
 /* things in NBodyCtx which influence individual steps that aren't the potential. */
@@ -433,6 +434,74 @@ static int installHashFunctions(lua_State* luaSt)
 }
 #endif
 
+/* Compare the bits so -0.0 and NaN must match exactly too */
+static mwbool sameReal(real x, real y)
+{
+    return memcmp(&x, &y, sizeof(real)) == 0;
+}
+
+/* Check that the bodies in a binary output file exactly match the state
+ * state:binaryOutputMatches(filename) */
+static int luaBinaryOutputMatches(lua_State* luaSt)
+{
+    const NBodyState* st;
+    const char* filename;
+    NBodyBinaryOutputHeader hdr;
+    Body* bodies;
+    const Body* a;
+    const Body* b;
+    int i;
+    mwbool matches;
+
+    if (lua_gettop(luaSt) != 2)
+        luaL_argerror(luaSt, 2, "Expected 2 arguments");
+
+    st = checkNBodyState(luaSt, 1);
+    filename = luaL_checkstring(luaSt, 2);
+
+    bodies = nbReadBodiesBinary(filename, &hdr);
+    if (!bodies)
+        return luaL_error(luaSt, "Error reading binary output '%s'", filename);
+
+    matches = (hdr.nbody == (uint32_t) st->nbody && hdr.step == (uint32_t) st->step);
+    for (i = 0; i < st->nbody && matches; ++i)
+    {
+        a = &st->bodytab[i];
+        b = &bodies[i];
+
+        matches = (   sameReal(X(Pos(a)), X(Pos(b)))
+                   && sameReal(Y(Pos(a)), Y(Pos(b)))
+                   && sameReal(Z(Pos(a)), Z(Pos(b)))
+                   && sameReal(X(Vel(a)), X(Vel(b)))
+                   && sameReal(Y(Vel(a)), Y(Vel(b)))
+                   && sameReal(Z(Vel(a)), Z(Vel(b)))
+                   && sameReal(Mass(a), Mass(b))
+                   && Type(a) == Type(b)
+                   && idBody(a) == idBody(b));
+        if (!matches)
+        {
+            mw_printf("Binary output body %d does not match\n", i);
+        }
+    }
+
+    mwFreeA(bodies);
+
+    lua_pushboolean(luaSt, matches);
+    return 1;
+}
+
+static void registerBinaryOutputTestFunctions(lua_State* luaSt)
+{
+    static const luaL_reg binaryOutputMethods[] =
+        {
+            { "binaryOutputMatches", luaBinaryOutputMatches },
+            { NULL, NULL }
+        };
+
+    luaL_register(luaSt, NBODYSTATE_TYPE, binaryOutputMethods);
+    lua_pop(luaSt, 1);
+}
+
 /* Create a context with everything unset, useful for testing but
  * undesirable for actual work. */
 static int createTestNBodyCtx(lua_State* luaSt)
@@ -465,6 +534,7 @@ static int runNBodyTest(const char* file, const char** args, unsigned int nArgs)
      * to not include useless / and or less safe versions of
      * functions. */
     registerNBodyState(luaSt);
+    registerBinaryOutputTestFunctions(luaSt);
 
   #if USE_SSL_TESTS
     installHashFunctions(luaSt);
@@ -25,20 +25,51 @@
 #define _EVALUATION_H_
 
 #include "separation_types.h"
+#include "star_geometry.h"
 #include "milkyway_util.h"
 
+#if SEPARATION_OPENCL
+  #include "setup_cl.h"
+#endif /* SEPARATION_OPENCL */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* The parts of an evaluation which don't depend on the fit parameters.
+ * Each part is set up the first time it is needed and then shared by
+ * every evaluation in the process, so bundled workunits and batch runs
+ * only redo the parameter dependent work. */
+typedef struct
+{
+    const char* starPointsFile;
+    char* geometryFile;       /* Saved StarGeometry, or NULL to not save it */
+    StarPoints sp;            /* Stars from starPointsFile once starsRead */
+    StarGeometry geom;        /* For sp with the last convolve and modfit */
+    StreamGauss sg;           /* Convolution points once sgConvolve != 0 */
+    unsigned int sgConvolve;
+    CLInfo ci;                /* Device and context once clReady */
+  #if SEPARATION_OPENCL
+    SeparationCLMem* cms;     /* Buffers for each integral in clIas */
+    IntegralArea* clIas;
+    AstronomyParameters clAp; /* Parameters the buffers were made for */
+    size_t clSummarizationWorkgroupSize;
+  #endif /* SEPARATION_OPENCL */
+    int verifyStars;          /* Check the checksum of a binary star points file */
+    int starsRead;
+    int clReady;
+} SeparationContext;
+
+void initSeparationContext(SeparationContext* ctx, const char* starPointsFile, int saveGeometry, int verifyStars);
+void freeSeparationContext(SeparationContext* ctx);
 
-int evaluate(SeparationResults* results,
+int evaluate(SeparationContext* ctx,
+             SeparationResults* results,
              AstronomyParameters* ap,
              const IntegralArea* ias,
              const Streams* streams,
              const StreamConstants* sc,
              int likelihoodToText,
-             const char* star_points_file,
              const CLRequest* clr,
              int do_separation,
              int *ignoreCheckpoint,
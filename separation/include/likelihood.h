@@ -29,10 +29,12 @@ extern "C" {
 #endif
 
 #include "separation_types.h"
+#include "star_geometry.h"
 
 int likelihood(SeparationResults* results,
                const AstronomyParameters* ap,
                const StarPoints* sp,
+               const StarGeometry* geom,
                const StreamConstants* sc,
                const Streams* streams,
                const StreamGauss sg,
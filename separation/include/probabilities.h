@@ -35,7 +35,11 @@ extern "C" {
 
 /* probabilities will be rebuilt for each SSE level */
 #if MW_IS_X86
-  #if defined(__AVX__)
+  #if defined(__AVX512F__)
+    #define INIT_PROBABILITIES initProbabilities_AVX512
+  #elif defined(__AVX2__) && defined(__FMA__)
+    #define INIT_PROBABILITIES initProbabilities_AVX2
+  #elif defined(__AVX__)
     #define INIT_PROBABILITIES initProbabilities_AVX
   #elif defined(__SSE4_1__)
     #define INIT_PROBABILITIES initProbabilities_SSE41
@@ -52,6 +56,8 @@ extern "C" {
 
 
 #if MW_IS_X86
+ProbabilityFunc initProbabilities_AVX512(const AstronomyParameters* ap);
+ProbabilityFunc initProbabilities_AVX2(const AstronomyParameters* ap);
 ProbabilityFunc initProbabilities_AVX(const AstronomyParameters* ap);
 ProbabilityFunc initProbabilities_SSE41(const AstronomyParameters* ap);
 ProbabilityFunc initProbabilities_SSE3(const AstronomyParameters* ap);
@@ -28,14 +28,15 @@ extern "C" {
 #include "separation_types.h"
 #include "evaluation_state.h"
 #include "milkyway_cl.h"
+#include "setup_cl.h"
 
 cl_int integrateCL(const AstronomyParameters* ap,
                    const IntegralArea* ia,
                    const StreamConstants* sc,
-                   const StreamGauss sg,
                    EvaluationState* es,
                    const CLRequest* clr,
-                   CLInfo* ci);
+                   CLInfo* ci,
+                   SeparationCLMem* cm);
 
 #ifdef __cplusplus
 }
@@ -60,6 +60,10 @@ typedef struct
     char* ap_file;  /* astronomy parameters */
     char* separation_outfile;
     char* preferredPlatformVendor;
+    char* batchFile;   /* Parameters to evaluate in one process, one set per line */
+    char* binaryStarsFile;  /* Convert the star points file to the binary format here */
+    int saveGeometry;  /* Save the per star geometry next to the star points file */
+    int verifyStars;   /* Check the checksum of a binary star points file */
     const char** forwardedArgs;
     real* numArgs;   /* Temporary */
     unsigned int nForwardedArgs;
@@ -80,6 +84,7 @@ typedef struct
     int modfit;         /* Modified fitting function from Newby 2011 */
     int background;		/* Broken Power Law Option */
     int LikelihoodToText;   /* Create text file containing likelihood for use in local MLE*/
+    int numThreads;         /* Threads for the CPU integral. No effect without OpenMP */
 
     MWPriority processPriority;
 
@@ -93,6 +98,8 @@ typedef struct
     int forceSSE3;
     int forceSSE41;
     int forceAVX;
+    int forceAVX2;
+    int forceAVX512;
 
     int verbose;
 } SeparationFlags;
@@ -39,6 +39,12 @@ cl_int createSeparationBuffers(CLInfo* ci,
                                const StreamGauss sg,
                                const SeparationSizes* sizes);
 
+cl_int writeSeparationParameterBuffers(CLInfo* ci,
+                                       SeparationCLMem* cm,
+                                       const AstronomyParameters* ap,
+                                       const StreamConstants* sc,
+                                       const SeparationSizes* sizes);
+
 void releaseSeparationBuffers(SeparationCLMem* cm);
 
 void calculateSizes(SeparationSizes* sizes, const AstronomyParameters* ap, const IntegralArea* ia);
@@ -65,9 +65,14 @@ typedef struct
 {
     unsigned int number_stars;
     mwvector* stars;
+
+    /* If stars points into a mapped binary star file rather than
+     * being allocated, the whole mapping */
+    void* mapping;
+    size_t mappingSize;
 } StarPoints;
 
-#define EMPTY_STAR_POINTS { 0, NULL }
+#define EMPTY_STAR_POINTS { 0, NULL, NULL, 0 }
 
 
 /* Convenience structure for passing mess of LBTrig to CAL kernel in 2 parts */
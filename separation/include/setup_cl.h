@@ -30,6 +30,9 @@ extern "C" {
 #endif
 
 
+/* Number of reals in the ap buffer passed to the integral kernel */
+#define AP_CONSTS_SIZE 18
+
 typedef struct
 {
     size_t summarizationBufs[2];
@@ -91,6 +94,8 @@ typedef struct
 
 #define EMPTY_SEPARATION_CL_MEM { { NULL, NULL }, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL }
 
+cl_int setupSeparationDevice(CLInfo* ci, const CLRequest* clr);
+
 cl_int setupSeparationCL(CLInfo* ci,
                          const AstronomyParameters* ap,
                          const IntegralArea* ias,
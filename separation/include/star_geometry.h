@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2008-2010 Travis Desell, Nathan Cole
+ *  Copyright (c) 2008-2010 Boleslaw Szymanski, Heidi Newberg
+ *  Copyright (c) 2008-2010 Carlos Varela, Malik Magdon-Ismail
+ *  Copyright (c) 2008-2011 Rensselaer Polytechnic Institute
+ *  Copyright (c) 2010-2011 Matthew Arsenault
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _STAR_GEOMETRY_H_
+#define _STAR_GEOMETRY_H_
+
+#include "separation_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The parts of the likelihood for each star which only depend on the
+ * star and the convolution, one array per field. The convolution
+ * points of star i start at i * stride, which keeps them aligned for
+ * the intrinsic probability functions. */
+typedef struct
+{
+    unsigned int number_stars;
+    int convolve;
+    int modfit;
+    unsigned int stride;
+
+    real* gPrime;
+    real* reff_xr_rp3;
+    real* lCosBCos;
+    real* lSinBCos;
+    real* bSin;
+
+    real* r_points;
+    real* qw_r3_N;
+} StarGeometry;
+
+#define EMPTY_STAR_GEOMETRY { 0, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, NULL, NULL }
+
+/* If the geometry was calculated for the same settings as ap */
+int starGeometryMatches(const StarGeometry* geom, const AstronomyParameters* ap, const StarPoints* sp);
+
+void calcStarGeometry(StarGeometry* geom,
+                      const AstronomyParameters* ap,
+                      const StarPoints* sp,
+                      const StreamGauss sg);
+
+/* Read geometry saved for the same stars and settings. Fails without
+ * complaint if the file is missing or doesn't match. */
+int readStarGeometry(StarGeometry* geom,
+                     const char* filename,
+                     const AstronomyParameters* ap,
+                     const StarPoints* sp);
+int writeStarGeometry(const StarGeometry* geom, const char* filename, const StarPoints* sp);
+
+void freeStarGeometry(StarGeometry* geom);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _STAR_GEOMETRY_H_ */
+
@@ -27,7 +27,11 @@
 #include <stdio.h>
 #include "separation_types.h"
 
-int readStarPoints(StarPoints* sp, const char* file);
+/* Reads either the text or the binary format. The header and size of a
+ * binary file are always checked, but the checksum, which means reading
+ * every star, only with verify set. */
+int readStarPoints(StarPoints* sp, const char* file, int verify);
+int writeStarPointsBinary(const StarPoints* sp, const char* file);
 void freeStarPoints(StarPoints* sp);
 
 #endif /* _STAR_POINTS_H_ */
@@ -134,12 +134,27 @@ double mw_sqrt_custom(double y)  // accurate to 1 ulp, i.e the last bit of the d
 #endif /* USE_CUSTOM_SQRT */
 
 
-inline real aux_prob(real r_in_mag)
+/* The fit parameters are passed in the ap_consts buffer instead of
+ * being compiled in, so one build of the program works for every
+ * evaluation. The layout is set by packAPBuffer(), and the IL kernel
+ * reads the same buffer. */
+#define AP_M_SUN_R0(ap)            ((ap)[4])
+#define AP_R0(ap)                  ((ap)[5])
+#define AP_Q_INV_SQR(ap)           ((ap)[6])
+#define AP_BG_A(ap)                ((ap)[8])
+#define AP_BG_B(ap)                ((ap)[9])
+#define AP_BG_C(ap)                ((ap)[10])
+#define AP_BACKGROUND_WEIGHT(ap)   ((ap)[12])
+#define AP_THICK_DISK_WEIGHT(ap)   ((ap)[13])
+#define AP_INNERPOWER(ap)          ((ap)[14])
+#define AP_ALPHA_DELTA_3(ap)       ((ap)[15])
+
+inline real aux_prob(__constant real* ap_consts, real r_in_mag)
 {
     real tmp;
 
-    tmp = mad(BG_B, r_in_mag, BG_C); /* bg_b * r_in_mag + bg_c */
-    tmp = mad(BG_A, sqr(r_in_mag), tmp); /* bg_a * r_in_mag2 + (bg_b * r_in_mag + bg_c)*/
+    tmp = mad(AP_BG_B(ap_consts), r_in_mag, AP_BG_C(ap_consts)); /* bg_b * r_in_mag + bg_c */
+    tmp = mad(AP_BG_A(ap_consts), sqr(r_in_mag), tmp); /* bg_a * r_in_mag2 + (bg_b * r_in_mag + bg_c)*/
 
     return tmp;
 }
@@ -179,8 +194,7 @@ __kernel void probabilities(__global real2* restrict bgOut,
                             __global const real* restrict bSinBuf,
 
 
-                            /* Placeholder for IL kernel */
-                            __constant real* _ap_consts __attribute__((max_constant_size(18 * sizeof(real)))),
+                            __constant real* ap_consts __attribute__((max_constant_size(18 * sizeof(real)))),
 
                             __constant SC* sc __attribute__((max_constant_size(NSTREAM * sizeof(SC)))),
                             __constant real* sg_dx __attribute__((max_constant_size(256 * sizeof(real)))),
@@ -205,8 +219,11 @@ __kernel void probabilities(__global real2* restrict bgOut,
     real2 lTrig = lTrigBuf[trigIdx];
     real bSin = bSinBuf[trigIdx];
     real2 rc = rConsts[r_step];
-    real ThickDiskCoef = THICK_DISK_WEIGHT;
-    real BackgroundCoef = BACKGROUND_WEIGHT;
+    real ThickDiskCoef = AP_THICK_DISK_WEIGHT(ap_consts);
+    real BackgroundCoef = AP_BACKGROUND_WEIGHT(ap_consts);
+    real m_sun_r0 = AP_M_SUN_R0(ap_consts);
+    real r0 = AP_R0(ap_consts);
+    real q_inv_sqr = AP_Q_INV_SQR(ap_consts);
 
     real2 bgTmp;
     real2 streamTmp[NSTREAM];
@@ -225,17 +242,17 @@ __kernel void probabilities(__global real2* restrict bgOut,
     {
         real2 rPt = rPts[CONVOLVE * r_step + i];
 
-        real x = mad(rPt.x, lTrig.x, (real) -SUN_R0);
+        real x = mad(rPt.x, lTrig.x, m_sun_r0);
         real y = rPt.x * lTrig.y;
         real z = rPt.x * bSin;
 
         /* sqrt(x^2 + y^2 + q_inv_sqr * z^2) */
         real tmp = x * x;
         tmp = mad(y, y, tmp);           /* x^2 + y^2 */
-        tmp = mad((real) Q_INV_SQR, z * z, tmp);   /* (q_invsqr * z^2) + (x^2 + y^2) */
+        tmp = mad(q_inv_sqr, z * z, tmp);   /* (q_invsqr * z^2) + (x^2 + y^2) */
 
         real rg = mw_fsqrt(tmp);
-        real rs = rg + R0;
+        real rs = rg + r0;
         real2 cylindricalCoords;
         cylindricalCoords.x = mw_fsqrt(mad(y, y, x * x));
         cylindricalCoords.y = z;
@@ -248,26 +265,26 @@ __kernel void probabilities(__global real2* restrict bgOut,
                 /* Currently not used */
                 /* Add a quadratic term in g to the Hernquist profile */
                 real g = rc.y + sg_dx[i];
-                bg_prob = mad(rPt.y, aux_prob(g), bg_prob);
+                bg_prob = mad(rPt.y, aux_prob(ap_consts, g), bg_prob);
             }
         }
         else if (BACKGROUND_PROFILE == SLOW_HERNQUIST)
         {
             /*TO DO: Double Check rPt.y is gaussian quadrature weight * r^3 * gaussian (N) */
             /* Add the thin and thick disk densities from Xu et al. (2015) to Hernquist */
-            bg_prob = mad(rPt.y, mad(ThickDiskCoef, prob_thick_disk(cylindricalCoords), mw_div(BackgroundCoef, powr(rg, INNERPOWER) * powr(rs, ALPHA_DELTA_3))), bg_prob);
+            bg_prob = mad(rPt.y, mad(ThickDiskCoef, prob_thick_disk(cylindricalCoords), mw_div(BackgroundCoef, powr(rg, AP_INNERPOWER(ap_consts)) * powr(rs, AP_ALPHA_DELTA_3(ap_consts)))), bg_prob);
             if (AUX_BG_PROFILE)
             {
                 /* Currently not used */
                 /* Add a quadratic term in g to the Hernquist profile */
                 real g = rc.y + sg_dx[i];
-                bg_prob = mad(rPt.y, aux_prob(g), bg_prob);
+                bg_prob = mad(rPt.y, aux_prob(ap_consts, g), bg_prob);
             }
         }
         else /*Broken Power Law*/
         {
-            const real n = mad((real)(rg >= R0),  (real)ALPHA_DELTA_3, (real)INNERPOWER);
-            bg_prob = mad(rPt.y, powr(mw_div((real) SUN_R0, rg), n), bg_prob);
+            const real n = mad((real)(rg >= r0), AP_ALPHA_DELTA_3(ap_consts), AP_INNERPOWER(ap_consts));
+            bg_prob = mad(rPt.y, powr(mw_div(-m_sun_r0, rg), n), bg_prob);
         }
 
         #pragma unroll NSTREAM
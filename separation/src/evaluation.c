@@ -29,6 +29,7 @@
 #if SEPARATION_OPENCL
   #include "run_cl.h"
   #include "setup_cl.h"
+  #include "separation_cl_buffers.h"
 #endif /* SEPARATION_OPENCL */
 
 #if SEPARATION_GRAPHICS
@@ -37,8 +38,214 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 
+/* The saved geometry goes next to the star points file */
+void initSeparationContext(SeparationContext* ctx, const char* starPointsFile, int saveGeometry, int verifyStars)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->starPointsFile = starPointsFile;
+    ctx->verifyStars = verifyStars;
+
+    if (saveGeometry && asprintf(&ctx->geometryFile, "%s.geom", starPointsFile) < 0)
+    {
+        mwPerror("Failed to get star geometry file name");
+        ctx->geometryFile = NULL;
+    }
+}
+
+#if SEPARATION_OPENCL
+
+static void contextReleaseCLBuffers(SeparationContext* ctx)
+{
+    int i;
+
+    for (i = 0; ctx->cms && i < ctx->clAp.number_integrals; ++i)
+    {
+        releaseSeparationBuffers(&ctx->cms[i]);
+    }
+
+    free(ctx->cms);
+    free(ctx->clIas);
+    ctx->cms = NULL;
+    ctx->clIas = NULL;
+}
+
+#endif /* SEPARATION_OPENCL */
+
+void freeSeparationContext(SeparationContext* ctx)
+{
+    freeStarPoints(&ctx->sp);
+    freeStarGeometry(&ctx->geom);
+    free(ctx->geometryFile);
+
+    if (ctx->sgConvolve != 0)
+    {
+        freeStreamGauss(ctx->sg);
+    }
+
+  #if SEPARATION_OPENCL
+    if (ctx->clReady)
+    {
+        contextReleaseCLBuffers(ctx);
+        releaseSeparationKernel();
+        mwDestroyCLInfo(&ctx->ci);
+    }
+  #endif /* SEPARATION_OPENCL */
+
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+static StreamGauss contextStreamGauss(SeparationContext* ctx, unsigned int convolve)
+{
+    if (ctx->sgConvolve != convolve)
+    {
+        if (ctx->sgConvolve != 0)
+        {
+            freeStreamGauss(ctx->sg);
+        }
+
+        ctx->sg = getStreamGauss(convolve);
+        ctx->sgConvolve = convolve;
+    }
+
+    return ctx->sg;
+}
+
+static const StarPoints* contextStarPoints(SeparationContext* ctx)
+{
+    if (!ctx->starsRead)
+    {
+        freeStarPoints(&ctx->sp);
+        ctx->sp.stars = NULL;
+        ctx->sp.number_stars = 0;
+
+        if (readStarPoints(&ctx->sp, ctx->starPointsFile, ctx->verifyStars))
+        {
+            return NULL;
+        }
+
+        ctx->starsRead = TRUE;
+    }
+
+    return &ctx->sp;
+}
+
+/* Read the saved geometry if it is for the same stars and settings,
+ * otherwise calculate it and save it for the next run */
+static const StarGeometry* contextStarGeometry(SeparationContext* ctx,
+                                               const AstronomyParameters* ap,
+                                               const StarPoints* sp,
+                                               const StreamGauss sg)
+{
+    if (starGeometryMatches(&ctx->geom, ap, sp))
+    {
+        return &ctx->geom;
+    }
+
+    if (ctx->geometryFile && !readStarGeometry(&ctx->geom, ctx->geometryFile, ap, sp))
+    {
+        mw_printf("Using star geometry from '%s'\n", ctx->geometryFile);
+        return &ctx->geom;
+    }
+
+    calcStarGeometry(&ctx->geom, ap, sp, sg);
+
+    if (ctx->geometryFile && writeStarGeometry(&ctx->geom, ctx->geometryFile, sp))
+    {
+        mw_printf("Warning: Failed to save star geometry\n");
+    }
+
+    return &ctx->geom;
+}
+
+#if SEPARATION_OPENCL
+
+/* The buffers only depend on the integral areas and the parts of the
+ * parameter file which aren't fit, so evaluations with the same
+ * parameter file reuse them. integrateCL() writes the fit parameters. */
+static int contextCLBuffersMatch(const SeparationContext* ctx,
+                                 const AstronomyParameters* ap,
+                                 const IntegralArea* ias)
+{
+    return ctx->cms
+        && ctx->clAp.number_integrals == ap->number_integrals
+        && ctx->clAp.number_streams == ap->number_streams
+        && ctx->clAp.convolve == ap->convolve
+        && ctx->clAp.wedge == ap->wedge
+        && ctx->clAp.modfit == ap->modfit
+        && ctx->clSummarizationWorkgroupSize == _summarizationWorkgroupSize
+        && !memcmp(ctx->clIas, ias, ap->number_integrals * sizeof(IntegralArea));
+}
+
+static int contextSetupCLBuffers(SeparationContext* ctx,
+                                 const AstronomyParameters* ap,
+                                 const IntegralArea* ias,
+                                 const StreamConstants* sc,
+                                 const StreamGauss sg)
+{
+    int i;
+    SeparationSizes sizes;
+
+    if (contextCLBuffersMatch(ctx, ap, ias))
+    {
+        return 0;
+    }
+
+    contextReleaseCLBuffers(ctx);
+
+    ctx->cms = (SeparationCLMem*) mwCalloc(ap->number_integrals, sizeof(SeparationCLMem));
+    ctx->clIas = (IntegralArea*) mwMalloc(ap->number_integrals * sizeof(IntegralArea));
+    memcpy(ctx->clIas, ias, ap->number_integrals * sizeof(IntegralArea));
+    ctx->clAp = *ap;
+    ctx->clSummarizationWorkgroupSize = _summarizationWorkgroupSize;
+
+    for (i = 0; i < ap->number_integrals; ++i)
+    {
+        calculateSizes(&sizes, ap, &ias[i]);
+        if (createSeparationBuffers(&ctx->ci, &ctx->cms[i], ap, &ias[i], sc, sg, &sizes) != CL_SUCCESS)
+        {
+            mw_printf("Failed to create CL buffers for integral %d\n", i);
+            contextReleaseCLBuffers(ctx);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* The device only needs to be set up once, and the programs and
+ * buffers are only made again when the parameter file changes */
+static int contextSetupCL(SeparationContext* ctx,
+                          const AstronomyParameters* ap,
+                          const IntegralArea* ias,
+                          const StreamConstants* sc,
+                          const StreamGauss sg,
+                          const CLRequest* clr)
+{
+    if (!ctx->clReady)
+    {
+        if (setupSeparationDevice(&ctx->ci, clr) != CL_SUCCESS)
+        {
+            mwDestroyCLInfo(&ctx->ci);
+            memset(&ctx->ci, 0, sizeof(ctx->ci));
+            return 1;
+        }
+
+        ctx->clReady = TRUE;
+    }
+
+    if (setupSeparationCL(&ctx->ci, ap, ias, clr) != CL_SUCCESS)
+    {
+        return 1;
+    }
+
+    return contextSetupCLBuffers(ctx, ap, ias, sc, sg);
+}
+
+#endif /* SEPARATION_OPENCL */
+
 static void getFinalIntegrals(SeparationResults* results,
                               const EvaluationState* es,
                               const unsigned int number_streams,
@@ -117,13 +324,13 @@ static int finalCheckpoint(EvaluationState* es)
     return rc;
 }
 
-static int calculateIntegrals(const AstronomyParameters* ap,
+static int calculateIntegrals(SeparationContext* ctx,
+                              const AstronomyParameters* ap,
                               const IntegralArea* ias,
                               const StreamConstants* sc,
                               const StreamGauss sg,
                               EvaluationState* es,
-                              const CLRequest* clr,
-                              CLInfo* ci)
+                              const CLRequest* clr)
 {
     const IntegralArea* ia;
     double t1, t2;
@@ -140,14 +347,14 @@ static int calculateIntegrals(const AstronomyParameters* ap,
       #if SEPARATION_OPENCL
         if (clr->forceNoOpenCL)
         {
-            rc = integrate(ap, ia, sc, sg, es, clr, ci);
+            rc = integrate(ap, ia, sc, sg, es, clr, &ctx->ci);
         }
         else
         {
-            rc = integrateCL(ap, ia, sc, sg, es, clr, ci);
+            rc = integrateCL(ap, ia, sc, es, clr, &ctx->ci, &ctx->cms[es->currentCut]);
         }
       #else
-        rc = integrate(ap, ia, sc, sg, es, clr, ci);
+        rc = integrate(ap, ia, sc, sg, es, clr, &ctx->ci);
       #endif /* SEPARATION_OPENCL */
 
         t2 = mwGetTime();
@@ -166,13 +373,13 @@ static int calculateIntegrals(const AstronomyParameters* ap,
     return 0;
 }
 
-int evaluate(SeparationResults* results,
+int evaluate(SeparationContext* ctx,
+             SeparationResults* results,
              AstronomyParameters* ap,
              const IntegralArea* ias,
              const Streams* streams,
              const StreamConstants* sc,
              int likelihoodToText,
-             const char* starPointsFile,
              const CLRequest* clr,
              int do_separation,
              int *ignoreCheckpoint,
@@ -181,16 +388,15 @@ int evaluate(SeparationResults* results,
     int rc = 0;
     EvaluationState* es;
     StreamGauss sg;
-    CLInfo ci;
+    const StarPoints* sp;
+    const StarGeometry* geom;
     int done = FALSE;
-    StarPoints sp = EMPTY_STAR_POINTS;
-    memset(&ci, 0, sizeof(ci));
 
     if (probabilityFunctionDispatch(ap, clr))
         return 1;
 
     es = newEvaluationState(ap);
-    sg  = getStreamGauss(ap->convolve);
+    sg = contextStreamGauss(ctx, ap->convolve);
 
   #if SEPARATION_GRAPHICS
     if (separationInitSharedEvaluationState(es))
@@ -246,7 +452,7 @@ int evaluate(SeparationResults* results,
   #if SEPARATION_OPENCL
     if (!clr->forceNoOpenCL && !done)
     {
-        rc = setupSeparationCL(&ci, ap, ias, clr);
+        rc = contextSetupCL(ctx, ap, ias, sc, sg, clr);
         if (rc)
         {
             goto error;
@@ -256,7 +462,7 @@ int evaluate(SeparationResults* results,
 
     if (!done)
     {
-        rc = calculateIntegrals(ap, ias, sc, sg, es, clr, &ci);
+        rc = calculateIntegrals(ctx, ap, ias, sc, sg, es, clr);
         if (rc)
         {
             goto error;
@@ -272,14 +478,16 @@ int evaluate(SeparationResults* results,
 
     getFinalIntegrals(results, es, ap->number_streams, ap->number_integrals);
 
-    rc = readStarPoints(&sp, starPointsFile);
-    if (rc)
+    sp = contextStarPoints(ctx);
+    if (!sp)
     {
+        rc = 1;
         goto error;
     }
 
+    geom = contextStarGeometry(ctx, ap, sp, sg);
 
-    rc = likelihood(results, ap, &sp, sc, streams, sg, do_separation, separation_outfile);
+    rc = likelihood(results, ap, sp, geom, sc, streams, sg, do_separation, separation_outfile);
     /* Modifying output;  non-finite results now return a very bad likelihood, but 
      * otherwise finish cleanly */
     if (checkSeparationResults(results, ap->number_streams))
@@ -306,15 +514,6 @@ int evaluate(SeparationResults* results,
 
 error:
     freeEvaluationState(es);
-    freeStarPoints(&sp);
-    freeStreamGauss(sg);
-
-  #if SEPARATION_OPENCL
-    if (!clr->forceNoOpenCL && !done)
-    {
-        mwDestroyCLInfo(&ci);
-    }
-  #endif
 
     return rc;
 }
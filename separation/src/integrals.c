@@ -32,6 +32,10 @@
 
 #include <time.h>
 
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
 /* Marshaling into split r_points and qw_r3_N which helps with vectorization */
 static RConsts* initRPoints(const AstronomyParameters* ap,
                             const IntegralArea* ia,
@@ -121,13 +125,13 @@ static inline void doBoincCheckpoint(const AstronomyParameters* ap,
 #endif /* BOINC_APPLICATION */
 
 HOT
-static inline void sumProbs(EvaluationState* es)
+static inline void sumProbs(Kahan* bgSum, Kahan* streamSums, real bgTmp, const real* streamTmps, int numberStreams)
 {
     int i;
 
-    KAHAN_ADD(es->bgSum, es->bgTmp);
-    for (i = 0; i < es->numberStreams; ++i)
-        KAHAN_ADD(es->streamSums[i], es->streamTmps[i]);
+    KAHAN_ADD(*bgSum, bgTmp);
+    for (i = 0; i < numberStreams; ++i)
+        KAHAN_ADD(streamSums[i], streamTmps[i]);
 }
 
 
@@ -139,26 +143,29 @@ static inline void r_sum(const AstronomyParameters* ap,
                          const real* RESTRICT qw_r3_N,
                          LBTrig lbt,
                          real id,
-                         EvaluationState* es,
+                         Kahan* bgSum,
+                         Kahan* streamSums,
+                         real* streamTmps,
                          const RConsts* rc,
                          unsigned int r_steps)
 {
     unsigned int r_step;
     real reff_xr_rp3;
+    real bgTmp;
 
     for (r_step = 0; r_step < r_steps; ++r_step)
     {
         reff_xr_rp3 = id * rc[r_step].irv_reff_xr_rp3;
-        es->bgTmp = probabilityFunc(ap,
-                                    sc,
-                                    sg_dx,
-                                    &rPoints[r_step * ap->convolve],
-                                    &qw_r3_N[r_step * ap->convolve],
-                                    lbt,
-                                    rc[r_step].gPrime,
-                                    reff_xr_rp3,
-                                    es->streamTmps);
-        sumProbs(es);
+        bgTmp = probabilityFunc(ap,
+                                sc,
+                                sg_dx,
+                                &rPoints[r_step * ap->convolve],
+                                &qw_r3_N[r_step * ap->convolve],
+                                lbt,
+                                rc[r_step].gPrime,
+                                reff_xr_rp3,
+                                streamTmps);
+        sumProbs(bgSum, streamSums, bgTmp, streamTmps, ap->number_streams);
     }
 }
 
@@ -177,39 +184,12 @@ inline LBTrig lb_trig(LB lb)
     return lbt;
 }
 
-HOT
-static inline void mu_sum(const AstronomyParameters* ap,
-                          const IntegralArea* ia,
-                          const StreamConstants* sc,
-                          const RConsts* rc,
-                          const real* RESTRICT sg_dx,
-                          const real* RESTRICT rPoints,
-                          const real* RESTRICT qw_r3_N,
-                          const NuId nuid,
-                          EvaluationState* es)
-{
-    real mu;
-    LB lb;
-    LBTrig lbt;
-
-    const real mu_step_size = ia->mu_step_size;
-    const real mu_min = ia->mu_min;
-
-    for (; es->mu_step < ia->mu_steps; es->mu_step++)
-    {
-        doBoincCheckpoint(ap, es, ia, ap->total_calc_probs);
-
-        mu = mu_min + (((real) es->mu_step + 0.5) * mu_step_size);
-
-        lb = gc2lb(ap->wedge, mu, nuid.nu); /* integral point */
-        lbt = lb_trig(lb);
-
-        r_sum(ap, sc, sg_dx, rPoints, qw_r3_N, lbt, nuid.id, es, rc, ia->r_steps);
-    }
-
-    es->mu_step = 0;
-}
-
+/* Each mu column of a nu row is summed on its own into a separate
+ * partial Kahan sum, and the partial sums are then added to the
+ * running total in mu order. The result does not depend on which
+ * thread handled which column, so it is the same for any number of
+ * threads, including a build without OpenMP. Checkpoints are only
+ * taken between nu rows. */
 static void nuSum(const AstronomyParameters* ap,
                   const IntegralArea* ia,
                   const StreamConstants* sc,
@@ -220,15 +200,79 @@ static void nuSum(const AstronomyParameters* ap,
                   EvaluationState* es)
 {
     NuId nuid;
+    int mu_step, muStart;
+    int i;
+    const int mu_steps = (int) ia->mu_steps;
+    const int nStreams = es->numberStreams;
+  #ifdef _OPENMP
+    const int nThread = omp_get_max_threads();
+  #else
+    const int nThread = 1;
+  #endif
+    const real mu_step_size = ia->mu_step_size;
+    const real mu_min = ia->mu_min;
+
+    Kahan* bgPartial = (Kahan*) mwMallocA(mu_steps * sizeof(Kahan));
+    Kahan* streamPartial = (Kahan*) mwMallocA(mu_steps * nStreams * sizeof(Kahan));
+    real* streamTmps = (real*) mwMallocA(nThread * nStreams * sizeof(real));
 
     for ( ; es->nu_step < ia->nu_steps; es->nu_step++)
     {
+        doBoincCheckpoint(ap, es, ia, ap->total_calc_probs);
+
         nuid = calcNuStep(ia, es->nu_step);
 
-        mu_sum(ap, ia, sc, rc, sg_dx, rPoints, qw_r3_N, nuid, es);
+        /* Checkpoints from older versions may start mid row */
+        muStart = (int) es->mu_step;
+
+      #ifdef _OPENMP
+        #pragma omp parallel for private(mu_step, i) schedule(dynamic)
+      #endif
+        for (mu_step = muStart; mu_step < mu_steps; ++mu_step)
+        {
+            real mu;
+            LB lb;
+            LBTrig lbt;
+            Kahan* streamSums = &streamPartial[mu_step * nStreams];
+          #ifdef _OPENMP
+            real* threadTmps = &streamTmps[omp_get_thread_num() * nStreams];
+          #else
+            real* threadTmps = streamTmps;
+          #endif
+
+            CLEAR_KAHAN(bgPartial[mu_step]);
+            for (i = 0; i < nStreams; ++i)
+            {
+                CLEAR_KAHAN(streamSums[i]);
+            }
+
+            mu = mu_min + (((real) mu_step + 0.5) * mu_step_size);
+
+            lb = gc2lb(ap->wedge, mu, nuid.nu); /* integral point */
+            lbt = lb_trig(lb);
+
+            r_sum(ap, sc, sg_dx, rPoints, qw_r3_N, lbt, nuid.id,
+                  &bgPartial[mu_step], streamSums, threadTmps,
+                  rc, ia->r_steps);
+        }
+
+        for (mu_step = muStart; mu_step < mu_steps; ++mu_step)
+        {
+            KAHAN_REDUCTION(es->bgSum, bgPartial[mu_step]);
+            for (i = 0; i < nStreams; ++i)
+            {
+                KAHAN_REDUCTION(es->streamSums[i], streamPartial[mu_step * nStreams + i]);
+            }
+        }
+
+        es->mu_step = 0;
     }
 
     es->nu_step = 0;
+
+    mwFreeA(bgPartial);
+    mwFreeA(streamPartial);
+    mwFreeA(streamTmps);
 }
 
 void separationIntegralGetSums(EvaluationState* es)
@@ -29,10 +29,20 @@
 #include "probabilities.h"
 #include "integrals.h"
 #include "r_points.h"
+#include "star_geometry.h"
 #include "calculated_constants.h"
 #include "milkyway_util.h"
 #include "separation_utils.h"
-#include "evaluation_state.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+/* Stars per block in the likelihood sum. Each block is summed
+ * separately and the blocks are combined in order, with one thread as
+ * well, so the result only depends on this and not on the number of
+ * threads. */
+#define LIKELIHOOD_BLOCK_SIZE 1024
 
 /* CHECKME: What is this? */
 static real probability_log(real bg, real sum_exp_weights)
@@ -152,40 +162,43 @@ static real likelihood_probability(const AstronomyParameters* ap,
                                    real gPrime,
                                    real reff_xr_rp3,
                                    const SeparationResults* results,
-                                   EvaluationState* es,
+
+                                   Kahan* bgSum,
+                                   Kahan* streamSums,
+                                   real* RESTRICT streamTmps,
 
                                    real* RESTRICT bgProb) /* Out argument for thing needed by separation */
 {
     int i;
-    real starProb, streamOnly;
+    real bgTmp, starProb, streamOnly;
 
     /* if q is 0, there is no probability */
     if (ap->q == 0.0)
     {
-        es->bgTmp = -1.0;
+        bgTmp = -1.0;
     }
     else
     {
-        es->bgTmp = probabilityFunc(ap, sc, sg_dx, r_points, qw_r3_N, lbt, gPrime, reff_xr_rp3, es->streamTmps);
+        bgTmp = probabilityFunc(ap, sc, sg_dx, r_points, qw_r3_N, lbt, gPrime, reff_xr_rp3, streamTmps);
     }
 
     if (bgProb)
-        *bgProb = es->bgTmp;
+        *bgProb = bgTmp;
 
-    es->bgTmp = es->bgTmp / results->backgroundIntegral;
+    bgTmp = bgTmp / results->backgroundIntegral;
 
-    starProb = es->bgTmp; /* bg only */
+    starProb = bgTmp; /* bg only */
     for (i = 0; i < ap->number_streams; ++i)
     {
-        streamOnly = es->streamTmps[i] / results->streamIntegrals[i] * streams->parameters[i].epsilonExp;
+        streamOnly = streamTmps[i] / results->streamIntegrals[i] * streams->parameters[i].epsilonExp;
         starProb += streamOnly;
         streamOnly = probability_log(streamOnly, streams->sumExpWeights);
-        KAHAN_ADD(es->streamSums[i], streamOnly);
+        KAHAN_ADD(streamSums[i], streamOnly);
     }
     starProb /= streams->sumExpWeights;
 
-    es->bgTmp = probability_log(es->bgTmp, streams->sumExpWeights);
-    KAHAN_ADD(es->bgSum, es->bgTmp);
+    bgTmp = probability_log(bgTmp, streams->sumExpWeights);
+    KAHAN_ADD(*bgSum, bgTmp);
 
     return starProb;
 }
@@ -266,81 +279,183 @@ static void printSeparationStats(const StreamStats* ss,
         printf("%d stars separated into stream\n", ss[i].q);
 }
 
+/* Sum the stars [first, last) into the given block sums. Everything
+ * which only depends on the star comes from geom. If
+ * starBgProbs and starStreamProbs are given, the raw probabilities of
+ * each star are saved for the separation pass */
+static void likelihood_block(const SeparationResults* results,
+                             const AstronomyParameters* ap,
+                             const StarGeometry* geom,
+                             const StreamConstants* sc,
+                             const Streams* streams,
+                             const StreamGauss sg,
+
+                             unsigned int first,
+                             unsigned int last,
+
+                             Kahan* prob,
+                             Kahan* bgSum,
+                             Kahan* streamSums,
+
+                             real* RESTRICT streamTmps,
+
+                             real* RESTRICT starBgProbs,
+                             real* RESTRICT starStreamProbs)
+{
+    unsigned int current_star_point;
+    int i;
+    real star_prob;
+    LBTrig lbt;
+    size_t offset;
+    real bgProb = 0.0;
+
+    lbt._pad = 0.0;
+
+    for (current_star_point = first; current_star_point < last; ++current_star_point)
+    {
+        offset = (size_t) current_star_point * geom->stride;
+
+        lbt.lCosBCos = geom->lCosBCos[current_star_point];
+        lbt.lSinBCos = geom->lSinBCos[current_star_point];
+        lbt.bSin = geom->bSin[current_star_point];
+
+        star_prob = likelihood_probability(ap, sc, streams, sg.dx,
+                                           &geom->r_points[offset], &geom->qw_r3_N[offset],
+                                           lbt, geom->gPrime[current_star_point],
+                                           geom->reff_xr_rp3[current_star_point],
+                                           results, bgSum, streamSums, streamTmps, &bgProb);
+
+        if (mw_cmpnzero_muleps(star_prob, SEPARATION_EPS))
+        {
+            star_prob = mw_log10(star_prob);
+            KAHAN_ADD(*prob, star_prob);
+        }
+        else
+        {
+            prob->sum -= 238.0;
+        }
+
+        if (starBgProbs)
+        {
+            starBgProbs[current_star_point] = bgProb;
+            for (i = 0; i < ap->number_streams; ++i)
+            {
+                starStreamProbs[current_star_point * ap->number_streams + i] = streamTmps[i];
+            }
+        }
+    }
+}
+
 static int likelihood_sum(SeparationResults* results,
                           const AstronomyParameters* ap,
                           const StarPoints* sp,
+                          const StarGeometry* geom,
                           const StreamConstants* sc,
                           const Streams* streams,
                           const StreamGauss sg,
 
-                          EvaluationState* es,
-
-                          real* RESTRICT r_points,
-                          real* RESTRICT qw_r3_N,
-
-
                           const int do_separation,
                           StreamStats* ss,
                           FILE* f)
 {
     Kahan prob = ZERO_KAHAN;
+    Kahan bgSum = ZERO_KAHAN;
+    Kahan* streamSums;
+
+    Kahan* blockProb;
+    Kahan* blockBgSum;
+    Kahan* blockStreamSums;
+    real* starBgProbs = NULL;
+    real* starStreamProbs = NULL;
 
     unsigned int current_star_point;
-    mwvector point;
-    real star_prob;
-    LB lb;
-    LBTrig lbt;
-    real reff_xr_rp3;
-    RConsts rc = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+    unsigned int nBlocks;
+    int block;
+    int i;
+    const int nStreams = ap->number_streams;
+    const unsigned int nStars = sp->number_stars;
 
-    real bgProb = 0.0;
     real epsilon_b = 0.0;
     mwmatrix cmatrix;
-    unsigned int num_zero = 0;
     unsigned int badJacobians = 0;  /* CHECKME: Seems like this never changes */
 
     if (do_separation)
     {
         setSeparationConstants(ap, results, cmatrix);
         epsilon_b = get_stream_bg_weight_consts(ss, streams);
-    }
 
-    for (current_star_point = 0; current_star_point < sp->number_stars; ++current_star_point)
-    {
-        point = sp->stars[current_star_point];
-        rc = calcRConstsLik(Z(point), ap);
-        setSplitRPoints(ap, sg, &rc, r_points, qw_r3_N);
-        reff_xr_rp3 = calcReffXrRp3(Z(point), rc.gPrime);
+        /* The separation pass uses a random number per star, so it
+         * needs to run in star order after the sum */
+        starBgProbs = (real*) mwMallocA(sizeof(real) * (nStars + 1));
+        starStreamProbs = (real*) mwMallocA(sizeof(real) * (nStars + 1) * nStreams);
+    }
 
-        LB_L(lb) = L(point);
-        LB_B(lb) = B(point);
+    nBlocks = (nStars + LIKELIHOOD_BLOCK_SIZE - 1) / LIKELIHOOD_BLOCK_SIZE;
 
-        lbt = lb_trig(lb);
+    streamSums = (Kahan*) mwCallocA(nStreams, sizeof(Kahan));
+    blockProb = (Kahan*) mwCallocA(nBlocks + 1, sizeof(Kahan));
+    blockBgSum = (Kahan*) mwCallocA(nBlocks + 1, sizeof(Kahan));
+    blockStreamSums = (Kahan*) mwCallocA((nBlocks + 1) * nStreams, sizeof(Kahan));
 
-        star_prob = likelihood_probability(ap, sc, streams, sg.dx, r_points, qw_r3_N, lbt, rc.gPrime,
-                                           reff_xr_rp3, results, es, &bgProb);
+  #ifdef _OPENMP
+    #pragma omp parallel private(block)
+  #endif
+    {
+        real* streamTmps = (real*) mwCallocA(nStreams, sizeof(real));
 
-        if (mw_cmpnzero_muleps(star_prob, SEPARATION_EPS))
+      #ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+      #endif
+        for (block = 0; block < (int) nBlocks; ++block)
         {
-            star_prob = mw_log10(star_prob);
-            KAHAN_ADD(prob, star_prob);
+            unsigned int first = (unsigned int) block * LIKELIHOOD_BLOCK_SIZE;
+            unsigned int last = (first + LIKELIHOOD_BLOCK_SIZE < nStars) ? first + LIKELIHOOD_BLOCK_SIZE : nStars;
+
+            likelihood_block(results, ap, geom, sc, streams, sg,
+                             first, last,
+                             &blockProb[block], &blockBgSum[block], &blockStreamSums[block * nStreams],
+                             streamTmps,
+                             starBgProbs, starStreamProbs);
         }
-        else
+
+        mwFreeA(streamTmps);
+    }
+
+    for (block = 0; block < (int) nBlocks; ++block)
+    {
+        KAHAN_REDUCTION(prob, blockProb[block]);
+        KAHAN_REDUCTION(bgSum, blockBgSum[block]);
+        for (i = 0; i < nStreams; ++i)
         {
-            ++num_zero;
-            prob.sum -= 238.0;
+            KAHAN_REDUCTION(streamSums[i], blockStreamSums[block * nStreams + i]);
         }
+    }
 
-        if (do_separation)
-            separation(f, ap, results, cmatrix, ss, es->streamTmps, bgProb, epsilon_b, point);
+    if (do_separation)
+    {
+        for (current_star_point = 0; current_star_point < nStars; ++current_star_point)
+        {
+            separation(f, ap, results, cmatrix, ss,
+                       &starStreamProbs[current_star_point * nStreams],
+                       starBgProbs[current_star_point],
+                       epsilon_b,
+                       sp->stars[current_star_point]);
+        }
     }
 
-    calculateLikelihoods(results, &prob, &es->bgSum, es->streamSums,
-                         sp->number_stars, streams->number_streams, badJacobians);
+    calculateLikelihoods(results, &prob, &bgSum, streamSums,
+                         nStars, streams->number_streams, badJacobians);
 
 
     if (do_separation)
-        printSeparationStats(ss, sp->number_stars, ap->number_streams);
+        printSeparationStats(ss, nStars, ap->number_streams);
+
+    mwFreeA(streamSums);
+    mwFreeA(blockProb);
+    mwFreeA(blockBgSum);
+    mwFreeA(blockStreamSums);
+    mwFreeA(starBgProbs);
+    mwFreeA(starStreamProbs);
 
     return 0;
 }
@@ -353,15 +468,13 @@ StreamStats* newStreamStats(const unsigned int number_streams)
 int likelihood(SeparationResults* results,
                const AstronomyParameters* ap,
                const StarPoints* sp,
+               const StarGeometry* geom,
                const StreamConstants* sc,
                const Streams* streams,
                const StreamGauss sg,
                const int do_separation,
                const char* separation_outfile)
 {
-    real* r_points;
-    real* qw_r3_N;
-    EvaluationState* es;
     StreamStats* ss = NULL;
     FILE* f = NULL;
 
@@ -382,29 +495,17 @@ int likelihood(SeparationResults* results,
         ss = newStreamStats(streams->number_streams);
     }
 
-    /* New state for this sum */
-    es = newEvaluationState(ap);
-
-    r_points = (real*) mwMallocA(sizeof(real) * ap->convolve);
-    qw_r3_N = (real*) mwMallocA(sizeof(real) * ap->convolve);
-
     t1 = mwGetTime();
     rc = likelihood_sum(results,
-                        ap, sp, sc, streams,
+                        ap, sp, geom, sc, streams,
                         sg,
-                        es,
-                        r_points,
-                        qw_r3_N,
                         do_separation,
                         ss,
                         f);
     t2 = mwGetTime();
     mw_printf("Likelihood time = %f s\n", t2 - t1);
 
-    mwFreeA(r_points);
-    mwFreeA(qw_r3_N);
     mwFreeA(ss);
-    freeEvaluationState(es);
 
     if (f && fclose(f))
         mwPerror("Closing separation output file '%s'", separation_outfile);
@@ -0,0 +1,418 @@
+/*
+ *  Copyright (c) 2008-2010 Travis Desell, Nathan Cole
+ *  Copyright (c) 2008-2010 Boleslaw Szymanski, Heidi Newberg
+ *  Copyright (c) 2008-2010 Carlos Varela, Malik Magdon-Ismail
+ *  Copyright (c) 2008-2011 Rensselaer Polytechnic Institute
+ *  Copyright (c) 2010-2011 Matthew Arsenault
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This is built twice, once with AVX2 and FMA for 4 doubles at a time
+ * and once with AVX-512F for 8 at a time. */
+
+#if !defined(__AVX512F__) && !(defined(__AVX2__) && defined(__FMA__))
+  #error AVX2 and FMA or AVX-512F required
+#endif
+
+#include <immintrin.h>
+
+#include "milkyway_util.h"
+#include "probabilities.h"
+#include "separation_constants.h"
+
+
+#ifdef __AVX512F__
+
+#define VWIDTH 8
+
+typedef __m512d vdouble;
+typedef __m512i vint;
+typedef __mmask8 vmask;
+
+#define v_set1(x)          _mm512_set1_pd(x)
+#define v_setzero()        _mm512_setzero_pd()
+#define v_load(p)          _mm512_load_pd(p)
+#define v_loadu(p)         _mm512_loadu_pd(p)
+#define v_store(p, x)      _mm512_store_pd(p, x)
+#define v_add(a, b)        _mm512_add_pd(a, b)
+#define v_sub(a, b)        _mm512_sub_pd(a, b)
+#define v_mul(a, b)        _mm512_mul_pd(a, b)
+#define v_div(a, b)        _mm512_div_pd(a, b)
+#define v_fmadd(a, b, c)   _mm512_fmadd_pd(a, b, c)
+#define v_fmsub(a, b, c)   _mm512_fmsub_pd(a, b, c)
+#define v_fnmadd(a, b, c)  _mm512_fnmadd_pd(a, b, c)
+#define v_sqrt(x)          _mm512_sqrt_pd(x)
+#define v_min(a, b)        _mm512_min_pd(a, b)
+#define v_max(a, b)        _mm512_max_pd(a, b)
+#define v_round(x)         _mm512_roundscale_pd(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define v_abs(x)           _mm512_castsi512_pd(_mm512_and_si512(_mm512_castpd_si512(x), \
+                                                                _mm512_set1_epi64(0x7fffffffffffffffLL)))
+
+#define v_cmpge(a, b)      _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ)
+#define v_cmpgt(a, b)      _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ)
+#define v_select(m, a, b)  _mm512_mask_blend_pd(m, a, b)  /* m ? b : a */
+#define v_zero_unless(m, x) _mm512_maskz_mov_pd(m, x)
+
+#define v_castpd_si(x)     _mm512_castpd_si512(x)
+#define v_castsi_pd(x)     _mm512_castsi512_pd(x)
+#define v_set1_epi64(x)    _mm512_set1_epi64(x)
+#define v_and_si(a, b)     _mm512_and_si512(a, b)
+#define v_or_si(a, b)      _mm512_or_si512(a, b)
+#define v_slli_epi64(x, n) _mm512_slli_epi64(x, n)
+#define v_srli_epi64(x, n) _mm512_srli_epi64(x, n)
+
+#define v_hsum(x)          _mm512_reduce_add_pd(x)
+
+/* The first n values of p, and 0 for the rest */
+static inline vdouble v_loadu_partial(const double* p, int n)
+{
+    return _mm512_maskz_loadu_pd((__mmask8) ((1u << n) - 1u), p);
+}
+
+#else
+
+#define VWIDTH 4
+
+typedef __m256d vdouble;
+typedef __m256i vint;
+typedef __m256d vmask;
+
+#define v_set1(x)          _mm256_set1_pd(x)
+#define v_setzero()        _mm256_setzero_pd()
+#define v_load(p)          _mm256_load_pd(p)
+#define v_loadu(p)         _mm256_loadu_pd(p)
+#define v_store(p, x)      _mm256_store_pd(p, x)
+#define v_add(a, b)        _mm256_add_pd(a, b)
+#define v_sub(a, b)        _mm256_sub_pd(a, b)
+#define v_mul(a, b)        _mm256_mul_pd(a, b)
+#define v_div(a, b)        _mm256_div_pd(a, b)
+#define v_fmadd(a, b, c)   _mm256_fmadd_pd(a, b, c)
+#define v_fmsub(a, b, c)   _mm256_fmsub_pd(a, b, c)
+#define v_fnmadd(a, b, c)  _mm256_fnmadd_pd(a, b, c)
+#define v_sqrt(x)          _mm256_sqrt_pd(x)
+#define v_min(a, b)        _mm256_min_pd(a, b)
+#define v_max(a, b)        _mm256_max_pd(a, b)
+#define v_round(x)         _mm256_round_pd(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define v_abs(x)           _mm256_andnot_pd(_mm256_set1_pd(-0.0), x)
+
+#define v_cmpge(a, b)      _mm256_cmp_pd(a, b, _CMP_GE_OQ)
+#define v_cmpgt(a, b)      _mm256_cmp_pd(a, b, _CMP_GT_OQ)
+#define v_select(m, a, b)  _mm256_blendv_pd(a, b, m)  /* m ? b : a */
+#define v_zero_unless(m, x) _mm256_and_pd(m, x)
+
+#define v_castpd_si(x)     _mm256_castpd_si256(x)
+#define v_castsi_pd(x)     _mm256_castsi256_pd(x)
+#define v_set1_epi64(x)    _mm256_set1_epi64x(x)
+#define v_and_si(a, b)     _mm256_and_si256(a, b)
+#define v_or_si(a, b)      _mm256_or_si256(a, b)
+#define v_slli_epi64(x, n) _mm256_slli_epi64(x, n)
+#define v_srli_epi64(x, n) _mm256_srli_epi64(x, n)
+
+static inline double v_hsum(vdouble x)
+{
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(x), _mm256_extractf128_pd(x, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+static inline vdouble v_loadu_partial(const double* p, int n)
+{
+    const __m256i mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(n), _mm256_set_epi64x(3, 2, 1, 0));
+    return _mm256_maskload_pd(p, mask);
+}
+
+#endif /* __AVX512F__ */
+
+#define ALIGN_BYTES (VWIDTH * 8)
+
+
+/* Adding this to a double in [-2^51, 2^51] rounded to an integer
+ * leaves the integer in the low bits of the representation */
+#define SHIFTER 6755399441055744.0 /* 1.5 * 2^52 */
+
+#define LN2_HI 6.93147180369123816490e-1
+#define LN2_LO 1.90821492927058770002e-10
+#define LOG2E  1.44269504088896338700
+
+/* exp(x) and 0 below the smallest normal result. The reduced argument
+ * r is in [-ln(2) / 2, ln(2) / 2] where the Taylor polynomial to order
+ * 12 is within 2e-16 relative error */
+static inline vdouble v_exp(vdouble x)
+{
+    vdouble n, r, p, scale;
+    vint k;
+    const vmask inRange = v_cmpge(x, v_set1(-708.0));
+
+    x = v_min(v_max(x, v_set1(-708.0)), v_set1(709.0));
+
+    n = v_round(v_mul(x, v_set1(LOG2E)));
+    r = v_fnmadd(n, v_set1(LN2_HI), x);
+    r = v_fnmadd(n, v_set1(LN2_LO), r);
+
+    p = v_set1(2.08767569878680989792e-9);             /* 1 / 12! */
+    p = v_fmadd(p, r, v_set1(2.50521083854417187751e-8));
+    p = v_fmadd(p, r, v_set1(2.75573192239858906526e-7));
+    p = v_fmadd(p, r, v_set1(2.75573192239858906526e-6));
+    p = v_fmadd(p, r, v_set1(2.48015873015873015873e-5));
+    p = v_fmadd(p, r, v_set1(1.98412698412698412698e-4));
+    p = v_fmadd(p, r, v_set1(1.38888888888888888889e-3));
+    p = v_fmadd(p, r, v_set1(8.33333333333333333333e-3));
+    p = v_fmadd(p, r, v_set1(4.16666666666666666667e-2));
+    p = v_fmadd(p, r, v_set1(1.66666666666666666667e-1));
+    p = v_fmadd(p, r, v_set1(0.5));
+    p = v_fmadd(p, r, v_set1(1.0));
+    p = v_fmadd(p, r, v_set1(1.0));
+
+    /* 2^n built directly in the exponent field, n + 1023 is in [1, 2046] */
+    k = v_castpd_si(v_add(n, v_set1(SHIFTER + 1023.0)));
+    scale = v_castsi_pd(v_slli_epi64(k, 52));
+
+    return v_zero_unless(inRange, v_mul(p, scale));
+}
+
+/* log(x) for positive, normal x. With x = 2^e * m and m in
+ * [sqrt(2) / 2, sqrt(2)], log(m) = 2 atanh(s) for s = (m - 1) / (m + 1),
+ * |s| <= 0.172, summed to s^21 */
+static inline vdouble v_log(vdouble x)
+{
+    vdouble e, m, s, z, p;
+    vmask big;
+    const vint bits = v_castpd_si(x);
+
+    /* Biased exponent as a double, by putting it under the bits of 2^52 */
+    e = v_castsi_pd(v_or_si(v_srli_epi64(bits, 52), v_set1_epi64(0x4330000000000000LL)));
+    e = v_sub(e, v_set1(4503599627370496.0 + 1023.0));
+
+    m = v_castsi_pd(v_or_si(v_and_si(bits, v_set1_epi64(0x000fffffffffffffLL)),
+                            v_set1_epi64(0x3ff0000000000000LL)));
+
+    big = v_cmpgt(m, v_set1(1.41421356237309504880));
+    m = v_mul(m, v_select(big, v_set1(1.0), v_set1(0.5)));
+    e = v_add(e, v_zero_unless(big, v_set1(1.0)));
+
+    s = v_div(v_sub(m, v_set1(1.0)), v_add(m, v_set1(1.0)));
+    z = v_mul(s, s);
+
+    p = v_set1(1.0 / 21.0);
+    p = v_fmadd(p, z, v_set1(1.0 / 19.0));
+    p = v_fmadd(p, z, v_set1(1.0 / 17.0));
+    p = v_fmadd(p, z, v_set1(1.0 / 15.0));
+    p = v_fmadd(p, z, v_set1(1.0 / 13.0));
+    p = v_fmadd(p, z, v_set1(1.0 / 11.0));
+    p = v_fmadd(p, z, v_set1(1.0 / 9.0));
+    p = v_fmadd(p, z, v_set1(1.0 / 7.0));
+    p = v_fmadd(p, z, v_set1(1.0 / 5.0));
+    p = v_fmadd(p, z, v_set1(1.0 / 3.0));
+    p = v_fmadd(p, z, v_set1(1.0));
+
+    p = v_mul(v_add(s, s), p);
+    p = v_fmadd(e, v_set1(LN2_LO), p);
+
+    return v_fmadd(e, v_set1(LN2_HI), p);
+}
+
+/* x^y for positive x */
+static inline vdouble v_pow(vdouble x, vdouble y)
+{
+    return v_exp(v_mul(y, v_log(x)));
+}
+
+/* The convolution points are read unaligned since the integrals pass
+ * every r step of one array. The points past convolve up to the next
+ * full vector are read as 0, which gives 0 weight. */
+static inline vdouble loadPoints(const real* p, int i, int convolve)
+{
+    return (i + VWIDTH <= convolve) ? v_loadu(&p[i]) : v_loadu_partial(&p[i], convolve - i);
+}
+
+/* Sum the streams over the points already transformed to galactic XYZ */
+static inline void streamSumsIntrinsics(const AstronomyParameters* ap,
+                                        const StreamConstants* sc,
+                                        const double* RESTRICT xs,
+                                        const double* RESTRICT ys,
+                                        const double* RESTRICT zs,
+                                        const double* RESTRICT qws,
+                                        int convolveV,
+                                        real reff_xr_rp3,
+                                        real* RESTRICT streamTmps)
+{
+    int i, j;
+
+    for (i = 0; i < ap->number_streams; ++i)
+    {
+        vdouble dx, dy, dz, dotted, xyzNorm, sum;
+
+        const vdouble CX = v_set1(X(sc[i].c));
+        const vdouble CY = v_set1(Y(sc[i].c));
+        const vdouble CZ = v_set1(Z(sc[i].c));
+        const vdouble AX = v_set1(X(sc[i].a));
+        const vdouble AY = v_set1(Y(sc[i].a));
+        const vdouble AZ = v_set1(Z(sc[i].a));
+        const vdouble NEG_SIGMA_SQ2_INV = v_set1(-sc[i].sigma_sq2_inv);
+
+        sum = v_setzero();
+
+        for (j = 0; j < convolveV; j += VWIDTH)
+        {
+            dx = v_sub(v_load(&xs[j]), CX);
+            dy = v_sub(v_load(&ys[j]), CY);
+            dz = v_sub(v_load(&zs[j]), CZ);
+
+            dotted = v_fmadd(AX, dx, v_fmadd(AY, dy, v_mul(AZ, dz)));
+
+            dx = v_fnmadd(dotted, AX, dx);
+            dy = v_fnmadd(dotted, AY, dy);
+            dz = v_fnmadd(dotted, AZ, dz);
+
+            xyzNorm = v_fmadd(dx, dx, v_fmadd(dy, dy, v_mul(dz, dz)));
+
+            sum = v_fmadd(v_load(&qws[j]), v_exp(v_mul(xyzNorm, NEG_SIGMA_SQ2_INV)), sum);
+        }
+
+        streamTmps[i] = v_hsum(sum) * reff_xr_rp3;
+    }
+}
+
+static real probabilities_intrinsics_hernquist(const AstronomyParameters* ap,
+                                               const StreamConstants* sc,
+                                               const real* RESTRICT sg_dx,
+                                               const real* RESTRICT r_point,
+                                               const real* RESTRICT qw_r3_N,
+                                               LBTrig lbt,
+                                               real gPrime,
+                                               real reff_xr_rp3,
+                                               real* RESTRICT streamTmps)
+{
+    int i;
+    const int convolve = ap->convolve;
+    MW_ALIGN_V(ALIGN_BYTES) double xs[MAX_CONVOLVE], ys[MAX_CONVOLVE], zs[MAX_CONVOLVE], qws[MAX_CONVOLVE];
+    vdouble RI, QW, x, y, z, zq, rxy2, cylR, cylZ, rg, rs, pbxv, pbthick;
+    vdouble bgp = v_setzero();
+
+    const vdouble COSBL    = v_set1(lbt.lCosBCos);
+    const vdouble SINCOSBL = v_set1(lbt.lSinBCos);
+    const vdouble SINB     = v_set1(lbt.bSin);
+    const vdouble SUNR0    = v_set1(ap->sun_r0);
+    const vdouble R0       = v_set1(ap->r0);
+    const vdouble QV_RECIP = v_set1(ap->q_inv);
+    const vdouble THICKLS  = v_set1(-0.285714286);  /* -1 / (3.5 kpc) from Xu et al. (2015) */
+    const vdouble THICKHS  = v_set1(-1.428571429);  /* -1 / (0.7 kpc) from Xu et al. (2015) */
+    const vdouble BGCOEF   = v_set1(ap->background_weight);
+    const vdouble THICKCOEF = v_set1(ap->thick_disk_weight);
+
+    (void) gPrime, (void) sg_dx;
+
+    for (i = 0; i < convolve; i += VWIDTH)
+    {
+        RI = loadPoints(r_point, i, convolve);
+        QW = loadPoints(qw_r3_N, i, convolve);
+
+        /* Coordinate transform to galactic centered XYZ */
+        x = v_fmsub(RI, COSBL, SUNR0);
+        y = v_mul(RI, SINCOSBL);
+        z = v_mul(RI, SINB);
+
+        v_store(&xs[i], x);
+        v_store(&ys[i], y);
+        v_store(&zs[i], z);
+        v_store(&qws[i], QW);
+
+        /* Cylindrical R and |Z| for the thick disk, and the halo radius */
+        rxy2 = v_fmadd(y, y, v_mul(x, x));
+        cylR = v_sqrt(rxy2);
+        cylZ = v_abs(z);
+
+        zq = v_mul(z, QV_RECIP);
+        rg = v_sqrt(v_fmadd(zq, zq, rxy2));
+        rs = v_add(rg, R0);
+
+        pbxv = v_div(BGCOEF, v_mul(v_mul(rg, rs), v_mul(rs, rs)));
+        pbthick = v_mul(THICKCOEF, v_exp(v_fmadd(cylR, THICKLS, v_mul(cylZ, THICKHS))));
+
+        bgp = v_fmadd(QW, v_add(pbxv, pbthick), bgp);
+    }
+
+    streamSumsIntrinsics(ap, sc, xs, ys, zs, qws, i, reff_xr_rp3, streamTmps);
+
+    return v_hsum(bgp) * reff_xr_rp3;
+}
+
+static real probabilities_intrinsics_BPL(const AstronomyParameters* ap,
+                                         const StreamConstants* sc,
+                                         const real* RESTRICT sg_dx,
+                                         const real* RESTRICT r_point,
+                                         const real* RESTRICT qw_r3_N,
+                                         LBTrig lbt,
+                                         real gPrime,
+                                         real reff_xr_rp3,
+                                         real* RESTRICT streamTmps)
+{
+    int i;
+    const int convolve = ap->convolve;
+    MW_ALIGN_V(ALIGN_BYTES) double xs[MAX_CONVOLVE], ys[MAX_CONVOLVE], zs[MAX_CONVOLVE], qws[MAX_CONVOLVE];
+    vdouble RI, QW, x, y, z, zq, rg, n;
+    vdouble bgp = v_setzero();
+
+    const vdouble COSBL    = v_set1(lbt.lCosBCos);
+    const vdouble SINCOSBL = v_set1(lbt.lSinBCos);
+    const vdouble SINB     = v_set1(lbt.bSin);
+    const vdouble SUNR0    = v_set1(ap->sun_r0);
+    const vdouble R0       = v_set1(ap->r0);
+    const vdouble QV_RECIP = v_set1(ap->q_inv);
+    const vdouble INNER    = v_set1(ap->innerPower);    /* Exponent for the inner halo */
+    const vdouble OUTER    = v_set1(ap->alpha_delta3);  /* Change in exponent from inner to outer */
+
+    (void) gPrime, (void) sg_dx;
+
+    for (i = 0; i < convolve; i += VWIDTH)
+    {
+        RI = loadPoints(r_point, i, convolve);
+        QW = loadPoints(qw_r3_N, i, convolve);
+
+        x = v_fmsub(RI, COSBL, SUNR0);
+        y = v_mul(RI, SINCOSBL);
+        z = v_mul(RI, SINB);
+
+        v_store(&xs[i], x);
+        v_store(&ys[i], y);
+        v_store(&zs[i], z);
+        v_store(&qws[i], QW);
+
+        zq = v_mul(z, QV_RECIP);
+        rg = v_sqrt(v_fmadd(zq, zq, v_fmadd(y, y, v_mul(x, x))));
+
+        /* Broken power law (sun_r0 / rg)^n, with n changing past r0 */
+        n = v_add(INNER, v_zero_unless(v_cmpge(rg, R0), OUTER));
+        bgp = v_fmadd(QW, v_pow(v_div(SUNR0, rg), n), bgp);
+    }
+
+    streamSumsIntrinsics(ap, sc, xs, ys, zs, qws, i, reff_xr_rp3, streamTmps);
+
+    return v_hsum(bgp) * reff_xr_rp3;
+}
+
+ProbabilityFunc INIT_PROBABILITIES(const AstronomyParameters* ap)
+{
+    if (ap->background_profile == FAST_HERNQUIST)
+    {
+        return probabilities_intrinsics_hernquist;
+    }
+    else
+    {
+        return probabilities_intrinsics_BPL;
+    }
+}
+
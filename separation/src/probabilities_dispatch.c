@@ -31,6 +31,14 @@ ProbabilityFunc probabilityFunc = NULL;
 
 
 /* MSVC can't do weak imports. Using dlsym()/GetProcAddress() etc. would be better */
+#if !HAVE_AVX512 || !DOUBLEPREC || defined(MSVC32_AVX_WORKAROUND)
+  #define initProbabilities_AVX512 NULL
+#endif
+
+#if !HAVE_AVX2 || !DOUBLEPREC || defined(MSVC32_AVX_WORKAROUND)
+  #define initProbabilities_AVX2 NULL
+#endif
+
 #if !HAVE_AVX || !DOUBLEPREC || defined(MSVC32_AVX_WORKAROUND)
   #define initProbabilities_AVX NULL
 #endif
@@ -48,6 +56,8 @@ ProbabilityFunc probabilityFunc = NULL;
 #endif
 
 /* Can't use the functions themselves if defined to NULL */
+static ProbInitFunc initAVX512 = initProbabilities_AVX512;
+static ProbInitFunc initAVX2 = initProbabilities_AVX2;
 static ProbInitFunc initAVX = initProbabilities_AVX;
 static ProbInitFunc initSSE41 = initProbabilities_SSE41;
 static ProbInitFunc initSSE3 = initProbabilities_SSE3;
@@ -101,9 +111,10 @@ static ProbabilityFunc selectStandardFunction(const AstronomyParameters* ap)
 /* Use one of the faster functions if available, or use something forced */
 int probabilityFunctionDispatch(const AstronomyParameters* ap, const CLRequest* clr)
 {
-    int hasSSE2, hasSSE3, hasSSE41, hasAVX;
-    int forcingInstructions = clr->forceAVX || clr->forceSSE41 || clr->forceSSE3 || clr->forceSSE2 || clr->forceX87;
-    int abcd[4];
+    int hasSSE2, hasSSE3, hasSSE41, hasAVX, hasAVX2, hasAVX512;
+    int forcingInstructions = clr->forceAVX512 || clr->forceAVX2 || clr->forceAVX
+                           || clr->forceSSE41 || clr->forceSSE3 || clr->forceSSE2 || clr->forceX87;
+    int abcd[4], abcd7[4] = { 0, 0, 0, 0 };
 
     if (!usingIntrinsicsIsAcceptable(ap, clr->forceNoIntrinsics))
     {
@@ -111,27 +122,47 @@ int probabilityFunctionDispatch(const AstronomyParameters* ap, const CLRequest*
         return 0;
     }
 
+    mw_cpuid(abcd, 0, 0);
+    if (abcd[0] >= 7)
+    {
+        mw_cpuid(abcd7, 7, 0);
+    }
+
     mw_cpuid(abcd, 1, 0);
 
     hasAVX = mwHasAVX(abcd) && mwOSHasAVXSupport();
+    hasAVX2 = hasAVX && mwHasAVX2(abcd7) && mwHasFMA(abcd);
+    hasAVX512 = hasAVX2 && mwHasAVX512F(abcd7) && mwOSHasAVX512Support();
     hasSSE41 = mwHasSSE41(abcd);
     hasSSE3 = mwHasSSE3(abcd);
     hasSSE2 = mwHasSSE2(abcd);
 
     if (clr->verbose)
     {
-        mw_printf("CPU features:        SSE2 = %d, SSE3 = %d, SSE4.1 = %d, AVX = %d\n"
-                  "Available functions: SSE2 = %d, SSE3 = %d, SSE4.1 = %d, AVX = %d\n"
-                  "Forcing:             SSE2 = %d, SSE3 = %d, SSE4.1 = %d, AVX = %d\n",
-                  hasSSE2, hasSSE3, hasSSE41, hasAVX,
+        mw_printf("CPU features:        SSE2 = %d, SSE3 = %d, SSE4.1 = %d, AVX = %d, AVX2 = %d, AVX-512 = %d\n"
+                  "Available functions: SSE2 = %d, SSE3 = %d, SSE4.1 = %d, AVX = %d, AVX2 = %d, AVX-512 = %d\n"
+                  "Forcing:             SSE2 = %d, SSE3 = %d, SSE4.1 = %d, AVX = %d, AVX2 = %d, AVX-512 = %d\n",
+                  hasSSE2, hasSSE3, hasSSE41, hasAVX, hasAVX2, hasAVX512,
                   initSSE2 != NULL, initSSE3 != NULL, initSSE41 != NULL, initAVX != NULL,
-                  clr->forceSSE2, clr->forceSSE3, clr->forceSSE41, clr->forceAVX);
+                  initAVX2 != NULL, initAVX512 != NULL,
+                  clr->forceSSE2, clr->forceSSE3, clr->forceSSE41, clr->forceAVX,
+                  clr->forceAVX2, clr->forceAVX512);
     }
 
     /* If multiple instructions are forced, the highest will take precedence */
     if (forcingInstructions)
     {
-        if (clr->forceAVX && hasAVX && initAVX)
+        if (clr->forceAVX512 && hasAVX512 && initAVX512)
+        {
+            mw_printf("Using AVX-512 path\n");
+            probabilityFunc = initAVX512(ap);
+        }
+        else if (clr->forceAVX2 && hasAVX2 && initAVX2)
+        {
+            mw_printf("Using AVX2 path\n");
+            probabilityFunc = initAVX2(ap);
+        }
+        else if (clr->forceAVX && hasAVX && initAVX)
         {
             mw_printf("Using AVX path\n");
             probabilityFunc = initAVX(ap);
@@ -165,7 +196,17 @@ int probabilityFunctionDispatch(const AstronomyParameters* ap, const CLRequest*
     else
     {
         /* Choose the highest level with available function and instructions */
-        if (hasAVX && initAVX)
+        if (hasAVX512 && initAVX512)
+        {
+            mw_printf("Using AVX-512 path\n");
+            probabilityFunc = initAVX512(ap);
+        }
+        else if (hasAVX2 && initAVX2)
+        {
+            mw_printf("Using AVX2 path\n");
+            probabilityFunc = initAVX2(ap);
+        }
+        else if (hasAVX && initAVX)
         {
             mw_printf("Using AVX path\n");
             probabilityFunc = initAVX(ap);
@@ -195,10 +236,14 @@ int probabilityFunctionDispatch(const AstronomyParameters* ap, const CLRequest*
     if (!probabilityFunc)
     {
         mw_panic("Probability function not set!:\n"
+                 "  Has AVX-512          = %d\n"
+                 "  Has AVX2             = %d\n"
                  "  Has AVX              = %d\n"
                  "  Has SSE4.1           = %d\n"
                  "  Has SSE3             = %d\n"
                  "  Has SSE2             = %d\n"
+                 "  Forced AVX-512       = %d\n"
+                 "  Forced AVX2          = %d\n"
                  "  Forced AVX           = %d\n"
                  "  Forced SSE4.1        = %d\n"
                  "  Forced SSE3          = %d\n"
@@ -206,8 +251,8 @@ int probabilityFunctionDispatch(const AstronomyParameters* ap, const CLRequest*
                  "  Forced x87           = %d\n"
                  "  Forced no intrinsics = %d\n"
                  "  Arch                 = %s\n",
-                 hasSSE41, hasSSE3, hasSSE2, hasAVX,
-                 clr->forceAVX, clr->forceSSE41, clr->forceSSE3, clr->forceSSE2,
+                 hasAVX512, hasAVX2, hasAVX, hasSSE41, hasSSE3, hasSSE2,
+                 clr->forceAVX512, clr->forceAVX2, clr->forceAVX, clr->forceSSE41, clr->forceSSE3, clr->forceSSE2,
                  clr->forceX87, clr->forceNoIntrinsics,
                  ARCH_STRING);
     }
@@ -368,18 +368,19 @@ static cl_int runIntegral(CLInfo* ci,
     return err;
 }
 
+/* cm holds the buffers made by createSeparationBuffers() for ia. The
+ * fit parameters in ap and sc are written to them here. */
 cl_int integrateCL(const AstronomyParameters* ap,
                    const IntegralArea* ia,
                    const StreamConstants* sc,
-                   const StreamGauss sg,
                    EvaluationState* es,
                    const CLRequest* clr,
-                   CLInfo* ci)
+                   CLInfo* ci,
+                   SeparationCLMem* cm)
 {
     cl_int err;
     RunSizes runSizes;
     SeparationSizes sizes;
-    SeparationCLMem cm = EMPTY_SEPARATION_CL_MEM;
 
     /* Need to test sizes for each integral, since the area size can change */
     calculateSizes(&sizes, ap, ia);
@@ -390,23 +391,21 @@ cl_int integrateCL(const AstronomyParameters* ap,
         return MW_CL_ERROR;
     }
 
-    err = createSeparationBuffers(ci, &cm, ap, ia, sc, sg, &sizes);
+    err = writeSeparationParameterBuffers(ci, cm, ap, sc, &sizes);
     if (err != CL_SUCCESS)
     {
-        mwPerrorCL(err, "Failed to create CL buffers");
+        mwPerrorCL(err, "Failed to write CL buffers");
         return err;
     }
 
-    err = separationSetKernelArgs(&cm, &runSizes);
+    err = separationSetKernelArgs(cm, &runSizes);
     if (err != CL_SUCCESS)
     {
         mwPerrorCL(err, "Failed to set integral kernel arguments");
         return err;
     }
 
-    err = runIntegral(ci, &cm, &runSizes, es, clr, ap, ia);
-
-    releaseSeparationBuffers(&cm);
+    err = runIntegral(ci, cm, &runSizes, es, clr, ap, ia);
 
     separationIntegralGetSums(es);
 
@@ -70,19 +70,14 @@ static cl_int createOutStreamsBuffer(CLInfo* ci, SeparationCLMem* cm, const Sepa
     return CL_SUCCESS;
 }
 
-static cl_int createSCBuffer(CLInfo* ci,
-                             SeparationCLMem* cm,
-                             const StreamConstants* sc,
-                             const SeparationSizes* sizes,
-                             const cl_mem_flags constBufFlags)
+/* Pack into format used by kernel. Result must be freed with mwFreeA() */
+static real* packSCBuffer(const StreamConstants* sc, const SeparationSizes* sizes)
 {
-    cl_int err;
     real* buf;
     cl_int i;
 
     buf = mwCallocA(sizes->nStream * 8, sizeof(real));
 
-    /* Pack into format used by kernel */
     for (i = 0; i < sizes->nStream; ++i)
     {
         buf[8 * i + 0] = X(sc[i].a);
@@ -98,6 +93,19 @@ static cl_int createSCBuffer(CLInfo* ci,
         buf[8 * i + 7] = 0.0;
     }
 
+    return buf;
+}
+
+static cl_int createSCBuffer(CLInfo* ci,
+                             SeparationCLMem* cm,
+                             const StreamConstants* sc,
+                             const SeparationSizes* sizes,
+                             const cl_mem_flags constBufFlags)
+{
+    cl_int err;
+    real* buf;
+
+    buf = packSCBuffer(sc, sizes);
     cm->sc = clCreateBuffer(ci->clctx, constBufFlags, sizes->sc, (void*) buf, &err);
     mwFreeA(buf);
 
@@ -228,29 +236,25 @@ static cl_int createLBTrigBuffer(CLInfo* ci,
     return CL_SUCCESS;
 }
 
-static cl_int createAPBuffer(CLInfo* ci,
-                             SeparationCLMem* cm,
-                             const AstronomyParameters* ap,
-                             const SeparationSizes* sizes,
-                             const cl_mem_flags constBufFlags)
+/* The fit parameters read by the kernel. The start of the buffer is
+ * the layout the IL kernel expects, which is only used with doubles. */
+static void packAPBuffer(real buf[AP_CONSTS_SIZE], const AstronomyParameters* ap)
 {
-    cl_int err = CL_SUCCESS;
-    double buf[18];
-    union
-    {
-        double d;
-        cl_uint i[2];
-    } item;
+    memset(buf, 0, AP_CONSTS_SIZE * sizeof(real));
 
-    memset(buf, 0, sizeof(buf));
-
-    buf[0] = 0.0;
-    buf[1] = 0.0;
+  #if DOUBLEPREC
+    {
+        union
+        {
+            double d;
+            cl_uint i[2];
+        } item;
 
-    item.i[0] = ap->convolve;
-    item.i[1] = ap->number_streams;
-    buf[2] = item.d;
-    buf[3] = 0.0;
+        item.i[0] = ap->convolve;
+        item.i[1] = ap->number_streams;
+        buf[2] = item.d;
+    }
+  #endif /* DOUBLEPREC */
 
     buf[4] = ap->m_sun_r0;
     buf[5] = ap->r0;
@@ -264,6 +268,23 @@ static cl_int createAPBuffer(CLInfo* ci,
     buf[10] = ap->bg_c;
     buf[11] = 0.0;
 
+    buf[12] = ap->background_weight;
+    buf[13] = ap->thick_disk_weight;
+    buf[14] = ap->innerPower;
+    buf[15] = ap->alpha_delta3;
+}
+
+static cl_int createAPBuffer(CLInfo* ci,
+                             SeparationCLMem* cm,
+                             const AstronomyParameters* ap,
+                             const SeparationSizes* sizes,
+                             const cl_mem_flags constBufFlags)
+{
+    cl_int err = CL_SUCCESS;
+    real buf[AP_CONSTS_SIZE];
+
+    packAPBuffer(buf, ap);
+
     cm->ap = clCreateBuffer(ci->clctx, constBufFlags, sizeof(buf), (void*) buf, &err);
     if (err != CL_SUCCESS)
     {
@@ -291,7 +312,7 @@ void calculateSizes(SeparationSizes* sizes, const AstronomyParameters* ap, const
     sizes->bSin = sizeof(real) * ia->mu_steps * ia->nu_steps;
 
     /* Constant buffer things */
-    sizes->ap = 18 * sizeof(double);
+    sizes->ap = AP_CONSTS_SIZE * sizeof(real);
     sizes->ia = sizeof(IntegralArea);
     sizes->sc = 8 * sizeof(real) * ap->number_streams;
     sizes->rc = sizeof(RCBuf) * ia->r_steps;
@@ -322,6 +343,67 @@ cl_int createSeparationBuffers(CLInfo* ci,
     return err;
 }
 
+static cl_int zeroBuffer(CLInfo* ci, cl_mem mem, size_t size)
+{
+    cl_int err;
+    void* p;
+
+    p = clEnqueueMapBuffer(ci->queue, mem, CL_TRUE, CL_MAP_WRITE,
+                           0, size, 0, NULL, NULL, &err);
+    if (err != CL_SUCCESS)
+    {
+        mwPerrorCL(err, "Error mapping buffer to clear");
+        return err;
+    }
+
+    memset(p, 0, size);
+
+    err = clEnqueueUnmapMemObject(ci->queue, mem, p, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        mwPerrorCL(err, "Failed to unmap cleared buffer");
+    }
+
+    return err;
+}
+
+/* Reuse buffers made by createSeparationBuffers() for another set of
+ * fit parameters. Everything else in them only depends on the
+ * parameter file and integral area. */
+cl_int writeSeparationParameterBuffers(CLInfo* ci,
+                                       SeparationCLMem* cm,
+                                       const AstronomyParameters* ap,
+                                       const StreamConstants* sc,
+                                       const SeparationSizes* sizes)
+{
+    cl_int err;
+    real apBuf[AP_CONSTS_SIZE];
+    real* scBuf;
+
+    packAPBuffer(apBuf, ap);
+    err = clEnqueueWriteBuffer(ci->queue, cm->ap, CL_TRUE, 0, sizeof(apBuf), apBuf, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        mwPerrorCL(err, "Error writing astronomy parameters buffer");
+        return err;
+    }
+
+    scBuf = packSCBuffer(sc, sizes);
+    err = clEnqueueWriteBuffer(ci->queue, cm->sc, CL_TRUE, 0, sizes->sc, scBuf, 0, NULL, NULL);
+    mwFreeA(scBuf);
+    if (err != CL_SUCCESS)
+    {
+        mwPerrorCL(err, "Error writing stream constants buffer");
+        return err;
+    }
+
+    err = zeroBuffer(ci, cm->outBg, sizes->outBg);
+    if (err != CL_SUCCESS)
+        return err;
+
+    return zeroBuffer(ci, cm->outStreams, sizes->outStreams);
+}
+
 void releaseSeparationBuffers(SeparationCLMem* cm)
 {
     clReleaseMemObject(cm->summarizationBufs[0]);
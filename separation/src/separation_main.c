@@ -37,6 +37,10 @@
 #include "io_util.h"
 #include <popt.h>
 
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
 
 #define DEFAULT_ASTRONOMY_PARAMETERS "astronomy_parameters.txt"
 #define DEFAULT_STAR_POINTS "stars.txt"
@@ -156,6 +160,8 @@ static void freeSeparationFlags(SeparationFlags* sf)
     free(sf->forwardedArgs);
     free(sf->numArgs);
     free(sf->preferredPlatformVendor);
+    free(sf->batchFile);
+    free(sf->binaryStarsFile);
 }
 
 /* Use hardcoded names if files not specified for compatability */
@@ -173,6 +179,8 @@ static void setCLReqFlags(CLRequest* clr, const SeparationFlags* sf)
     clr->forceSSE3 = sf->forceSSE3;
     clr->forceSSE41 = sf->forceSSE41;
     clr->forceAVX = sf->forceAVX;
+    clr->forceAVX2 = sf->forceAVX2;
+    clr->forceAVX512 = sf->forceAVX512;
     clr->verbose = sf->verbose;
     clr->nonResponsive = sf->nonResponsive;
     clr->enableCheckpointing = !sf->disableGPUCheckpointing;
@@ -371,6 +379,30 @@ static int parseParameters(int argc, const char** argv, SeparationFlags* sfOut)
 				0, "Uses broken power law as background fit", NULL
 			},
 
+            {
+                "batch", '\0',
+                POPT_ARG_STRING, &sf.batchFile,
+                0, "Evaluate each line of parameters in this file (- for stdin), printing a likelihood for each", NULL
+            },
+
+            {
+                "write-binary-stars", '\0',
+                POPT_ARG_STRING, &sf.binaryStarsFile,
+                0, "Write the star points file in the binary format to this file and exit", NULL
+            },
+
+            {
+                "verify-stars", '\0',
+                POPT_ARG_NONE, &sf.verifyStars,
+                0, "Check the checksum of a binary star points file, which reads the whole file", NULL
+            },
+
+            {
+                "save-geometry", '\0',
+                POPT_ARG_NONE, &sf.saveGeometry,
+                0, "Save the star geometry next to the star points file and reuse it in later runs", NULL
+            },
+
             {
                 "ignore-checkpoint", 'i',
                 POPT_ARG_NONE, &sf.ignoreCheckpoint,
@@ -395,6 +427,12 @@ static int parseParameters(int argc, const char** argv, SeparationFlags* sfOut)
                 0, "Init BOINC with debugging. No effect if not built with BOINC_APPLICATION", NULL
             },
 
+            {
+                "nthreads", '\0',
+                POPT_ARG_INT, &sf.numThreads,
+                0, "Number of threads for the CPU integral. No effect if built without OpenMP", NULL
+            },
+
             {
                 "process-priority", 'b',
                 POPT_ARG_INT, &sf.processPriority,
@@ -503,6 +541,18 @@ static int parseParameters(int argc, const char** argv, SeparationFlags* sfOut)
                 0, "Force to use AVX path", NULL
             },
 
+            {
+                "force-avx2", '\0',
+                POPT_ARG_NONE, &sf.forceAVX2,
+                0, "Force to use AVX2 and FMA path", NULL
+            },
+
+            {
+                "force-avx512", '\0',
+                POPT_ARG_NONE, &sf.forceAVX512,
+                0, "Force to use AVX-512 path", NULL
+            },
+
             {
                 "p", 'p',
                 POPT_ARG_NONE, &serverParams,
@@ -611,6 +661,125 @@ static IntegralArea* prepareParameters(const SeparationFlags* sf,
 
     return ias;
 }
+/* Evaluate one line of parameters from the batch file. Returns the
+ * likelihood, or NAN if it could not be calculated. */
+static real evaluateBatchVector(SeparationContext* ctx,
+                                const SeparationFlags* sf,
+                                AstronomyParameters* ap,
+                                BackgroundParameters* bgp,
+                                Streams* streams,
+                                const IntegralArea* ias,
+                                const CLRequest* clr,
+                                const MWBatchReader* br)
+{
+    real* params;
+    StreamConstants* sc;
+    SeparationResults* results;
+    int ignoreCheckpoint = TRUE;
+    real likelihood = NAN;
+
+    params = mwReadRestArgs(br->args, br->nArgs);
+    if (!params)
+        return NAN;
+
+    if (setParameters(ap, bgp, streams, params, br->nArgs) || setAstronomyParameters(ap, bgp))
+    {
+        free(params);
+        return NAN;
+    }
+
+    free(params);
+
+    setExpStreamWeights(ap, streams);
+    sc = getStreamConstants(ap, streams);
+    if (!sc)
+    {
+        mw_printf("Failed to get stream constants\n");
+        return NAN;
+    }
+
+    results = newSeparationResults(ap->number_streams);
+    if (evaluate(ctx, results, ap, ias, streams, sc, sf->LikelihoodToText,
+                 clr, sf->do_separation, &ignoreCheckpoint, sf->separation_outfile))
+    {
+        mw_printf("Failed to calculate likelihood\n");
+    }
+    else
+    {
+        likelihood = results->likelihood;
+    }
+
+    freeSeparationResults(results);
+    mwFreeA(sc);
+
+    return likelihood;
+}
+
+/* Evaluate the parameters on each line of sf->batchFile in turn, in
+ * place of the parameters given on the command line, and write a line
+ * with each likelihood to stdout. Checkpoints are not resumed from. */
+static int batchWorker(const SeparationFlags* sf,
+                       AstronomyParameters* ap,
+                       BackgroundParameters* bgp,
+                       Streams* streams,
+                       const IntegralArea* ias,
+                       const CLRequest* clr)
+{
+    MWBatchReader* br;
+    SeparationContext ctx;
+    real likelihood;
+    int rc = 0;
+
+    br = mwOpenBatchReader(sf->batchFile);
+    if (!br)
+        return 1;
+
+    ap->totalWUs = 1;
+    ap->currentWU = 0;
+
+    initSeparationContext(&ctx, sf->star_points_file, sf->saveGeometry, sf->verifyStars);
+
+    while (mwReadBatchVector(br))
+    {
+        likelihood = evaluateBatchVector(&ctx, sf, ap, bgp, streams, ias, clr, br);
+        rc |= isnan(likelihood);
+
+        printf("%.15f\n", likelihood);
+        fflush(stdout);
+    }
+
+    freeSeparationContext(&ctx);
+    mwCloseBatchReader(br);
+    mw_remove(CHECKPOINT_FILE);
+
+    return rc;
+}
+
+/* Write the star points file, in either format, as a binary star points
+ * file. Normal runs don't check the checksum, so check both files here */
+static int convertStarPoints(const SeparationFlags* sf)
+{
+    StarPoints sp = EMPTY_STAR_POINTS;
+    StarPoints written = EMPTY_STAR_POINTS;
+    int rc;
+
+    rc = readStarPoints(&sp, sf->star_points_file, TRUE);
+    if (!rc)
+    {
+        rc = writeStarPointsBinary(&sp, sf->binaryStarsFile)
+          || readStarPoints(&written, sf->binaryStarsFile, TRUE);
+        if (!rc)
+        {
+            mw_printf("Wrote %u stars to '%s'\n", sp.number_stars, sf->binaryStarsFile);
+        }
+    }
+
+    freeStarPoints(&sp);
+    freeStarPoints(&written);
+
+    return rc;
+}
+
 //Needs to loop to account for number of WUs being crunched
 static int worker(const SeparationFlags* sf)
 {
@@ -620,6 +789,7 @@ static int worker(const SeparationFlags* sf)
     IntegralArea* ias = NULL;
     StreamConstants* sc = NULL;
     SeparationResults* results = NULL;
+    SeparationContext ctx;
     int rc;
     CLRequest clr;
 
@@ -644,6 +814,14 @@ static int worker(const SeparationFlags* sf)
     if (!ias)
         return 1;
 
+    if (sf->batchFile)
+    {
+        rc = batchWorker(sf, &ap, &bgp, &streams, ias, &clr);
+        mwFreeA(ias);
+        freeStreams(&streams);
+        return rc;
+    }
+
     if(sf->nForwardedArgs)
     {
         ap.totalWUs = sf->nForwardedArgs/ap.params_per_workunit;
@@ -655,50 +833,84 @@ static int worker(const SeparationFlags* sf)
     mw_printf("<number_WUs> %d </number_WUs>\n", ap.totalWUs);
     mw_printf("<number_params_per_WU> %d </number_params_per_WU>\n", ap.params_per_workunit);
     int ignoreCheckpoint = sf->ignoreCheckpoint;
+
+    /* The stars, convolution points and CL device are the same for
+     * every workunit, so they are only set up once */
+    initSeparationContext(&ctx, sf->star_points_file, sf->saveGeometry, sf->verifyStars);
+
     for(ap.currentWU = 0; ap.currentWU < ap.totalWUs; ap.currentWU++)
     {
 
         if (sf->numArgs && setParameters(&ap, &bgp, &streams, &(sf->numArgs[ap.params_per_workunit * ap.currentWU]), ap.params_per_workunit))
         {
-            mwFreeA(ias);
-            freeStreams(&streams);
-            return 1;
+            rc = 1;
+            break;
         }
 
         rc = setAstronomyParameters(&ap, &bgp);
         if (rc)
-        {
-            mwFreeA(ias);
-            freeStreams(&streams);
-            return 1;
-        }
+            break;
 
         setExpStreamWeights(&ap, &streams);
         sc = getStreamConstants(&ap, &streams);
         if (!sc)
         {
             mw_printf("Failed to get stream constants\n");
-            mwFreeA(ias);
-            freeStreams(&streams);
-            return 1;
+            rc = 1;
+            break;
         }
 
         results = newSeparationResults(ap.number_streams);
-        int currentWU = ap.currentWU;
-        rc = evaluate(results, &ap, ias, &streams, sc, sf->LikelihoodToText, sf->star_points_file,
-                  &clr, sf->do_separation, &ignoreCheckpoint, sf->separation_outfile);
+        rc = evaluate(&ctx, results, &ap, ias, &streams, sc, sf->LikelihoodToText,
+                      &clr, sf->do_separation, &ignoreCheckpoint, sf->separation_outfile);
         if (rc)
             mw_printf("Failed to calculate likelihood\n");
+
+        freeSeparationResults(results);
+        mwFreeA(sc);
+        results = NULL;
+        sc = NULL;
     }
-    
+
+    freeSeparationContext(&ctx);
     mwFreeA(ias);
-    mwFreeA(sc);
     freeStreams(&streams);
-    if(results) freeSeparationResults(results);
 
     return rc;
 }
 
+static int separationSetNumThreads(int numThreads)
+{
+  #ifdef _OPENMP
+    int nProc = omp_get_num_procs();
+    int nBoinc = mwGetBoincNumCPU();
+
+    if (nProc <= 0)
+    {
+        mw_printf("Number of processors %d is crazy\n", nProc);
+        return 1;
+    }
+
+    /* If command line argument not given, and BOINC gives us a value use that */
+    if (numThreads <= 0 && nBoinc > 0)
+    {
+        numThreads = nBoinc;
+    }
+
+    if (numThreads != 0)
+    {
+        omp_set_num_threads(numThreads);
+        mw_printf("Using OpenMP %d max threads on a system with %d processors\n",
+                  omp_get_max_threads(),
+                  nProc);
+    }
+  #else
+    (void) numThreads;
+  #endif
+
+    return 0;
+}
+
 static int separationInit(int debugBOINC)
 {
     int rc;
@@ -781,7 +993,20 @@ int main(int argc, const char* argv[])
         mwSetProcessPriority(sf.processPriority);
     }
 
-    rc = worker(&sf);
+    if (separationSetNumThreads(sf.numThreads))
+    {
+        freeSeparationFlags(&sf);
+        mw_finish(EXIT_FAILURE);
+    }
+
+    if (sf.binaryStarsFile)
+    {
+        rc = convertStarPoints(&sf);
+    }
+    else
+    {
+        rc = worker(&sf);
+    }
 
     freeSeparationFlags(&sf);
 
@@ -28,6 +28,7 @@
 #include "replace_amd_il.h"
 
 #include <assert.h>
+#include <string.h>
 
 #ifdef _WIN32
   #include <direct.h>
@@ -37,6 +38,10 @@
 static cl_program integrationProgram = NULL;
 static cl_program summarizationProgram = NULL;
 
+/* Compiler flags the programs were built with. These only depend on
+ * the parameter file, not the fit parameters. */
+static char* builtCompileFlags = NULL;
+
 
 extern const unsigned char probabilities_kernel_cl[];
 extern const size_t probabilities_kernel_cl_len;
@@ -63,9 +68,17 @@ cl_int releaseSeparationKernel(void)
     if (integrationProgram)
         err |= clReleaseProgram(integrationProgram);
 
-    if (integrationProgram)
+    if (summarizationProgram)
         err |= clReleaseProgram(summarizationProgram);
 
+    _separationKernel = NULL;
+    _summarizationKernel = NULL;
+    integrationProgram = NULL;
+    summarizationProgram = NULL;
+
+    free(builtCompileFlags);
+    builtCompileFlags = NULL;
+
     return err;
 }
 
@@ -557,20 +570,11 @@ static cl_bool setSummarizationWorkgroupSize(const CLInfo* ci)
     return CL_FALSE;
 }
 
-cl_int setupSeparationCL(CLInfo* ci,
-                         const AstronomyParameters* ap,
-                         const IntegralArea* ias,
-                         const CLRequest* clr)
+/* Find the device and create the context and queue. This does not
+ * depend on the parameters, so it only needs to be done once. */
+cl_int setupSeparationDevice(CLInfo* ci, const CLRequest* clr)
 {
-    char* compileFlags;
-    cl_bool useILKernel;
-    cl_int err = MW_CL_ERROR;
-    const char* kernSrc = (const char*) probabilities_kernel_cl;
-    size_t kernSrcLen = probabilities_kernel_cl_len;
-
-    const char* summarizationKernSrc = (const char*) summarization_kernel_cl;
-    size_t summarizationKernSrcLen = summarization_kernel_cl_len;
-
+    cl_int err;
 
     err = mwSetupCL(ci, clr);
     if (err != CL_SUCCESS)
@@ -584,6 +588,28 @@ cl_int setupSeparationCL(CLInfo* ci,
         return MW_CL_ERROR;
     }
 
+    return CL_SUCCESS;
+}
+
+/* Build the programs and kernels for ap on the device set up by
+ * setupSeparationDevice(). If the last programs built were compiled
+ * with the same flags they are used again, which they are for every
+ * evaluation with the same parameter file. */
+cl_int setupSeparationCL(CLInfo* ci,
+                         const AstronomyParameters* ap,
+                         const IntegralArea* ias,
+                         const CLRequest* clr)
+{
+    char* compileFlags;
+    cl_bool useILKernel;
+    cl_int err = CL_SUCCESS;
+    const char* kernSrc = (const char*) probabilities_kernel_cl;
+    size_t kernSrcLen = probabilities_kernel_cl_len;
+
+    const char* summarizationKernSrc = (const char*) summarization_kernel_cl;
+    size_t summarizationKernSrcLen = summarization_kernel_cl_len;
+
+
     useILKernel = usingILKernelIsAcceptable(ci, ap, clr);
     compileFlags = getCompilerFlags(ci, ap, useILKernel);
     if (!compileFlags)
@@ -592,6 +618,14 @@ cl_int setupSeparationCL(CLInfo* ci,
         return MW_CL_ERROR;
     }
 
+    if (builtCompileFlags && !strcmp(builtCompileFlags, compileFlags))
+    {
+        free(compileFlags);
+        return CL_SUCCESS;
+    }
+
+    releaseSeparationKernel();
+
     if (clr->verbose)
     {
         mw_printf("\nCompiler flags:\n%s\n\n", compileFlags);
@@ -638,7 +672,14 @@ cl_int setupSeparationCL(CLInfo* ci,
 
 
 setup_exit:
-    free(compileFlags);
+    if (err == CL_SUCCESS)
+    {
+        builtCompileFlags = compileFlags;
+    }
+    else
+    {
+        free(compileFlags);
+    }
 
     return err;
 }
@@ -0,0 +1,274 @@
+/*
+ *  Copyright (c) 2008-2010 Travis Desell, Nathan Cole
+ *  Copyright (c) 2008-2010 Boleslaw Szymanski, Heidi Newberg
+ *  Copyright (c) 2008-2010 Carlos Varela, Malik Magdon-Ismail
+ *  Copyright (c) 2008-2011 Rensselaer Polytechnic Institute
+ *  Copyright (c) 2010-2011 Matthew Arsenault
+ *
+ *  This file is part of Milkway@Home.
+ *
+ *  Milkway@Home is free software: you may copy, redistribute and/or modify it
+ *  under the terms of the GNU General Public License as published by the
+ *  Free Software Foundation, either version 3 of the License, or (at your
+ *  option) any later version.
+ *
+ *  This file is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "star_geometry.h"
+#include "integrals.h"
+#include "r_points.h"
+#include "milkyway_util.h"
+
+/* Enough for 32 byte alignment in single or double precision */
+#define STAR_GEOMETRY_ALIGN 8
+
+static const char geometry_header[] = "separation_star_geometry";
+static const uint32_t geometryVersion = 1;
+
+typedef struct
+{
+    uint32_t version;
+    uint32_t realSize;
+    uint32_t number_stars;
+    int32_t convolve;
+    int32_t modfit;
+    uint32_t stride;
+    uint64_t starsHash;
+} StarGeometryHeader;
+
+/* FNV-1a over the star coordinates, so a sidecar file left over from
+ * different stars isn't used */
+static uint64_t hashStarPoints(const StarPoints* sp)
+{
+    unsigned int i, j;
+    size_t k;
+    real coords[3];
+    const unsigned char* p;
+    uint64_t hash = UINT64_C(14695981039346656037);
+
+    for (i = 0; i < sp->number_stars; ++i)
+    {
+        coords[0] = L(sp->stars[i]);
+        coords[1] = B(sp->stars[i]);
+        coords[2] = R(sp->stars[i]);
+
+        for (j = 0; j < 3; ++j)
+        {
+            p = (const unsigned char*) &coords[j];
+            for (k = 0; k < sizeof(real); ++k)
+            {
+                hash ^= p[k];
+                hash *= UINT64_C(1099511628211);
+            }
+        }
+    }
+
+    return hash;
+}
+
+static unsigned int geometryStride(int convolve)
+{
+    return ((unsigned int) convolve + STAR_GEOMETRY_ALIGN - 1) & ~(STAR_GEOMETRY_ALIGN - 1u);
+}
+
+static void allocStarGeometry(StarGeometry* geom, unsigned int nStars, int convolve, int modfit)
+{
+    size_t n = nStars + 1;
+    size_t nPoints = (size_t) nStars * geometryStride(convolve) + 1;
+
+    geom->number_stars = nStars;
+    geom->convolve = convolve;
+    geom->modfit = modfit;
+    geom->stride = geometryStride(convolve);
+
+    geom->gPrime = (real*) mwMallocA(sizeof(real) * n);
+    geom->reff_xr_rp3 = (real*) mwMallocA(sizeof(real) * n);
+    geom->lCosBCos = (real*) mwMallocA(sizeof(real) * n);
+    geom->lSinBCos = (real*) mwMallocA(sizeof(real) * n);
+    geom->bSin = (real*) mwMallocA(sizeof(real) * n);
+
+    geom->r_points = (real*) mwCallocA(nPoints, sizeof(real));
+    geom->qw_r3_N = (real*) mwCallocA(nPoints, sizeof(real));
+}
+
+void freeStarGeometry(StarGeometry* geom)
+{
+    mwFreeA(geom->gPrime);
+    mwFreeA(geom->reff_xr_rp3);
+    mwFreeA(geom->lCosBCos);
+    mwFreeA(geom->lSinBCos);
+    mwFreeA(geom->bSin);
+    mwFreeA(geom->r_points);
+    mwFreeA(geom->qw_r3_N);
+
+    memset(geom, 0, sizeof(*geom));
+}
+
+int starGeometryMatches(const StarGeometry* geom, const AstronomyParameters* ap, const StarPoints* sp)
+{
+    return geom->gPrime
+        && geom->number_stars == sp->number_stars
+        && geom->convolve == ap->convolve
+        && geom->modfit == ap->modfit;
+}
+
+void calcStarGeometry(StarGeometry* geom,
+                      const AstronomyParameters* ap,
+                      const StarPoints* sp,
+                      const StreamGauss sg)
+{
+    int i;
+    const int nStars = (int) sp->number_stars;
+
+    freeStarGeometry(geom);
+    allocStarGeometry(geom, sp->number_stars, ap->convolve, ap->modfit);
+
+  #ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+  #endif
+    for (i = 0; i < nStars; ++i)
+    {
+        RConsts rc;
+        LB lb;
+        LBTrig lbt;
+        mwvector point = sp->stars[i];
+        size_t offset = (size_t) i * geom->stride;
+
+        rc = calcRConstsLik(Z(point), ap);
+        setSplitRPoints(ap, sg, &rc, &geom->r_points[offset], &geom->qw_r3_N[offset]);
+
+        geom->gPrime[i] = rc.gPrime;
+        geom->reff_xr_rp3[i] = calcReffXrRp3(Z(point), rc.gPrime);
+
+        LB_L(lb) = L(point);
+        LB_B(lb) = B(point);
+        lbt = lb_trig(lb);
+
+        geom->lCosBCos[i] = lbt.lCosBCos;
+        geom->lSinBCos[i] = lbt.lSinBCos;
+        geom->bSin[i] = lbt.bSin;
+    }
+}
+
+static int freadReals(FILE* f, real* p, size_t n)
+{
+    return fread(p, sizeof(real), n, f) != n;
+}
+
+int readStarGeometry(StarGeometry* geom,
+                     const char* filename,
+                     const AstronomyParameters* ap,
+                     const StarPoints* sp)
+{
+    FILE* f;
+    StarGeometryHeader h;
+    char str_buf[sizeof(geometry_header)];
+    size_t n, nPoints;
+    int rc;
+
+    f = mw_fopen(filename, "rb");
+    if (!f)
+        return 1;
+
+    if (   fread(str_buf, sizeof(geometry_header), 1, f) != 1
+        || strncmp(str_buf, geometry_header, sizeof(geometry_header))
+        || fread(&h, sizeof(h), 1, f) != 1
+        || h.version != geometryVersion
+        || h.realSize != sizeof(real)
+        || h.number_stars != sp->number_stars
+        || h.convolve != ap->convolve
+        || h.modfit != ap->modfit
+        || h.stride != geometryStride(ap->convolve)
+        || h.starsHash != hashStarPoints(sp))
+    {
+        fclose(f);
+        return 1;
+    }
+
+    freeStarGeometry(geom);
+    allocStarGeometry(geom, h.number_stars, h.convolve, h.modfit);
+
+    n = h.number_stars;
+    nPoints = (size_t) h.number_stars * h.stride;
+
+    rc = freadReals(f, geom->gPrime, n)
+      || freadReals(f, geom->reff_xr_rp3, n)
+      || freadReals(f, geom->lCosBCos, n)
+      || freadReals(f, geom->lSinBCos, n)
+      || freadReals(f, geom->bSin, n)
+      || freadReals(f, geom->r_points, nPoints)
+      || freadReals(f, geom->qw_r3_N, nPoints);
+
+    fclose(f);
+
+    if (rc)
+    {
+        mw_printf("Failed to read star geometry from '%s'\n", filename);
+        freeStarGeometry(geom);
+    }
+
+    return rc;
+}
+
+static int fwriteReals(FILE* f, const real* p, size_t n)
+{
+    return fwrite(p, sizeof(real), n, f) != n;
+}
+
+int writeStarGeometry(const StarGeometry* geom, const char* filename, const StarPoints* sp)
+{
+    FILE* f;
+    StarGeometryHeader h;
+    size_t n = geom->number_stars;
+    size_t nPoints = (size_t) geom->number_stars * geom->stride;
+    int rc;
+
+    memset(&h, 0, sizeof(h));
+    h.version = geometryVersion;
+    h.realSize = sizeof(real);
+    h.number_stars = geom->number_stars;
+    h.convolve = geom->convolve;
+    h.modfit = geom->modfit;
+    h.stride = geom->stride;
+    h.starsHash = hashStarPoints(sp);
+
+    f = mw_fopen(filename, "wb");
+    if (!f)
+    {
+        mwPerror("Opening star geometry file '%s'", filename);
+        return 1;
+    }
+
+    rc = fwrite(geometry_header, sizeof(geometry_header), 1, f) != 1
+      || fwrite(&h, sizeof(h), 1, f) != 1
+      || fwriteReals(f, geom->gPrime, n)
+      || fwriteReals(f, geom->reff_xr_rp3, n)
+      || fwriteReals(f, geom->lCosBCos, n)
+      || fwriteReals(f, geom->lSinBCos, n)
+      || fwriteReals(f, geom->bSin, n)
+      || fwriteReals(f, geom->r_points, nPoints)
+      || fwriteReals(f, geom->qw_r3_N, nPoints);
+
+    if (fclose(f))
+        rc = 1;
+
+    if (rc)
+    {
+        mwPerror("Writing star geometry file '%s'", filename);
+        mw_remove(filename);
+    }
+
+    return rc;
+}
+
@@ -24,6 +24,59 @@
 #include "star_points.h"
 #include "milkyway_util.h"
 
+#include <string.h>
+
+#if HAVE_SYS_MMAN_H
+  #include <sys/mman.h>
+#endif
+
+/* Binary star points file. The stars are stored like a double
+   precision mwvector, so the file can be mapped and used in place.
+   Numbers are in the byte order of the writer.
+   Name          Type          Notes
+-------------------------------------------------------
+   header        char[16]      "mwstars"
+   byteOrder     uint32        0x01020304
+   version       uint32
+   number_stars  uint32
+   recordSize    uint32        32
+   checksum      uint64        FNV-1a of the stars
+   padding       char[24]      To keep the stars aligned
+   stars         double[4][]   l, b, r, 0
+ */
+
+static const char starsHeader[] = "mwstars";
+static const uint32_t starsByteOrder = 0x01020304;
+static const uint32_t starsVersion = 1;
+
+typedef struct
+{
+    char header[16];
+    uint32_t byteOrder;
+    uint32_t version;
+    uint32_t number_stars;
+    uint32_t recordSize;
+    uint64_t checksum;
+    char padding[24];
+} StarPointsHeader;
+
+#define STAR_RECORD_SIZE (4 * sizeof(double))
+
+static uint64_t hashStarRecords(const double* records, size_t n)
+{
+    size_t i;
+    const unsigned char* p = (const unsigned char*) records;
+    uint64_t hash = UINT64_C(14695981039346656037);
+
+    for (i = 0; i < n * STAR_RECORD_SIZE; ++i)
+    {
+        hash ^= p[i];
+        hash *= UINT64_C(1099511628211);
+    }
+
+    return hash;
+}
+
 static int freadStarPoints(FILE* data_file, StarPoints* sp)
 {
     double x, y, z;
@@ -50,26 +103,222 @@ static int freadStarPoints(FILE* data_file, StarPoints* sp)
     return 0;
 }
 
-int readStarPoints(StarPoints* sp, const char* filename)
+static int checkStarPointsHeader(const StarPointsHeader* h, size_t fileSize, const char* filename)
+{
+    if (h->byteOrder != starsByteOrder)
+    {
+        mw_printf("Star points file '%s' has the wrong byte order\n", filename);
+        return 1;
+    }
+
+    if (h->version != starsVersion || h->recordSize != STAR_RECORD_SIZE)
+    {
+        mw_printf("Star points file '%s' has unknown version %u\n", filename, h->version);
+        return 1;
+    }
+
+    if (fileSize != sizeof(StarPointsHeader) + (size_t) h->number_stars * STAR_RECORD_SIZE)
+    {
+        mw_printf("Star points file '%s' is the wrong size for %u stars\n", filename, h->number_stars);
+        return 1;
+    }
+
+    return 0;
+}
+
+#if HAVE_SYS_MMAN_H && DOUBLEPREC
+
+/* The stars are used straight from the page cache, so processes
+ * reading the same file share them. The mapping is private so they
+ * can still be written. */
+static int mapStarPoints(StarPoints* sp, FILE* f, size_t fileSize)
+{
+    void* p;
+
+    if (sizeof(mwvector) != STAR_RECORD_SIZE)
+        return 1;
+
+    p = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0);
+    if (p == MAP_FAILED)
+        return 1;
+
+    sp->mapping = p;
+    sp->mappingSize = fileSize;
+    sp->stars = (mwvector*) ((char*) p + sizeof(StarPointsHeader));
+
+    return 0;
+}
+
+#endif /* HAVE_SYS_MMAN_H && DOUBLEPREC */
+
+static int readStarRecords(StarPoints* sp, FILE* f, uint64_t checksum, int verify)
+{
+    unsigned int i;
+    double* records;
+    int rc = 0;
+
+    records = (double*) mwMallocA(STAR_RECORD_SIZE * sp->number_stars + 1);
+    if (fread(records, STAR_RECORD_SIZE, sp->number_stars, f) != sp->number_stars)
+    {
+        mwPerror("Failed to read star points\n");
+        rc = 1;
+    }
+    else if (verify && hashStarRecords(records, sp->number_stars) != checksum)
+    {
+        mw_printf("Star points checksum does not match\n");
+        rc = 1;
+    }
+    else
+    {
+        sp->stars = (mwvector*) mwMallocA(sizeof(mwvector) * sp->number_stars + 1);
+        for (i = 0; i < sp->number_stars; ++i)
+        {
+            SET_VECTOR(sp->stars[i],
+                       (real) records[4 * i + 0],
+                       (real) records[4 * i + 1],
+                       (real) records[4 * i + 2]);
+        }
+    }
+
+    mwFreeA(records);
+
+    return rc;
+}
+
+static int freadStarPointsBinary(FILE* f, StarPoints* sp, const char* filename, int verify)
+{
+    StarPointsHeader h;
+    long fileSize;
+
+    if (fseek(f, 0, SEEK_SET) || fread(&h, sizeof(h), 1, f) != 1)
+    {
+        mw_printf("Failed to read header of star points file '%s'\n", filename);
+        return 1;
+    }
+
+    if (fseek(f, 0, SEEK_END) || (fileSize = ftell(f)) < 0)
+    {
+        mwPerror("Failed to get size of star points file '%s'", filename);
+        return 1;
+    }
+
+    if (checkStarPointsHeader(&h, (size_t) fileSize, filename))
+        return 1;
+
+    sp->number_stars = h.number_stars;
+
+  #if HAVE_SYS_MMAN_H && DOUBLEPREC
+    if (!mapStarPoints(sp, f, (size_t) fileSize))
+    {
+        /* Hashing would touch every page of the mapping */
+        if (verify && hashStarRecords((const double*) sp->stars, sp->number_stars) != h.checksum)
+        {
+            mw_printf("Star points checksum does not match in '%s'\n", filename);
+            return 1;
+        }
+
+        return 0;
+    }
+  #endif /* HAVE_SYS_MMAN_H && DOUBLEPREC */
+
+    if (fseek(f, (long) sizeof(h), SEEK_SET))
+    {
+        mwPerror("Failed to seek in star points file '%s'", filename);
+        return 1;
+    }
+
+    return readStarRecords(sp, f, h.checksum, verify);
+}
+
+int readStarPoints(StarPoints* sp, const char* filename, int verify)
 {
     int rc;
     FILE* f;
+    char header[sizeof(starsHeader)];
 
-    f = mwOpenResolved(filename, "r");
+    f = mwOpenResolved(filename, "rb");
     if (!f)
     {
         mwPerror("Opening star points file '%s'", filename);
         return 1;
     }
 
-    rc = freadStarPoints(f, sp);
+    sp->mapping = NULL;
+    sp->mappingSize = 0;
+
+    if (   fread(header, sizeof(header), 1, f) == 1
+        && !memcmp(header, starsHeader, sizeof(starsHeader)))
+    {
+        rc = freadStarPointsBinary(f, sp, filename, verify);
+    }
+    else
+    {
+        rewind(f);
+        rc = freadStarPoints(f, sp);
+    }
+
     fclose(f);
 
     return rc;
 }
 
+int writeStarPointsBinary(const StarPoints* sp, const char* filename)
+{
+    FILE* f;
+    StarPointsHeader h;
+    double* records;
+    unsigned int i;
+    int rc;
+
+    records = (double*) mwCallocA(4 * (size_t) sp->number_stars + 1, sizeof(double));
+    for (i = 0; i < sp->number_stars; ++i)
+    {
+        records[4 * i + 0] = (double) L(sp->stars[i]);
+        records[4 * i + 1] = (double) B(sp->stars[i]);
+        records[4 * i + 2] = (double) R(sp->stars[i]);
+    }
+
+    memset(&h, 0, sizeof(h));
+    strcpy(h.header, starsHeader);
+    h.byteOrder = starsByteOrder;
+    h.version = starsVersion;
+    h.number_stars = sp->number_stars;
+    h.recordSize = STAR_RECORD_SIZE;
+    h.checksum = hashStarRecords(records, sp->number_stars);
+
+    f = mw_fopen(filename, "wb");
+    if (!f)
+    {
+        mwPerror("Opening star points file '%s'", filename);
+        mwFreeA(records);
+        return 1;
+    }
+
+    rc = fwrite(&h, sizeof(h), 1, f) != 1
+      || fwrite(records, STAR_RECORD_SIZE, sp->number_stars, f) != sp->number_stars;
+
+    if (fclose(f))
+        rc = 1;
+
+    if (rc)
+        mwPerror("Writing star points file '%s'", filename);
+
+    mwFreeA(records);
+
+    return rc;
+}
+
 void freeStarPoints(StarPoints* sp)
 {
+  #if HAVE_SYS_MMAN_H
+    if (sp->mapping)
+    {
+        munmap(sp->mapping, sp->mappingSize);
+        sp->mapping = NULL;
+        sp->stars = NULL;
+        return;
+    }
+  #endif /* HAVE_SYS_MMAN_H */
+
     mwFreeA(sp->stars);
 }
-
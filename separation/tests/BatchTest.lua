@@ -0,0 +1,159 @@
+--
+-- Copyright (C) 2011 Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+
+-- Run a few lines of parameters through --batch. Each line should
+-- give one likelihood, the same as a normal run with those parameters
+-- in the parameter file, and a bad line should give nan without
+-- stopping the others.
+
+argv = {...}
+
+binName = argv[1]
+assert(binName, "Binary name not set")
+
+local function readProcess(bin, ...)
+   local cmd = table.concat({ bin, table.concat({...}, " "), "2>&1" }, " ")
+   local f = assert(io.popen(cmd, "r"))
+   local s = assert(f:read('*a'))
+   f:close()
+   return s
+end
+
+-- Only read stdout, where the likelihoods go
+local function readBatchOutput(bin, ...)
+   local cmd = table.concat({ bin, table.concat({...}, " ") }, " ")
+   local f = assert(io.popen(cmd, "r"))
+   local lines = { }
+   for line in f:lines() do
+      lines[#lines + 1] = line
+   end
+   f:close()
+   return lines
+end
+
+local function writeFile(name, str)
+   local f = assert(io.open(name, "w"))
+   f:write(str)
+   f:close()
+end
+
+local parameters = [[
+wedge = 12
+
+background = {
+   epsilon = 0.0,
+   q  = 0.5542541421233699,
+   r0 = 6.77241567700913
+}
+
+streams = {
+   {
+      epsilon = -1.3418071207676023,
+      mu      = 201.61411243124968,
+      r       = 40.611097427272284,
+      theta   = -1.3139406571545202,
+      phi     = -0.014875537191203507,
+      sigma   = 5.465750530081221
+   }
+}
+
+area = {
+   {
+      r_min = 16.0,
+      r_max = 23.0,
+      r_steps = 20,
+
+      mu_min = 135,
+      mu_max = 235,
+      mu_steps = 20,
+
+      nu_min = -1.25,
+      nu_max = 1.25,
+      nu_steps = 10
+   }
+}
+]]
+
+-- The first line of the batch has the same parameters as the file
+local good = { 0.0, 0.5542541421233699, -1.3418071207676023, 201.61411243124968,
+               40.611097427272284, -1.3139406571545202, -0.014875537191203507, 5.465750530081221 }
+local moved = { 0.0, 0.5542541421233699, -1.3418071207676023, 195.0,
+                40.611097427272284, -1.3139406571545202, -0.014875537191203507, 5.465750530081221 }
+
+-- Stars on a fixed pattern over the wedge
+local function starPoints(n)
+   local lines = { tostring(n) }
+   for i = 1, n do
+      lines[#lines + 1] = string.format("%f %f %f",
+                                        150.0 + 60.0 * ((0.618034 * i) % 1.0),
+                                        20.0 + 40.0 * ((0.414214 * i) % 1.0),
+                                        5.0 + 40.0 * ((0.732051 * i) % 1.0))
+   end
+   return table.concat(lines, "\n") .. "\n"
+end
+
+local batch = {
+   "# Comments and blank lines are skipped",
+   table.concat(good, " "),
+   "",
+   table.concat(good, " ", 1, 5),    -- Too few parameters
+   table.concat(moved, ", "),
+   table.concat(good, " ")
+}
+
+local paramFile = os.tmpname()
+local starsFile = os.tmpname()
+local batchFile = os.tmpname()
+
+writeFile(paramFile, parameters)
+writeFile(starsFile, starPoints(200))
+writeFile(batchFile, table.concat(batch, "\n") .. "\n")
+
+local single = readProcess(binName, "-i", "-a", paramFile, "-s", starsFile)
+local expected = tonumber(single:match("<search_likelihood>%s*([^<%s]+)%s*</search_likelihood>"))
+
+local output = readBatchOutput(binName, "-a", paramFile, "-s", starsFile, "--batch=" .. batchFile)
+
+os.remove(paramFile)
+os.remove(starsFile)
+os.remove(batchFile)
+
+assert(expected, "Failed to find the likelihood of a single run:\n" .. single)
+
+assert(#output == 4, string.format("Expected 4 lines of output, got %d:\n%s\n", #output, table.concat(output, "\n")))
+
+local results = { }
+for i = 1, #output do
+   results[i] = tonumber(output[i])
+   assert(results[i], string.format("Line %d of output is not a number: '%s'", i, output[i]))
+end
+
+local function closeEnough(a, b)
+   return math.abs(a - b) < 1.0e-12
+end
+
+assert(closeEnough(results[1], expected),
+       string.format("Batch likelihood %.15f does not match a single run %.15f", results[1], expected))
+assert(results[2] ~= results[2], string.format("Bad parameters gave %.15f instead of nan", results[2]))
+assert(results[3] == results[3] and not closeEnough(results[3], expected),
+       string.format("Changed parameters gave likelihood %.15f, not a different one from %.15f", results[3], expected))
+assert(results[4] == results[1],
+       string.format("Repeated parameters gave likelihood %.15f instead of %.15f", results[4], results[1]))
+
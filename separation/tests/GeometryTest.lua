@@ -0,0 +1,188 @@
+--
+-- Copyright (C) 2011 Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- With --save-geometry the per star geometry is written next to the
+-- star points file and read back by later runs. A run using the saved
+-- geometry must give exactly the likelihoods of a run which calculates
+-- it, and the saved file must be the same as a newly calculated one.
+-- A saved file for different stars, convolve or modfit must not be
+-- used.
+
+argv = {...}
+
+binName = argv[1]
+assert(binName, "Binary name not set")
+
+local function readProcess(bin, ...)
+   local cmd = table.concat({ bin, table.concat({...}, " "), "2>&1" }, " ")
+   local f = assert(io.popen(cmd, "r"))
+   local s = assert(f:read('*a'))
+   f:close()
+   return s
+end
+
+local function readFile(name)
+   local f = io.open(name, "rb")
+   if not f then
+      return nil
+   end
+   local s = assert(f:read("*a"))
+   f:close()
+   return s
+end
+
+local function writeFile(name, str)
+   local f = assert(io.open(name, "wb"))
+   f:write(str)
+   f:close()
+end
+
+local parameters = [[
+wedge = 12
+convolve = %d
+
+background = {
+   epsilon = 0.0,
+   q  = 0.5542541421233699,
+   r0 = 6.77241567700913
+}
+
+streams = {
+   {
+      epsilon = -1.3418071207676023,
+      mu      = 201.61411243124968,
+      r       = 40.611097427272284,
+      theta   = -1.3139406571545202,
+      phi     = -0.014875537191203507,
+      sigma   = 5.465750530081221
+   }
+}
+
+area = {
+   {
+      r_min = 16.0,
+      r_max = 23.0,
+      r_steps = 20,
+
+      mu_min = 135,
+      mu_max = 235,
+      mu_steps = 20,
+
+      nu_min = -1.25,
+      nu_max = 1.25,
+      nu_steps = 10
+   }
+}
+]]
+
+-- Stars on a fixed pattern over the wedge
+local function starPoints(n, shift)
+   local lines = { tostring(n) }
+   for i = 1, n do
+      lines[#lines + 1] = string.format("%f %f %f",
+                                        150.0 + 60.0 * ((0.618034 * i) % 1.0),
+                                        20.0 + 40.0 * ((0.414214 * i) % 1.0),
+                                        5.0 + 40.0 * ((0.732051 * i) % 1.0) + (i == 7 and shift or 0.0))
+   end
+   return table.concat(lines, "\n") .. "\n"
+end
+
+local paramFile = os.tmpname()
+local starsFile = os.tmpname()
+local geometryFile = starsFile .. ".geom"
+
+local usingSaved = "Using star geometry from"
+
+local function likelihoods(output)
+   local bg = output:match("<background_likelihood>%s*([^<%s]+)%s*</background_likelihood>")
+   local search = output:match("<search_likelihood>%s*([^<%s]+)%s*</search_likelihood>")
+   assert(bg and search, "Failed to find the likelihoods in output:\n" .. output)
+   return bg .. " " .. search
+end
+
+local function run(...)
+   return readProcess(binName, "-i", "-a", paramFile, "-s", starsFile, ...)
+end
+
+-- Likelihoods from calculating the geometry, without a saved file
+local function fresh(...)
+   return likelihoods(run(...))
+end
+
+local fails = 0
+local function check(name, f)
+   local ok, err = pcall(f)
+   if not ok then
+      io.stderr:write(name, ": ", err, "\n")
+      fails = fails + 1
+   end
+end
+
+-- Run with --save-geometry, which should or shouldn't use the saved
+-- file, and compare against calculating the geometry
+local function checkSaved(name, expectUsed, ...)
+   local args = { ... }
+   check(name, function()
+            local expected = fresh(unpack(args))
+            local output = run("--save-geometry", unpack(args))
+            local used = output:find(usingSaved, 1, true) ~= nil
+            assert(used == expectUsed,
+                   string.format("Saved geometry was %s:\n%s", used and "used" or "not used", output))
+            assert(likelihoods(output) == expected,
+                   string.format("Likelihoods %s differ from calculating the geometry %s",
+                                 likelihoods(output), expected))
+         end)
+end
+
+os.remove(geometryFile)
+writeFile(paramFile, string.format(parameters, 120))
+writeFile(starsFile, starPoints(200, 0.0))
+
+checkSaved("first run", false)
+local saved = readFile(geometryFile)
+assert(saved, "Geometry file was not saved")
+
+checkSaved("saved geometry", true)
+
+check("calculated again", function()
+         os.remove(geometryFile)
+         run("--save-geometry")
+         assert(readFile(geometryFile) == saved, "Calculating the geometry again gave a different file")
+      end)
+
+-- A different star at the same count
+writeFile(starsFile, starPoints(200, 1.5))
+checkSaved("changed star", false)
+checkSaved("changed star saved", true)
+
+-- Different convolve
+writeFile(paramFile, string.format(parameters, 60))
+checkSaved("changed convolve", false)
+checkSaved("changed convolve saved", true)
+
+-- Turning on modfit
+checkSaved("modfit", false, "--modfit")
+checkSaved("modfit saved", true, "--modfit")
+checkSaved("modfit off", false)
+
+os.remove(paramFile)
+os.remove(starsFile)
+os.remove(geometryFile)
+
+assert(fails == 0, string.format("%d star geometry checks failed", fails))
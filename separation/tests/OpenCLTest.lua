@@ -0,0 +1,282 @@
+--
+-- Copyright (C) 2011 Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+
+-- Compare the OpenCL integrals and likelihoods against the CPU path,
+-- for both background profiles and with and without the IL kernel.
+-- A --batch run checks that the kernel picks up new fit parameters
+-- for each line, since the program is only built once.
+
+argv = {...}
+
+binName = argv[1]
+assert(binName, "Binary name not set")
+
+local tolerance = 1.0e-10
+
+local function readProcess(bin, ...)
+   local cmd = table.concat({ bin, table.concat({...}, " "), "2>&1" }, " ")
+   local f = assert(io.popen(cmd, "r"))
+   local s = assert(f:read('*a'))
+   f:close()
+   return s
+end
+
+-- Only read stdout, where the batch likelihoods go
+local function readBatchOutput(bin, ...)
+   local cmd = table.concat({ bin, table.concat({...}, " ") }, " ")
+   local f = assert(io.popen(cmd, "r"))
+   local lines = { }
+   for line in f:lines() do
+      lines[#lines + 1] = tonumber(line)
+   end
+   f:close()
+   return lines
+end
+
+local function writeFile(name, str)
+   local f = assert(io.open(name, "w"))
+   f:write(str)
+   f:close()
+end
+
+-- Three streams, the default convolve and one integral
+local parameters3 = [[
+wedge = 12
+
+background = {
+   epsilon = 0.0,
+   q  = 0.5542541421233699,
+   r0 = 6.77241567700913
+}
+
+streams = {
+   {
+      epsilon = -1.3418071207676023,
+      mu      = 201.61411243124968,
+      r       = 40.611097427272284,
+      theta   = -1.3139406571545202,
+      phi     = -0.014875537191203507,
+      sigma   = 5.465750530081221
+   },
+
+   {
+      epsilon = -0.81552376729401,
+      mu      = 188.6021207229066,
+      r       = 15.135973046949974,
+      theta   = -2.3099138937634947,
+      phi     = -3.4870662898908216,
+      sigma   = 6.633812372442989
+   },
+
+   {
+      epsilon = -1.2245217466190073,
+      mu      = 220.0,
+      r       = 39.18049401905237,
+      theta   = -1.1935119905401974,
+      phi     = 0.3471722711173001,
+      sigma   = 21.189750057392178
+   }
+}
+
+area = {
+   {
+      r_min = 16.0,
+      r_max = 23.0,
+      r_steps = 40,
+
+      mu_min = 135,
+      mu_max = 235,
+      mu_steps = 40,
+
+      nu_min = -1.25,
+      nu_max = 1.25,
+      nu_steps = 16
+   }
+}
+]]
+
+-- One stream, a small convolve and a cut, with sizes which aren't a
+-- multiple of the work group size
+local parameters1 = [[
+wedge = 12
+convolve = 30
+
+background = {
+   epsilon = 0.3,
+   q  = 0.7,
+   r0 = 9.5
+}
+
+streams = {
+   {
+      epsilon = -1.0,
+      mu      = 195.0,
+      r       = 30.0,
+      theta   = -1.0,
+      phi     = 0.2,
+      sigma   = 4.0
+   }
+}
+
+area = {
+   {
+      r_min = 16.0,
+      r_max = 23.0,
+      r_steps = 45,
+
+      mu_min = 135,
+      mu_max = 235,
+      mu_steps = 30,
+
+      nu_min = -1.25,
+      nu_max = 1.25,
+      nu_steps = 12
+   },
+
+   {
+      r_min = 16.0,
+      r_max = 23.0,
+      r_steps = 15,
+
+      mu_min = 180,
+      mu_max = 200,
+      mu_steps = 17,
+
+      nu_min = -0.3,
+      nu_max = 0.3,
+      nu_steps = 7
+   }
+}
+]]
+
+-- Stars on a fixed pattern over the wedge
+local function starPoints(n)
+   local lines = { tostring(n) }
+   for i = 1, n do
+      lines[#lines + 1] = string.format("%f %f %f",
+                                        150.0 + 60.0 * ((0.618034 * i) % 1.0),
+                                        20.0 + 40.0 * ((0.414214 * i) % 1.0),
+                                        5.0 + 40.0 * ((0.732051 * i) % 1.0))
+   end
+   return table.concat(lines, "\n") .. "\n"
+end
+
+local function readNumbers(output, tag)
+   local values = { }
+   local str = output:match("<" .. tag .. ">(.-)</" .. tag .. ">")
+   assert(str, string.format("Failed to find <%s> in output:\n%s\n", tag, output))
+   for x in str:gmatch("%S+") do
+      values[#values + 1] = tonumber(x)
+   end
+   return values
+end
+
+local function readResults(output)
+   return {
+      background_integral   = readNumbers(output, "background_integral"),
+      stream_integral       = readNumbers(output, "stream_integral"),
+      background_likelihood = readNumbers(output, "background_likelihood"),
+      search_likelihood     = readNumbers(output, "search_likelihood")
+   }
+end
+
+local function relativeDifference(a, b)
+   if a == b then
+      return 0.0
+   end
+   return math.abs(a - b) / math.max(math.abs(a), math.abs(b))
+end
+
+local function compareResults(name, cpu, cl)
+   for tag, cpuValues in pairs(cpu) do
+      local clValues = cl[tag]
+      assert(#clValues == #cpuValues,
+             string.format("%s: %d values of %s with OpenCL, expected %d", name, #clValues, tag, #cpuValues))
+      for i = 1, #cpuValues do
+         local d = relativeDifference(cpuValues[i], clValues[i])
+         assert(d < tolerance,
+                string.format("%s: OpenCL %s[%d] = %.15g differs from CPU %.15g by %g",
+                              name, tag, i, clValues[i], cpuValues[i], d))
+      end
+   end
+end
+
+local paramFile = os.tmpname()
+local starsFile = os.tmpname()
+local batchFile = os.tmpname()
+
+writeFile(starsFile, starPoints(200))
+
+local fails = 0
+local function check(name, f)
+   local ok, err = pcall(f)
+   if not ok then
+      io.stderr:write(err, "\n")
+      fails = fails + 1
+   end
+end
+
+for _, params in ipairs({ { "3 streams", parameters3 }, { "1 stream, 2 cuts", parameters1 } }) do
+   writeFile(paramFile, params[2])
+
+   for _, profile in ipairs({ { "Hernquist", "" }, { "broken power law", "-y" } }) do
+      local args = { "-i", "-a", paramFile, "-s", starsFile, profile[2] }
+      local cpu = readResults(readProcess(binName, "--force-no-opencl", unpack(args)))
+
+      for _, kernel in ipairs({ { "default kernel", "" }, { "CL kernel", "--force-no-il-kernel" } }) do
+         local name = string.format("%s, %s, %s", params[1], profile[1], kernel[1])
+         check(name, function()
+                  compareResults(name, cpu, readResults(readProcess(binName, kernel[2], unpack(args))))
+               end)
+      end
+   end
+end
+
+-- Several parameter sets through one program build
+local batch = {
+   "0.0 0.5542541421233699 -1.3418071207676023 201.61411243124968 40.611097427272284 -1.3139406571545202 -0.014875537191203507 5.465750530081221",
+   "0.2 0.75 -1.0 195.0 30.0 -1.0 0.2 4.0",
+   "0.0 0.5542541421233699 -1.3418071207676023 201.61411243124968 40.611097427272284 -1.3139406571545202 -0.014875537191203507 5.465750530081221"
+}
+
+writeFile(paramFile, (parameters1:gsub("epsilon = 0.3", "epsilon = 0.0")))
+writeFile(batchFile, table.concat(batch, "\n") .. "\n")
+
+check("batch", function()
+         local cpu = readBatchOutput(binName, "--force-no-opencl", "-a", paramFile, "-s", starsFile, "--batch=" .. batchFile)
+         local cl = readBatchOutput(binName, "--force-no-il-kernel", "-a", paramFile, "-s", starsFile, "--batch=" .. batchFile)
+
+         assert(#cpu == #batch and #cl == #batch,
+                string.format("Expected %d batch likelihoods, got %d on the CPU and %d with OpenCL", #batch, #cpu, #cl))
+         assert(relativeDifference(cpu[1], cpu[2]) > tolerance, "Batch lines should give different likelihoods")
+         for i = 1, #batch do
+            local d = relativeDifference(cpu[i], cl[i])
+            assert(d < tolerance,
+                   string.format("Batch line %d: OpenCL likelihood %.15g differs from CPU %.15g by %g",
+                                 i, cl[i], cpu[i], d))
+         end
+      end)
+
+os.remove(paramFile)
+os.remove(starsFile)
+os.remove(batchFile)
+
+assert(fails == 0, string.format("%d OpenCL comparisons failed", fails))
+
@@ -0,0 +1,207 @@
+--
+-- Copyright (C) 2011 Matthew Arsenault
+--
+-- This file is part of Milkway@Home.
+--
+-- Milkyway@Home is free software: you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation, either version 3 of the License, or
+-- (at your option) any later version.
+--
+-- Milkyway@Home is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- Convert a text star points file to the binary format and check a
+-- run on it gives the same likelihood, which on double precision
+-- builds with mmap() reads the stars straight from the mapped file.
+-- Converting the binary file again must give the same file. Damaged
+-- binary files must be rejected: a bad byte order or size always, and
+-- a bad checksum with --verify-stars or when converting.
+
+argv = {...}
+
+binName = argv[1]
+assert(binName, "Binary name not set")
+
+local function readProcess(bin, ...)
+   local cmd = table.concat({ bin, table.concat({...}, " "), "2>&1" }, " ")
+   local f = assert(io.popen(cmd, "r"))
+   local s = assert(f:read('*a'))
+   f:close()
+   return s
+end
+
+local function readFile(name)
+   local f = assert(io.open(name, "rb"))
+   local s = assert(f:read("*a"))
+   f:close()
+   return s
+end
+
+local function writeFile(name, str)
+   local f = assert(io.open(name, "wb"))
+   f:write(str)
+   f:close()
+end
+
+local parameters = [[
+wedge = 12
+
+background = {
+   epsilon = 0.0,
+   q  = 0.5542541421233699,
+   r0 = 6.77241567700913
+}
+
+streams = {
+   {
+      epsilon = -1.3418071207676023,
+      mu      = 201.61411243124968,
+      r       = 40.611097427272284,
+      theta   = -1.3139406571545202,
+      phi     = -0.014875537191203507,
+      sigma   = 5.465750530081221
+   }
+}
+
+area = {
+   {
+      r_min = 16.0,
+      r_max = 23.0,
+      r_steps = 20,
+
+      mu_min = 135,
+      mu_max = 235,
+      mu_steps = 20,
+
+      nu_min = -1.25,
+      nu_max = 1.25,
+      nu_steps = 10
+   }
+}
+]]
+
+-- Stars on a fixed pattern over the wedge
+local function starPoints(n)
+   local lines = { tostring(n) }
+   for i = 1, n do
+      lines[#lines + 1] = string.format("%f %f %f",
+                                        150.0 + 60.0 * ((0.618034 * i) % 1.0),
+                                        20.0 + 40.0 * ((0.414214 * i) % 1.0),
+                                        5.0 + 40.0 * ((0.732051 * i) % 1.0))
+   end
+   return table.concat(lines, "\n") .. "\n"
+end
+
+-- Offsets in the binary file
+local byteOrderOffset = 16
+local checksumOffset = 32
+local firstStarOffset = 64
+local recordSize = 32
+
+local nStars = 200
+
+local paramFile = os.tmpname()
+local textFile = os.tmpname()
+local binFile = os.tmpname()
+local binFile2 = os.tmpname()
+local badFile = os.tmpname()
+
+writeFile(paramFile, parameters)
+writeFile(textFile, starPoints(nStars))
+
+local function likelihoods(starsFile, ...)
+   local output = readProcess(binName, "-i", "-a", paramFile, "-s", starsFile, ...)
+   local bg = output:match("<background_likelihood>%s*([^<%s]+)%s*</background_likelihood>")
+   local search = output:match("<search_likelihood>%s*([^<%s]+)%s*</search_likelihood>")
+   return bg and search and (bg .. " " .. search), output
+end
+
+local function convert(from, to)
+   return readProcess(binName, "-s", from, "--write-binary-stars=" .. to)
+end
+
+-- Replace the bytes at offset in s
+local function replace(s, offset, bytes)
+   return s:sub(1, offset) .. bytes .. s:sub(offset + #bytes + 1)
+end
+
+local fails = 0
+local function check(name, f)
+   local ok, err = pcall(f)
+   if not ok then
+      io.stderr:write(name, ": ", err, "\n")
+      fails = fails + 1
+   end
+end
+
+local expected, textOutput = likelihoods(textFile)
+assert(expected, "Failed to find the likelihood from the text file:\n" .. textOutput)
+
+local conversion = convert(textFile, binFile)
+assert(conversion:find(string.format("Wrote %d stars", nStars), 1, true),
+       "Failed to convert the star points:\n" .. conversion)
+local good = readFile(binFile)
+assert(#good == firstStarOffset + nStars * recordSize,
+       string.format("Binary star points file is %d bytes", #good))
+
+check("binary file", function()
+         local got, output = likelihoods(binFile)
+         assert(got == expected,
+                string.format("Likelihoods '%s' differ from the text file's '%s':\n%s", tostring(got), expected, output))
+      end)
+
+check("binary file with --verify-stars", function()
+         local got, output = likelihoods(binFile, "--verify-stars")
+         assert(got == expected,
+                string.format("Likelihoods '%s' differ from the text file's '%s':\n%s", tostring(got), expected, output))
+      end)
+
+check("round trip", function()
+         convert(binFile, binFile2)
+         assert(readFile(binFile2) == good, "Converting the binary file again gave a different file")
+      end)
+
+local function rejected(name, s, ...)
+   local args = { ... }
+   check(name, function()
+            writeFile(badFile, s)
+            local got, output = likelihoods(badFile, unpack(args))
+            assert(not got, "Damaged file was not rejected:\n" .. output)
+         end)
+end
+
+-- Change a star without updating the checksum
+local star = firstStarOffset + 10 * recordSize
+local damagedStar = replace(good, star, string.char((good:byte(star + 1) + 1) % 256))
+local damagedChecksum = replace(good, checksumOffset, string.char((good:byte(checksumOffset + 1) + 1) % 256))
+
+rejected("changed star", damagedStar, "--verify-stars")
+rejected("changed checksum", damagedChecksum, "--verify-stars")
+rejected("reversed byte order", replace(good, byteOrderOffset, good:sub(byteOrderOffset + 1, byteOrderOffset + 4):reverse()))
+rejected("truncated", good:sub(1, #good - recordSize))
+rejected("extra bytes", good .. string.rep("\0", recordSize))
+
+check("changed star without --verify-stars", function()
+         writeFile(badFile, damagedStar)
+         assert(likelihoods(badFile), "File with only the stars changed should be read without --verify-stars")
+      end)
+
+check("converting a changed star", function()
+         writeFile(badFile, damagedStar)
+         assert(not convert(badFile, binFile2):find("Wrote", 1, true), "Converting a damaged file should fail")
+      end)
+
+os.remove(paramFile)
+os.remove(textFile)
+os.remove(binFile)
+os.remove(binFile2)
+os.remove(badFile)
+
+assert(fails == 0, string.format("%d star points checks failed", fails))
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2011 Matthew Arsenault
+ * Copyright (c) 2011 Rensselaer Polytechnic Institute
+ *
+ * This file is part of Milkway@Home.
+ *
+ * Milkyway@Home is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Milkyway@Home is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Milkyway@Home.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compare the intrinsic probability functions to the scalar ones */
+
+#include "milkyway_util.h"
+#include "milkyway_cpuid.h"
+#include "probabilities.h"
+#include "separation_constants.h"
+#include "dSFMT.h"
+#include <time.h>
+
+static dsfmt_t _prng;
+
+/* Relative difference allowed from the different exp, log and order of
+ * the sums. The intrinsic exp flushes results below exp(-708) to 0, so
+ * the sums also have an absolute difference of up to MAX_CONVOLVE of
+ * those. */
+#define PROB_TOLERANCE 1.0e-12
+#define PROB_ABS_TOLERANCE 1.0e-300
+
+#define N_TEST_STREAMS 4
+
+typedef struct
+{
+    const char* name;
+    ProbInitFunc init;
+} IntrinsicsPath;
+
+static real randomRange(real low, real high)
+{
+    return low + (high - low) * dsfmt_genrand_close_open(&_prng);
+}
+
+static void randomAstronomyParameters(AstronomyParameters* ap, int backgroundProfile, int convolve)
+{
+    memset(ap, 0, sizeof(*ap));
+
+    ap->sun_r0 = 8.0;
+    ap->m_sun_r0 = -ap->sun_r0;
+    ap->r0 = randomRange(1.0, 20.0);
+    ap->q = randomRange(0.5, 1.5);
+    ap->q_inv = 1.0 / ap->q;
+    ap->q_inv_sqr = sqr(ap->q_inv);
+
+    ap->background_profile = backgroundProfile;
+    ap->innerPower = randomRange(0.0, 3.0);
+    ap->outerPower = randomRange(0.0, 3.0);
+    ap->alpha_delta3 = 3.0 - ap->innerPower + ap->outerPower;
+
+    ap->background_weight = randomRange(0.0, 1.0);
+    ap->thick_disk_weight = randomRange(0.0, 1.0);
+
+    ap->convolve = convolve;
+    ap->number_streams = N_TEST_STREAMS;
+}
+
+static void randomStreamConstants(StreamConstants* sc)
+{
+    real theta = randomRange(0.0, M_PI);
+    real phi = randomRange(0.0, 2.0 * M_PI);
+    real sigma = randomRange(0.5, 10.0);
+
+    memset(sc, 0, sizeof(*sc));
+
+    X(sc->a) = mw_sin(theta) * mw_cos(phi);
+    Y(sc->a) = mw_sin(theta) * mw_sin(phi);
+    Z(sc->a) = mw_cos(theta);
+
+    X(sc->c) = randomRange(-30.0, 30.0);
+    Y(sc->c) = randomRange(-30.0, 30.0);
+    Z(sc->c) = randomRange(-30.0, 30.0);
+
+    sc->sigma_sq2_inv = 1.0 / (2.0 * sqr(sigma));
+}
+
+static int valuesDiffer(real value, real expected)
+{
+    return mw_fabs(value - expected) > PROB_TOLERANCE * mw_fabs(expected) + PROB_ABS_TOLERANCE;
+}
+
+/* Compare one random star against the scalar function. The points
+ * are offset by one from the allocation so they aren't aligned. */
+static int testProbabilities(const IntrinsicsPath* path, int backgroundProfile, int convolve)
+{
+    int i;
+    int fails = 0;
+    AstronomyParameters ap;
+    StreamConstants sc[N_TEST_STREAMS];
+    LBTrig lbt;
+    real l, b, gPrime, reff_xr_rp3;
+    real bg, bgExpected;
+    real streamTmps[N_TEST_STREAMS], streamExpected[N_TEST_STREAMS];
+    real rBuf[MAX_CONVOLVE + 1], qwBuf[MAX_CONVOLVE + 1], sgBuf[MAX_CONVOLVE + 1];
+    real* r_point = &rBuf[1];
+    real* qw_r3_N = &qwBuf[1];
+    real* sg_dx = &sgBuf[1];
+    ProbabilityFunc intrinsicsFunc;
+    ProbabilityFunc scalarFunc;
+
+    randomAstronomyParameters(&ap, backgroundProfile, convolve);
+    for (i = 0; i < N_TEST_STREAMS; ++i)
+    {
+        randomStreamConstants(&sc[i]);
+    }
+
+    l = randomRange(0.0, 2.0 * M_PI);
+    b = randomRange(-0.5 * M_PI, 0.5 * M_PI);
+    lbt.lCosBCos = mw_cos(l) * mw_cos(b);
+    lbt.lSinBCos = mw_sin(l) * mw_cos(b);
+    lbt.bSin = mw_sin(b);
+    lbt._pad = 0.0;
+
+    gPrime = randomRange(16.0, 23.0);
+    reff_xr_rp3 = randomRange(1.0e-4, 1.0);
+
+    for (i = 0; i < convolve; ++i)
+    {
+        r_point[i] = randomRange(1.0, 60.0);
+        qw_r3_N[i] = randomRange(0.0, 1.0);
+        sg_dx[i] = randomRange(-1.0, 1.0);
+    }
+
+    scalarFunc = (backgroundProfile == FAST_HERNQUIST) ? probabilities_fast_hprob : probabilities_broken_power_law;
+    intrinsicsFunc = path->init(&ap);
+
+    bgExpected = scalarFunc(&ap, sc, sg_dx, r_point, qw_r3_N, lbt, gPrime, reff_xr_rp3, streamExpected);
+    bg = intrinsicsFunc(&ap, sc, sg_dx, r_point, qw_r3_N, lbt, gPrime, reff_xr_rp3, streamTmps);
+
+    if (valuesDiffer(bg, bgExpected))
+    {
+        mw_printf("ERROR: %s background probability differs with profile %d, convolve %d:\n"
+                  "  Got      %.17g\n"
+                  "  Expected %.17g\n",
+                  path->name, backgroundProfile, convolve, bg, bgExpected);
+        ++fails;
+    }
+
+    for (i = 0; i < N_TEST_STREAMS; ++i)
+    {
+        if (valuesDiffer(streamTmps[i], streamExpected[i]))
+        {
+            mw_printf("ERROR: %s stream %d probability differs with profile %d, convolve %d:\n"
+                      "  Got      %.17g\n"
+                      "  Expected %.17g\n",
+                      path->name, i, backgroundProfile, convolve, streamTmps[i], streamExpected[i]);
+            ++fails;
+        }
+    }
+
+    return fails;
+}
+
+static int runTestsProbabilities(const IntrinsicsPath* path)
+{
+    /* Include sizes which aren't a multiple of the vector width */
+    static const int convolves[] = { 1, 7, 8, 30, 120, 141, MAX_CONVOLVE };
+    unsigned int i, j;
+    int fails = 0;
+
+    for (i = 0; i < sizeof(convolves) / sizeof(convolves[0]); ++i)
+    {
+        for (j = 0; j < 10; ++j)
+        {
+            fails += testProbabilities(path, FAST_HERNQUIST, convolves[i]);
+            fails += testProbabilities(path, BROKEN_POWER_LAW, convolves[i]);
+        }
+    }
+
+    mw_printf("Probabilities test %-8s %s\n", path->name, fails ? "failed" : "passed");
+
+    return fails;
+}
+
+int main(int argc, const char* argv[])
+{
+    int fails = 0;
+    int abcd[4], abcd7[4] = { 0, 0, 0, 0 };
+    int hasAVX2, hasAVX512;
+
+    (void) argc, (void) argv;
+
+    dsfmt_init_gen_rand(&_prng, (uint32_t) time(NULL));
+
+    mw_cpuid(abcd, 0, 0);
+    if (abcd[0] >= 7)
+    {
+        mw_cpuid(abcd7, 7, 0);
+    }
+    mw_cpuid(abcd, 1, 0);
+
+    hasAVX2 = mwHasAVX(abcd) && mwOSHasAVXSupport() && mwHasAVX2(abcd7) && mwHasFMA(abcd);
+    hasAVX512 = hasAVX2 && mwHasAVX512F(abcd7) && mwOSHasAVX512Support();
+
+  #if HAVE_AVX2 && DOUBLEPREC
+    if (hasAVX2)
+    {
+        const IntrinsicsPath avx2 = { "AVX2", initProbabilities_AVX2 };
+        fails += runTestsProbabilities(&avx2);
+    }
+  #endif
+
+  #if HAVE_AVX512 && DOUBLEPREC
+    if (hasAVX512)
+    {
+        const IntrinsicsPath avx512 = { "AVX-512", initProbabilities_AVX512 };
+        fails += runTestsProbabilities(&avx512);
+    }
+  #endif
+
+    (void) hasAVX2, (void) hasAVX512;
+
+    if (fails != 0)
+    {
+        mw_printf("%d probability comparisons failed\n", fails);
+    }
+
+    return fails;
+}
+